@@ -0,0 +1,88 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Labelling of user points by their nearest bone
+//---------------------------------------------------------------------------
+#include <limits>
+
+#include "bonelabel.h"
+
+const Bone g_Bones[] = {
+	{ "left_arm",      7,  6 },
+	{ "left_calf",     18, 20 },
+	{ "left_chest",    6,  17 },
+	{ "left_collar",   2,  6 },
+	{ "left_forearm",  9,  7 },
+	{ "left_thigh",    17, 18 },
+	{ "neck",          1,  2 },
+	{ "right_arm",     12, 13 },
+	{ "right_calf",    22, 24 },
+	{ "right_chest",   12, 21 },
+	{ "right_collar",  2,  12 },
+	{ "right_forearm", 13, 15 },
+	{ "right_thigh",   21, 22 },
+};
+const int g_NumBones = sizeof(g_Bones) / sizeof(g_Bones[0]);
+
+void LabelBones(const float* xs, const float* ys, const float* zs, size_t n_points,
+		const Joint* joints, size_t n_joints, std::vector<uint16_t>& labels)
+{
+	labels.assign(n_points, 0);
+
+	// Look up joint positions by id
+	const Joint* by_id[g_NumJointTypes + 1] = { NULL };
+	for (size_t i = 0; i < n_joints; ++i)
+	{
+		if ((joints[i].id >= 1) && (joints[i].id <= g_NumJointTypes)) {
+			by_id[joints[i].id] = &joints[i];
+		}
+	}
+
+	std::vector<float> best_d2(n_points, std::numeric_limits<float>::max());
+
+	for (int bone_idx = 0; bone_idx < g_NumBones; ++bone_idx)
+	{
+		const Joint* p_a(by_id[g_Bones[bone_idx].joint_a]);
+		const Joint* p_b(by_id[g_Bones[bone_idx].joint_b]);
+		if (!p_a || !p_b) {
+			continue;
+		}
+
+		// Bone is a + t * d for t in [0, 1]
+		const float ax(p_a->x), ay(p_a->y), az(p_a->z);
+		const float dx(p_b->x - ax), dy(p_b->y - ay), dz(p_b->z - az);
+		const float len2(dx * dx + dy * dy + dz * dz);
+		const float inv_len2(len2 > 0.f ? 1.f / len2 : 0.f);
+		const uint16_t label(static_cast<uint16_t>(bone_idx + 1));
+
+		// Branch-free so that the compiler can vectorise across points
+		float* best(&best_d2[0]);
+		uint16_t* out(&labels[0]);
+		for (size_t i = 0; i < n_points; ++i)
+		{
+			const float px(xs[i] - ax), py(ys[i] - ay), pz(zs[i] - az);
+			float t((px * dx + py * dy + pz * dz) * inv_len2);
+			t = (t < 0.f) ? 0.f : ((t > 1.f) ? 1.f : t);
+			const float ex(px - t * dx), ey(py - t * dy), ez(pz - t * dz);
+			const float d2(ex * ex + ey * ey + ez * ez);
+			const bool closer(d2 < best[i]);
+			best[i] = closer ? d2 : best[i];
+			out[i] = closer ? label : out[i];
+		}
+	}
+}
@@ -0,0 +1,241 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Reusing skeleton calibrations of users who have been seen before
+//---------------------------------------------------------------------------
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "calibcache.h"
+
+CalibrationCache::CalibrationCache(xn::DepthGenerator& depthGenerator, xn::UserGenerator& userGenerator,
+		const CalibrationCacheParams& params)
+	: depth_generator_(depthGenerator), user_generator_(userGenerator), params_(params)
+	, n_hits_(0), n_misses_(0)
+{ }
+
+bool CalibrationCache::Open(const std::string& directory)
+{
+	if ((mkdir(directory.c_str(), 0777) != 0) && (errno != EEXIST)) {
+		std::cerr << "Error: could not create calibration cache " << directory << ": "
+			<< strerror(errno) << '\n';
+		return false;
+	}
+
+	directory_ = directory;
+	slots_.clear();
+	return ReadIndex();
+}
+
+bool CalibrationCache::Measure(XnUserID user, UserProfile& profile) const
+{
+	xn::SceneMetaData smd;
+	XnPoint3D com;
+	XnFieldOfView fov;
+	if ((user_generator_.GetUserPixels(user, smd) != XN_STATUS_OK) ||
+		(user_generator_.GetCoM(user, com) != XN_STATUS_OK) ||
+		(depth_generator_.GetFieldOfView(fov) != XN_STATUS_OK) ||
+		(com.Z <= 0.f))
+	{
+		return false;
+	}
+
+	// Bounding box of the user's label
+	const XnLabel* labels(smd.Data());
+	XnUInt32 rows(smd.YRes()), cols(smd.XRes());
+	XnUInt32 min_row(rows), max_row(0), min_col(cols), max_col(0);
+	for (XnUInt32 r = 0; r < rows; ++r)
+	{
+		for (XnUInt32 c = 0; c < cols; ++c)
+		{
+			if (labels[r*cols + c] != user) {
+				continue;
+			}
+			if (r < min_row) { min_row = r; }
+			if (r > max_row) { max_row = r; }
+			if (c < min_col) { min_col = c; }
+			if (c > max_col) { max_col = c; }
+		}
+	}
+
+	// A user cut off at the top or bottom would be measured too short
+	if ((min_row > max_row) || (min_row == 0) || (max_row + 1 == rows)) {
+		return false;
+	}
+
+	// Size of one pixel at the user's distance
+	float mm_per_row(2.f * std::tan(fov.fVFOV / 2.f) * com.Z / rows);
+	float mm_per_col(2.f * std::tan(fov.fHFOV / 2.f) * com.Z / cols);
+	profile.height_mm = (max_row - min_row + 1) * mm_per_row;
+	profile.width_mm = (max_col - min_col + 1) * mm_per_col;
+
+	return true;
+}
+
+int CalibrationCache::FindSlot(const UserProfile& profile) const
+{
+	int best(-1);
+	float best_distance(std::numeric_limits<float>::max());
+	for (size_t i = 0; i < slots_.size(); ++i)
+	{
+		// Distance relative to the tolerances so that a match has a distance of at most one
+		float dh((slots_[i].profile.height_mm - profile.height_mm) / params_.height_tolerance_mm);
+		float dw((slots_[i].profile.width_mm - profile.width_mm) / params_.width_tolerance_mm);
+		if ((std::fabs(dh) > 1.f) || (std::fabs(dw) > 1.f)) {
+			continue;
+		}
+
+		float distance(dh*dh + dw*dw);
+		if (distance < best_distance) {
+			best = static_cast<int>(i);
+			best_distance = distance;
+		}
+	}
+
+	return best;
+}
+
+bool CalibrationCache::Load(XnUserID user)
+{
+	UserProfile profile;
+	int slot(-1);
+	profiles_.erase(user);
+	if (Measure(user, profile)) {
+		profiles_[user] = profile;
+		slot = FindSlot(profile);
+	}
+	if (slot < 0) {
+		++n_misses_;
+		return false;
+	}
+
+	XnStatus nRetVal = user_generator_.GetSkeletonCap().LoadCalibrationDataFromFile(user,
+			SlotFilename(slot).c_str());
+	if (nRetVal != XN_STATUS_OK)
+	{
+		std::cerr << "Could not load cached calibration " << SlotFilename(slot) << ": "
+			<< xnGetStatusString(nRetVal) << '\n';
+		++n_misses_;
+		return false;
+	}
+
+	++n_hits_;
+	++slots_[slot].n_uses;
+	slots_[slot].last_used = static_cast<uint64_t>(time(NULL));
+	WriteIndex();
+
+	return true;
+}
+
+bool CalibrationCache::Save(XnUserID user)
+{
+	std::map<XnUserID, UserProfile>::const_iterator measured(profiles_.find(user));
+	if (measured == profiles_.end()) {
+		return false;
+	}
+	const UserProfile& profile(measured->second);
+
+	// Replace a calibration of a similar user, else take a free slot, else the least recently used
+	int slot(FindSlot(profile));
+	if ((slot < 0) && (slots_.size() < params_.max_slots))
+	{
+		slot = static_cast<int>(slots_.size());
+		slots_.push_back(Slot());
+	}
+	if (slot < 0)
+	{
+		slot = 0;
+		for (size_t i = 1; i < slots_.size(); ++i)
+		{
+			if (slots_[i].last_used < slots_[slot].last_used) {
+				slot = static_cast<int>(i);
+			}
+		}
+	}
+
+	XnStatus nRetVal = user_generator_.GetSkeletonCap().SaveCalibrationDataToFile(user,
+			SlotFilename(slot).c_str());
+	if (nRetVal != XN_STATUS_OK)
+	{
+		std::cerr << "Could not save calibration " << SlotFilename(slot) << ": "
+			<< xnGetStatusString(nRetVal) << '\n';
+		return false;
+	}
+
+	slots_[slot].profile = profile;
+	slots_[slot].n_uses = 0;
+	slots_[slot].last_used = static_cast<uint64_t>(time(NULL));
+
+	return WriteIndex();
+}
+
+std::string CalibrationCache::SlotFilename(size_t slot) const
+{
+	char name_str[20];
+	snprintf(name_str, 20, "slot_%02zu.bin", slot);
+	return directory_ + '/' + name_str;
+}
+
+// The index is a text file with a line per slot: height, width, uses and time last used
+bool CalibrationCache::ReadIndex()
+{
+	std::ifstream index((directory_ + "/index.txt").c_str());
+	if (!index) {
+		return true; // a new cache
+	}
+
+	Slot slot;
+	while ((slots_.size() < params_.max_slots) &&
+		(index >> slot.profile.height_mm >> slot.profile.width_mm >> slot.n_uses >> slot.last_used))
+	{
+		slots_.push_back(slot);
+	}
+
+	if (!index.eof() && (slots_.size() < params_.max_slots)) {
+		std::cerr << "Warning: ignoring malformed end of " << directory_ << "/index.txt\n";
+	}
+
+	return true;
+}
+
+bool CalibrationCache::WriteIndex() const
+{
+	std::string filename(directory_ + "/index.txt");
+	std::ofstream index(filename.c_str(), std::ios::trunc);
+	for (size_t i = 0; i < slots_.size(); ++i)
+	{
+		index << slots_[i].profile.height_mm << ' ' << slots_[i].profile.width_mm << ' '
+			<< slots_[i].n_uses << ' ' << slots_[i].last_used << '\n';
+	}
+
+	if (!index) {
+		std::cerr << "Error: could not write " << filename << '\n';
+		return false;
+	}
+
+	return true;
+}
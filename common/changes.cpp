@@ -0,0 +1,92 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+#include <algorithm>
+#include <cstring>
+
+#include "changes.h"
+
+ChangeDetector::ChangeDetector(const ChangeParams& params)
+	: params_(params), rows_(0), cols_(0)
+{ }
+
+bool ChangeDetector::Changed(const uint16_t* depth, const uint16_t* labels, int rows, int cols) const
+{
+	if ((rows != rows_) || (cols != cols_) || (rows <= 0) || (cols <= 0)) {
+		return true;
+	}
+
+	const int tile(std::max(1, params_.tile_size));
+
+	for (int tile_row = 0; tile_row < rows; tile_row += tile)
+	{
+		const int n_rows(std::min(tile, rows - tile_row));
+		for (int tile_col = 0; tile_col < cols; tile_col += tile)
+		{
+			const int n_cols(std::min(tile, cols - tile_col));
+
+			// The mean is over the pixels with depth in both frames, which also copes with the
+			// partial tiles at the right and bottom edges. Pixels with depth in only one count
+			// separately.
+			uint32_t sad(0), n_valid(0), n_hole_changes(0);
+			uint16_t label_diff(0);
+			for (int row = tile_row; row < tile_row + n_rows; ++row)
+			{
+				const size_t offset(static_cast<size_t>(row) * cols + tile_col);
+				const uint16_t *p_depth(depth + offset), *p_ref_depth(&depth_[offset]);
+				const uint16_t *p_label(labels + offset), *p_ref_label(&labels_[offset]);
+				for (int col = 0; col < n_cols; ++col)
+				{
+					const int32_t a(p_depth[col]), b(p_ref_depth[col]);
+					const int32_t diff((a > b) ? (a - b) : (b - a));
+					const uint32_t valid(((a != 0) && (b != 0)) ? 1u : 0u);
+					sad += valid * static_cast<uint32_t>(diff);
+					n_valid += valid;
+					n_hole_changes += ((a != 0) != (b != 0)) ? 1u : 0u;
+					label_diff |= static_cast<uint16_t>(p_label[col] ^ p_ref_label[col]);
+				}
+			}
+
+			if ((label_diff != 0)
+					|| (static_cast<float>(sad) > params_.threshold_mm * static_cast<float>(n_valid))
+					|| (static_cast<float>(n_hole_changes)
+						> params_.max_hole_change * static_cast<float>(n_rows * n_cols))) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+void ChangeDetector::SetReference(const uint16_t* depth, const uint16_t* labels, int rows, int cols)
+{
+	const size_t n(static_cast<size_t>(rows) * cols);
+	rows_ = rows;
+	cols_ = cols;
+	depth_.resize(n);
+	labels_.resize(n);
+	if (n > 0) {
+		memcpy(&depth_[0], depth, n * sizeof(uint16_t));
+		memcpy(&labels_[0], labels, n * sizeof(uint16_t));
+	}
+}
+
+void ChangeDetector::ClearReference()
+{
+	rows_ = cols_ = 0;
+}
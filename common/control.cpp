@@ -0,0 +1,209 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Line based command socket for controlling a running process
+//---------------------------------------------------------------------------
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "control.h"
+
+// Longest command accepted before a client is disconnected
+static const size_t g_MaxCommandLength = 4096;
+
+// Fill address for the socket at path. Returns false if path is too long.
+static bool MakeAddress(const std::string& path, sockaddr_un& address)
+{
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path)) {
+		std::cerr << "Error: socket path " << path << " is too long.\n";
+		return false;
+	}
+	strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+	return true;
+}
+
+ControlServer::ControlServer()
+	: socket_(-1)
+{ }
+
+ControlServer::~ControlServer()
+{
+	Close();
+}
+
+bool ControlServer::Open(const std::string& path)
+{
+	Close();
+
+	sockaddr_un address;
+	if (!MakeAddress(path, address)) {
+		return false;
+	}
+
+	socket_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (socket_ < 0) {
+		std::cerr << "Error: could not create control socket: " << strerror(errno) << '\n';
+		return false;
+	}
+
+	// A socket left behind by a process which died would stop us binding
+	unlink(path.c_str());
+	if ((bind(socket_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) ||
+		(listen(socket_, 8) < 0))
+	{
+		std::cerr << "Error: could not listen on " << path << ": " << strerror(errno) << '\n';
+		close(socket_);
+		socket_ = -1;
+		return false;
+	}
+
+	path_ = path;
+	return true;
+}
+
+void ControlServer::Close()
+{
+	while (!clients_.empty()) {
+		Disconnect(clients_.begin()->first);
+	}
+	if (socket_ >= 0) {
+		close(socket_);
+		unlink(path_.c_str());
+		socket_ = -1;
+	}
+}
+
+void ControlServer::Disconnect(int client)
+{
+	close(client);
+	clients_.erase(client);
+}
+
+bool ControlServer::Poll(int& client, std::string& line)
+{
+	if (socket_ < 0) {
+		return false;
+	}
+
+	int new_client;
+	while ((new_client = accept4(socket_, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		clients_[new_client] = std::string();
+	}
+
+	char buffer[512];
+	std::map<int, std::string>::iterator it(clients_.begin());
+	while (it != clients_.end())
+	{
+		int fd(it->first);
+		std::string& input(it->second);
+		++it;  // the client may be disconnected below
+
+		// Read whatever has arrived, noting if the client has gone
+		bool closed(false);
+		ssize_t n;
+		while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+			input.append(buffer, static_cast<size_t>(n));
+		}
+		if ((n == 0) || ((n < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK))) {
+			closed = true;
+		}
+
+		// Commands still waiting are handled even if the client has hung up
+		size_t newline(input.find('\n'));
+		if (newline != std::string::npos)
+		{
+			client = fd;
+			line = input.substr(0, newline);
+			input.erase(0, newline + 1);
+			if (!line.empty() && (line[line.size() - 1] == '\r')) {
+				line.erase(line.size() - 1);
+			}
+			return true;
+		}
+
+		if (closed || (input.size() > g_MaxCommandLength)) {
+			Disconnect(fd);
+		}
+	}
+
+	return false;
+}
+
+void ControlServer::Reply(int client, const std::string& text)
+{
+	if (clients_.find(client) == clients_.end()) {
+		return;
+	}
+
+	// Replies are short so a client which cannot take one is not worth waiting for
+	std::string reply(text + '\n');
+	if (send(client, reply.data(), reply.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(reply.size())) {
+		Disconnect(client);
+	}
+}
+
+bool SendControlCommand(const std::string& path, const std::string& command)
+{
+	sockaddr_un address;
+	if (!MakeAddress(path, address)) {
+		return false;
+	}
+
+	int fd(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+	if (fd < 0) {
+		std::cerr << "Error: could not create socket: " << strerror(errno) << '\n';
+		return false;
+	}
+	if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+		std::cerr << "Error: could not connect to " << path << ": " << strerror(errno) << '\n';
+		close(fd);
+		return false;
+	}
+
+	std::string request(command + '\n');
+	if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size())) {
+		std::cerr << "Error: could not send command: " << strerror(errno) << '\n';
+		close(fd);
+		return false;
+	}
+
+	// Read up to the end of the reply line
+	std::string reply;
+	char buffer[512];
+	ssize_t n;
+	while ((reply.find('\n') == std::string::npos) && ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0)) {
+		reply.append(buffer, static_cast<size_t>(n));
+	}
+	close(fd);
+
+	if (reply.empty()) {
+		std::cerr << "Error: no reply from " << path << '\n';
+		return false;
+	}
+	std::cout << reply.substr(0, reply.find('\n')) << '\n';
+
+	return reply.compare(0, 5, "ERROR") != 0;
+}
@@ -0,0 +1,107 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Events reported by the user tracking callbacks
+//---------------------------------------------------------------------------
+#include <iomanip>
+
+#include "events.h"
+
+using namespace H5;
+
+const char* UserEventName(UserEventType type)
+{
+	switch (type)
+	{
+		case USER_EVENT_NEW:                  return "new";
+		case USER_EVENT_POSE_DETECTED:        return "pose_detected";
+		case USER_EVENT_CALIBRATION_START:    return "calibration_start";
+		case USER_EVENT_CALIBRATION_COMPLETE: return "calibration_complete";
+		case USER_EVENT_CALIBRATION_FAILED:   return "calibration_failed";
+		case USER_EVENT_CALIBRATION_LOADED:   return "calibration_loaded";
+		case USER_EVENT_LOST:                 return "lost";
+	}
+	return "unknown";
+}
+
+void PrintUserEvent(std::ostream& os, const UserEvent& event)
+{
+	os << event.wall_time / 1000000 << '.' << std::setfill('0') << std::setw(3)
+		<< (event.wall_time / 1000) % 1000 << std::setfill(' ')
+		<< " frame " << event.frame_id << " user " << event.user << ' ' << UserEventName(event.type);
+	if (event.detail[0] != '\0') {
+		os << ' ' << event.detail;
+	}
+	os << '\n';
+}
+
+CompType MakeUserEventDataType()
+{
+	EnumType type_dt(sizeof(UserEventType));
+	for (int type = USER_EVENT_NEW; type <= USER_EVENT_LOST; ++type)
+	{
+		UserEventType value(static_cast<UserEventType>(type));
+		type_dt.insert(UserEventName(value), &value);
+	}
+	StrType detail_dt(PredType::C_S1, g_UserEventDetailLength);
+
+	CompType dt(sizeof(UserEvent));
+	dt.insertMember(H5std_string("timestamp"), HOFFSET(UserEvent, timestamp), PredType::NATIVE_UINT64);
+	dt.insertMember(H5std_string("wall_time"), HOFFSET(UserEvent, wall_time), PredType::NATIVE_UINT64);
+	dt.insertMember(H5std_string("frame_id"), HOFFSET(UserEvent, frame_id), PredType::NATIVE_UINT32);
+	dt.insertMember(H5std_string("user"), HOFFSET(UserEvent, user), PredType::NATIVE_UINT16);
+	dt.insertMember(H5std_string("type"), HOFFSET(UserEvent, type), type_dt);
+	dt.insertMember(H5std_string("detail"), HOFFSET(UserEvent, detail), detail_dt);
+	return dt;
+}
+
+UserEventRing::UserEventRing(size_t capacity)
+	: head_(0), tail_(0), n_dropped_(0)
+{
+	size_t size(1);
+	while (size < capacity) {
+		size <<= 1;
+	}
+	slots_.resize(size);
+	mask_ = size - 1;
+}
+
+bool UserEventRing::Push(const UserEvent& event)
+{
+	uint64_t head(head_.load(std::memory_order_relaxed));
+	if (head - tail_.load(std::memory_order_acquire) >= slots_.size()) {
+		n_dropped_.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	slots_[head & mask_] = event;
+	head_.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+size_t UserEventRing::Drain(std::vector<UserEvent>& events)
+{
+	uint64_t tail(tail_.load(std::memory_order_relaxed));
+	uint64_t head(head_.load(std::memory_order_acquire));
+	for (uint64_t i = tail; i != head; ++i)
+	{
+		events.push_back(slots_[i & mask_]);
+	}
+	tail_.store(head, std::memory_order_release);
+	return static_cast<size_t>(head - tail);
+}
@@ -0,0 +1,324 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+#include "framesink.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+//---------------------------------------------------------------------------
+// Sink options
+//---------------------------------------------------------------------------
+
+bool ParseSinkOptions(const std::string& spec, std::string& name, SinkOptions& options)
+{
+	std::vector<std::string> fields;
+	size_t start(0);
+	while (true)
+	{
+		size_t end(spec.find(':', start));
+		fields.push_back(spec.substr(start, end - start));
+		if (end == std::string::npos) {
+			break;
+		}
+		start = end + 1;
+	}
+
+	if ((fields.size() < 2) || (fields.size() > 3) || fields[0].empty()) {
+		std::cerr << "Error: sink " << spec << " is not of the form NAME:POLICY[:LENGTH].\n";
+		return false;
+	}
+
+	name = fields[0];
+	if (fields[1] == "block") {
+		options.policy = DROP_NONE;
+	} else if (fields[1] == "drop-oldest") {
+		options.policy = DROP_OLDEST;
+	} else if (fields[1] == "drop-newest") {
+		options.policy = DROP_NEWEST;
+	} else {
+		std::cerr << "Error: unknown drop policy " << fields[1]
+			<< ". Use block, drop-oldest or drop-newest.\n";
+		return false;
+	}
+
+	if (fields.size() == 3) {
+		char* p_end(NULL);
+		long length(strtol(fields[2].c_str(), &p_end, 10));
+		if (fields[2].empty() || (*p_end != '\0') || (length < 1)) {
+			std::cerr << "Error: queue length of sink " << name << " must be a positive integer.\n";
+			return false;
+		}
+		options.queue_length = static_cast<size_t>(length);
+	}
+
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// Frame hashing
+//---------------------------------------------------------------------------
+
+template<typename T>
+static uint64_t HashValue(const T& value, uint64_t hash)
+{
+	return HashBytes(&value, sizeof(value), hash);
+}
+
+uint64_t HashFrame(const FrameSnapshot& frame, uint64_t hash)
+{
+	hash = HashValue(frame.frame_id, hash);
+	hash = HashValue(frame.timestamp, hash);
+	hash = HashValue(frame.rows, hash);
+	hash = HashValue(frame.cols, hash);
+	if (!frame.depth.empty()) {
+		hash = HashBytes(&frame.depth[0], frame.depth.size() * sizeof(uint16_t), hash);
+	}
+	if (!frame.label.empty()) {
+		hash = HashBytes(&frame.label[0], frame.label.size() * sizeof(uint16_t), hash);
+	}
+
+	// Joints field by field so that padding does not count
+	for (size_t i = 0; i < frame.users.size(); ++i)
+	{
+		const TrackedUser& user(frame.users[i]);
+		hash = HashValue(user.user, hash);
+		hash = HashValue(static_cast<int>(i < frame.user_states.size() ? frame.user_states[i] : -1), hash);
+		hash = HashValue(user.n_joints, hash);
+		for (int j = 0; j < user.n_joints; ++j)
+		{
+			const Joint& joint(user.joints[j]);
+			hash = HashValue(joint.id, hash);
+			hash = HashValue(joint.confidence, hash);
+			hash = HashValue(joint.x, hash);
+			hash = HashValue(joint.y, hash);
+			hash = HashValue(joint.z, hash);
+			hash = HashValue(joint.u, hash);
+			hash = HashValue(joint.v, hash);
+			hash = HashValue(joint.w, hash);
+		}
+	}
+
+	return hash;
+}
+
+//---------------------------------------------------------------------------
+// FrameDispatcher
+//---------------------------------------------------------------------------
+
+FrameDispatcher::FramePool::~FramePool()
+{
+	for (size_t i = 0; i < free.size(); ++i)
+	{
+		delete free[i];
+	}
+}
+
+FrameDispatcher::FrameDispatcher()
+	: p_pool_(new FramePool), running_(false)
+{ }
+
+FrameDispatcher::~FrameDispatcher()
+{
+	Stop();
+	for (size_t i = 0; i < queues_.size(); ++i)
+	{
+		delete queues_[i];
+	}
+}
+
+void FrameDispatcher::AddSink(FrameSink* p_sink, const SinkOptions& options)
+{
+	if (running_) {
+		std::cerr << "Error: sink " << p_sink->Name() << " added after the dispatcher started.\n";
+		return;
+	}
+
+	SinkQueue* p_queue(new SinkQueue);
+	p_queue->p_sink = p_sink;
+	p_queue->options = options;
+	p_queue->options.queue_length = std::max(options.queue_length, static_cast<size_t>(1));
+	p_queue->stopping = false;
+	p_queue->stats.consumed = p_queue->stats.dropped = 0;
+	p_queue->stats.max_queued = 0;
+	p_queue->stats.busy_seconds = 0.;
+	queues_.push_back(p_queue);
+}
+
+void FrameDispatcher::Start()
+{
+	if (running_) { return; }
+
+	for (size_t i = 0; i < queues_.size(); ++i)
+	{
+		queues_[i]->stopping = false;
+		queues_[i]->thread = std::thread(Work, queues_[i]);
+	}
+	running_ = true;
+}
+
+void FrameDispatcher::Stop()
+{
+	if (!running_) { return; }
+
+	for (size_t i = 0; i < queues_.size(); ++i)
+	{
+		SinkQueue& queue(*queues_[i]);
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.stopping = true;
+		}
+		queue.frame_ready.notify_one();
+	}
+	for (size_t i = 0; i < queues_.size(); ++i)
+	{
+		queues_[i]->thread.join();
+	}
+	running_ = false;
+}
+
+std::shared_ptr<FrameSnapshot> FrameDispatcher::NewFrame()
+{
+	FrameSnapshot* p_frame(NULL);
+	{
+		std::lock_guard<std::mutex> lock(p_pool_->mutex);
+		if (!p_pool_->free.empty()) {
+			p_frame = p_pool_->free.back();
+			p_pool_->free.pop_back();
+		}
+	}
+	if (!p_frame) {
+		p_frame = new FrameSnapshot;
+	}
+
+	// Return the snapshot to the pool when the last reference goes. The pool outlives the
+	// dispatcher if a sink holds on to a frame.
+	std::shared_ptr<FramePool> p_pool(p_pool_);
+	return std::shared_ptr<FrameSnapshot>(p_frame, [p_pool](FrameSnapshot* p) {
+		std::lock_guard<std::mutex> lock(p_pool->mutex);
+		p_pool->free.push_back(p);
+	});
+}
+
+FrameRef FrameDispatcher::CarryForward(const std::vector<uint16_t>& lost_users,
+		const std::vector<UserEvent>& user_events, const FrameRef& frame)
+{
+	if (lost_users.empty() && user_events.empty()) {
+		return frame;
+	}
+
+	std::shared_ptr<FrameSnapshot> p_copy(NewFrame());
+	*p_copy = *frame;
+	p_copy->lost_users.insert(p_copy->lost_users.begin(), lost_users.begin(), lost_users.end());
+	p_copy->user_events.insert(p_copy->user_events.begin(), user_events.begin(), user_events.end());
+	return p_copy;
+}
+
+void FrameDispatcher::Dispatch(const FrameRef& frame)
+{
+	for (size_t i = 0; i < queues_.size(); ++i)
+	{
+		SinkQueue& queue(*queues_[i]);
+		{
+			std::unique_lock<std::mutex> lock(queue.mutex);
+			FrameRef queued(frame);
+			if (queue.frames.size() >= queue.options.queue_length) {
+				switch (queue.options.policy) {
+					case DROP_NONE:
+						while (queue.frames.size() >= queue.options.queue_length) {
+							queue.space_ready.wait(lock);
+						}
+						break;
+					case DROP_OLDEST:
+					{
+						FrameRef dropped(queue.frames.front());
+						queue.frames.pop_front();
+						++queue.stats.dropped;
+						FrameRef& next(queue.frames.empty() ? queued : queue.frames.front());
+						next = CarryForward(dropped->lost_users, dropped->user_events, next);
+						break;
+					}
+					case DROP_NEWEST:
+						queue.lost_users.insert(queue.lost_users.end(),
+								frame->lost_users.begin(), frame->lost_users.end());
+						queue.user_events.insert(queue.user_events.end(),
+								frame->user_events.begin(), frame->user_events.end());
+						++queue.stats.dropped;
+						continue;
+				}
+			}
+			queued = CarryForward(queue.lost_users, queue.user_events, queued);
+			queue.lost_users.clear();
+			queue.user_events.clear();
+			queue.frames.push_back(queued);
+			queue.stats.max_queued = std::max(queue.stats.max_queued, queue.frames.size());
+		}
+		queue.frame_ready.notify_one();
+	}
+}
+
+FrameDispatcher::SinkStats FrameDispatcher::Stats(size_t sink_idx) const
+{
+	SinkQueue& queue(*queues_[sink_idx]);
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	return queue.stats;
+}
+
+void FrameDispatcher::PrintStats(std::ostream& os) const
+{
+	for (size_t i = 0; i < queues_.size(); ++i)
+	{
+		SinkStats stats(Stats(i));
+		double ms_per_frame(stats.consumed ? 1e3 * stats.busy_seconds / stats.consumed : 0.);
+		os << "Sink " << queues_[i]->p_sink->Name() << ": " << stats.consumed << " frame(s), "
+			<< stats.dropped << " dropped, at most " << stats.max_queued << " queued, "
+			<< ms_per_frame << " ms per frame.\n";
+	}
+}
+
+void FrameDispatcher::Work(SinkQueue* p_queue)
+{
+	SinkQueue& queue(*p_queue);
+	while (true)
+	{
+		FrameRef frame;
+		{
+			std::unique_lock<std::mutex> lock(queue.mutex);
+			while (queue.frames.empty() && !queue.stopping) {
+				queue.frame_ready.wait(lock);
+			}
+			if (queue.frames.empty()) {
+				break;
+			}
+			frame = queue.frames.front();
+			queue.frames.pop_front();
+		}
+		queue.space_ready.notify_one();
+
+		std::chrono::steady_clock::time_point start(std::chrono::steady_clock::now());
+		queue.p_sink->Consume(frame);
+		std::chrono::duration<double> busy(std::chrono::steady_clock::now() - start);
+
+		// Let go of the frame before counting it so that it can be recycled
+		frame.reset();
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		++queue.stats.consumed;
+		queue.stats.busy_seconds += busy.count();
+	}
+
+	queue.p_sink->Finish();
+}
@@ -0,0 +1,28 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+#include "hash.h"
+
+uint64_t HashBytes(const void* p_data, size_t n_bytes, uint64_t hash)
+{
+	const uint8_t* p_bytes(static_cast<const uint8_t*>(p_data));
+	for (size_t i = 0; i < n_bytes; ++i)
+	{
+		hash = (hash ^ p_bytes[i]) * 0x100000001b3ULL;
+	}
+	return hash;
+}
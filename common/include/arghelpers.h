@@ -76,4 +76,15 @@ struct Arg: public option::Arg
 		if (msg) printError("Option '", option, "' requires a numeric argument\n");
 		return option::ARG_ILLEGAL;
 	}
+
+	static option::ArgStatus Real(const option::Option& option, bool msg)
+	{
+		char* endptr = 0;
+		if (option.arg != 0 && strtod(option.arg, &endptr)){};
+		if (endptr != option.arg && *endptr == 0)
+			return option::ARG_OK;
+
+		if (msg) printError("Option '", option, "' requires a real-valued argument\n");
+		return option::ARG_ILLEGAL;
+	}
 };
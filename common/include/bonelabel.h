@@ -0,0 +1,48 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Labelling of user points by their nearest bone
+//---------------------------------------------------------------------------
+#ifndef XNV_BONELABEL_H__
+#define XNV_BONELABEL_H__
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "joint.h"
+
+// A bone joining two joints. Joint ids are as in Joint::id.
+struct Bone {
+	const char* name;
+	int         joint_a, joint_b;
+};
+
+// The skeleton topology used for labelling. A point's bone label is one more than the index of
+// its nearest bone in this table so that zero means "no bone". This is the same topology, in the
+// same order, as examples/labelbones.py.
+extern const Bone g_Bones[];
+extern const int g_NumBones;
+
+// Label n_points points with their nearest bone. Points are given as separate arrays of x, y and
+// z co-ordinates. Bones whose joints are not both present in joints are ignored. If no bone is
+// usable every label is zero. On return labels has n_points entries.
+void LabelBones(const float* xs, const float* ys, const float* zs, size_t n_points,
+		const Joint* joints, size_t n_joints, std::vector<uint16_t>& labels);
+
+#endif // XNV_BONELABEL_H__
@@ -0,0 +1,109 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Reusing skeleton calibrations of users who have been seen before
+//---------------------------------------------------------------------------
+#ifndef XNV_CALIBCACHE_H__
+#define XNV_CALIBCACHE_H__
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <XnCppWrapper.h>
+
+// The size of a user's silhouette in millimetres, measured at their centre of mass
+struct UserProfile {
+	float height_mm;
+	float width_mm;
+};
+
+struct CalibrationCacheParams {
+	size_t max_slots;            // calibrations kept; the least recently used is replaced
+	float  height_tolerance_mm;  // largest difference in height for a calibration to be reused
+	float  width_tolerance_mm;   // largest difference in width
+
+	CalibrationCacheParams()
+		: max_slots(16), height_tolerance_mm(50.f), width_tolerance_mm(150.f)
+	{ }
+};
+
+// Successful calibrations are saved to a directory in slots, each labelled with the profile of the
+// user it was made for. When a new user appears, the calibration of the most similar profile is
+// loaded, if there is one within tolerance, and the user is tracked straight away rather than
+// waiting for live calibration. The directory persists between runs.
+//
+// Users are measured once, when they are detected, and that profile is the one saved with their
+// calibration. A user measured in the calibration pose, arms raised, would look wider than when
+// they next walk in. Users whose silhouette is cut off by the edge of the frame when detected
+// cannot be measured. They are always calibrated live and their calibrations are not saved.
+class CalibrationCache
+{
+public:
+	struct Slot {
+		UserProfile profile;
+		uint32_t    n_uses;     // number of times loaded
+		uint64_t    last_used;  // seconds since the epoch
+	};
+
+	CalibrationCache(xn::DepthGenerator& depthGenerator, xn::UserGenerator& userGenerator,
+			const CalibrationCacheParams& params = CalibrationCacheParams());
+
+	// Use directory, which is created if need be, reading any calibrations already in it. Returns
+	// false and prints an error on failure.
+	bool Open(const std::string& directory);
+
+	// Measure user from the current label map. Returns false if they cannot be measured.
+	bool Measure(XnUserID user, UserProfile& profile) const;
+
+	// Measure user, who has just been detected, and load the cached calibration closest to their
+	// profile. Returns false, and loads nothing, if there is none within tolerance. On success the
+	// caller should start tracking the user.
+	bool Load(XnUserID user);
+
+	// Save the calibration of user, who has just been calibrated live, with the profile measured by
+	// Load(). It replaces any calibration of a similar profile.
+	bool Save(XnUserID user);
+
+	// Discard the profile of user, who has been lost
+	void Forget(XnUserID user) { profiles_.erase(user); }
+
+	// Index of the slot closest to profile within tolerance, or -1
+	int FindSlot(const UserProfile& profile) const;
+
+	const std::vector<Slot>& Slots() const { return slots_; }
+
+	size_t Hits() const { return n_hits_; }
+	size_t Misses() const { return n_misses_; }
+
+private:
+	xn::DepthGenerator&     depth_generator_;
+	xn::UserGenerator&      user_generator_;
+	CalibrationCacheParams  params_;
+	std::string             directory_;
+	std::vector<Slot>       slots_;
+	size_t                  n_hits_, n_misses_;
+	std::map<XnUserID, UserProfile> profiles_;  // measured when each user was detected
+
+	std::string SlotFilename(size_t slot) const;
+	bool ReadIndex();
+	bool WriteIndex() const;
+};
+
+#endif // XNV_CALIBCACHE_H__
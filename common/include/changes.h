@@ -0,0 +1,68 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Detection of frames whose depth map has not changed
+//---------------------------------------------------------------------------
+#ifndef XNV_CHANGES_H__
+#define XNV_CHANGES_H__
+
+#include <vector>
+#include <stdint.h>
+
+// Parameters of ChangeDetector. The depth map is divided into square tiles and the sum of
+// absolute depth differences taken over each. A tile has changed if its mean absolute difference
+// exceeds the threshold, which should be just above the sensor's noise at the working distance,
+// or if more than a small fraction of its pixels have gained or lost depth.
+struct ChangeParams {
+	int   tile_size;        // in pixels
+	float threshold_mm;     // mean absolute difference over the pixels of a tile with depth
+	float max_hole_change;  // fraction of a tile's pixels which may gain or lose depth
+
+	ChangeParams()
+		: tile_size(16), threshold_mm(10.f), max_hole_change(0.05f)
+	{ }
+};
+
+// Decides whether a frame differs enough from a reference frame to be worth logging. Pixels with
+// no depth in either frame are left out of the mean so that flickering holes are not mistaken for
+// movement. Many pixels of a tile gaining or losing depth are, as when something moves in front
+// of a background with no depth, and so is any change of label. The sums are plain loops over a
+// tile's rows for the compiler to vectorise and stop at the first changed tile, so a moving scene
+// costs little.
+class ChangeDetector
+{
+public:
+	explicit ChangeDetector(const ChangeParams& params = ChangeParams());
+
+	// True if the rows x cols depth map and labels differ from the reference in any tile, or if
+	// there is no reference of the same size.
+	bool Changed(const uint16_t* depth, const uint16_t* labels, int rows, int cols) const;
+
+	// Compare later frames with this one.
+	void SetReference(const uint16_t* depth, const uint16_t* labels, int rows, int cols);
+
+	void ClearReference();
+
+private:
+	ChangeParams          params_;
+	int                   rows_, cols_;   // of the reference, zero if none
+	std::vector<uint16_t> depth_;
+	std::vector<uint16_t> labels_;
+};
+
+#endif // XNV_CHANGES_H__
@@ -0,0 +1,66 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Line based command socket for controlling a running process
+//---------------------------------------------------------------------------
+#ifndef XNV_CONTROL_H__
+#define XNV_CONTROL_H__
+
+#include <map>
+#include <string>
+
+// Listens on a Unix domain stream socket. Each client sends commands as lines of text and gets a
+// single line reply to each. The socket is polled rather than given a thread so that commands are
+// handled on the caller's thread, between frames.
+class ControlServer
+{
+public:
+	ControlServer();
+	~ControlServer();
+
+	// Listen at path, replacing any stale socket left there. Returns false and prints an error on
+	// failure.
+	bool Open(const std::string& path);
+
+	// Stop listening, disconnect every client and remove the socket.
+	void Close();
+	bool IsOpen() const { return socket_ >= 0; }
+
+	// Accept new clients and read what they have sent without blocking. Returns true and sets
+	// client and line, without its newline, if a complete command is waiting.
+	bool Poll(int& client, std::string& line);
+
+	// Send a reply line to client. A newline is added.
+	void Reply(int client, const std::string& text);
+
+private:
+	int                        socket_;
+	std::string                path_;
+	std::map<int, std::string> clients_;  // partial input of each connected client
+
+	void Disconnect(int client);
+
+	ControlServer(const ControlServer&);
+	ControlServer& operator = (const ControlServer&);
+};
+
+// Connect to the server at path, send command and print the reply to stdout. Returns false and
+// prints an error if there is no server or the reply starts with "ERROR".
+bool SendControlCommand(const std::string& path, const std::string& command);
+
+#endif // XNV_CONTROL_H__
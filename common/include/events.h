@@ -0,0 +1,101 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Events reported by the user tracking callbacks
+//---------------------------------------------------------------------------
+#ifndef XNV_EVENTS_H__
+#define XNV_EVENTS_H__
+
+#include <atomic>
+#include <iostream>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <hdf5.h>
+#include <H5Cpp.h>
+
+// Something which happened to a user, as reported by the tracking callbacks
+enum UserEventType {
+	USER_EVENT_NEW,
+	USER_EVENT_POSE_DETECTED,
+	USER_EVENT_CALIBRATION_START,
+	USER_EVENT_CALIBRATION_COMPLETE,
+	USER_EVENT_CALIBRATION_FAILED,
+	USER_EVENT_CALIBRATION_LOADED,  // tracking from a cached calibration
+	USER_EVENT_LOST,
+};
+
+// Name of type, e.g. "new"
+const char* UserEventName(UserEventType type);
+
+// Length of UserEvent::detail including the terminating zero
+const int g_UserEventDetailLength = 24;
+
+// A fixed size event record so that the callbacks need not allocate
+struct UserEvent {
+	uint64_t      timestamp;   // user generator timestamp, microseconds
+	uint64_t      wall_time;   // microseconds since the epoch
+	uint32_t      frame_id;    // user generator frame id
+	uint16_t      user;
+	UserEventType type;
+	char          detail[g_UserEventDetailLength];  // e.g. the pose detected; may be empty
+};
+
+// Print event as a line of text
+void PrintUserEvent(std::ostream& os, const UserEvent& event);
+
+// Create the HDF5 compound datatype matching UserEvent. The type is an HDF5 enum of the names
+// given by UserEventName().
+H5::CompType MakeUserEventDataType();
+
+// A lock-free ring of events with a single producer, the tracking callbacks, and a single
+// consumer, which may be on another thread. Neither side blocks or allocates: if the consumer
+// falls behind, new events are dropped and counted.
+class UserEventRing
+{
+public:
+	// capacity is rounded up to a power of two
+	explicit UserEventRing(size_t capacity = 1024);
+
+	// Producer: add event. Returns false if the ring is full.
+	bool Push(const UserEvent& event);
+
+	// Consumer: append every event in the ring to events. Returns the number appended.
+	size_t Drain(std::vector<UserEvent>& events);
+
+	// Events which did not fit
+	uint64_t Dropped() const { return n_dropped_.load(std::memory_order_relaxed); }
+
+private:
+	std::vector<UserEvent> slots_;
+	size_t                 mask_;
+
+	// Counts of events pushed and popped. Padded onto separate cache lines so that the producer
+	// and consumer do not contend. alignas() is avoided as it would stop owners being created
+	// with new before C++17.
+	std::atomic<uint64_t>  head_;
+	char                   pad_[64];
+	std::atomic<uint64_t>  tail_;
+	std::atomic<uint64_t>  n_dropped_;
+
+	UserEventRing(const UserEventRing&);
+	UserEventRing& operator = (const UserEventRing&);
+};
+
+#endif // XNV_EVENTS_H__
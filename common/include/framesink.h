@@ -0,0 +1,201 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Fanning frames out to several consumers, each on its own thread
+//---------------------------------------------------------------------------
+#ifndef XNV_FRAMESINK_H__
+#define XNV_FRAMESINK_H__
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#include "hash.h"
+#include "joint.h"
+#include "metrics.h"
+
+// Tracking state of a user in a frame
+enum UserState { USER_LOOKING, USER_CALIBRATING, USER_TRACKING };
+
+// Everything the tracker produced for one frame. Once dispatched a snapshot is shared between
+// sinks and must not be modified.
+struct FrameSnapshot {
+	uint64_t                 number;       // index of this frame in the order captured
+	uint32_t                 frame_id;     // depth frame id
+	uint64_t                 timestamp;    // depth timestamp, microseconds
+	int                      rows, cols;
+	std::vector<uint16_t>    depth;        // rows x cols, millimetres
+	std::vector<uint16_t>    label;        // rows x cols user ids
+
+	// Projective to real world conversion: x = (col / cols - 0.5) * z * x_to_z and
+	// y = (0.5 - row / rows) * z * y_to_z, as done by OpenNI.
+	double                   x_to_z, y_to_z;
+
+	std::vector<TrackedUser> users;        // every user; untracked users have no joints
+	std::vector<UserState>   user_states;  // state of each of users
+	std::vector<uint16_t>    lost_users;   // users lost by the tracker since the previous frame
+	std::vector<UserEvent>   user_events;  // tracking callbacks since the previous frame
+
+	// Colour image, if one was captured. Packed RGB.
+	bool                     has_image;
+	uint32_t                 image_frame_id;
+	uint64_t                 image_timestamp;
+	int                      image_width, image_height;
+	std::vector<uint8_t>     image;
+};
+
+typedef std::shared_ptr<const FrameSnapshot> FrameRef;
+
+// Starting value for HashFrame()
+const uint64_t g_FrameHashSeed = g_HashSeed;
+
+// Fold what the tracker made of frame into hash: its id and timestamp, depth, labels, users,
+// their states and joints. Events and images are left out as they carry wall-clock times and
+// lossy encodings. Two runs producing the same sequence of hashes tracked identically.
+uint64_t HashFrame(const FrameSnapshot& frame, uint64_t hash = g_FrameHashSeed);
+
+// A consumer of frames. Consume() is called on a thread belonging to the sink, once for each
+// frame in order, and Finish() on the same thread after the last. Sinks must not throw.
+class FrameSink
+{
+public:
+	virtual ~FrameSink() { }
+
+	// Name for messages, e.g. "log"
+	virtual const char* Name() const = 0;
+
+	virtual void Consume(const FrameRef& frame) = 0;
+	virtual void Finish() { }
+};
+
+// What to do with a new frame when a sink's queue is full
+enum DropPolicy {
+	DROP_NONE,     // wait for the sink to catch up. This holds up every other sink.
+	DROP_OLDEST,   // discard the oldest queued frame
+	DROP_NEWEST,   // discard the new frame
+};
+
+struct SinkOptions {
+	DropPolicy policy;
+	size_t     queue_length;
+
+	SinkOptions(DropPolicy policy_ = DROP_NONE, size_t queue_length_ = 16)
+		: policy(policy_), queue_length(queue_length_)
+	{ }
+};
+
+// Parse a command-line sink specification "NAME:POLICY[:LENGTH]" where POLICY is one of "block",
+// "drop-oldest" or "drop-newest". Fields not given keep their value in options. Returns false
+// and prints an error if spec is invalid.
+bool ParseSinkOptions(const std::string& spec, std::string& name, SinkOptions& options);
+
+// Hands each frame to any number of sinks. Every sink has its own thread and queue so that a slow
+// sink only loses frames itself, according to its drop policy, rather than slowing down the
+// others.
+class FrameDispatcher
+{
+public:
+	// Per-sink counts
+	struct SinkStats {
+		uint64_t consumed;
+		uint64_t dropped;
+		size_t   max_queued;
+		double   busy_seconds;  // total time spent in Consume()
+	};
+
+	FrameDispatcher();
+
+	// Calls Stop()
+	~FrameDispatcher();
+
+	// Add a sink. The caller retains ownership; it must outlive Stop(). Sinks may only be added
+	// before Start().
+	void AddSink(FrameSink* p_sink, const SinkOptions& options = SinkOptions());
+	size_t SinkCount() const { return queues_.size(); }
+
+	// Start a thread for each sink
+	void Start();
+
+	// Pass any frames still queued to their sinks, call Finish() on each sink and stop the
+	// threads.
+	void Stop();
+
+	// Get a snapshot to fill in for Dispatch(). Snapshots are recycled once every sink has
+	// finished with them, so that their buffers are not allocated every frame. Fields of a
+	// recycled snapshot keep their old values.
+	std::shared_ptr<FrameSnapshot> NewFrame();
+
+	// Queue frame for every sink. Users lost and events in a frame a sink drops are passed on
+	// with the next frame the sink does consume.
+	void Dispatch(const FrameRef& frame);
+
+	SinkStats Stats(size_t sink_idx) const;
+
+	// Print counts for each sink
+	void PrintStats(std::ostream& os) const;
+
+protected:
+	struct SinkQueue {
+		FrameSink*              p_sink;
+		SinkOptions             options;
+		std::deque<FrameRef>    frames;
+		std::mutex              mutex;
+		std::condition_variable frame_ready;
+		std::condition_variable space_ready;
+		bool                    stopping;
+		SinkStats               stats;
+		std::thread             thread;
+
+		// Carried over from frames dropped under DROP_NEWEST to the next frame queued. Lost if no
+		// frame follows before Stop().
+		std::vector<uint16_t>   lost_users;
+		std::vector<UserEvent>  user_events;
+	};
+
+	// Recycled snapshots. Shared with the deleters of snapshots still in use.
+	struct FramePool {
+		std::mutex                  mutex;
+		std::vector<FrameSnapshot*> free;
+
+		~FramePool();
+	};
+
+	std::vector<SinkQueue*>    queues_;
+	std::shared_ptr<FramePool> p_pool_;
+	bool                       running_;
+
+	static void Work(SinkQueue* p_queue);
+
+	// Return frame with lost_users and user_events inserted before its own. A copy is made only
+	// if there is anything to insert.
+	FrameRef CarryForward(const std::vector<uint16_t>& lost_users,
+			const std::vector<UserEvent>& user_events, const FrameRef& frame);
+
+	// Not copyable
+	FrameDispatcher(const FrameDispatcher&);
+	FrameDispatcher& operator = (const FrameDispatcher&);
+};
+
+#endif // XNV_FRAMESINK_H__
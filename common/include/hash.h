@@ -0,0 +1,34 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Hashing for comparing runs
+//---------------------------------------------------------------------------
+#ifndef XNV_HASH_H__
+#define XNV_HASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Starting value for HashBytes()
+const uint64_t g_HashSeed = 0xcbf29ce484222325ULL;
+
+// Fold n_bytes at p_data into hash with 64-bit FNV-1a. Fast rather than secure; used to check
+// that two runs produced the same output.
+uint64_t HashBytes(const void* p_data, size_t n_bytes, uint64_t hash = g_HashSeed);
+
+#endif // XNV_HASH_H__
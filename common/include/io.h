@@ -23,26 +23,161 @@
 
 #include <iostream>
 #include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
 #include <XnCppWrapper.h>
 #include <hdf5.h>
 #include <H5Cpp.h>
 
+#include "changes.h"
+#include "framesink.h"
+#include "joint.h"
+#include "metrics.h"
+#include "prediction.h"
+#include "smoothing.h"
+
+class ThreadPool;
+
+// Fill joints with those joints of user which are currently tracked. Returns the number filled.
+int GetUserJoints(xn::DepthGenerator& depthGenerator, xn::UserGenerator& userGenerator,
+		XnUserID user, Joint joints[g_NumJointTypes]);
+
+// Copy the depth map, labels and users of the current frame into frame. The colour image, lost
+// users and user events are cleared.
+void CaptureFrame(const xn::DepthMetaData& dmd, const xn::SceneMetaData& smd,
+		xn::DepthGenerator& depthGenerator, xn::UserGenerator& userGenerator, FrameSnapshot& frame);
+
+// A lost user handler for Session::SetLostUserHandler() which adds the user to the
+// std::vector<uint16_t> pointed to by pCookie. The lost users are passed on with the next frame
+// so that the sinks discard their state for them on their own threads.
+void XN_CALLBACK_TYPE QueueLostUser(XnUserID user, void* pCookie);
+
+// Copy a colour image into frame. Returns false, and leaves frame without an image, if it is not
+// RGB.
+bool CaptureImage(const xn::ImageMetaData& imd, FrameSnapshot& frame);
+
 class DepthMapLogger
 {
 protected:
 	H5::H5File    *p_h5_file_;
+	H5::Group     *p_parent_group_;  // root of the file or the group given to Open()
 	H5::Group     *p_frames_group_;
 
+	// User events from every frame, in the "events" table beside "frames"
+	H5::DataSet   *p_events_ds_;
+	H5::CompType   event_dt_;
+	hsize_t        n_events_;
+
+	void CreateEventTable();
+	void WriteEvents(hsize_t frame_idx, const std::vector<UserEvent>& events);
+
 	H5::CompType   joint_dt_;
+
+	bool           log_normals_;
+
+	// Non-NULL if smoothed joints are also logged
+	JointSmoother *p_smoother_;
+
+	// Non-NULL if predicted joints are also logged
+	JointPredictor *p_predictor_;
+
+	void WritePredictionErrors();
+
+	// Non-NULL if frames whose depth map has not changed share the pixel datasets of the last
+	// frame written in full, which is named by reference_frame_
+	ChangeDetector *p_change_detector_;
+	std::string     reference_frame_;
+	hsize_t         reference_frame_idx_;
+	hsize_t         n_unchanged_frames_;
+
+	void WritePixels(const FrameSnapshot& frame, H5::Group& frame_group);
+	void LinkPixels(H5::Group& frame_group);
+
+	// Lifecycle of every user and joint confidences, written to the "metrics" group on Close()
+	TrackingMetrics metrics_;
+
+	void WriteTrackingMetrics();
+
+	// A colour image on its way to the log
+	struct PendingImage {
+		hsize_t              frame_idx;
+		uint32_t             frame_id;
+		uint64_t             timestamp;
+		int                  width, height;
+		std::vector<uint8_t> pixels;    // packed RGB
+		std::vector<uint8_t> jpeg;      // compressed
+	};
+
+	// Colour images are compressed on a pool of workers and written by whichever thread calls
+	// DumpFrame(). PendingImage buffers are recycled to avoid allocating per frame.
+	ThreadPool                 *p_image_pool_;
+	int                         jpeg_quality_;
+	std::mutex                  images_mutex_;
+	std::vector<PendingImage*>  completed_images_;
+	std::vector<PendingImage*>  free_images_;
+	size_t                      n_dropped_images_;
+
+	void WriteCompletedImages();
+	void QueueImage(uint32_t frame_id, uint64_t timestamp, int width, int height, const uint8_t* pixels);
+
+	void WriteFrame(const FrameSnapshot& frame);
 public:
 	DepthMapLogger();
 	~DepthMapLogger();
 
+	// Log per-pixel surface normals for user pixels as an rows x cols x 3 int8 "normals" dataset.
+	// See ComputeNormals() in normals.h.
+	void EnableNormals(bool enable);
+
+	// Allow colour images to be logged. They are JPEG compressed with quality jpeg_quality on a
+	// pool of n_threads workers. Zero threads means one per hardware thread.
+	void EnableImages(int jpeg_quality, size_t n_threads = 0);
+
+	// Also log each user's joints after One Euro filtering as "joints_smoothed". The dataset's
+	// "lag_ms" attribute gives the delay of the filter for each joint. Call LostUser() when the
+	// tracker loses a user so that their filter state is discarded.
+	void EnableSmoothing(bool enable, const OneEuroParams& params = OneEuroParams());
+
+	// Also log each user's joints extrapolated params.horizon_ms into the future as
+	// "joints_predicted". On Close() the accuracy of the predictions is written to the
+	// "prediction" group of the log. See JointPredictor in prediction.h.
+	void EnablePrediction(bool enable, const PredictionParams& params = PredictionParams());
+
+	// The predictor enabled by EnablePrediction(), or NULL. Its error statistics cover the frames
+	// logged since Open().
+	const JointPredictor* Predictor() const { return p_predictor_; }
+
+	// Compare each frame's depth map and labels with those of the last frame written in full. If
+	// they have not changed by more than params allows, the "depth", "label", "points",
+	// "point_labels" and "normals" datasets of the frame are hard links to those of that frame and
+	// its "pixels_from_idx" attribute gives its index. Users and joints are always written.
+	void EnableChangeDetection(bool enable, const ChangeParams& params = ChangeParams());
+
+	// Number of frames logged since Open() whose pixels are shared with an earlier frame.
+	hsize_t UnchangedFrameCount() const;
+
+	// Discard any per-user state for user.
+	void LostUser(XnUserID user);
+
+	// A lost user handler for Session::SetLostUserHandler(). The cookie is the logger.
+	static void XN_CALLBACK_TYPE LostUserHandler(XnUserID user, void* pCookie);
+
 	void Open(const char* h5_filename);
+
+	// Log to a new "frames" group within parent. The caller retains ownership of the file.
+	void Open(H5::Group& parent);
 	void Close();
 
-	// Dump the current depth map to the specified output stream.
-	void DumpDepthMap(const xn::DepthMetaData& dmd, const xn::SceneMetaData& smd);
+	// Number of frames logged so far. This is also the index of the next frame to be logged.
+	hsize_t FrameCount() const;
+
+	// Log a frame captured by CaptureFrame(), along with its colour image if images are enabled.
+	// This does not touch any generators so it may be called from any thread, although only one
+	// at a time. Images are compressed in the background and written out by a later DumpFrame()
+	// or Close(). They are dropped rather than holding up the caller if compression falls behind.
+	void DumpFrame(const FrameSnapshot& frame);
 };
 
 #endif // XNV_IO_H__
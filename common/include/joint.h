@@ -0,0 +1,64 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Joint records as stored in logs
+//---------------------------------------------------------------------------
+#ifndef XNV_JOINT_H__
+#define XNV_JOINT_H__
+
+#include <stdint.h>
+
+#include <hdf5.h>
+#include <H5Cpp.h>
+
+// A structure describing a joint. Each tracked user's "joints" dataset is an array of these.
+struct Joint {
+	int id;
+	float confidence;
+	float x, y, z; // real-world
+	float u, v, w; // projective
+};
+
+// Number of joints in the full skeleton profile. Joint ids run from 1 to this inclusive.
+const int g_NumJointTypes = 24;
+
+// The joints of one tracked user in a single frame
+struct TrackedUser {
+	uint16_t user;
+	int      n_joints;
+	Joint    joints[g_NumJointTypes];  // only the first n_joints are valid
+};
+
+// Create the HDF5 compound datatype matching Joint.
+H5::CompType MakeJointDataType();
+
+// Joints laid out as arrays indexed by joint type, for filters which process every co-ordinate of
+// every joint type in one branch-free pass that the compiler can vectorise. The x, y, z, u, v and
+// w of the joint with id j start at (j - 1) * g_JointCoords.
+const int g_JointCoords = 6;
+const int g_JointArraySize = g_JointCoords * g_NumJointTypes;
+
+// Scatter the n joints into values, setting present to 1 for their co-ordinates and to 0 for
+// those of joint types not given. Joints with ids out of range are skipped.
+void ScatterJoints(const Joint* joints, int n, float* values, float* present);
+
+// Copy the n joints to out, taking their co-ordinates from values. Joints with ids out of range
+// are copied unchanged.
+void GatherJoints(const Joint* joints, int n, const float* values, Joint* out);
+
+#endif // XNV_JOINT_H__
@@ -0,0 +1,71 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Writing joint positions as an Apache Arrow IPC file
+//---------------------------------------------------------------------------
+#ifndef XNV_JOINTSTREAM_H__
+#define XNV_JOINTSTREAM_H__
+
+#include <cstddef>
+#include <stdint.h>
+
+#include "joint.h"
+
+// Writes joints as a flat table with one row per joint and the columns
+//
+//   frame (uint64), timestamp (uint64), user (uint16), joint (int32),
+//   confidence, x, y, z, u, v, w (float32)
+//
+// where frame is the index of the frame within the log. Rows are buffered and written as a
+// record batch once enough have accumulated. The output is in the Arrow IPC file format, whose
+// footer indexes the batches, so that it may be memory-mapped and its batches read in any order
+// without parsing. The footer is only written by Close(); until then the file cannot be read.
+//
+// Arrow itself is hidden from users of this class so that they need not be built against it.
+class JointStreamWriter
+{
+public:
+	JointStreamWriter();
+	~JointStreamWriter();
+
+	// Open a new file at filename. Returns false and prints an error on failure.
+	bool Open(const char* filename, size_t batch_rows = 16384);
+
+	// Write any buffered rows and the footer and close the file. Returns false if any write failed.
+	bool Close();
+
+	bool IsOpen() const;
+
+	// Add rows for n joints of one user in one frame.
+	void Append(uint64_t frame, uint64_t timestamp, uint16_t user, const Joint* joints, size_t n);
+
+	// Write buffered rows as a record batch now.
+	bool Flush();
+
+	// Number of rows appended since Open().
+	uint64_t RowCount() const;
+
+private:
+	struct Impl;
+	Impl* p_impl_;
+
+	JointStreamWriter(const JointStreamWriter&);
+	JointStreamWriter& operator = (const JointStreamWriter&);
+};
+
+#endif // XNV_JOINTSTREAM_H__
@@ -0,0 +1,32 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// JPEG compression of colour images
+//---------------------------------------------------------------------------
+#ifndef XNV_JPEG_H__
+#define XNV_JPEG_H__
+
+#include <vector>
+#include <stdint.h>
+
+// Compress a packed 24-bit RGB image of width x height pixels, replacing the contents of out with
+// the JPEG file data. Quality is from 1 (worst) to 100 (best). Safe to call from any thread.
+// Returns false, leaving out empty, if libjpeg reports an error such as the image being too large.
+bool CompressJpeg(const uint8_t* rgb, int width, int height, int quality, std::vector<uint8_t>& out);
+
+#endif // XNV_JPEG_H__
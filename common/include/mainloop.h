@@ -18,18 +18,75 @@
 #ifndef XNV_MAINLOOP_H___
 #define XNV_MAINLOOP_H___
 
+#include <map>
+
 #include <XnOpenNI.h>
 #include <XnCppWrapper.h>
 
-extern xn::Context g_Context;
-extern xn::ScriptNode g_scriptNode;
-extern xn::DepthGenerator g_DepthGenerator;
-extern xn::UserGenerator g_UserGenerator;
-extern xn::Player g_Player;
+#include "events.h"
+
+class CalibrationCache;
+
+// Called from the tracking callbacks with the id of the user concerned
+typedef void (XN_CALLBACK_TYPE* UserEventHandler)(XnUserID nId, void* pCookie);
+
+// Time from a user being detected to the first frame in which their skeleton is tracked, split by
+// whether their calibration came from the cache or was done live
+struct TimeToTracking {
+	XnUInt32 nCached;
+	XnUInt32 nCalibrated;
+	XnDouble fCachedSeconds;     // totals over all users
+	XnDouble fCalibratedSeconds;
+};
+
+// State shared by the user tracking callbacks of a single user generator. A pointer to one of
+// these is registered as the cookie for each callback so that several user generators, each in
+// their own context, may be tracking at once.
+struct TrackingState {
+	xn::UserGenerator* pUserGenerator;
+	XnBool bNeedPose;
+	XnChar strPose[20];
+
+	// Optional handler called when a user is lost, e.g. to discard per-user state
+	UserEventHandler pLostUserHandler;
+	void* pLostUserCookie;
+
+	// Optional cache tried for new users before falling back to live calibration
+	CalibrationCache* pCalibrationCache;
+
+	// User generator timestamp at which each user not yet tracked was detected
+	std::map<XnUserID, XnUInt64> detectionTimes;
+	TimeToTracking timeToTracking;
+
+	// Users told to start tracking whose skeleton has not yet been tracked, and whether their
+	// calibration came from the cache
+	std::map<XnUserID, bool> startingTracking;
+
+	// Optional ring to which the callbacks report what happened to each user. The callbacks
+	// themselves print nothing.
+	UserEventRing* pEvents;
+};
+
+// Field of view of a Kinect's depth camera, which mock depth generators have unless told otherwise
+extern const XnFieldOfView g_DefaultFieldOfView;
+
+// Find the depth generator in context, creating a mock one if none exists.
+bool EnsureDepthGenerator(xn::Context& context, xn::DepthGenerator& depthGenerator);
+
+// Create a mock depth generator in context with the given output mode and field of view. Its
+// depth map is blank until frames are pushed to it with SetData().
+bool CreateMockDepthGenerator(xn::Context& context, const XnMapOutputMode& mode,
+		const XnFieldOfView& fov, xn::MockDepthGenerator& mockDepth);
+
+// Find the image generator in context and register depthGenerator to its viewpoint.
+bool EnsureImageGenerator(xn::Context& context, xn::ImageGenerator& imageGenerator,
+		xn::DepthGenerator& depthGenerator);
+
+// Find or create a user generator in context and register the tracking callbacks with state.
+bool EnsureUserGenerator(xn::Context& context, xn::UserGenerator& userGenerator, TrackingState& state);
 
-bool InitialiseContextFromRecording(const char* recordingFilename);
-bool InitialiseContextFromXmlConfig(const char* xmlConfigFilename);
-bool PreMainLoop();
-void PostMainLoop();
+// Add the time to tracking of users whose skeleton is tracked for the first time to
+// state.timeToTracking. Call after each update.
+void UpdateTimeToTracking(TrackingState& state);
 
 #endif // XNV_MAINLOOP_H___
@@ -0,0 +1,105 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// How quickly and reliably users are acquired and tracked
+//---------------------------------------------------------------------------
+#ifndef XNV_METRICS_H__
+#define XNV_METRICS_H__
+
+#include <iostream>
+#include <map>
+#include <vector>
+#include <stdint.h>
+
+#include "events.h"
+#include "joint.h"
+
+struct FrameSnapshot;
+
+// The life of one user from detection until they are lost. Times are generator timestamps in
+// milliseconds, or -1 if the event did not happen. Users already present when metrics start have
+// no detection time.
+struct UserLifecycle {
+	uint16_t user;
+	double   new_user_ms;
+	double   pose_detected_ms;
+	double   calibration_start_ms;    // most recent attempt
+	double   calibration_complete_ms; // calibration completed or loaded from the cache
+	double   tracking_ms;             // first frame in which the user's skeleton was tracked
+	double   lost_ms;
+	uint32_t calibration_failures;
+	uint8_t  cached;                  // non-zero if the calibration came from the cache
+	uint64_t frames;                  // frames in which the user was present
+	uint64_t tracked_frames;          // frames in which the user's skeleton was tracked
+
+	// tracking_ms - new_user_ms, or -1 if either is unknown
+	double TimeToTrackingMs() const;
+};
+
+// Create the HDF5 compound datatype matching UserLifecycle.
+H5::CompType MakeUserLifecycleDataType();
+
+// Accumulates a UserLifecycle for each user seen along with a histogram of the confidence of each
+// joint type in tracked frames. Feed it every frame in order with the events which happened up to
+// that frame.
+class TrackingMetrics
+{
+public:
+	// Confidences are binned into [0, 0.1), [0.1, 0.2), ..., [0.9, 1]
+	static const int n_confidence_bins = 10;
+
+	TrackingMetrics();
+
+	void AddEvents(const std::vector<UserEvent>& events);
+	void AddFrame(const FrameSnapshot& frame);
+
+	uint64_t Frames() const { return n_frames_; }
+
+	// Every user seen, in order of detection. Users who are detected again after being lost get a
+	// new entry.
+	const std::vector<UserLifecycle>& Users() const { return users_; }
+
+	// Number of times joint_id was seen in a tracked frame with a confidence in bin
+	uint64_t ConfidenceCount(int joint_id, int bin) const { return confidence_histogram_[joint_id-1][bin]; }
+
+	// Summary over all users
+	struct Summary {
+		uint32_t users;
+		uint32_t tracked_users;          // users whose skeleton was tracked at some point
+		uint32_t cached_users;           // of which using a cached calibration
+		double   mean_time_to_tracking_ms;    // -1 if no user was both detected and tracked
+		double   median_time_to_tracking_ms;
+		double   max_time_to_tracking_ms;
+		double   tracked_frame_ratio;    // tracked frames over present frames for all users
+	};
+	Summary Summarise() const;
+
+	// Print the summary to os
+	void Print(std::ostream& os) const;
+
+private:
+	uint64_t                    n_frames_;
+	std::vector<UserLifecycle>  users_;
+	std::map<uint16_t, size_t>  current_;  // index into users_ of the current life of each user
+	uint64_t                    confidence_histogram_[g_NumJointTypes][n_confidence_bins];
+
+	UserLifecycle& Current(uint16_t user);
+	UserLifecycle& Begin(uint16_t user);
+};
+
+#endif // XNV_METRICS_H__
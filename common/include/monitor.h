@@ -0,0 +1,60 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Command line tools which watch a live stream of frames
+//---------------------------------------------------------------------------
+#ifndef XNV_MONITOR_H__
+#define XNV_MONITOR_H__
+
+#include "optionparser.h"
+
+// Options taken by every monitor. A tool's own options are numbered from MONITOR_OPTIONS_END.
+enum MonitorOptionIndex { MONITOR_UNKNOWN, MONITOR_HELP, MONITOR_DURATION, MONITOR_VERBOSE,
+	MONITOR_SELF_TEST, MONITOR_OPTIONS_END, };
+
+// A source of frames watched by a tool such as skel-udprecv or skel-shmstat. The tool is given the
+// name of the source, e.g. a port, and reports on it once a second for --duration seconds or until
+// interrupted. With --self-test N it sends N frames to itself instead and checks them.
+class Monitor
+{
+public:
+	virtual ~Monitor() { }
+
+	// Start watching the source called name. options holds the tool's own options too. Returns
+	// false and prints an error on failure.
+	virtual bool Open(const char* name, const option::Option* options) = 0;
+
+	// Wait up to about 100 ms for frames and account for them, printing each if verbose.
+	virtual void Poll(bool verbose) = 0;
+
+	// Print statistics gathered over the last seconds and start afresh.
+	virtual void Report(double seconds) = 0;
+
+	// Send n_frames frames to ourselves and check them. Returns the exit status of the tool.
+	virtual int SelfTest(int n_frames) = 0;
+};
+
+// Parse the command line of a monitor and run it. Returns the exit status of the tool.
+//
+// usage gives the command line, e.g. "skel-udprecv [options] PORT", and source describes the name
+// it takes, e.g. "a port". extra_options describes the tool's own options and ends with a zero
+// record.
+int RunMonitor(int argc, char** argv, Monitor& monitor, const char* usage, const char* source,
+		const option::Descriptor* extra_options);
+
+#endif // XNV_MONITOR_H__
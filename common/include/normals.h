@@ -0,0 +1,41 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Surface normal estimation for user pixels
+//---------------------------------------------------------------------------
+#ifndef XNV_NORMALS_H__
+#define XNV_NORMALS_H__
+
+#include <vector>
+#include <stdint.h>
+
+// Normals are stored as signed bytes scaled by this factor
+const int g_NormalScale = 127;
+
+// Estimate surface normals for every user pixel of a rows x cols frame. This is the same
+// algorithm as examples/normalshade.py: each user's points are grown outwards by a few pixels,
+// smoothed with a Gaussian of unit standard deviation and the normal taken as the cross product of
+// the row and column gradients.
+//
+// points is an organised rows x cols x 3 array of real-world positions. labels gives the user of
+// each pixel (zero for none). On return normals is a rows x cols x 3 array of unit normals
+// scaled by g_NormalScale, zero for non-user pixels.
+void ComputeNormals(const float* points, const uint16_t* labels, int rows, int cols,
+		std::vector<int8_t>& normals);
+
+#endif // XNV_NORMALS_H__
@@ -0,0 +1,104 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Extrapolation of joint positions into the future
+//---------------------------------------------------------------------------
+#ifndef XNV_PREDICTION_H__
+#define XNV_PREDICTION_H__
+
+#include <deque>
+#include <map>
+#include <stdint.h>
+
+#include "joint.h"
+
+struct PredictionParams {
+	float horizon_ms;        // how far ahead to predict
+	bool  use_acceleration;  // constant acceleration rather than constant velocity model
+	float half_life_ms;      // confidence is halved for every half_life_ms of horizon
+
+	PredictionParams()
+		: horizon_ms(80.f), use_acceleration(false), half_life_ms(100.f)
+	{ }
+};
+
+// Predicts where each joint of each user will be horizon_ms after the current frame by
+// extrapolating its recent motion. Velocities and accelerations are finite differences of
+// consecutive frames. Every co-ordinate of every joint type is extrapolated together in one pass
+// over contiguous arrays.
+//
+// Each prediction is kept until a frame at or after the time it was made for arrives. It is then
+// compared with the real position, linearly interpolated between frames, and the error is added
+// to per-joint statistics. This allows the horizon and model to be tuned from recordings.
+class JointPredictor
+{
+public:
+	// Prediction error statistics for one joint type
+	struct JointError {
+		uint64_t count;
+		double   sum_mm, sum_sq_mm, max_mm;
+
+		double Mean() const;
+		double Rms() const;
+	};
+
+	explicit JointPredictor(const PredictionParams& params = PredictionParams());
+
+	const PredictionParams& Params() const { return params_; }
+
+	// Add the n joints of user at timestamp, in microseconds, and write their predicted positions
+	// at timestamp + horizon_ms to out.
+	void Predict(uint16_t user, uint64_t timestamp, const Joint* joints, int n, Joint* out);
+
+	// Forget the history of user, e.g. because the tracker has lost them.
+	void Reset(uint16_t user);
+
+	// Start error statistics afresh, e.g. for a new log. Users' histories are kept.
+	void ResetErrors();
+
+	// Error statistics indexed by joint id - 1
+	const JointError* Errors() const { return errors_; }
+
+	// Error statistics over all joints
+	JointError TotalError() const;
+
+private:
+	// A prediction waiting for the frames either side of its target time. Values here and in
+	// UserState are indexed as joint arrays, see ScatterJoints().
+	struct Pending {
+		uint64_t target;
+		float    value[g_JointArraySize];
+		float    valid[g_JointArraySize];
+	};
+
+	struct UserState {
+		uint64_t            timestamp;                 // of previous frame
+		float               value[g_JointArraySize];   // previous position
+		float               speed[g_JointArraySize];   // previous velocity
+		float               has_value[g_JointArraySize], has_speed[g_JointArraySize];
+		std::deque<Pending> pending;
+	};
+
+	void Score(UserState& state, uint64_t timestamp, const float* value, const float* present);
+
+	PredictionParams               params_;
+	std::map<uint16_t, UserState>  users_;
+	JointError                     errors_[g_NumJointTypes];
+};
+
+#endif // XNV_PREDICTION_H__
@@ -0,0 +1,171 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Random-access reading of logs written by DepthMapLogger
+//---------------------------------------------------------------------------
+#ifndef XNV_READER_H__
+#define XNV_READER_H__
+
+#include <condition_variable>
+#include <deque>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#include <hdf5.h>
+#include <H5Cpp.h>
+
+#include "joint.h"
+
+// A single frame of a log. Arrays are empty if not present in the log.
+struct LogFrame {
+	// A user present in the frame
+	struct User {
+		uint16_t           idx;
+		std::string        state;    // "tracking", "calibrating" or "looking"
+		std::vector<Joint> joints;   // empty unless tracked
+	};
+
+	size_t                idx;
+	uint32_t              frame_id;     // zero for logs which predate frame ids
+	uint64_t              timestamp;    // microseconds, zero if unknown
+	double                x_to_z;       // field of view as in FrameSnapshot, zero if unknown
+	double                y_to_z;
+	int                   rows, cols;
+	std::vector<uint16_t> depth;        // rows x cols
+	std::vector<uint16_t> label;        // rows x cols
+	std::vector<float>    points;       // n x 3 real-world positions of non-zero depth pixels
+	std::vector<uint16_t> point_labels; // n
+	std::vector<User>     users;
+};
+
+typedef std::shared_ptr<const LogFrame> LogFramePtr;
+
+// Reads frames from a log by index. Decoded frames are kept in an LRU cache and, when frames are
+// read in order, the following frames are read ahead of time on a background thread so that
+// sequential scans are limited by the disk rather than by decoding.
+//
+// A FrameReader may be used from several threads at once. Access to the HDF5 library is
+// serialised internally.
+class FrameReader
+{
+public:
+	struct Options {
+		std::string frames_path;        // group holding frame_N groups
+		size_t      cache_frames;       // number of decoded frames to keep
+		size_t      prefetch_frames;    // number of frames to read ahead, zero to disable
+		size_t      chunk_cache_bytes;  // HDF5 raw data chunk cache size per dataset
+
+		Options()
+			: frames_path("/frames"), cache_frames(64), prefetch_frames(8)
+			, chunk_cache_bytes(16 << 20)
+		{ }
+	};
+
+	// Iterates over a range of frames in order
+	class iterator
+	{
+		FrameReader* p_reader_;
+		size_t       idx_;
+	public:
+		typedef std::input_iterator_tag iterator_category;
+		typedef LogFramePtr             value_type;
+		typedef ptrdiff_t               difference_type;
+		typedef const LogFramePtr*      pointer;
+		typedef LogFramePtr             reference;
+
+		iterator(FrameReader* p_reader, size_t idx) : p_reader_(p_reader), idx_(idx) { }
+		LogFramePtr operator * () const { return p_reader_->frame(idx_); }
+		iterator& operator ++ () { ++idx_; return *this; }
+		bool operator == (const iterator& other) const { return idx_ == other.idx_; }
+		bool operator != (const iterator& other) const { return idx_ != other.idx_; }
+		size_t index() const { return idx_; }
+	};
+
+	// A half-open range of frame indices
+	class Range
+	{
+		FrameReader* p_reader_;
+		size_t       begin_, end_;
+	public:
+		Range(FrameReader* p_reader, size_t begin, size_t end)
+			: p_reader_(p_reader), begin_(begin), end_(end) { }
+		iterator begin() const { return iterator(p_reader_, begin_); }
+		iterator end() const { return iterator(p_reader_, end_); }
+		size_t size() const { return end_ - begin_; }
+	};
+
+	FrameReader();
+	~FrameReader();
+
+	// Open a log. Throws H5::Exception if the log cannot be read.
+	void Open(const char* filename, const Options& options = Options());
+	void Close();
+
+	// Number of frames in the log
+	size_t size() const { return frame_names_.size(); }
+
+	// Return frame i, reading it if it is not cached. Throws std::out_of_range if i is not less
+	// than size() and H5::Exception on read errors.
+	LogFramePtr frame(size_t i);
+
+	// Frames [begin, end). The end is clamped to size().
+	Range range(size_t begin, size_t end);
+	Range all() { return range(0, size()); }
+
+protected:
+	Options                   options_;
+	H5::H5File               *p_file_;
+	H5::Group                *p_frames_group_;
+	H5::CompType              joint_dt_;
+	std::vector<std::string>  frame_names_;
+
+	// Guards all use of the HDF5 library
+	std::mutex                h5_mutex_;
+
+	// LRU cache of decoded frames, most recently used at the front, and frames being read
+	std::mutex                cache_mutex_;
+	std::condition_variable   frame_loaded_;
+	std::list<size_t>         lru_;
+	std::map<size_t, std::pair<LogFramePtr, std::list<size_t>::iterator> > cache_;
+	std::set<size_t>          loading_;
+	size_t                    last_requested_;
+
+	// Background read-ahead
+	std::thread               prefetch_thread_;
+	std::condition_variable   prefetch_wanted_;
+	std::deque<size_t>        prefetch_queue_;
+	bool                      stopping_;
+
+	LogFramePtr Read(size_t i);
+	void Insert(size_t i, const LogFramePtr& frame);
+	void Prefetch();
+
+	// Not copyable
+	FrameReader(const FrameReader&);
+	FrameReader& operator = (const FrameReader&);
+};
+
+#endif // XNV_READER_H__
@@ -0,0 +1,167 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// An OpenNI context with its generators and tracking callbacks
+//---------------------------------------------------------------------------
+#ifndef XNV_SESSION_H__
+#define XNV_SESSION_H__
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <XnOpenNI.h>
+#include <XnCppWrapper.h>
+
+#include "calibcache.h"
+#include "events.h"
+#include "mainloop.h"
+#include "reader.h"
+
+// How the depth frames returned by Session::Update() followed on from one another
+struct FrameSequence {
+	XnUInt64 nFrames;
+	XnUInt32 nFirstFrameID;
+	XnUInt32 nLastFrameID;
+	XnUInt64 nSkipped;   // frame ids jumped over
+	XnUInt64 nRepeated;  // frames whose id did not come after the one before
+};
+
+// Number of failed calls to Session::Update() in a row after which a main loop gives up
+const int g_MaxUpdateFailures = 30;
+
+// Everything needed to track users from one sensor or recording. Each Session has a context,
+// generators and tracking callbacks of its own; the callbacks find their Session's state through
+// their cookie. Several Sessions may therefore be tracking at once from separate threads.
+class Session
+{
+protected:
+	xn::Context        context_;
+	xn::ScriptNode     script_node_;
+	xn::Player         player_;
+	xn::DepthGenerator depth_generator_;
+	xn::UserGenerator  user_generator_;
+	xn::ImageGenerator image_generator_;
+	TrackingState      tracking_;
+	std::unique_ptr<CalibrationCache> calibration_cache_;
+	UserEventRing      events_;
+
+	// When replaying a log, its frames are pushed through a mock depth generator
+	std::unique_ptr<FrameReader> log_reader_;
+	xn::MockDepthGenerator log_depth_;
+	LogFramePtr        log_frame_;
+	size_t             log_next_;
+	bool               log_repeat_;
+	bool               log_real_time_;
+	bool               log_clock_started_;
+	std::chrono::steady_clock::time_point log_clock_start_;
+	uint64_t           log_timestamp_start_;
+
+	xn::DepthMetaData  depth_md_;
+	xn::SceneMetaData  scene_md_;
+
+	bool               is_open_;
+	bool               eof_;
+	bool               deterministic_;
+	FrameSequence      sequence_;
+
+	// Find or create generators and start them generating
+	bool Start(bool use_image);
+
+	// Give the next frame of the log being replayed to the mock depth generator
+	bool PushLogFrame();
+
+	void ResetFrameSequence();
+	void CheckFrameSequence(XnUInt32 nFrameID);
+
+	// Not copyable
+	Session(const Session&);
+	Session& operator = (const Session&);
+public:
+	Session();
+	~Session();
+
+	// Open a recording and start tracking. Recordings loop unless SetRepeat(false) is called. If
+	// use_image is true, the recording must have a colour stream.
+	bool OpenRecording(const char* recordingFilename, bool use_image = false);
+
+	// Open the sensors described by an OpenNI XML config and start tracking. If use_image is true,
+	// the colour stream is also started and the depth map registered to it.
+	bool OpenXmlConfig(const char* xmlConfigFilename, bool use_image = false);
+
+	// Open a log written by DepthMapLogger and track users again in its depth maps, which are fed
+	// to NITE through a mock depth generator. Frames keep the ids and timestamps they were logged
+	// with. If real_time is true, Update() paces frames by their timestamps; otherwise frames are
+	// tracked as fast as possible. Logs loop unless SetRepeat(false) is called.
+	bool OpenLog(const char* logFilename, bool real_time = true);
+
+	void Close();
+	bool IsOpen() const { return is_open_; }
+
+	// For recordings and logs, whether to go back to the start after the last frame
+	void SetRepeat(bool repeat);
+
+	// For recordings and logs, continue from the first frame whose id is at least frameId
+	bool SeekToFrame(XnUInt32 frameId);
+
+	// For recordings and logs, step through frames one at a time as fast as they can be tracked
+	// rather than pacing them by wall-clock time, so that every run tracks the same frames.
+	// Call after opening.
+	void SetDeterministic(bool deterministic);
+
+	// Which frames Update() has returned since opening. Frame ids going back to the first after
+	// a recording or log repeats, or jumping after SeekToFrame(), are not counted as out of order.
+	const FrameSequence& GetFrameSequence() const { return sequence_; }
+
+	// Call handler with pCookie whenever this session loses a user. Pass NULL to remove it.
+	void SetLostUserHandler(UserEventHandler handler, void* pCookie);
+
+	// Reuse calibrations saved in directory for users who have been seen before, saving new ones
+	// there. May be called before or after opening. Returns false if directory cannot be used.
+	bool EnableCalibrationCache(const std::string& directory,
+			const CalibrationCacheParams& params = CalibrationCacheParams());
+	const CalibrationCache* GetCalibrationCache() const { return calibration_cache_.get(); }
+
+	// How long users have taken to be tracked since detection
+	const TimeToTracking& GetTimeToTracking() const { return tracking_.timeToTracking; }
+
+	// Append the user events reported by the tracking callbacks since the last call to events.
+	// The callbacks run on the thread calling Update(); this may be called from one other thread.
+	void TakeUserEvents(std::vector<UserEvent>& events);
+
+	// Events lost because TakeUserEvents() was not called often enough
+	uint64_t DroppedUserEvents() const { return events_.Dropped(); }
+
+	// Wait for the next frame and fetch its depth and label maps. Returns false at the end of a
+	// recording which does not repeat, or on error. Errors are printed.
+	bool Update();
+
+	// True once Update() has reached the end of a recording
+	bool IsEOF() const { return eof_; }
+
+	const xn::DepthMetaData& GetDepthMetaData() const { return depth_md_; }
+	const xn::SceneMetaData& GetSceneMetaData() const { return scene_md_; }
+	xn::Context& GetContext() { return context_; }
+	xn::Player& GetPlayer() { return player_; }
+	xn::DepthGenerator& GetDepthGenerator() { return depth_generator_; }
+	xn::UserGenerator& GetUserGenerator() { return user_generator_; }
+	xn::ImageGenerator& GetImageGenerator() { return image_generator_; }
+};
+
+#endif // XNV_SESSION_H__
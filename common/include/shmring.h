@@ -0,0 +1,150 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Publishing frames to other processes through shared memory
+//---------------------------------------------------------------------------
+#ifndef XNV_SHMRING_H__
+#define XNV_SHMRING_H__
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "joint.h"
+
+// Frames are published into a ring of slots in a POSIX shared memory object. There is one writer
+// and any number of readers, which never block or signal the writer. Each slot is protected by
+// a sequence lock: its sequence number is odd while the writer is filling it and becomes
+// 2 * (n + 1) once frame n is complete. A reader checks the sequence number before and after
+// using a slot; if it changed the slot was overwritten and the data must be discarded.
+//
+// The layout of the shared memory object is an ShmRingHeader followed by n_slots slots of
+// slot_size bytes. Each slot is an ShmFrame followed by max_rows x max_cols uint16 depth values
+// and the same number of uint16 labels.
+
+const uint32_t g_ShmRingMagic = 0x534b4652; // "SKFR"
+const uint32_t g_ShmRingVersion = 1;
+const int g_ShmRingMaxUsers = 15;
+
+// Size of the slots created by logskel: a VGA depth map
+const int g_ShmRingMaxRows = 480;
+const int g_ShmRingMaxCols = 640;
+
+struct ShmRingHeader {
+	uint32_t              magic, version;
+	uint32_t              n_slots;
+	uint32_t              max_rows, max_cols;
+	uint64_t              slot_size;
+	std::atomic<uint64_t> published;  // number of frames published so far
+};
+
+struct ShmFrame {
+	std::atomic<uint64_t> sequence;
+	uint64_t              number;     // index of this frame in the order published
+	uint32_t              frame_id;
+	uint64_t              timestamp;  // microseconds
+	int32_t               rows, cols;
+	int32_t               n_users;
+	TrackedUser           users[g_ShmRingMaxUsers];
+};
+
+// A frame in the ring. The pointers point directly into shared memory and may be overwritten by
+// the writer at any time. Check ShmRingReader::IsValid() after using them.
+struct ShmFrameView {
+	uint64_t           sequence;   // expected sequence number of the slot
+	const ShmFrame*    frame;
+	const uint16_t*    depth;      // frame->rows x frame->cols
+	const uint16_t*    label;
+};
+
+// Publishes frames to a new shared memory object. The object is removed by Close().
+class ShmRingWriter
+{
+public:
+	ShmRingWriter();
+	~ShmRingWriter();
+
+	// Create the shared memory object called name, e.g. "/logskel", with room for n_slots frames
+	// of at most max_rows x max_cols pixels. Returns false and prints an error on failure.
+	bool Open(const std::string& name, int n_slots, int max_rows, int max_cols);
+	void Close();
+	bool IsOpen() const { return p_header_ != NULL; }
+
+	// Publish a frame. Frames larger than the maximum size or with more than g_ShmRingMaxUsers
+	// users are truncated.
+	void Publish(uint32_t frame_id, uint64_t timestamp, int rows, int cols,
+			const uint16_t* depth, const uint16_t* label, const std::vector<TrackedUser>& users);
+
+private:
+	std::string      name_;
+	ShmRingHeader*   p_header_;
+	size_t           size_;
+
+	ShmRingWriter(const ShmRingWriter&);
+	ShmRingWriter& operator = (const ShmRingWriter&);
+};
+
+// Reads frames published by an ShmRingWriter. The shared memory is mapped read-only.
+class ShmRingReader
+{
+public:
+	ShmRingReader();
+	~ShmRingReader();
+
+	// Attach to the shared memory object called name. Returns false and prints an error if it does
+	// not exist or was not created by ShmRingWriter.
+	bool Open(const std::string& name);
+	void Close();
+
+	// Number of frames published so far
+	uint64_t Published() const;
+
+	// Get frame number n. Returns false if it has not been published yet, is being written or has
+	// been overwritten.
+	bool Get(uint64_t n, ShmFrameView& view) const;
+
+	// Get the most recently published frame.
+	bool Latest(ShmFrameView& view) const;
+
+	// Get the frame after the one last returned by Next(), starting with the oldest frame still
+	// in the ring. Frames overwritten before we got to them are skipped and counted as overruns.
+	// Returns false if there is no new frame.
+	bool Next(ShmFrameView& view);
+
+	// True if the data in view has not been overwritten since it was returned.
+	bool IsValid(const ShmFrameView& view) const;
+
+	// Frames skipped by Next() because the writer overtook us
+	uint64_t Overruns() const { return n_overruns_; }
+
+private:
+	const ShmRingHeader*  p_header_;
+	size_t                size_;
+	bool                  started_;
+	uint64_t              next_;
+	uint64_t              n_overruns_;
+
+	const ShmFrame* Slot(uint64_t n) const;
+
+	ShmRingReader(const ShmRingReader&);
+	ShmRingReader& operator = (const ShmRingReader&);
+};
+
+#endif // XNV_SHMRING_H__
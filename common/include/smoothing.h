@@ -0,0 +1,78 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Smoothing of joint positions over time
+//---------------------------------------------------------------------------
+#ifndef XNV_SMOOTHING_H__
+#define XNV_SMOOTHING_H__
+
+#include <map>
+#include <stdint.h>
+
+#include "joint.h"
+
+// Parameters of a One Euro filter (Casiez et al., CHI 2012). The cut-off frequency of a
+// first-order low-pass filter rises with the speed of the joint so that slow movements are
+// smoothed heavily while fast ones are followed with little lag. Positions are in millimetres
+// (x, y, z and w) or pixels (u and v) so speeds are per second in those units.
+struct OneEuroParams {
+	float min_cutoff;   // cut-off in Hz when stationary
+	float beta;         // increase in cut-off per unit of speed
+	float d_cutoff;     // cut-off in Hz for the speed estimate
+
+	OneEuroParams()
+		: min_cutoff(1.f), beta(0.01f), d_cutoff(1.f)
+	{ }
+};
+
+// Applies a One Euro filter to each co-ordinate of each joint of each user. State is kept per
+// user between frames. Every co-ordinate of every joint type is filtered together in one pass
+// over contiguous arrays.
+//
+// A joint is passed through unfiltered the first time it is seen and whenever it reappears after
+// being missing from a frame.
+class JointSmoother
+{
+public:
+	explicit JointSmoother(const OneEuroParams& params = OneEuroParams());
+
+	// Filter the n joints of user at timestamp, in microseconds, writing the smoothed joints to
+	// out. If lag_ms is non-NULL it receives the current delay of the filter in milliseconds for
+	// each joint, which is zero for joints passed through unfiltered.
+	void Filter(uint16_t user, uint64_t timestamp, const Joint* joints, int n,
+			Joint* out, float* lag_ms = NULL);
+
+	// Forget the state of user, e.g. because the tracker has lost them.
+	void Reset(uint16_t user);
+
+	void ResetAll();
+
+private:
+	// Indexed as joint arrays, see ScatterJoints()
+	struct UserState {
+		uint64_t timestamp;                 // of previous frame
+		float    value[g_JointArraySize];   // previous filtered value
+		float    speed[g_JointArraySize];   // previous filtered speed
+		float    valid[g_JointArraySize];   // 1 if value and speed hold state, 0 otherwise
+	};
+
+	OneEuroParams                 params_;
+	std::map<uint16_t, UserState> users_;
+};
+
+#endif // XNV_SMOOTHING_H__
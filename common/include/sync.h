@@ -0,0 +1,86 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Logging of several simultaneous recordings to a single log
+//---------------------------------------------------------------------------
+#ifndef XNV_SYNC_H__
+#define XNV_SYNC_H__
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <hdf5.h>
+#include <H5Cpp.h>
+
+#include "io.h"
+#include "session.h"
+
+// Each recording is tracked on its own thread and logged to
+// /sensors/sensor_NN/frames. Once every recording has finished, frames are
+// aligned by timestamp and the alignment written to /sync:
+//
+//   /sync/frame_idx   N x S int64 array of frame indices, -1 if no frame of
+//                     sensor S is within the tolerance of sync row N.
+//   /sync/timestamp   N x S uint64 array of the matched frames' timestamps.
+//
+// Timestamps are measured in microseconds from each recording's first frame.
+// Rows are driven by the first recording's frames.
+class SynchronisedLogger
+{
+protected:
+	struct Stream {
+		std::string           recording;
+		Session               session;
+		DepthMapLogger        logger;
+		FrameSnapshot         frame;
+		std::vector<uint64_t> timestamps;
+	};
+
+	std::vector<Stream*>      streams_;
+	std::vector<std::thread>  threads_;
+	std::mutex                write_mutex_;   // serialises all HDF5 access
+	std::atomic<bool>         stop_;
+	std::atomic<int>          n_running_;
+
+	H5::H5File               *p_h5_file_;
+	uint64_t                  tolerance_us_;
+
+	void Track(Stream& stream);
+	void WriteSyncTable();
+public:
+	SynchronisedLogger();
+	~SynchronisedLogger();
+
+	// Open each recording in its own context
+	bool Open(const std::vector<std::string>& recordings);
+
+	// Start tracking and logging every recording to h5_filename. Frames of other sensors are
+	// matched to the first sensor's frames if their timestamps differ by at most tolerance_ms.
+	bool Start(const char* h5_filename, double tolerance_ms);
+
+	// True while at least one recording is still being logged
+	bool IsRunning() const { return n_running_ > 0; }
+
+	// Stop logging, write the sync table and close the log
+	void Stop();
+};
+
+#endif // XNV_SYNC_H__
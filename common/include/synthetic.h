@@ -0,0 +1,89 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Synthetic scenes of walking figures for testing without a sensor
+//---------------------------------------------------------------------------
+#ifndef XNV_SYNTHETIC_H__
+#define XNV_SYNTHETIC_H__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "framesink.h"
+#include "joint.h"
+
+struct SyntheticParams {
+	int      n_users;     // at most 15
+	int      rows, cols;
+	double   fps;         // sets the frame timestamps; frames are rendered as fast as they are asked for
+	float    noise_mm;    // standard deviation of Gaussian noise added to depth
+	float    speed;       // walking speed relative to a normal pace; zero to stand still
+	uint32_t seed;        // varies the figures' starting positions and the noise
+	uint64_t n_frames;    // length of the scene; zero for no end
+	uint64_t enter_frame; // frame in which the figures appear; the scene is empty before it
+
+	SyntheticParams()
+		: n_users(1), rows(240), cols(320), fps(30.), noise_mm(0.f), speed(1.f), seed(1), n_frames(0)
+		, enter_frame(0)
+	{ }
+};
+
+// Parse a specification of comma separated KEY=VALUE pairs, e.g. "users=4,size=640x480,fps=60".
+// Keys are users, size, fps, noise, speed, seed, frames and enter. Keys not given keep their value in
+// params. Returns false and prints an error if spec is invalid.
+bool ParseSyntheticParams(const std::string& spec, SyntheticParams& params);
+
+// Renders people, each an articulated figure of capsules, walking in circles in front of a wall
+// with a floor. The sensor is 1m above the floor with the field of view of the mock depth
+// generator. Every frame is a function of the parameters and frame number only, so scenes are
+// reproducible and frames may be rendered in any order.
+//
+// Frames are complete FrameSnapshots: depth, labels and, in place of tracked joints, the true
+// position of each figure's joints. Every figure is tracked from the first frame rendered at or
+// after enter_frame, which has a "new" event for each.
+class SyntheticScene
+{
+public:
+	explicit SyntheticScene(const SyntheticParams& params = SyntheticParams());
+
+	const SyntheticParams& Params() const { return params_; }
+
+	// Render frame number n, which has frame id n + 1, into frame. Its number field is not set.
+	void Render(uint64_t n, FrameSnapshot& frame);
+
+private:
+	// A segment of a figure's body with rounded ends
+	struct Capsule {
+		float a[3], b[3];  // end points, real-world millimetres
+		float radius;
+		uint16_t user;
+	};
+
+	SyntheticParams       params_;
+	double                x_to_z_, y_to_z_;
+	bool                  started_;
+	uint64_t              first_frame_;
+	std::vector<Capsule>  capsules_;
+
+	// Set the joints of user at time t seconds and add their capsules
+	void PoseFigure(int user, double t, TrackedUser& joints);
+	void DrawCapsule(const Capsule& capsule, FrameSnapshot& frame) const;
+};
+
+#endif // XNV_SYNTHETIC_H__
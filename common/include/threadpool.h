@@ -0,0 +1,66 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// A fixed-size pool of worker threads
+//---------------------------------------------------------------------------
+#ifndef XNV_THREADPOOL_H__
+#define XNV_THREADPOOL_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+protected:
+	std::vector<std::thread>          workers_;
+	std::deque<std::function<void()> > tasks_;
+	mutable std::mutex                mutex_;
+	std::condition_variable           task_ready_;
+	std::condition_variable           task_done_;
+	size_t                            n_active_;
+	bool                              stopping_;
+
+	void Work();
+
+	// Not copyable
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator = (const ThreadPool&);
+public:
+	// Start n_threads workers. Zero means one per hardware thread.
+	explicit ThreadPool(size_t n_threads = 0);
+
+	// Completes all submitted tasks before returning.
+	~ThreadPool();
+
+	// Queue task to be run on one of the workers.
+	void Submit(const std::function<void()>& task);
+
+	// Block until every submitted task has completed.
+	void Wait();
+
+	// Number of tasks queued or running.
+	size_t Pending() const;
+
+	size_t Size() const { return workers_.size(); }
+};
+
+#endif // XNV_THREADPOOL_H__
@@ -0,0 +1,102 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Passing frames on to a sink only while users are around
+//---------------------------------------------------------------------------
+#ifndef XNV_TRIGGER_H__
+#define XNV_TRIGGER_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "framesink.h"
+
+// What has to be in a frame for it to be passed on
+enum TriggerCondition {
+	TRIGGER_USER_PRESENT,  // a user has been detected
+	TRIGGER_TRACKING,      // a user's skeleton is being tracked
+};
+
+struct TriggerParams {
+	TriggerCondition condition;
+	double           pre_trigger_seconds;  // how far back frames are kept in case of a trigger
+	double           hold_off_seconds;     // how long frames are passed on after the condition ends
+
+	TriggerParams()
+		: condition(TRIGGER_USER_PRESENT), pre_trigger_seconds(5.), hold_off_seconds(5.)
+	{ }
+};
+
+// Parse "user-present" or "tracking". Returns false and prints an error otherwise.
+bool ParseTriggerCondition(const std::string& name, TriggerCondition& condition);
+
+// Passes frames on to another sink only around the times a condition holds. Frames are held in a
+// ring covering the last pre_trigger_seconds, by frame timestamp. When a frame meets the
+// condition, the frames in the ring are passed on first so that the lead-up is not lost. Frames
+// are then passed on as they come until hold_off_seconds after the last one to meet the
+// condition, e.g. after the last user was lost. Frames which never come near a trigger are
+// discarded, but their lost users and events are passed on with the next frame which is. Those of
+// frames still held when the sink finishes are lost with them.
+//
+// The ring's snapshots are allocated up front and held frames are copied into them, so frames go
+// back to the FrameDispatcher's pool as soon as they are consumed. The ring's buffers grow to the
+// size of a frame the first time each slot is used and are reused after that.
+class TriggeredSink : public FrameSink
+{
+public:
+	TriggeredSink(FrameSink& sink, const TriggerParams& params = TriggerParams());
+
+	const char* Name() const { return sink_.Name(); }
+	void Consume(const FrameRef& frame);
+
+	// Discards any frames still held, then finishes the sink
+	void Finish();
+
+	// Counts for the frames consumed so far. Only to be read after the sink has finished.
+	uint64_t Triggers() const { return n_triggers_; }
+	uint64_t FramesPassed() const { return n_passed_; }
+	uint64_t FramesDiscarded() const { return n_discarded_; }
+
+protected:
+	FrameSink&            sink_;
+	TriggerParams         params_;
+
+	// Frames held before a trigger, oldest at ring_start_
+	std::vector<std::shared_ptr<FrameSnapshot> > ring_;
+	size_t                ring_start_, ring_count_;
+
+	// Lost users and events of discarded frames, to go with the next frame passed on or held
+	std::vector<uint16_t>  lost_users_;
+	std::vector<UserEvent> user_events_;
+	std::shared_ptr<FrameSnapshot> p_spare_;  // for passing on a frame with those added
+
+	bool                  triggered_;
+	uint64_t              last_met_timestamp_;  // of the last frame meeting the condition
+
+	uint64_t              n_triggers_, n_passed_, n_discarded_;
+
+	bool ConditionMet(const FrameSnapshot& frame) const;
+	void Hold(const FrameRef& frame);
+	void Discard(const FrameSnapshot& frame);
+	void PassOn(const FrameRef& frame);
+	void PassOnHeld();
+};
+
+#endif // XNV_TRIGGER_H__
@@ -0,0 +1,163 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Sending and receiving skeletons as compact UDP packets
+//---------------------------------------------------------------------------
+#ifndef XNV_UDP_H__
+#define XNV_UDP_H__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "joint.h"
+#include "wallclock.h" // send_time is WallClockMicroseconds()
+
+// Each frame is sent as a single datagram. All fields are in network byte order.
+//
+//   header (32 bytes)
+//     uint32  magic          g_SkelPacketMagic
+//     uint8   version        g_SkelPacketVersion
+//     uint8   n_users
+//     uint16  reserved
+//     uint32  sequence       incremented for every packet sent
+//     uint32  frame_id       depth frame id
+//     uint64  timestamp      depth timestamp in microseconds
+//     uint64  send_time      sender's wall clock time in microseconds since the epoch
+//
+//   n_users x user (174 bytes)
+//     uint16  user           user id
+//     uint32  joint_mask     bit (id - 1) is set if joint id is present
+//     24 x joint, in order of joint id
+//       int16 x, y, z        real-world position in millimetres
+//       uint8 confidence     confidence scaled to 0-255
+//
+// Joints which are not present are sent as zeros. Projective co-ordinates are not sent.
+const uint32_t g_SkelPacketMagic = 0x534b454c; // "SKEL"
+const uint8_t g_SkelPacketVersion = 1;
+const int g_SkelPacketHeaderSize = 32;
+const int g_SkelPacketUserSize = 2 + 4 + g_NumJointTypes * 7;
+const int g_SkelPacketMaxUsers = 15;
+const int g_SkelPacketMaxSize = g_SkelPacketHeaderSize + g_SkelPacketMaxUsers * g_SkelPacketUserSize;
+
+// A decoded packet
+struct SkeletonPacket {
+	struct User {
+		uint16_t idx;
+		int      n_joints;
+		Joint    joints[g_NumJointTypes];  // only the first n_joints are valid
+	};
+
+	uint32_t sequence;
+	uint32_t frame_id;
+	uint64_t timestamp;
+	uint64_t send_time;
+	int      n_users;
+	User     users[g_SkelPacketMaxUsers];
+};
+
+// Sends one packet per frame to any number of destinations. The packet is built in place in a
+// buffer allocated by Open() and sent to every destination with a single sendmmsg() call.
+class UdpSkeletonSender
+{
+public:
+	UdpSkeletonSender();
+	~UdpSkeletonSender();
+
+	// Open a socket for sending to each "host:port" destination. Broadcast addresses are allowed.
+	// Returns false and prints an error on failure.
+	bool Open(const std::vector<std::string>& destinations);
+	void Close();
+	bool IsOpen() const { return socket_ >= 0; }
+
+	// Start a new packet. Users beyond g_SkelPacketMaxUsers are ignored.
+	void BeginFrame(uint32_t frame_id, uint64_t timestamp);
+	void AddUser(uint16_t user, const Joint* joints, int n);
+
+	// Send the packet. Returns false if it could not be sent to every destination.
+	bool Send();
+
+	uint64_t PacketsSent() const { return n_sent_; }
+	uint64_t SendErrors() const { return n_errors_; }
+
+private:
+	int                          socket_;
+	std::vector<sockaddr_in>     addresses_;
+	std::vector<struct mmsghdr>  messages_;
+	struct iovec                 iov_;
+	std::vector<uint8_t>         buffer_;
+	size_t                       size_;      // of packet being built
+	int                          n_users_;   // in packet being built
+	uint32_t                     sequence_;
+	uint64_t                     n_sent_, n_errors_;
+
+	UdpSkeletonSender(const UdpSkeletonSender&);
+	UdpSkeletonSender& operator = (const UdpSkeletonSender&);
+};
+
+// Receives packets sent by UdpSkeletonSender and keeps count of lost packets and latency.
+// Latency is measured from the sender's wall clock so is only meaningful if the clocks of the
+// two hosts agree, e.g. over loopback or with NTP.
+class UdpSkeletonReceiver
+{
+public:
+	struct Stats {
+		uint64_t received;      // valid packets
+		uint64_t invalid;       // datagrams which were not valid packets
+		uint64_t lost;          // gaps in the sequence
+		uint64_t out_of_order;  // packets arriving after a later one
+		double   latency_sum_ms, latency_max_ms;
+
+		double MeanLatencyMs() const { return (received > 0) ? latency_sum_ms / received : 0.; }
+	};
+
+	UdpSkeletonReceiver();
+	~UdpSkeletonReceiver();
+
+	// Listen on port of the address bind_host, or all addresses if bind_host is empty. A port of
+	// zero picks any free port.
+	bool Open(const std::string& bind_host, int port);
+	void Close();
+
+	// The port being listened on
+	int Port() const;
+
+	// Wait up to timeout_ms milliseconds for a packet. Returns false on time out or error.
+	bool Receive(SkeletonPacket& packet, int timeout_ms);
+
+	const Stats& GetStats() const { return stats_; }
+	void ResetStats();
+
+private:
+	int                  socket_;
+	std::vector<uint8_t> buffer_;
+	bool                 have_sequence_;
+	uint32_t             next_sequence_;
+	Stats                stats_;
+
+	UdpSkeletonReceiver(const UdpSkeletonReceiver&);
+	UdpSkeletonReceiver& operator = (const UdpSkeletonReceiver&);
+};
+
+// Decode size bytes of data into packet. Returns false if they are not a valid packet.
+bool DecodeSkeletonPacket(const uint8_t* data, size_t size, SkeletonPacket& packet);
+
+#endif // XNV_UDP_H__
@@ -0,0 +1,34 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Wall clock and elapsed time
+//---------------------------------------------------------------------------
+#ifndef XNV_WALLCLOCK_H__
+#define XNV_WALLCLOCK_H__
+
+#include <stdint.h>
+
+// Wall clock time in microseconds since the epoch. Unlike tracker timestamps this may be compared
+// between processes and machines.
+uint64_t WallClockMicroseconds();
+
+// Seconds since an arbitrary point. This clock never jumps, so use it for measuring how long
+// something took.
+double MonotonicSeconds();
+
+#endif // XNV_WALLCLOCK_H__
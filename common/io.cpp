@@ -19,23 +19,20 @@
 // Support for saving frames to disk
 //---------------------------------------------------------------------------
 
+#include <cmath>
+#include <cstring>
+#include <string>
+
 #include "io.h"
+#include "jpeg.h"
+#include "normals.h"
+#include "threadpool.h"
 
 using namespace H5;
 
-extern xn::UserGenerator g_UserGenerator;
-extern xn::DepthGenerator g_DepthGenerator;
-
-// A structure describing a joint
-struct Joint {
-	int id;
-	float confidence;
-	float x, y, z; // real-world
-	float u, v, w; // projective
-};
-
 // Dump joint data to output
-bool DumpJoint(XnUserID player, XnSkeletonJoint eJoint, Joint& out_joint);
+bool DumpJoint(xn::DepthGenerator& depthGenerator, xn::UserGenerator& userGenerator,
+		XnUserID player, XnSkeletonJoint eJoint, Joint& out_joint);
 
 // Convert joint id to a human-friendly string
 const char* NameJoint(XnSkeletonJoint joint);
@@ -49,27 +46,100 @@ const XnSkeletonJoint g_JointTypes[] = {
 	XN_SKEL_LEFT_HIP, XN_SKEL_LEFT_KNEE, XN_SKEL_LEFT_ANKLE, XN_SKEL_LEFT_FOOT,
 	XN_SKEL_RIGHT_HIP, XN_SKEL_RIGHT_KNEE, XN_SKEL_RIGHT_ANKLE, XN_SKEL_RIGHT_FOOT
 };
-const int g_NumJointTypes = 24;
+
+// A row of the "events" table: a user event and the index of the frame it was logged with
+struct LoggedEvent {
+	uint64_t  frame_idx;
+	UserEvent event;
+};
+
+static CompType MakeLoggedEventDataType()
+{
+	CompType event_dt(MakeUserEventDataType());
+	CompType dt(sizeof(LoggedEvent));
+	dt.insertMember(H5std_string("frame_idx"), HOFFSET(LoggedEvent, frame_idx), PredType::NATIVE_UINT64);
+	for (int i = 0; i < event_dt.getNmembers(); ++i)
+	{
+		dt.insertMember(event_dt.getMemberName(i), HOFFSET(LoggedEvent, event) + event_dt.getMemberOffset(i),
+				event_dt.getMemberDataType(i));
+	}
+	return dt;
+}
 
 DepthMapLogger::DepthMapLogger()
-	: p_h5_file_(NULL), p_frames_group_(NULL)
-	, joint_dt_(sizeof(Joint))
+	: p_h5_file_(NULL), p_parent_group_(NULL), p_frames_group_(NULL)
+	, p_events_ds_(NULL), event_dt_(MakeLoggedEventDataType()), n_events_(0)
+	, joint_dt_(MakeJointDataType())
+	, log_normals_(false), p_smoother_(NULL), p_predictor_(NULL)
+	, p_change_detector_(NULL), reference_frame_idx_(0), n_unchanged_frames_(0)
+	, p_image_pool_(NULL), jpeg_quality_(90), n_dropped_images_(0)
 {
-	// Create memory datatype for joints
-	joint_dt_.insertMember(H5std_string("id"), HOFFSET(Joint, id), PredType::NATIVE_INT);
-	joint_dt_.insertMember(H5std_string("confidence"), HOFFSET(Joint, confidence),
-			PredType::NATIVE_FLOAT);
-	joint_dt_.insertMember(H5std_string("x"), HOFFSET(Joint, x), PredType::NATIVE_FLOAT);
-	joint_dt_.insertMember(H5std_string("y"), HOFFSET(Joint, y), PredType::NATIVE_FLOAT);
-	joint_dt_.insertMember(H5std_string("z"), HOFFSET(Joint, z), PredType::NATIVE_FLOAT);
-	joint_dt_.insertMember(H5std_string("u"), HOFFSET(Joint, u), PredType::NATIVE_FLOAT);
-	joint_dt_.insertMember(H5std_string("v"), HOFFSET(Joint, v), PredType::NATIVE_FLOAT);
-	joint_dt_.insertMember(H5std_string("w"), HOFFSET(Joint, w), PredType::NATIVE_FLOAT);
 }
 
 DepthMapLogger::~DepthMapLogger()
 {
 	Close();
+
+	delete p_smoother_;
+	delete p_predictor_;
+	delete p_change_detector_;
+	delete p_image_pool_;
+	for (size_t i = 0; i < free_images_.size(); ++i)
+	{
+		delete free_images_[i];
+	}
+}
+
+void DepthMapLogger::EnableNormals(bool enable)
+{
+	log_normals_ = enable;
+}
+
+void DepthMapLogger::EnableImages(int jpeg_quality, size_t n_threads)
+{
+	jpeg_quality_ = jpeg_quality;
+	if (!p_image_pool_) {
+		p_image_pool_ = new ThreadPool(n_threads);
+	}
+}
+
+void DepthMapLogger::EnableSmoothing(bool enable, const OneEuroParams& params)
+{
+	delete p_smoother_;
+	p_smoother_ = enable ? new JointSmoother(params) : NULL;
+}
+
+void DepthMapLogger::EnablePrediction(bool enable, const PredictionParams& params)
+{
+	delete p_predictor_;
+	p_predictor_ = enable ? new JointPredictor(params) : NULL;
+}
+
+void DepthMapLogger::EnableChangeDetection(bool enable, const ChangeParams& params)
+{
+	delete p_change_detector_;
+	p_change_detector_ = enable ? new ChangeDetector(params) : NULL;
+	reference_frame_.clear();
+}
+
+hsize_t DepthMapLogger::UnchangedFrameCount() const
+{
+	return n_unchanged_frames_;
+}
+
+void DepthMapLogger::LostUser(XnUserID user)
+{
+	if (p_smoother_) {
+		p_smoother_->Reset(static_cast<uint16_t>(user));
+	}
+	if (p_predictor_) {
+		p_predictor_->Reset(static_cast<uint16_t>(user));
+	}
+}
+
+void XN_CALLBACK_TYPE DepthMapLogger::LostUserHandler(XnUserID user, void* pCookie)
+{
+	static_cast<DepthMapLogger*>(pCookie)->LostUser(user);
 }
 
 void DepthMapLogger::Open(const char* h5_filename)
@@ -79,64 +149,226 @@ void DepthMapLogger::Open(const char* h5_filename)
 
 	// Open new ones
 	p_h5_file_ = new H5File(h5_filename, H5F_ACC_TRUNC);
+	p_parent_group_ = new Group(p_h5_file_->openGroup("/"));
 
 	// Create new group for storing frames
 	p_frames_group_ = new Group(p_h5_file_->createGroup("frames"));
+	CreateEventTable();
+	metrics_ = TrackingMetrics();
+	if (p_predictor_) {
+		p_predictor_->ResetErrors();
+	}
+	reference_frame_.clear();
+	n_unchanged_frames_ = 0;
+}
+
+void DepthMapLogger::Open(H5::Group& parent)
+{
+	// Ensure closed
+	Close();
+
+	// Create new group for storing frames. The file is owned by whoever owns parent.
+	p_parent_group_ = new Group(parent);
+	p_frames_group_ = new Group(parent.createGroup("frames"));
+	CreateEventTable();
+	metrics_ = TrackingMetrics();
+	if (p_predictor_) {
+		p_predictor_->ResetErrors();
+	}
+	reference_frame_.clear();
+	n_unchanged_frames_ = 0;
+}
+
+void DepthMapLogger::CreateEventTable()
+{
+	hsize_t dims[1] = { 0 }, max_dims[1] = { H5S_UNLIMITED }, chunk_dims[1] = { 256 };
+	DSetCreatPropList props;
+	props.setChunk(1, chunk_dims);
+	p_events_ds_ = new DataSet(p_parent_group_->createDataSet("events", event_dt_,
+				DataSpace(1, dims, max_dims), props));
+	n_events_ = 0;
+}
+
+void DepthMapLogger::WriteEvents(hsize_t frame_idx, const std::vector<UserEvent>& events)
+{
+	if (!p_events_ds_ || events.empty()) { return; }
+
+	std::vector<LoggedEvent> rows(events.size());
+	for (size_t i = 0; i < events.size(); ++i)
+	{
+		rows[i].frame_idx = frame_idx;
+		rows[i].event = events[i];
+	}
+
+	hsize_t offset[1] = { n_events_ }, count[1] = { rows.size() };
+	hsize_t new_size[1] = { n_events_ + rows.size() };
+	p_events_ds_->extend(new_size);
+	DataSpace file_space(p_events_ds_->getSpace());
+	file_space.selectHyperslab(H5S_SELECT_SET, count, offset);
+	p_events_ds_->write(&rows[0], event_dt_, DataSpace(1, count), file_space);
+	n_events_ += rows.size();
 }
 
 void DepthMapLogger::Close()
 {
+	// Flush any colour images still being compressed
+	if (p_image_pool_) {
+		p_image_pool_->Wait();
+		WriteCompletedImages();
+	}
+	if (n_dropped_images_ > 0) {
+		std::cerr << "Warning: " << n_dropped_images_ << " colour image(s) were dropped.\n";
+		n_dropped_images_ = 0;
+	}
+
+	if (p_predictor_ && p_frames_group_) {
+		WritePredictionErrors();
+	}
+	if (p_parent_group_) {
+		WriteTrackingMetrics();
+	}
+
 	// this invalidates all the rest of the datasets as well
+	if(p_events_ds_) { delete p_events_ds_; }
 	if(p_frames_group_) { delete p_frames_group_; }
+	if(p_parent_group_) { delete p_parent_group_; }
 	if(p_h5_file_) { delete p_h5_file_; }
 
 	// Reset pointer
 	p_h5_file_ = NULL;
+	p_parent_group_ = NULL;
 	p_frames_group_ = NULL;
+	p_events_ds_ = NULL;
 }
 
-void DepthMapLogger::DumpDepthMap(const xn::DepthMetaData& dmd, const xn::SceneMetaData& smd)
+void DepthMapLogger::WriteTrackingMetrics()
 {
-	static char name_str[20], comment_str[255];
-
-	// Don't do anything if the h5 file is not open
-	if(!p_h5_file_ || !p_frames_group_) { return; }
+	metrics_.Print(std::cout);
+
+	Group metrics_group(p_parent_group_->createGroup("metrics"));
+	TrackingMetrics::Summary summary(metrics_.Summarise());
+	uint64_t n_frames(metrics_.Frames());
+	metrics_group.createAttribute("frames", PredType::NATIVE_UINT64, DataSpace())
+		.write(PredType::NATIVE_UINT64, &n_frames);
+	metrics_group.createAttribute("users", PredType::NATIVE_UINT32, DataSpace())
+		.write(PredType::NATIVE_UINT32, &summary.users);
+	metrics_group.createAttribute("tracked_users", PredType::NATIVE_UINT32, DataSpace())
+		.write(PredType::NATIVE_UINT32, &summary.tracked_users);
+	metrics_group.createAttribute("cached_users", PredType::NATIVE_UINT32, DataSpace())
+		.write(PredType::NATIVE_UINT32, &summary.cached_users);
+	metrics_group.createAttribute("mean_time_to_tracking_ms", PredType::NATIVE_DOUBLE, DataSpace())
+		.write(PredType::NATIVE_DOUBLE, &summary.mean_time_to_tracking_ms);
+	metrics_group.createAttribute("median_time_to_tracking_ms", PredType::NATIVE_DOUBLE, DataSpace())
+		.write(PredType::NATIVE_DOUBLE, &summary.median_time_to_tracking_ms);
+	metrics_group.createAttribute("max_time_to_tracking_ms", PredType::NATIVE_DOUBLE, DataSpace())
+		.write(PredType::NATIVE_DOUBLE, &summary.max_time_to_tracking_ms);
+	metrics_group.createAttribute("tracked_frame_ratio", PredType::NATIVE_DOUBLE, DataSpace())
+		.write(PredType::NATIVE_DOUBLE, &summary.tracked_frame_ratio);
+
+	// One row per user lifecycle
+	const std::vector<UserLifecycle>& users(metrics_.Users());
+	hsize_t user_dims[1] = { users.size() };
+	DataSet users_ds(metrics_group.createDataSet("users", MakeUserLifecycleDataType(),
+				DataSpace(1, user_dims)));
+	if (!users.empty()) {
+		users_ds.write(&users[0], MakeUserLifecycleDataType());
+	}
 
-	// References to various bits of the HDF5 output
-	H5File &file(*p_h5_file_);
-	Group &frames_group(*p_frames_group_);
+	// Confidence histogram indexed by joint id - 1 and bin
+	const int n_bins(TrackingMetrics::n_confidence_bins);
+	uint64_t histogram[g_NumJointTypes][n_bins];
+	for (int j = 0; j < g_NumJointTypes; ++j)
+	{
+		for (int b = 0; b < n_bins; ++b)
+		{
+			histogram[j][b] = metrics_.ConfidenceCount(j + 1, b);
+		}
+	}
+	hsize_t histogram_dims[2] = { g_NumJointTypes, n_bins };
+	metrics_group.createDataSet("joint_confidence", PredType::NATIVE_UINT64, DataSpace(2, histogram_dims))
+		.write(histogram, PredType::NATIVE_UINT64);
+}
 
-	// This frame's index is the number of frames we've previously saved
-	hsize_t this_frame_idx = frames_group.getNumObjs();
+void DepthMapLogger::WritePredictionErrors()
+{
+	// Only logs which own their file have somewhere to put the statistics
+	if (!p_h5_file_) { return; }
+
+	const PredictionParams& params(p_predictor_->Params());
+	Group prediction_group(p_h5_file_->createGroup("prediction"));
+	prediction_group.createAttribute("horizon_ms", PredType::NATIVE_FLOAT, DataSpace())
+		.write(PredType::NATIVE_FLOAT, &params.horizon_ms);
+	StrType model_type(PredType::C_S1, 16);
+	H5std_string model(params.use_acceleration ? "acceleration" : "velocity");
+	prediction_group.createAttribute("model", model_type, DataSpace()).write(model_type, model);
+
+	// Per-joint statistics indexed by joint id - 1
+	uint64_t count[g_NumJointTypes];
+	double mean[g_NumJointTypes], rms[g_NumJointTypes], max[g_NumJointTypes];
+	for (int j = 0; j < g_NumJointTypes; ++j)
+	{
+		const JointPredictor::JointError& error(p_predictor_->Errors()[j]);
+		count[j] = error.count;
+		mean[j] = error.Mean();
+		rms[j] = error.Rms();
+		max[j] = error.max_mm;
+	}
+	hsize_t dims[1] = { g_NumJointTypes };
+	DataSpace space(1, dims);
+	prediction_group.createDataSet("count", PredType::NATIVE_UINT64, space)
+		.write(count, PredType::NATIVE_UINT64);
+	prediction_group.createDataSet("mean_error_mm", PredType::NATIVE_DOUBLE, space)
+		.write(mean, PredType::NATIVE_DOUBLE);
+	prediction_group.createDataSet("rms_error_mm", PredType::NATIVE_DOUBLE, space)
+		.write(rms, PredType::NATIVE_DOUBLE);
+	prediction_group.createDataSet("max_error_mm", PredType::NATIVE_DOUBLE, space)
+		.write(max, PredType::NATIVE_DOUBLE);
+}
 
-	// Create this frame's group
-	snprintf(name_str, 20, "frame_%06lld", this_frame_idx);
-	snprintf(comment_str, 255, "Data for frame %lld", this_frame_idx);
-	Group this_frame_group(frames_group.createGroup(name_str));
-	this_frame_group.setComment(".", comment_str);
+hsize_t DepthMapLogger::FrameCount() const
+{
+	if(!p_frames_group_) { return 0; }
+	return p_frames_group_->getNumObjs();
+}
 
-	// Create attributes for this group
-	Attribute idx_attr = this_frame_group.createAttribute("idx", PredType::NATIVE_HSIZE, DataSpace());
-	idx_attr.write(PredType::NATIVE_HSIZE, &this_frame_idx);
+void DepthMapLogger::DumpFrame(const FrameSnapshot& frame)
+{
+	if(!p_frames_group_) { return; }
+
+	// Write any colour images which have finished compressing since the last frame
+	WriteCompletedImages();
+	WriteFrame(frame);
+
+	if (p_image_pool_) {
+		if (frame.has_image) {
+			QueueImage(frame.image_frame_id, frame.image_timestamp, frame.image_width,
+					frame.image_height, &frame.image[0]);
+		} else {
+			++n_dropped_images_;
+		}
+	}
+}
 
+void DepthMapLogger::WritePixels(const FrameSnapshot& frame, H5::Group& frame_group)
+{
 	// Create this frame's datasets
 	DSetCreatPropList creat_props;
 	uint16_t fill_value(0);
 	creat_props.setFillValue(PredType::NATIVE_UINT16, &fill_value);
 
-	hsize_t rows(static_cast<hsize_t>(dmd.YRes())), cols(static_cast<hsize_t>(dmd.XRes()));
+	hsize_t rows(static_cast<hsize_t>(frame.rows)), cols(static_cast<hsize_t>(frame.cols));
 	hsize_t creation_dims[2] = { rows, cols };
 	hsize_t max_dims[2] = { rows, cols };
 	DataSpace mem_space(2, creation_dims, max_dims);
 
-	DataSet depth_ds(this_frame_group.createDataSet(
+	DataSet depth_ds(frame_group.createDataSet(
 		"depth", PredType::NATIVE_UINT16, mem_space, creat_props));
-	DataSet label_ds(this_frame_group.createDataSet(
+	DataSet label_ds(frame_group.createDataSet(
 		"label", PredType::NATIVE_UINT16, mem_space, creat_props));
 
 	// Get depth and label buffers
-	const uint16_t *p_depths = dmd.Data();
-	const uint16_t *p_labels = smd.Data();
+	const uint16_t *p_depths = &frame.depth[0];
+	const uint16_t *p_labels = &frame.label[0];
 
 	// Write depth data
 	depth_ds.write(p_depths, PredType::NATIVE_UINT16);
@@ -145,8 +377,8 @@ void DepthMapLogger::DumpDepthMap(const xn::DepthMetaData& dmd, const xn::SceneM
 	label_ds.write(p_labels, PredType::NATIVE_UINT16);
 
 	// Convert non-zero depth values into 3D point positions
-	XnPoint3D *pts = new XnPoint3D[rows*cols];
-	uint16_t *pt_labels = new uint16_t[rows*cols];
+	std::vector<XnPoint3D> pts(rows*cols);
+	std::vector<uint16_t> pt_labels(rows*cols);
 	size_t n_pts(0);
 	for(size_t depth_idx(0); depth_idx < rows*cols; ++depth_idx) {
 		// Skip zero depth values
@@ -154,14 +386,16 @@ void DepthMapLogger::DumpDepthMap(const xn::DepthMetaData& dmd, const xn::SceneM
 			continue;
 		}
 
-		// Store projective-values
-		pts[n_pts].X = depth_idx % cols;
-		pts[n_pts].Y = depth_idx / cols;
-		pts[n_pts].Z = p_depths[depth_idx];
+		// Convert from projective co-ordinates in the same way as OpenNI
+		double z(p_depths[depth_idx]);
+		double normalised_x(static_cast<float>(depth_idx % cols) / cols - 0.5);
+		double normalised_y(0.5 - static_cast<float>(depth_idx / cols) / rows);
+		pts[n_pts].X = static_cast<XnFloat>(normalised_x * z * frame.x_to_z);
+		pts[n_pts].Y = static_cast<XnFloat>(normalised_y * z * frame.y_to_z);
+		pts[n_pts].Z = static_cast<XnFloat>(z);
 		pt_labels[n_pts] = p_labels[depth_idx];
 		++n_pts;
 	}
-	g_DepthGenerator.ConvertProjectiveToRealWorld(n_pts, pts, pts);
 
 	if (n_pts > 0)
 	{
@@ -169,106 +403,395 @@ void DepthMapLogger::DumpDepthMap(const xn::DepthMetaData& dmd, const xn::SceneM
 		hsize_t pts_creation_dims[2] = { n_pts, 3 };
 		hsize_t pts_max_dims[2] = { n_pts, 3 };
 		DataSpace pts_mem_space(2, pts_creation_dims, pts_max_dims);
-		DataSet pts_ds(this_frame_group.createDataSet(
+		DataSet pts_ds(frame_group.createDataSet(
 			"points", PredType::NATIVE_FLOAT, pts_mem_space, creat_props));
 		hsize_t pt_labels_creation_dims[1] = { n_pts };
 		hsize_t pt_labels_max_dims[1] = { n_pts };
 		DataSpace pt_labels_mem_space(1, pt_labels_creation_dims, pt_labels_max_dims);
-		DataSet pt_labels_ds(this_frame_group.createDataSet(
+		DataSet pt_labels_ds(frame_group.createDataSet(
 			"point_labels", PredType::NATIVE_UINT16, pt_labels_mem_space, creat_props));
 
 		// Write points data
-		pts_ds.write(pts, PredType::NATIVE_FLOAT);
-		pt_labels_ds.write(pt_labels, PredType::NATIVE_UINT16);
+		pts_ds.write(&pts[0], PredType::NATIVE_FLOAT);
+		pt_labels_ds.write(&pt_labels[0], PredType::NATIVE_UINT16);
+	}
+
+	if (log_normals_ && (n_pts > 0))
+	{
+		// Scatter points back into an organised grid. They were packed in raster order above.
+		std::vector<float> grid(rows*cols*3, 0.f);
+		size_t pt_idx(0);
+		for(size_t depth_idx(0); depth_idx < rows*cols; ++depth_idx) {
+			if(p_depths[depth_idx] == 0) {
+				continue;
+			}
+			grid[depth_idx*3] = pts[pt_idx].X;
+			grid[depth_idx*3 + 1] = pts[pt_idx].Y;
+			grid[depth_idx*3 + 2] = pts[pt_idx].Z;
+			++pt_idx;
+		}
+
+		std::vector<int8_t> normals;
+		ComputeNormals(&grid[0], p_labels, static_cast<int>(rows), static_cast<int>(cols), normals);
+
+		hsize_t normals_dims[3] = { rows, cols, 3 };
+		DataSpace normals_space(3, normals_dims);
+		DataSet normals_ds(frame_group.createDataSet(
+			"normals", PredType::NATIVE_INT8, normals_space));
+		normals_ds.write(&normals[0], PredType::NATIVE_INT8);
+		Attribute scale_attr(normals_ds.createAttribute("scale", PredType::NATIVE_INT, DataSpace()));
+		scale_attr.write(PredType::NATIVE_INT, &g_NormalScale);
+	}
+}
+
+void DepthMapLogger::LinkPixels(H5::Group& frame_group)
+{
+	static const char* const names[] = { "depth", "label", "points", "point_labels", "normals" };
+
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+	{
+		std::string source(reference_frame_ + "/" + names[i]);
+		if (H5Lexists(p_frames_group_->getId(), source.c_str(), H5P_DEFAULT) <= 0) {
+			continue;
+		}
+		if (H5Lcreate_hard(p_frames_group_->getId(), source.c_str(), frame_group.getId(), names[i],
+					H5P_DEFAULT, H5P_DEFAULT) < 0) {
+			throw GroupIException("DepthMapLogger::LinkPixels", "could not link " + source);
+		}
+	}
+
+	// Say which frame the pixels came from
+	frame_group.createAttribute("pixels_from_idx", PredType::NATIVE_HSIZE, DataSpace())
+		.write(PredType::NATIVE_HSIZE, &reference_frame_idx_);
+}
+
+void DepthMapLogger::WriteFrame(const FrameSnapshot& frame)
+{
+	char name_str[20], comment_str[255];
+
+	// References to various bits of the HDF5 output
+	Group &frames_group(*p_frames_group_);
+
+	// This frame's index is the number of frames we've previously saved
+	hsize_t this_frame_idx = frames_group.getNumObjs();
+
+	WriteEvents(this_frame_idx, frame.user_events);
+	metrics_.AddEvents(frame.user_events);
+	metrics_.AddFrame(frame);
+
+	// Create this frame's group
+	snprintf(name_str, 20, "frame_%06lld", this_frame_idx);
+	snprintf(comment_str, 255, "Data for frame %lld", this_frame_idx);
+	Group this_frame_group(frames_group.createGroup(name_str));
+	this_frame_group.setComment(".", comment_str);
+
+	// Create attributes for this group
+	Attribute idx_attr = this_frame_group.createAttribute("idx", PredType::NATIVE_HSIZE, DataSpace());
+	idx_attr.write(PredType::NATIVE_HSIZE, &this_frame_idx);
+
+	// Record where this frame came from so that logs of parts of a recording can be stitched
+	// back together.
+	uint32_t frame_id(frame.frame_id);
+	Attribute frame_id_attr = this_frame_group.createAttribute(
+			"frame_id", PredType::NATIVE_UINT32, DataSpace());
+	frame_id_attr.write(PredType::NATIVE_UINT32, &frame_id);
+	uint64_t timestamp(frame.timestamp);
+	Attribute timestamp_attr = this_frame_group.createAttribute(
+			"timestamp", PredType::NATIVE_UINT64, DataSpace());
+	timestamp_attr.write(PredType::NATIVE_UINT64, &timestamp);
+
+	// ...and the field of view, so that the depth map may be fed to a tracker again
+	this_frame_group.createAttribute("x_to_z", PredType::NATIVE_DOUBLE, DataSpace())
+		.write(PredType::NATIVE_DOUBLE, &frame.x_to_z);
+	this_frame_group.createAttribute("y_to_z", PredType::NATIVE_DOUBLE, DataSpace())
+		.write(PredType::NATIVE_DOUBLE, &frame.y_to_z);
+
+	// A frame whose depth map has barely changed shares the pixel datasets of the last frame
+	// written in full. The links are ordinary HDF5 hard links so readers need not know.
+	if (p_change_detector_ && !reference_frame_.empty() &&
+			!p_change_detector_->Changed(&frame.depth[0], &frame.label[0], frame.rows, frame.cols))
+	{
+		LinkPixels(this_frame_group);
+		++n_unchanged_frames_;
+	}
+	else
+	{
+		WritePixels(frame, this_frame_group);
+		if (p_change_detector_) {
+			p_change_detector_->SetReference(&frame.depth[0], &frame.label[0], frame.rows, frame.cols);
+			reference_frame_ = name_str;
+			reference_frame_idx_ = this_frame_idx;
+		}
 	}
 
 	// Create groups to store detected users
 	Group users_group(this_frame_group.createGroup("users"));
 
+	// Discard state of users who have gone
+	for (size_t i = 0; i < frame.lost_users.size(); ++i)
+	{
+		LostUser(frame.lost_users[i]);
+	}
+
 	// Dump each user in turn
-	char strLabel[50] = "";
-	XnUserID aUsers[15];
-	XnUInt16 nUsers = 15;
-	g_UserGenerator.GetUsers(aUsers, nUsers);
-	for (int i = 0; i < nUsers; ++i)
+	for (size_t i = 0; i < frame.users.size(); ++i)
 	{
+		const TrackedUser& user(frame.users[i]);
+
 		// Create a group for this user
-		snprintf(name_str, 20, "user_%02d", aUsers[i]);
+		snprintf(name_str, 20, "user_%02d", user.user);
 		Group this_user_group(users_group.createGroup(name_str));
 
 		// Create attributes for this group
 		Attribute user_idx_attr = this_user_group.createAttribute(
 				"idx", PredType::NATIVE_UINT16, DataSpace());
-		uint16_t this_user_idx(aUsers[i]);
+		uint16_t this_user_idx(user.user);
 		user_idx_attr.write(PredType::NATIVE_UINT16, &this_user_idx);
 
 
 		// Write state (if any)
 		H5std_string strwritebuf;
-		if (g_UserGenerator.GetSkeletonCap().IsTracking(aUsers[i]))
-		{
-			strwritebuf = "tracking";
-		}
-		else if (g_UserGenerator.GetSkeletonCap().IsCalibrating(aUsers[i]))
-		{
-			// Calibrating
-			strwritebuf = "calibrating";
-		}
-		else
-		{
-			// Nothing
-			strwritebuf = "looking";
+		switch (frame.user_states[i]) {
+			case USER_TRACKING:    strwritebuf = "tracking"; break;
+			case USER_CALIBRATING: strwritebuf = "calibrating"; break;
+			default:               strwritebuf = "looking"; break;
 		}
 		StrType strdatatype(PredType::C_S1, strwritebuf.size()); // of length 256 characters
 		Attribute user_state_attr = this_user_group.createAttribute(
 				"state", strdatatype, DataSpace());
 		user_state_attr.write(strdatatype, strwritebuf);
 
-		static Joint joints[g_NumJointTypes];
-		int n_joints_found = 0;
-
-		// Try to dump all joints
-		for(int jt_idx=0; jt_idx < g_NumJointTypes; ++jt_idx)
-		{
-			if(DumpJoint(aUsers[i], g_JointTypes[jt_idx], joints[n_joints_found])) 
-			{
-				++n_joints_found;
-			}
-		}
+		const Joint* joints(user.joints);
+		int n_joints_found(user.n_joints);
 
 		if (n_joints_found > 0)
 		{
 			// Create joints dataset
-			hsize_t joints_dim[] = { n_joints_found };
+			hsize_t joints_dim[] = { static_cast<hsize_t>(n_joints_found) };
 			DataSpace joints_space(1, joints_dim);
 			DataSet joints_ds(this_user_group.createDataSet("joints", joint_dt_, joints_space));
 			joints_ds.write(joints, joint_dt_);
+
+			if (p_smoother_)
+			{
+				Joint smoothed[g_NumJointTypes];
+				float lag_ms[g_NumJointTypes];
+				p_smoother_->Filter(this_user_idx, timestamp, joints, n_joints_found, smoothed, lag_ms);
+
+				DataSet smoothed_ds(this_user_group.createDataSet(
+					"joints_smoothed", joint_dt_, joints_space));
+				smoothed_ds.write(smoothed, joint_dt_);
+				Attribute lag_attr(smoothed_ds.createAttribute(
+					"lag_ms", PredType::NATIVE_FLOAT, joints_space));
+				lag_attr.write(PredType::NATIVE_FLOAT, lag_ms);
+			}
+
+			if (p_predictor_)
+			{
+				Joint predicted[g_NumJointTypes];
+				p_predictor_->Predict(this_user_idx, timestamp, joints, n_joints_found, predicted);
+
+				DataSet predicted_ds(this_user_group.createDataSet(
+					"joints_predicted", joint_dt_, joints_space));
+				predicted_ds.write(predicted, joint_dt_);
+				float horizon_ms(p_predictor_->Params().horizon_ms);
+				Attribute horizon_attr(predicted_ds.createAttribute(
+					"horizon_ms", PredType::NATIVE_FLOAT, DataSpace()));
+				horizon_attr.write(PredType::NATIVE_FLOAT, &horizon_ms);
+			}
+		}
+		else
+		{
+			// Joints which reappear will start afresh anyway
+			LostUser(user.user);
 		}
 	}
 }
 
-bool DumpJoint(XnUserID player, XnSkeletonJoint eJoint, Joint &out_joint)
+void DepthMapLogger::QueueImage(uint32_t frame_id, uint64_t timestamp, int width, int height,
+		const uint8_t* pixels)
+{
+	// Don't let a backlog of compression slow down depth logging. There is nowhere to put an image
+	// which arrives before the first depth map.
+	if ((FrameCount() == 0) || (p_image_pool_->Pending() >= 4 * p_image_pool_->Size())) {
+		++n_dropped_images_;
+		return;
+	}
+
+	PendingImage* p_image(NULL);
+	{
+		std::lock_guard<std::mutex> lock(images_mutex_);
+		if (!free_images_.empty()) {
+			p_image = free_images_.back();
+			free_images_.pop_back();
+		}
+	}
+	if (!p_image) {
+		p_image = new PendingImage;
+	}
+
+	p_image->frame_idx = FrameCount() - 1;
+	p_image->frame_id = frame_id;
+	p_image->timestamp = timestamp;
+	p_image->width = width;
+	p_image->height = height;
+	p_image->pixels.resize(p_image->width * p_image->height * 3);
+	memcpy(&p_image->pixels[0], pixels, p_image->pixels.size());
+
+	int quality(jpeg_quality_);
+	p_image_pool_->Submit([this, p_image, quality]() {
+		CompressJpeg(&p_image->pixels[0], p_image->width, p_image->height, quality, p_image->jpeg);
+
+		std::lock_guard<std::mutex> lock(images_mutex_);
+		completed_images_.push_back(p_image);
+	});
+}
+
+void DepthMapLogger::WriteCompletedImages()
+{
+	char name_str[20];
+
+	std::vector<PendingImage*> completed;
+	{
+		std::lock_guard<std::mutex> lock(images_mutex_);
+		completed.swap(completed_images_);
+	}
+
+	for (size_t i = 0; i < completed.size(); ++i)
+	{
+		PendingImage& image(*completed[i]);
+
+		// Compression failed
+		if (image.jpeg.empty()) {
+			++n_dropped_images_;
+			continue;
+		}
+
+		snprintf(name_str, 20, "frame_%06lld", image.frame_idx);
+		Group frame_group(p_frames_group_->openGroup(name_str));
+
+		hsize_t dims[1] = { image.jpeg.size() };
+		DataSpace space(1, dims);
+		DataSet image_ds(frame_group.createDataSet("image", PredType::NATIVE_UINT8, space));
+		image_ds.write(&image.jpeg[0], PredType::NATIVE_UINT8);
+
+		StrType str_type(PredType::C_S1, 4);
+		image_ds.createAttribute("encoding", str_type, DataSpace()).write(str_type, H5std_string("jpeg"));
+		image_ds.createAttribute("width", PredType::NATIVE_INT, DataSpace())
+			.write(PredType::NATIVE_INT, &image.width);
+		image_ds.createAttribute("height", PredType::NATIVE_INT, DataSpace())
+			.write(PredType::NATIVE_INT, &image.height);
+		image_ds.createAttribute("frame_id", PredType::NATIVE_UINT32, DataSpace())
+			.write(PredType::NATIVE_UINT32, &image.frame_id);
+		image_ds.createAttribute("timestamp", PredType::NATIVE_UINT64, DataSpace())
+			.write(PredType::NATIVE_UINT64, &image.timestamp);
+	}
+
+	std::lock_guard<std::mutex> lock(images_mutex_);
+	free_images_.insert(free_images_.end(), completed.begin(), completed.end());
+}
+
+int GetUserJoints(xn::DepthGenerator& depthGenerator, xn::UserGenerator& userGenerator,
+		XnUserID user, Joint joints[g_NumJointTypes])
+{
+	int n_joints_found = 0;
+
+	// Try to dump all joints
+	for(int jt_idx=0; jt_idx < g_NumJointTypes; ++jt_idx)
+	{
+		if(DumpJoint(depthGenerator, userGenerator,
+					user, g_JointTypes[jt_idx], joints[n_joints_found]))
+		{
+			++n_joints_found;
+		}
+	}
+
+	return n_joints_found;
+}
+
+void CaptureFrame(const xn::DepthMetaData& dmd, const xn::SceneMetaData& smd,
+		xn::DepthGenerator& depthGenerator, xn::UserGenerator& userGenerator, FrameSnapshot& frame)
+{
+	frame.frame_id = dmd.FrameID();
+	frame.timestamp = dmd.Timestamp();
+	frame.rows = static_cast<int>(dmd.YRes());
+	frame.cols = static_cast<int>(dmd.XRes());
+	frame.depth.assign(dmd.Data(), dmd.Data() + frame.rows * frame.cols);
+	frame.label.assign(smd.Data(), smd.Data() + frame.rows * frame.cols);
+
+	XnFieldOfView fov;
+	depthGenerator.GetFieldOfView(fov);
+	frame.x_to_z = 2. * tan(fov.fHFOV / 2.);
+	frame.y_to_z = 2. * tan(fov.fVFOV / 2.);
+
+	XnUserID aUsers[15];
+	XnUInt16 nUsers = 15;
+	userGenerator.GetUsers(aUsers, nUsers);
+	frame.users.resize(nUsers);
+	frame.user_states.resize(nUsers);
+	for (int i = 0; i < nUsers; ++i)
+	{
+		TrackedUser& user(frame.users[i]);
+		user.user = static_cast<uint16_t>(aUsers[i]);
+		user.n_joints = GetUserJoints(depthGenerator, userGenerator, aUsers[i], user.joints);
+
+		if (userGenerator.GetSkeletonCap().IsTracking(aUsers[i])) {
+			frame.user_states[i] = USER_TRACKING;
+		} else if (userGenerator.GetSkeletonCap().IsCalibrating(aUsers[i])) {
+			frame.user_states[i] = USER_CALIBRATING;
+		} else {
+			frame.user_states[i] = USER_LOOKING;
+		}
+	}
+
+	frame.lost_users.clear();
+	frame.user_events.clear();
+	frame.has_image = false;
+}
+
+void XN_CALLBACK_TYPE QueueLostUser(XnUserID user, void* pCookie)
+{
+	static_cast<std::vector<uint16_t>*>(pCookie)->push_back(static_cast<uint16_t>(user));
+}
+
+bool CaptureImage(const xn::ImageMetaData& imd, FrameSnapshot& frame)
+{
+	frame.has_image = (imd.PixelFormat() == XN_PIXEL_FORMAT_RGB24);
+	if (!frame.has_image) {
+		return false;
+	}
+
+	frame.image_frame_id = imd.FrameID();
+	frame.image_timestamp = imd.Timestamp();
+	frame.image_width = static_cast<int>(imd.XRes());
+	frame.image_height = static_cast<int>(imd.YRes());
+	frame.image.assign(imd.Data(), imd.Data() + frame.image_width * frame.image_height * 3);
+	return true;
+}
+
+bool DumpJoint(xn::DepthGenerator& depthGenerator, xn::UserGenerator& userGenerator,
+		XnUserID player, XnSkeletonJoint eJoint, Joint &out_joint)
 {
 	// Check the user is being tracked
-	if (!g_UserGenerator.GetSkeletonCap().IsTracking(player))
+	if (!userGenerator.GetSkeletonCap().IsTracking(player))
 	{
 		return false;
 	}
 
 	// Check the joint is actually there
-	if (!g_UserGenerator.GetSkeletonCap().IsJointActive(eJoint))
+	if (!userGenerator.GetSkeletonCap().IsJointActive(eJoint))
 	{
 		return false;
 	}
 
 	// Extract joint positions
 	XnSkeletonJointPosition joint;
-	g_UserGenerator.GetSkeletonCap().GetSkeletonJointPosition(player, eJoint, joint);
+	userGenerator.GetSkeletonCap().GetSkeletonJointPosition(player, eJoint, joint);
 
 	XnPoint3D pt, imagePt;
 	pt = joint.position;
 
-	g_DepthGenerator.ConvertRealWorldToProjective(1, &pt, &imagePt);
+	depthGenerator.ConvertRealWorldToProjective(1, &pt, &imagePt);
 
 	out_joint.id = eJoint;
 	out_joint.confidence = joint.fConfidence;
@@ -0,0 +1,75 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Joint records as stored in logs
+//---------------------------------------------------------------------------
+#include <cstring>
+
+#include "joint.h"
+
+using namespace H5;
+
+CompType MakeJointDataType()
+{
+	CompType joint_dt(sizeof(Joint));
+	joint_dt.insertMember(H5std_string("id"), HOFFSET(Joint, id), PredType::NATIVE_INT);
+	joint_dt.insertMember(H5std_string("confidence"), HOFFSET(Joint, confidence),
+			PredType::NATIVE_FLOAT);
+	joint_dt.insertMember(H5std_string("x"), HOFFSET(Joint, x), PredType::NATIVE_FLOAT);
+	joint_dt.insertMember(H5std_string("y"), HOFFSET(Joint, y), PredType::NATIVE_FLOAT);
+	joint_dt.insertMember(H5std_string("z"), HOFFSET(Joint, z), PredType::NATIVE_FLOAT);
+	joint_dt.insertMember(H5std_string("u"), HOFFSET(Joint, u), PredType::NATIVE_FLOAT);
+	joint_dt.insertMember(H5std_string("v"), HOFFSET(Joint, v), PredType::NATIVE_FLOAT);
+	joint_dt.insertMember(H5std_string("w"), HOFFSET(Joint, w), PredType::NATIVE_FLOAT);
+	return joint_dt;
+}
+
+void ScatterJoints(const Joint* joints, int n, float* values, float* present)
+{
+	memset(values, 0, g_JointArraySize * sizeof(float));
+	memset(present, 0, g_JointArraySize * sizeof(float));
+	for (int i = 0; i < n; ++i)
+	{
+		const Joint& joint(joints[i]);
+		if ((joint.id < 1) || (joint.id > g_NumJointTypes)) {
+			continue;
+		}
+		float* p_value(values + (joint.id - 1) * g_JointCoords);
+		p_value[0] = joint.x; p_value[1] = joint.y; p_value[2] = joint.z;
+		p_value[3] = joint.u; p_value[4] = joint.v; p_value[5] = joint.w;
+		for (int c = 0; c < g_JointCoords; ++c)
+		{
+			present[(joint.id - 1) * g_JointCoords + c] = 1.f;
+		}
+	}
+}
+
+void GatherJoints(const Joint* joints, int n, const float* values, Joint* out)
+{
+	for (int i = 0; i < n; ++i)
+	{
+		const Joint& joint(joints[i]);
+		out[i] = joint;
+		if ((joint.id < 1) || (joint.id > g_NumJointTypes)) {
+			continue;
+		}
+		const float* p_value(values + (joint.id - 1) * g_JointCoords);
+		out[i].x = p_value[0]; out[i].y = p_value[1]; out[i].z = p_value[2];
+		out[i].u = p_value[3]; out[i].v = p_value[4]; out[i].w = p_value[5];
+	}
+}
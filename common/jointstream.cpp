@@ -0,0 +1,201 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+#include "jointstream.h"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <arrow/api.h>
+#include <arrow/io/file.h>
+#include <arrow/ipc/writer.h>
+
+// Columns are accumulated in plain vectors and handed to Arrow without copying when a batch is
+// written.
+struct JointStreamWriter::Impl {
+	std::shared_ptr<arrow::Schema>                  schema;
+	std::shared_ptr<arrow::io::FileOutputStream>    file;
+	std::shared_ptr<arrow::ipc::RecordBatchWriter>  writer;
+	std::string                                     filename;
+	size_t                                          batch_rows;
+	uint64_t                                        n_rows;
+	bool                                            failed;
+
+	std::vector<uint64_t>  frame, timestamp;
+	std::vector<uint16_t>  user;
+	std::vector<int32_t>   joint;
+	std::vector<float>     confidence, x, y, z, u, v, w;
+
+	bool Check(const arrow::Status& status, const char* what)
+	{
+		if (status.ok()) {
+			return true;
+		}
+		std::cerr << "Error " << what << ' ' << filename << ": " << status.ToString() << '\n';
+		failed = true;
+		return false;
+	}
+};
+
+template<typename ArrowType, typename T>
+static std::shared_ptr<arrow::Array> WrapColumn(const std::vector<T>& values)
+{
+	return std::make_shared<arrow::NumericArray<ArrowType> >(
+		static_cast<int64_t>(values.size()), arrow::Buffer::Wrap(values));
+}
+
+JointStreamWriter::JointStreamWriter()
+	: p_impl_(NULL)
+{ }
+
+JointStreamWriter::~JointStreamWriter()
+{
+	Close();
+}
+
+bool JointStreamWriter::Open(const char* filename, size_t batch_rows)
+{
+	Close();
+
+	p_impl_ = new Impl;
+	p_impl_->filename = filename;
+	p_impl_->batch_rows = (batch_rows > 0) ? batch_rows : 1;
+	p_impl_->n_rows = 0;
+	p_impl_->failed = false;
+	p_impl_->schema = arrow::schema({
+		arrow::field("frame", arrow::uint64(), false),
+		arrow::field("timestamp", arrow::uint64(), false),
+		arrow::field("user", arrow::uint16(), false),
+		arrow::field("joint", arrow::int32(), false),
+		arrow::field("confidence", arrow::float32(), false),
+		arrow::field("x", arrow::float32(), false),
+		arrow::field("y", arrow::float32(), false),
+		arrow::field("z", arrow::float32(), false),
+		arrow::field("u", arrow::float32(), false),
+		arrow::field("v", arrow::float32(), false),
+		arrow::field("w", arrow::float32(), false),
+	});
+
+	arrow::Result<std::shared_ptr<arrow::io::FileOutputStream> > file(
+		arrow::io::FileOutputStream::Open(filename));
+	if (!p_impl_->Check(file.status(), "opening")) {
+		delete p_impl_;
+		p_impl_ = NULL;
+		return false;
+	}
+	p_impl_->file = *file;
+
+	arrow::Result<std::shared_ptr<arrow::ipc::RecordBatchWriter> > writer(
+		arrow::ipc::MakeFileWriter(p_impl_->file, p_impl_->schema));
+	if (!p_impl_->Check(writer.status(), "starting")) {
+		delete p_impl_;
+		p_impl_ = NULL;
+		return false;
+	}
+	p_impl_->writer = *writer;
+
+	return true;
+}
+
+bool JointStreamWriter::Close()
+{
+	if (!p_impl_) { return true; }
+
+	Flush();
+	p_impl_->Check(p_impl_->writer->Close(), "finishing");
+	p_impl_->Check(p_impl_->file->Close(), "closing");
+	bool ok(!p_impl_->failed);
+
+	delete p_impl_;
+	p_impl_ = NULL;
+	return ok;
+}
+
+bool JointStreamWriter::IsOpen() const
+{
+	return p_impl_ != NULL;
+}
+
+void JointStreamWriter::Append(uint64_t frame, uint64_t timestamp, uint16_t user,
+		const Joint* joints, size_t n)
+{
+	if (!p_impl_) { return; }
+
+	Impl& impl(*p_impl_);
+	impl.frame.insert(impl.frame.end(), n, frame);
+	impl.timestamp.insert(impl.timestamp.end(), n, timestamp);
+	impl.user.insert(impl.user.end(), n, user);
+	for (size_t i = 0; i < n; ++i)
+	{
+		const Joint& joint(joints[i]);
+		impl.joint.push_back(joint.id);
+		impl.confidence.push_back(joint.confidence);
+		impl.x.push_back(joint.x);
+		impl.y.push_back(joint.y);
+		impl.z.push_back(joint.z);
+		impl.u.push_back(joint.u);
+		impl.v.push_back(joint.v);
+		impl.w.push_back(joint.w);
+	}
+	impl.n_rows += n;
+
+	if (impl.frame.size() >= impl.batch_rows) {
+		Flush();
+	}
+}
+
+bool JointStreamWriter::Flush()
+{
+	if (!p_impl_) { return false; }
+
+	Impl& impl(*p_impl_);
+	if (impl.frame.empty()) {
+		return !impl.failed;
+	}
+
+	std::shared_ptr<arrow::RecordBatch> batch(arrow::RecordBatch::Make(
+		impl.schema, static_cast<int64_t>(impl.frame.size()), {
+			WrapColumn<arrow::UInt64Type>(impl.frame),
+			WrapColumn<arrow::UInt64Type>(impl.timestamp),
+			WrapColumn<arrow::UInt16Type>(impl.user),
+			WrapColumn<arrow::Int32Type>(impl.joint),
+			WrapColumn<arrow::FloatType>(impl.confidence),
+			WrapColumn<arrow::FloatType>(impl.x),
+			WrapColumn<arrow::FloatType>(impl.y),
+			WrapColumn<arrow::FloatType>(impl.z),
+			WrapColumn<arrow::FloatType>(impl.u),
+			WrapColumn<arrow::FloatType>(impl.v),
+			WrapColumn<arrow::FloatType>(impl.w),
+		}));
+	bool ok(impl.Check(impl.writer->WriteRecordBatch(*batch), "writing to"));
+
+	// The batch has been written out so the columns may be reused
+	batch.reset();
+	impl.frame.clear(); impl.timestamp.clear(); impl.user.clear(); impl.joint.clear();
+	impl.confidence.clear();
+	impl.x.clear(); impl.y.clear(); impl.z.clear();
+	impl.u.clear(); impl.v.clear(); impl.w.clear();
+
+	return ok;
+}
+
+uint64_t JointStreamWriter::RowCount() const
+{
+	return p_impl_ ? p_impl_->n_rows : 0;
+}
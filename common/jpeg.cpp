@@ -0,0 +1,78 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// JPEG compression of colour images
+//---------------------------------------------------------------------------
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <jpeglib.h>
+
+#include "jpeg.h"
+
+// libjpeg's default error handler exits the process. This one returns to CompressJpeg() instead.
+struct JpegErrorManager {
+	struct jpeg_error_mgr pub;
+	jmp_buf               return_point;
+};
+
+static void ExitJpegError(j_common_ptr cinfo)
+{
+	JpegErrorManager* p_err(reinterpret_cast<JpegErrorManager*>(cinfo->err));
+	(*cinfo->err->output_message)(cinfo);
+	longjmp(p_err->return_point, 1);
+}
+
+bool CompressJpeg(const uint8_t* rgb, int width, int height, int quality, std::vector<uint8_t>& out)
+{
+	struct jpeg_compress_struct cinfo;
+	JpegErrorManager jerr;
+	unsigned char* p_buffer(NULL);
+	unsigned long buffer_size(0);
+
+	out.clear();
+	cinfo.err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = ExitJpegError;
+	if (setjmp(jerr.return_point)) {
+		jpeg_destroy_compress(&cinfo);
+		free(p_buffer);
+		return false;
+	}
+	jpeg_create_compress(&cinfo);
+	jpeg_mem_dest(&cinfo, &p_buffer, &buffer_size);
+
+	cinfo.image_width = width;
+	cinfo.image_height = height;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, quality, TRUE);
+
+	jpeg_start_compress(&cinfo, TRUE);
+	while (cinfo.next_scanline < cinfo.image_height)
+	{
+		JSAMPROW row = const_cast<JSAMPROW>(rgb + cinfo.next_scanline * width * 3);
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+
+	out.assign(p_buffer, p_buffer + buffer_size);
+	free(p_buffer);
+	return true;
+}
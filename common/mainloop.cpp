@@ -19,39 +19,52 @@
 // Includes
 //---------------------------------------------------------------------------
 #include <iostream>
+#include <stdio.h>
 #include <time.h>
 #include <XnOpenNI.h>
 #include <XnCodecIDs.h>
 #include <XnCppWrapper.h>
 #include <XnPropNames.h>
 
+#include "calibcache.h"
 #include "mainloop.h"
-#include "io.h"
-
-//---------------------------------------------------------------------------
-// Globals
-//---------------------------------------------------------------------------
-xn::Context g_Context;
-xn::ScriptNode g_scriptNode;
-xn::DepthGenerator g_DepthGenerator;
-xn::UserGenerator g_UserGenerator;
-xn::Player g_Player;
-
-XnBool g_bNeedPose = FALSE;
-XnChar g_strPose[20] = "";
+#include "wallclock.h"
 
 //---------------------------------------------------------------------------
 // Forward declarations
 //---------------------------------------------------------------------------
-bool EnsureDepthGenerator();
-bool EnsureUserGenerator();
-bool StartGenerating();
+void XN_CALLBACK_TYPE User_NewUser(xn::UserGenerator& /*generator*/, XnUserID nId, void* pCookie);
+void XN_CALLBACK_TYPE User_LostUser(xn::UserGenerator& /*generator*/, XnUserID nId, void* pCookie);
+void XN_CALLBACK_TYPE UserPose_PoseDetected(xn::PoseDetectionCapability& /*capability*/, const XnChar* strPose, XnUserID nId, void* pCookie);
+void XN_CALLBACK_TYPE UserCalibration_CalibrationStart(xn::SkeletonCapability& /*capability*/, XnUserID nId, void* pCookie);
+void XN_CALLBACK_TYPE UserCalibration_CalibrationComplete(xn::SkeletonCapability& /*capability*/, XnUserID nId, XnCalibrationStatus eStatus, void* pCookie);
+
+// Note that event happened to nId at the user generator's current time. detail may be NULL.
+// This must not block: it runs on the tracking thread in the middle of an update.
+static void RecordEvent(TrackingState& state, XnUserID nId, UserEventType type, const char* detail = NULL)
+{
+	if (!state.pEvents) {
+		return;
+	}
+
+	UserEvent event;
+	event.timestamp = state.pUserGenerator->GetTimestamp();
+	event.wall_time = WallClockMicroseconds();
+	event.frame_id = state.pUserGenerator->GetFrameID();
+	event.user = static_cast<uint16_t>(nId);
+	event.type = type;
+	snprintf(event.detail, g_UserEventDetailLength, "%s", detail ? detail : "");
+	state.pEvents->Push(event);
+}
 
-void XN_CALLBACK_TYPE User_NewUser(xn::UserGenerator& /*generator*/, XnUserID nId, void* /*pCookie*/);
-void XN_CALLBACK_TYPE User_LostUser(xn::UserGenerator& /*generator*/, XnUserID nId, void* /*pCookie*/);
-void XN_CALLBACK_TYPE UserPose_PoseDetected(xn::PoseDetectionCapability& /*capability*/, const XnChar* strPose, XnUserID nId, void* /*pCookie*/);
-void XN_CALLBACK_TYPE UserCalibration_CalibrationStart(xn::SkeletonCapability& /*capability*/, XnUserID nId, void* /*pCookie*/);
-void XN_CALLBACK_TYPE UserCalibration_CalibrationComplete(xn::SkeletonCapability& /*capability*/, XnUserID nId, XnCalibrationStatus eStatus, void* /*pCookie*/);
+// Start tracking nId, who has been calibrated or had a calibration loaded as type says. Their time
+// to tracking is recorded by UpdateTimeToTracking() once they are tracked.
+static void StartTracking(TrackingState& state, XnUserID nId, UserEventType type)
+{
+	state.pUserGenerator->GetSkeletonCap().StartTracking(nId);
+	state.startingTracking[nId] = (type == USER_EVENT_CALIBRATION_LOADED);
+	RecordEvent(state, nId, type);
+}
 
 #define CHECK_RC_RETURNING(rv, nRetVal, what)								\
 	if (nRetVal != XN_STATUS_OK)									\
@@ -60,232 +73,245 @@ void XN_CALLBACK_TYPE UserCalibration_CalibrationComplete(xn::SkeletonCapability
 		return rv;										\
 	}
 
-bool InitialiseContextFromRecording(const char* recordingFilename)
+const XnFieldOfView g_DefaultFieldOfView = { 1.0225999419141749, 0.79661567681716894 };
+
+bool EnsureDepthGenerator(xn::Context& context, xn::DepthGenerator& depthGenerator)
 {
 	XnStatus nRetVal = XN_STATUS_OK;
 
-	nRetVal = g_Context.Init();
-	CHECK_RC_RETURNING(false, nRetVal, "Init");
-	nRetVal = g_Context.OpenFileRecording(recordingFilename, g_Player);
+	nRetVal = context.FindExistingNode(XN_NODE_TYPE_DEPTH, depthGenerator);
 	if (nRetVal != XN_STATUS_OK)
 	{
-		printf("Can't open recording %s: %s\n", recordingFilename, xnGetStatusString(nRetVal));
-		return false;
+		printf("No depth generator found. Using a default one...");
+		xn::MockDepthGenerator mockDepth;
+		XnMapOutputMode defaultMode;
+		defaultMode.nXRes = 320;
+		defaultMode.nYRes = 240;
+		defaultMode.nFPS = 30;
+		if (!CreateMockDepthGenerator(context, defaultMode, g_DefaultFieldOfView, mockDepth)) {
+			return false;
+		}
+		depthGenerator = mockDepth;
 	}
+
 	return true;
 }
 
-bool InitialiseContextFromXmlConfig(const char* xmlConfigFilename)
+bool CreateMockDepthGenerator(xn::Context& context, const XnMapOutputMode& mode,
+		const XnFieldOfView& fov, xn::MockDepthGenerator& mockDepth)
 {
 	XnStatus nRetVal = XN_STATUS_OK;
-	xn::EnumerationErrors errors;
 
-	nRetVal = g_Context.InitFromXmlFile(xmlConfigFilename, g_scriptNode, &errors);
-	if (nRetVal == XN_STATUS_NO_NODE_PRESENT)
-	{
-		XnChar strError[1024];
-		errors.ToString(strError, 1024);
-		printf("%s\n", strError);
-		return false;
-	}
-	else if (nRetVal != XN_STATUS_OK)
-	{
-		printf("Open failed: %s\n", xnGetStatusString(nRetVal));
-		return false;
-	}
+	nRetVal = mockDepth.Create(context);
+	CHECK_RC_RETURNING(false, nRetVal, "Create mock depth");
 
-	return true;
-}
+	nRetVal = mockDepth.SetMapOutputMode(mode);
+	CHECK_RC_RETURNING(false, nRetVal, "set mock depth mode");
 
-bool PreMainLoop()
-{
-	if(!EnsureDepthGenerator()) {
-		std::cerr << "Error initialising depth generator.\n";
-		return false;
-	}
+	nRetVal = mockDepth.SetGeneralProperty(XN_PROP_FIELD_OF_VIEW, sizeof(fov), &fov);
+	CHECK_RC_RETURNING(false, nRetVal, "set FOV");
 
-	if(!EnsureUserGenerator()) {
-		std::cerr << "Error initialising user generator.\n";
-		return false;
-	}
-
-	if(!StartGenerating()) {
-		std::cerr << "Error starting generators.\n";
-		return false;
-	}
+	XnUInt32 nDataSize = mode.nXRes * mode.nYRes * sizeof(XnDepthPixel);
+	XnDepthPixel* pData = (XnDepthPixel*)xnOSCallocAligned(nDataSize, 1, XN_DEFAULT_MEM_ALIGN);
+	nRetVal = mockDepth.SetData(1, 0, nDataSize, pData);
+	CHECK_RC_RETURNING(false, nRetVal, "set empty depth map");
 
 	return true;
 }
 
-void PostMainLoop()
-{
-	// Clean up all resources
-	g_scriptNode.Release();
-	g_DepthGenerator.Release();
-	g_UserGenerator.Release();
-	g_Player.Release();
-	g_Context.Release();
-}
-
-bool EnsureDepthGenerator()
+bool EnsureImageGenerator(xn::Context& context, xn::ImageGenerator& imageGenerator,
+		xn::DepthGenerator& depthGenerator)
 {
 	XnStatus nRetVal = XN_STATUS_OK;
 
-	nRetVal = g_Context.FindExistingNode(XN_NODE_TYPE_DEPTH, g_DepthGenerator);
+	nRetVal = context.FindExistingNode(XN_NODE_TYPE_IMAGE, imageGenerator);
+	CHECK_RC_RETURNING(false, nRetVal, "Find image generator");
+
+	// Live sensors can be asked for RGB. Recordings keep the format they were recorded with so
+	// failure here is not fatal.
+	nRetVal = imageGenerator.SetPixelFormat(XN_PIXEL_FORMAT_RGB24);
 	if (nRetVal != XN_STATUS_OK)
 	{
-		printf("No depth generator found. Using a default one...");
-		xn::MockDepthGenerator mockDepth;
-		nRetVal = mockDepth.Create(g_Context);
-		CHECK_RC_RETURNING(false, nRetVal, "Create mock depth");
-
-		// set some defaults
-		XnMapOutputMode defaultMode;
-		defaultMode.nXRes = 320;
-		defaultMode.nYRes = 240;
-		defaultMode.nFPS = 30;
-		nRetVal = mockDepth.SetMapOutputMode(defaultMode);
-		CHECK_RC_RETURNING(false, nRetVal, "set default mode");
+		std::cerr << "Could not set RGB pixel format: " << xnGetStatusString(nRetVal) << '\n';
+	}
 
-		// set FOV
-		XnFieldOfView fov;
-		fov.fHFOV = 1.0225999419141749;
-		fov.fVFOV = 0.79661567681716894;
-		nRetVal = mockDepth.SetGeneralProperty(XN_PROP_FIELD_OF_VIEW, sizeof(fov), &fov);
-		CHECK_RC_RETURNING(false, nRetVal, "set FOV");
+	// Register the depth map to the colour camera so that depth, label and colour pixels line
+	// up. Again, recordings are stuck with the viewpoint they were recorded from.
+	if (depthGenerator.IsCapabilitySupported(XN_CAPABILITY_ALTERNATIVE_VIEW_POINT) &&
+		!depthGenerator.GetAlternativeViewPointCap().IsViewPointAs(imageGenerator))
+	{
+		nRetVal = depthGenerator.GetAlternativeViewPointCap().SetViewPoint(imageGenerator);
+		if (nRetVal != XN_STATUS_OK)
+		{
+			std::cerr << "Could not register depth to image: " << xnGetStatusString(nRetVal) << '\n';
+		}
+	}
 
-		XnUInt32 nDataSize = defaultMode.nXRes * defaultMode.nYRes * sizeof(XnDepthPixel);
-		XnDepthPixel* pData = (XnDepthPixel*)xnOSCallocAligned(nDataSize, 1, XN_DEFAULT_MEM_ALIGN);
+	return true;
+}
 
-		nRetVal = mockDepth.SetData(1, 0, nDataSize, pData);
-		CHECK_RC_RETURNING(false, nRetVal, "set empty depth map");
+void UpdateTimeToTracking(TrackingState& state)
+{
+	std::map<XnUserID, bool>::iterator it(state.startingTracking.begin());
+	while (it != state.startingTracking.end())
+	{
+		if (!state.pUserGenerator->GetSkeletonCap().IsTracking(it->first)) {
+			++it;
+			continue;
+		}
 
-		g_DepthGenerator = mockDepth;
+		std::map<XnUserID, XnUInt64>::iterator detected(state.detectionTimes.find(it->first));
+		if (detected != state.detectionTimes.end())
+		{
+			XnDouble seconds(1e-6 * (state.pUserGenerator->GetTimestamp() - detected->second));
+			state.detectionTimes.erase(detected);
+
+			if (it->second) {
+				++state.timeToTracking.nCached;
+				state.timeToTracking.fCachedSeconds += seconds;
+			} else {
+				++state.timeToTracking.nCalibrated;
+				state.timeToTracking.fCalibratedSeconds += seconds;
+			}
+		}
+		state.startingTracking.erase(it++);
 	}
-
-	return true;
 }
 
-bool EnsureUserGenerator()
+bool EnsureUserGenerator(xn::Context& context, xn::UserGenerator& userGenerator, TrackingState& state)
 {
 	XnStatus nRetVal = XN_STATUS_OK;
 
-	nRetVal = g_Context.FindExistingNode(XN_NODE_TYPE_USER, g_UserGenerator);
+	nRetVal = context.FindExistingNode(XN_NODE_TYPE_USER, userGenerator);
 	if (nRetVal != XN_STATUS_OK)
 	{
-		nRetVal = g_UserGenerator.Create(g_Context);
+		nRetVal = userGenerator.Create(context);
 		CHECK_RC_RETURNING(false, nRetVal, "Find user generator");
 	}
 
+	state.pUserGenerator = &userGenerator;
+	state.bNeedPose = FALSE;
+	state.strPose[0] = '\0';
+
 	XnCallbackHandle hUserCallbacks, hCalibrationStart, hCalibrationComplete, hPoseDetected, hCalibrationInProgress, hPoseInProgress;
-	if (!g_UserGenerator.IsCapabilitySupported(XN_CAPABILITY_SKELETON))
+	if (!userGenerator.IsCapabilitySupported(XN_CAPABILITY_SKELETON))
 	{
 		std::cerr << "Supplied user generator doesn't support skeleton\n";
 		return false;
 	}
-	nRetVal = g_UserGenerator.RegisterUserCallbacks(User_NewUser, User_LostUser, NULL, hUserCallbacks);
+	nRetVal = userGenerator.RegisterUserCallbacks(User_NewUser, User_LostUser, &state, hUserCallbacks);
 	CHECK_RC_RETURNING(false, nRetVal, "Register to user callbacks");
-	nRetVal = g_UserGenerator.GetSkeletonCap().RegisterToCalibrationStart(UserCalibration_CalibrationStart, NULL, hCalibrationStart);
+	nRetVal = userGenerator.GetSkeletonCap().RegisterToCalibrationStart(UserCalibration_CalibrationStart, &state, hCalibrationStart);
 	CHECK_RC_RETURNING(false, nRetVal, "Register to calibration start");
-	nRetVal = g_UserGenerator.GetSkeletonCap().RegisterToCalibrationComplete(UserCalibration_CalibrationComplete, NULL, hCalibrationComplete);
+	nRetVal = userGenerator.GetSkeletonCap().RegisterToCalibrationComplete(UserCalibration_CalibrationComplete, &state, hCalibrationComplete);
 	CHECK_RC_RETURNING(false, nRetVal, "Register to calibration complete");
 
-	if (g_UserGenerator.GetSkeletonCap().NeedPoseForCalibration())
+	if (userGenerator.GetSkeletonCap().NeedPoseForCalibration())
 	{
-		g_bNeedPose = TRUE;
-		if (!g_UserGenerator.IsCapabilitySupported(XN_CAPABILITY_POSE_DETECTION))
+		state.bNeedPose = TRUE;
+		if (!userGenerator.IsCapabilitySupported(XN_CAPABILITY_POSE_DETECTION))
 		{
 			std::cerr << "Pose required, but not supported\n";
 			return false;
 		}
-		nRetVal = g_UserGenerator.GetPoseDetectionCap().RegisterToPoseDetected(UserPose_PoseDetected, NULL, hPoseDetected);
+		nRetVal = userGenerator.GetPoseDetectionCap().RegisterToPoseDetected(UserPose_PoseDetected, &state, hPoseDetected);
 		CHECK_RC_RETURNING(false, nRetVal, "Register to Pose Detected");
-		g_UserGenerator.GetSkeletonCap().GetCalibrationPose(g_strPose);
+		userGenerator.GetSkeletonCap().GetCalibrationPose(state.strPose);
 	}
 
-	g_UserGenerator.GetSkeletonCap().SetSkeletonProfile(XN_SKEL_PROFILE_ALL);
-
-	return true;
-}
+	userGenerator.GetSkeletonCap().SetSkeletonProfile(XN_SKEL_PROFILE_ALL);
 
-bool StartGenerating()
-{
-	XnStatus nRetVal = XN_STATUS_OK;
-	nRetVal = g_Context.StartGeneratingAll();
-	CHECK_RC_RETURNING(false, nRetVal, "StartGenerating");
 	return true;
 }
 
 // Callback: New user was detected
-void XN_CALLBACK_TYPE User_NewUser(xn::UserGenerator& /*generator*/, XnUserID nId, void* /*pCookie*/)
+void XN_CALLBACK_TYPE User_NewUser(xn::UserGenerator& /*generator*/, XnUserID nId, void* pCookie)
 {
-	XnUInt32 epochTime = 0;
-	xnOSGetEpochTime(&epochTime);
-	printf("%d New User %d\n", epochTime, nId);
+	TrackingState& state(*static_cast<TrackingState*>(pCookie));
+	state.detectionTimes[nId] = state.pUserGenerator->GetTimestamp();
+	RecordEvent(state, nId, USER_EVENT_NEW);
+
+	// Users seen before need not calibrate again
+	if (state.pCalibrationCache && state.pCalibrationCache->Load(nId))
+	{
+		StartTracking(state, nId, USER_EVENT_CALIBRATION_LOADED);
+		return;
+	}
+
 	// New user found
-	if (g_bNeedPose)
+	if (state.bNeedPose)
 	{
-		g_UserGenerator.GetPoseDetectionCap().StartPoseDetection(g_strPose, nId);
+		state.pUserGenerator->GetPoseDetectionCap().StartPoseDetection(state.strPose, nId);
 	}
 	else
 	{
-		g_UserGenerator.GetSkeletonCap().RequestCalibration(nId, TRUE);
+		state.pUserGenerator->GetSkeletonCap().RequestCalibration(nId, TRUE);
 	}
 }
 
 // Callback: An existing user was lost
-void XN_CALLBACK_TYPE User_LostUser(xn::UserGenerator& /*generator*/, XnUserID nId, void* /*pCookie*/)
+void XN_CALLBACK_TYPE User_LostUser(xn::UserGenerator& /*generator*/, XnUserID nId, void* pCookie)
 {
-	XnUInt32 epochTime = 0;
-	xnOSGetEpochTime(&epochTime);
-	printf("%d Lost user %d\n", epochTime, nId);	
+	TrackingState& state(*static_cast<TrackingState*>(pCookie));
+	state.detectionTimes.erase(nId);
+	state.startingTracking.erase(nId);
+	if (state.pCalibrationCache)
+	{
+		state.pCalibrationCache->Forget(nId);
+	}
+	RecordEvent(state, nId, USER_EVENT_LOST);
+	if (state.pLostUserHandler)
+	{
+		state.pLostUserHandler(nId, state.pLostUserCookie);
+	}
 }
 
 // Callback: Detected a pose
-void XN_CALLBACK_TYPE UserPose_PoseDetected(xn::PoseDetectionCapability& /*capability*/, const XnChar* strPose, XnUserID nId, void* /*pCookie*/)
+void XN_CALLBACK_TYPE UserPose_PoseDetected(xn::PoseDetectionCapability& /*capability*/, const XnChar* strPose, XnUserID nId, void* pCookie)
 {
-	XnUInt32 epochTime = 0;
-	xnOSGetEpochTime(&epochTime);
-	printf("%d Pose %s detected for user %d\n", epochTime, strPose, nId);
-	g_UserGenerator.GetPoseDetectionCap().StopPoseDetection(nId);
-	g_UserGenerator.GetSkeletonCap().RequestCalibration(nId, TRUE);
+	TrackingState& state(*static_cast<TrackingState*>(pCookie));
+	RecordEvent(state, nId, USER_EVENT_POSE_DETECTED, strPose);
+	state.pUserGenerator->GetPoseDetectionCap().StopPoseDetection(nId);
+	state.pUserGenerator->GetSkeletonCap().RequestCalibration(nId, TRUE);
 }
 
 // Callback: Started calibration
-void XN_CALLBACK_TYPE UserCalibration_CalibrationStart(xn::SkeletonCapability& /*capability*/, XnUserID nId, void* /*pCookie*/)
+void XN_CALLBACK_TYPE UserCalibration_CalibrationStart(xn::SkeletonCapability& /*capability*/, XnUserID nId, void* pCookie)
 {
-	XnUInt32 epochTime = 0;
-	xnOSGetEpochTime(&epochTime);
-	printf("%d Calibration started for user %d\n", epochTime, nId);
+	TrackingState& state(*static_cast<TrackingState*>(pCookie));
+	RecordEvent(state, nId, USER_EVENT_CALIBRATION_START);
 }
 
 // Callback: Finished calibration
-void XN_CALLBACK_TYPE UserCalibration_CalibrationComplete(xn::SkeletonCapability& /*capability*/, XnUserID nId, XnCalibrationStatus eStatus, void* /*pCookie*/)
+void XN_CALLBACK_TYPE UserCalibration_CalibrationComplete(xn::SkeletonCapability& /*capability*/, XnUserID nId, XnCalibrationStatus eStatus, void* pCookie)
 {
-	XnUInt32 epochTime = 0;
-	xnOSGetEpochTime(&epochTime);
+	TrackingState& state(*static_cast<TrackingState*>(pCookie));
 	if (eStatus == XN_CALIBRATION_STATUS_OK)
 	{
 		// Calibration succeeded
-		printf("%d Calibration complete, start tracking user %d\n", epochTime, nId);		
-		g_UserGenerator.GetSkeletonCap().StartTracking(nId);
+		StartTracking(state, nId, USER_EVENT_CALIBRATION_COMPLETE);
+		if (state.pCalibrationCache)
+		{
+			state.pCalibrationCache->Save(nId);
+		}
 	}
 	else
 	{
 		// Calibration failed
-		printf("%d Calibration failed for user %d\n", epochTime, nId);
 		if(eStatus==XN_CALIBRATION_STATUS_MANUAL_ABORT)
 		{
-			printf("Manual abort occured, stop attempting to calibrate!");
+			// Stop attempting to calibrate
+			RecordEvent(state, nId, USER_EVENT_CALIBRATION_FAILED, "manual abort");
 			return;
 		}
-		if (g_bNeedPose)
+		RecordEvent(state, nId, USER_EVENT_CALIBRATION_FAILED);
+		if (state.bNeedPose)
 		{
-			g_UserGenerator.GetPoseDetectionCap().StartPoseDetection(g_strPose, nId);
+			state.pUserGenerator->GetPoseDetectionCap().StartPoseDetection(state.strPose, nId);
 		}
 		else
 		{
-			g_UserGenerator.GetSkeletonCap().RequestCalibration(nId, TRUE);
+			state.pUserGenerator->GetSkeletonCap().RequestCalibration(nId, TRUE);
 		}
 	}
 }
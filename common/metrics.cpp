@@ -0,0 +1,209 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// How quickly and reliably users are acquired and tracked
+//---------------------------------------------------------------------------
+#include <algorithm>
+#include <cstring>
+
+#include "framesink.h"
+#include "metrics.h"
+
+using namespace H5;
+
+double UserLifecycle::TimeToTrackingMs() const
+{
+	if ((new_user_ms < 0.) || (tracking_ms < 0.)) {
+		return -1.;
+	}
+	return tracking_ms - new_user_ms;
+}
+
+CompType MakeUserLifecycleDataType()
+{
+	CompType dt(sizeof(UserLifecycle));
+	dt.insertMember(H5std_string("user"), HOFFSET(UserLifecycle, user), PredType::NATIVE_UINT16);
+	dt.insertMember(H5std_string("new_user_ms"), HOFFSET(UserLifecycle, new_user_ms),
+			PredType::NATIVE_DOUBLE);
+	dt.insertMember(H5std_string("pose_detected_ms"), HOFFSET(UserLifecycle, pose_detected_ms),
+			PredType::NATIVE_DOUBLE);
+	dt.insertMember(H5std_string("calibration_start_ms"), HOFFSET(UserLifecycle, calibration_start_ms),
+			PredType::NATIVE_DOUBLE);
+	dt.insertMember(H5std_string("calibration_complete_ms"),
+			HOFFSET(UserLifecycle, calibration_complete_ms), PredType::NATIVE_DOUBLE);
+	dt.insertMember(H5std_string("tracking_ms"), HOFFSET(UserLifecycle, tracking_ms),
+			PredType::NATIVE_DOUBLE);
+	dt.insertMember(H5std_string("lost_ms"), HOFFSET(UserLifecycle, lost_ms), PredType::NATIVE_DOUBLE);
+	dt.insertMember(H5std_string("calibration_failures"), HOFFSET(UserLifecycle, calibration_failures),
+			PredType::NATIVE_UINT32);
+	dt.insertMember(H5std_string("cached"), HOFFSET(UserLifecycle, cached), PredType::NATIVE_UINT8);
+	dt.insertMember(H5std_string("frames"), HOFFSET(UserLifecycle, frames), PredType::NATIVE_UINT64);
+	dt.insertMember(H5std_string("tracked_frames"), HOFFSET(UserLifecycle, tracked_frames),
+			PredType::NATIVE_UINT64);
+	return dt;
+}
+
+TrackingMetrics::TrackingMetrics()
+	: n_frames_(0)
+{
+	memset(confidence_histogram_, 0, sizeof(confidence_histogram_));
+}
+
+UserLifecycle& TrackingMetrics::Begin(uint16_t user)
+{
+	UserLifecycle life;
+	life.user = user;
+	life.new_user_ms = life.pose_detected_ms = life.calibration_start_ms = -1.;
+	life.calibration_complete_ms = -1.;
+	life.tracking_ms = life.lost_ms = -1.;
+	life.calibration_failures = 0;
+	life.cached = 0;
+	life.frames = life.tracked_frames = 0;
+
+	current_[user] = users_.size();
+	users_.push_back(life);
+	return users_.back();
+}
+
+UserLifecycle& TrackingMetrics::Current(uint16_t user)
+{
+	std::map<uint16_t, size_t>::const_iterator it(current_.find(user));
+	if (it == current_.end()) {
+		return Begin(user);
+	}
+	return users_[it->second];
+}
+
+void TrackingMetrics::AddEvents(const std::vector<UserEvent>& events)
+{
+	for (size_t i = 0; i < events.size(); ++i)
+	{
+		const UserEvent& event(events[i]);
+		double ms(1e-3 * event.timestamp);
+
+		switch (event.type)
+		{
+			case USER_EVENT_NEW:
+				Begin(event.user).new_user_ms = ms;
+				break;
+			case USER_EVENT_POSE_DETECTED:
+				Current(event.user).pose_detected_ms = ms;
+				break;
+			case USER_EVENT_CALIBRATION_START:
+				Current(event.user).calibration_start_ms = ms;
+				break;
+			case USER_EVENT_CALIBRATION_COMPLETE:
+				Current(event.user).calibration_complete_ms = ms;
+				break;
+			case USER_EVENT_CALIBRATION_FAILED:
+				++Current(event.user).calibration_failures;
+				break;
+			case USER_EVENT_CALIBRATION_LOADED:
+				Current(event.user).calibration_complete_ms = ms;
+				Current(event.user).cached = 1;
+				break;
+			case USER_EVENT_LOST:
+				Current(event.user).lost_ms = ms;
+				current_.erase(event.user);
+				break;
+		}
+	}
+}
+
+void TrackingMetrics::AddFrame(const FrameSnapshot& frame)
+{
+	++n_frames_;
+
+	for (size_t i = 0; i < frame.users.size(); ++i)
+	{
+		const TrackedUser& user(frame.users[i]);
+		UserLifecycle& life(Current(user.user));
+		++life.frames;
+		if (frame.user_states[i] != USER_TRACKING) {
+			continue;
+		}
+
+		if (life.tracked_frames++ == 0) {
+			life.tracking_ms = 1e-3 * frame.timestamp;
+		}
+		for (int j = 0; j < user.n_joints; ++j)
+		{
+			const Joint& joint(user.joints[j]);
+			if ((joint.id < 1) || (joint.id > g_NumJointTypes)) {
+				continue;
+			}
+			int bin(static_cast<int>(joint.confidence * n_confidence_bins));
+			bin = std::max(0, std::min(n_confidence_bins - 1, bin));
+			++confidence_histogram_[joint.id - 1][bin];
+		}
+	}
+}
+
+TrackingMetrics::Summary TrackingMetrics::Summarise() const
+{
+	Summary summary;
+	summary.users = static_cast<uint32_t>(users_.size());
+	summary.tracked_users = summary.cached_users = 0;
+	summary.mean_time_to_tracking_ms = summary.median_time_to_tracking_ms = -1.;
+	summary.max_time_to_tracking_ms = -1.;
+
+	std::vector<double> times;
+	uint64_t frames(0), tracked_frames(0);
+	for (size_t i = 0; i < users_.size(); ++i)
+	{
+		const UserLifecycle& life(users_[i]);
+		frames += life.frames;
+		tracked_frames += life.tracked_frames;
+		if (life.tracked_frames > 0) {
+			++summary.tracked_users;
+		}
+		if (life.cached) {
+			++summary.cached_users;
+		}
+		if (life.TimeToTrackingMs() >= 0.) {
+			times.push_back(life.TimeToTrackingMs());
+		}
+	}
+
+	if (!times.empty())
+	{
+		std::sort(times.begin(), times.end());
+		double total(0.);
+		for (size_t i = 0; i < times.size(); ++i)
+		{
+			total += times[i];
+		}
+		summary.mean_time_to_tracking_ms = total / times.size();
+		summary.median_time_to_tracking_ms = (times.size() % 2)
+			? times[times.size() / 2]
+			: 0.5 * (times[times.size() / 2 - 1] + times[times.size() / 2]);
+		summary.max_time_to_tracking_ms = times.back();
+	}
+
+	summary.tracked_frame_ratio = (frames > 0) ? static_cast<double>(tracked_frames) / frames : 0.;
+
+	return summary;
+}
+
+void TrackingMetrics::Print(std::ostream& os) const
+{
+	Summary summary(Summarise());
+	os << "Tracked " << summary.tracked_users << " of " << summary.users << " user(s) ("
+		<< summary.cached_users << " from cached calibrations) in " << n_frames_ << " frame(s). "
+		<< "Users were tracked in " << 100. * summary.tracked_frame_ratio << "% of the frames they were in.\n";
+}
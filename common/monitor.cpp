@@ -0,0 +1,113 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+#include <cstdlib> // for EXIT_SUCCESS
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "arghelpers.h"
+#include "monitor.h"
+#include "wallclock.h"
+
+int RunMonitor(int argc, char** argv, Monitor& monitor, const char* usage, const char* source,
+		const option::Descriptor* extra_options)
+{
+	// The usage table is the common options with the tool's own inserted after --help
+	std::string program(usage);
+	program = program.substr(0, program.find(' '));
+	const std::string header("Usage:\n  " + std::string(usage) + "\n  " + program + " --self-test N\n\nOptions:");
+	const option::Descriptor head[] = {
+		{ MONITOR_UNKNOWN,   0, "",   "",          option::Arg::None, header.c_str() },
+		{ MONITOR_HELP,      0, "h?", "help",      option::Arg::None, "  --help, -h, -?  \tPrint a brief usage summary." },
+	};
+	const option::Descriptor tail[] = {
+		{ MONITOR_DURATION,  0, "d",  "duration",  Arg::Numeric,      "  --duration, -d SECONDS  \tStop after the specified duration." },
+		{ MONITOR_VERBOSE,   0, "v",  "verbose",   option::Arg::None, "  --verbose, -v  \tPrint every frame received." },
+		{ MONITOR_SELF_TEST, 0, "",   "self-test", Arg::Numeric,      "  --self-test N  \tSend N frames to ourselves and check them." },
+		{ 0,0,0,0,0,0 } // Zero record marking end of array.
+	};
+	std::vector<option::Descriptor> descriptors;
+	for (size_t i = 0; i < sizeof(head) / sizeof(head[0]); ++i)
+	{
+		descriptors.push_back(head[i]);
+	}
+	for (const option::Descriptor* p_extra = extra_options; p_extra->shortopt; ++p_extra)
+	{
+		descriptors.push_back(*p_extra);
+	}
+	for (size_t i = 0; i < sizeof(tail) / sizeof(tail[0]); ++i)
+	{
+		descriptors.push_back(tail[i]);
+	}
+	const option::Descriptor* p_usage(&descriptors[0]);
+
+	// Parse command-line options
+	argc-=(argc>0); argv+=(argc>0); // skip program name argv[0] if present
+	option::Stats  stats(p_usage, argc, argv);
+	option::Option options[stats.options_max], buffer[stats.buffer_max];
+	option::Parser parse(p_usage, argc, argv, options, buffer);
+
+	if (parse.error()) {
+		return EXIT_FAILURE;
+	}
+
+	if (options[MONITOR_HELP]) {
+		option::printUsage(std::cout, p_usage);
+		return EXIT_SUCCESS;
+	}
+
+	if (options[MONITOR_SELF_TEST]) {
+		long n_frames(strtol(options[MONITOR_SELF_TEST].arg, NULL, 10));
+		if (n_frames < 1) {
+			std::cerr << "Number of frames must be positive.\n";
+			return EXIT_FAILURE;
+		}
+		return monitor.SelfTest(static_cast<int>(n_frames));
+	}
+
+	if (parse.nonOptionsCount() != 1) {
+		std::cerr << "Error: " << source << " must be specified.\n";
+		option::printUsage(std::cerr, p_usage);
+		return EXIT_FAILURE;
+	}
+
+	double duration(0.);
+	if (options[MONITOR_DURATION]) {
+		duration = static_cast<double>(strtol(options[MONITOR_DURATION].arg, NULL, 10));
+	}
+
+	if (!monitor.Open(parse.nonOption(0), options)) {
+		return EXIT_FAILURE;
+	}
+
+	// Report once a second
+	uint64_t start(WallClockMicroseconds()), last_report(start);
+	while ((duration <= 0.) || (WallClockMicroseconds() - start < 1e6 * duration))
+	{
+		monitor.Poll(options[MONITOR_VERBOSE]);
+
+		uint64_t now(WallClockMicroseconds());
+		if (now - last_report >= 1000000) {
+			monitor.Report(1e-6 * (now - last_report));
+			last_report = now;
+		}
+	}
+	monitor.Report(1e-6 * (WallClockMicroseconds() - last_report));
+
+	return EXIT_SUCCESS;
+}
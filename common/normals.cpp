@@ -0,0 +1,289 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Surface normal estimation for user pixels
+//
+// All filters work on one float plane per co-ordinate and are separable so
+// that inner loops run along contiguous rows of memory. They are written to
+// be auto-vectorised by the compiler rather than with explicit intrinsics.
+//---------------------------------------------------------------------------
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+#include "normals.h"
+
+namespace {
+
+// Number of times non-user pixels are grown into from their neighbours
+const int g_NumDilations = 4;
+
+// Gaussian blur radius. As for scipy, truncate at four standard deviations.
+const int g_BlurRadius = 4;
+
+// Padding needed around a user's bounding box for all of the above and the gradients
+const int g_Margin = g_NumDilations + g_BlurRadius + 1;
+
+// A rectangular region of the frame
+struct Box {
+	int r0, r1, c0, c1; // half-open
+};
+
+// A single channel image with rows of contiguous floats
+struct Plane {
+	int rows, cols;
+	std::vector<float> data;
+
+	void Resize(int r, int c) { rows = r; cols = c; data.resize(r * c); }
+	float* Row(int r) { return &data[r * cols]; }
+	const float* Row(int r) const { return &data[r * cols]; }
+};
+
+// out = maximum of in over a 3x3 neighbourhood, only for pixels where mask is false.
+void DilateMasked(const Plane& in, const std::vector<uint8_t>& mask, Plane& tmp, Plane& out)
+{
+	const int rows(in.rows), cols(in.cols);
+
+	// Horizontal pass
+	for (int r = 0; r < rows; ++r)
+	{
+		const float* src(in.Row(r));
+		float* dst(tmp.Row(r));
+		dst[0] = std::max(src[0], src[1]);
+		for (int c = 1; c < cols - 1; ++c)
+		{
+			dst[c] = std::max(std::max(src[c-1], src[c]), src[c+1]);
+		}
+		dst[cols-1] = std::max(src[cols-2], src[cols-1]);
+	}
+
+	// Vertical pass, keeping the original value of masked pixels
+	for (int r = 0; r < rows; ++r)
+	{
+		const float* above(tmp.Row(std::max(r - 1, 0)));
+		const float* here(tmp.Row(r));
+		const float* below(tmp.Row(std::min(r + 1, rows - 1)));
+		const float* orig(in.Row(r));
+		const uint8_t* m(&mask[r * cols]);
+		float* dst(out.Row(r));
+		for (int c = 0; c < cols; ++c)
+		{
+			float grown(std::max(std::max(above[c], here[c]), below[c]));
+			dst[c] = m[c] ? orig[c] : grown;
+		}
+	}
+}
+
+// out = in convolved with kernel of half-width g_BlurRadius in both directions.
+void Blur(const Plane& in, const float* kernel, Plane& tmp, Plane& out)
+{
+	const int rows(in.rows), cols(in.cols), R(g_BlurRadius);
+
+	// Horizontal pass. Edge pixels are replicated.
+	std::vector<float> padded(cols + 2 * R);
+	for (int r = 0; r < rows; ++r)
+	{
+		const float* src(in.Row(r));
+		std::fill(padded.begin(), padded.begin() + R, src[0]);
+		std::copy(src, src + cols, padded.begin() + R);
+		std::fill(padded.begin() + R + cols, padded.end(), src[cols-1]);
+
+		float* dst(tmp.Row(r));
+		for (int c = 0; c < cols; ++c)
+		{
+			dst[c] = 0.f;
+		}
+		for (int k = -R; k <= R; ++k)
+		{
+			const float w(kernel[k + R]);
+			const float* p(&padded[R + k]);
+			for (int c = 0; c < cols; ++c)
+			{
+				dst[c] += w * p[c];
+			}
+		}
+	}
+
+	// Vertical pass, accumulating whole rows at a time
+	for (int r = 0; r < rows; ++r)
+	{
+		float* dst(out.Row(r));
+		for (int c = 0; c < cols; ++c)
+		{
+			dst[c] = 0.f;
+		}
+		for (int k = -R; k <= R; ++k)
+		{
+			const float w(kernel[k + R]);
+			const float* src(tmp.Row(std::min(std::max(r + k, 0), rows - 1)));
+			for (int c = 0; c < cols; ++c)
+			{
+				dst[c] += w * src[c];
+			}
+		}
+	}
+}
+
+// Central difference gradients along rows (d_row) and columns (d_col) at (r, c).
+inline void Gradient(const Plane& p, int r, int c, float& d_row, float& d_col)
+{
+	d_row = 0.5f * (p.Row(r + 1)[c] - p.Row(r - 1)[c]);
+	d_col = 0.5f * (p.Row(r)[c + 1] - p.Row(r)[c - 1]);
+}
+
+} // namespace
+
+void ComputeNormals(const float* points, const uint16_t* labels, int rows, int cols,
+		std::vector<int8_t>& normals)
+{
+	normals.assign(rows * cols * 3, 0);
+
+	// Find the bounding box of each user
+	std::map<uint16_t, Box> boxes;
+	for (int r = 0; r < rows; ++r)
+	{
+		for (int c = 0; c < cols; ++c)
+		{
+			uint16_t label(labels[r * cols + c]);
+			if (label == 0) {
+				continue;
+			}
+
+			std::map<uint16_t, Box>::iterator it(boxes.find(label));
+			if (it == boxes.end()) {
+				Box box = { r, r + 1, c, c + 1 };
+				boxes[label] = box;
+			} else {
+				Box& box(it->second);
+				box.r0 = std::min(box.r0, r); box.r1 = std::max(box.r1, r + 1);
+				box.c0 = std::min(box.c0, c); box.c1 = std::max(box.c1, c + 1);
+			}
+		}
+	}
+
+	// Normalised Gaussian kernel with unit standard deviation
+	float kernel[2 * g_BlurRadius + 1], kernel_sum(0.f);
+	for (int k = -g_BlurRadius; k <= g_BlurRadius; ++k)
+	{
+		kernel[k + g_BlurRadius] = std::exp(-0.5f * k * k);
+		kernel_sum += kernel[k + g_BlurRadius];
+	}
+	for (int k = 0; k < 2 * g_BlurRadius + 1; ++k)
+	{
+		kernel[k] /= kernel_sum;
+	}
+
+	Plane planes[3], tmp, grown;
+	std::vector<uint8_t> mask;
+
+	for (std::map<uint16_t, Box>::const_iterator it = boxes.begin(); it != boxes.end(); ++it)
+	{
+		const uint16_t user(it->first);
+		const int r0(std::max(it->second.r0 - g_Margin, 0)), r1(std::min(it->second.r1 + g_Margin, rows));
+		const int c0(std::max(it->second.c0 - g_Margin, 0)), c1(std::min(it->second.c1 + g_Margin, cols));
+		const int box_rows(r1 - r0), box_cols(c1 - c0);
+
+		// Need at least a 3x3 region for the filters to make sense
+		if ((box_rows < 3) || (box_cols < 3)) {
+			continue;
+		}
+
+		// Copy this user's points into one plane per co-ordinate. Other pixels are set to the
+		// minimum co-ordinate so that dilation grows the user outwards.
+		mask.resize(box_rows * box_cols);
+		tmp.Resize(box_rows, box_cols);
+		grown.Resize(box_rows, box_cols);
+		for (int ch = 0; ch < 3; ++ch)
+		{
+			planes[ch].Resize(box_rows, box_cols);
+		}
+
+		float minimum[3] = { 0.f, 0.f, 0.f };
+		for (int r = 0; r < box_rows; ++r)
+		{
+			for (int c = 0; c < box_cols; ++c)
+			{
+				const int idx((r + r0) * cols + (c + c0));
+				mask[r * box_cols + c] = (labels[idx] == user);
+				if (mask[r * box_cols + c]) {
+					for (int ch = 0; ch < 3; ++ch)
+					{
+						minimum[ch] = std::min(minimum[ch], points[idx * 3 + ch]);
+					}
+				}
+			}
+		}
+		for (int ch = 0; ch < 3; ++ch)
+		{
+			for (int r = 0; r < box_rows; ++r)
+			{
+				float* dst(planes[ch].Row(r));
+				const uint8_t* m(&mask[r * box_cols]);
+				const float* src(&points[((r + r0) * cols + c0) * 3 + ch]);
+				for (int c = 0; c < box_cols; ++c)
+				{
+					dst[c] = m[c] ? src[c * 3] : minimum[ch];
+				}
+			}
+
+			for (int i = 0; i < g_NumDilations; ++i)
+			{
+				DilateMasked(planes[ch], mask, tmp, grown);
+				std::swap(planes[ch], grown);
+			}
+
+			Blur(planes[ch], kernel, tmp, grown);
+			std::swap(planes[ch], grown);
+		}
+
+		// Normal is the cross product of the row tangent and the negated column tangent (since
+		// columns run along -ve y).
+		for (int r = 1; r < box_rows - 1; ++r)
+		{
+			for (int c = 1; c < box_cols - 1; ++c)
+			{
+				if (!mask[r * box_cols + c]) {
+					continue;
+				}
+
+				float a[3], b[3];
+				for (int ch = 0; ch < 3; ++ch)
+				{
+					Gradient(planes[ch], r, c, a[ch], b[ch]);
+					b[ch] = -b[ch];
+				}
+
+				float n[3] = {
+					a[1] * b[2] - a[2] * b[1],
+					a[2] * b[0] - a[0] * b[2],
+					a[0] * b[1] - a[1] * b[0],
+				};
+				float len(std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]));
+				if (len == 0.f) {
+					continue;
+				}
+
+				int8_t* out(&normals[((r + r0) * cols + (c + c0)) * 3]);
+				for (int ch = 0; ch < 3; ++ch)
+				{
+					out[ch] = static_cast<int8_t>(std::floor(g_NormalScale * n[ch] / len + 0.5f));
+				}
+			}
+		}
+	}
+}
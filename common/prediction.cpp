@@ -0,0 +1,170 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+#include "prediction.h"
+
+#include <cmath>
+#include <cstring>
+
+double JointPredictor::JointError::Mean() const
+{
+	return (count > 0) ? sum_mm / static_cast<double>(count) : 0.;
+}
+
+double JointPredictor::JointError::Rms() const
+{
+	return (count > 0) ? std::sqrt(sum_sq_mm / static_cast<double>(count)) : 0.;
+}
+
+JointPredictor::JointPredictor(const PredictionParams& params)
+	: params_(params)
+{
+	memset(errors_, 0, sizeof(errors_));
+}
+
+void JointPredictor::Predict(uint16_t user, uint64_t timestamp, const Joint* joints, int n, Joint* out)
+{
+	std::map<uint16_t, UserState>::iterator it(users_.find(user));
+	if (it == users_.end()) {
+		it = users_.insert(std::make_pair(user, UserState())).first;
+		UserState& fresh(it->second);
+		fresh.timestamp = timestamp;
+		memset(fresh.value, 0, sizeof(fresh.value));
+		memset(fresh.speed, 0, sizeof(fresh.speed));
+		memset(fresh.has_value, 0, sizeof(fresh.has_value));
+		memset(fresh.has_speed, 0, sizeof(fresh.has_speed));
+	}
+	UserState& state(it->second);
+
+	float raw[g_JointArraySize], present[g_JointArraySize];
+	ScatterJoints(joints, n, raw, present);
+
+	// Score earlier predictions now that we know where the joints went
+	Score(state, timestamp, raw, present);
+
+	// Time since the previous frame. Repeated timestamps give no motion information.
+	float dt(1e-6f * static_cast<float>(timestamp - state.timestamp));
+	float motion((timestamp > state.timestamp) ? 1.f : 0.f);
+	float inv_dt(motion / ((dt > 0.f) ? dt : 1.f));
+
+	// Extrapolate. Values need one previous frame for a velocity and two for an acceleration;
+	// without them the model degrades to constant position or velocity. Absent joints lose their
+	// history.
+	const float h(1e-3f * params_.horizon_ms);
+	const float accel_weight(params_.use_acceleration ? 0.5f * h * h : 0.f);
+	Pending prediction;
+	prediction.target = timestamp + static_cast<uint64_t>(1e3f * params_.horizon_ms);
+	for (int i = 0; i < g_JointArraySize; ++i)
+	{
+		float has_speed(state.has_value[i] * motion);
+		float has_accel(state.has_speed[i] * has_speed);
+		float speed(has_speed * (raw[i] - state.value[i]) * inv_dt);
+		float accel(has_accel * (speed - state.speed[i]) * inv_dt);
+
+		prediction.value[i] = raw[i] + speed * h + accel * accel_weight;
+		prediction.valid[i] = present[i];
+
+		// Keep the old velocity if this frame repeated the last one's timestamp
+		state.speed[i] = motion * speed + (1.f - motion) * state.speed[i];
+		state.has_speed[i] = present[i] * (motion * has_speed + (1.f - motion) * state.has_speed[i]);
+		state.value[i] = raw[i];
+		state.has_value[i] = present[i];
+	}
+	if (timestamp > state.timestamp) {
+		state.timestamp = timestamp;
+	}
+
+	// Confidence falls the further ahead the prediction
+	GatherJoints(joints, n, prediction.value, out);
+	const float decay(std::exp2(-params_.horizon_ms / params_.half_life_ms));
+	for (int i = 0; i < n; ++i)
+	{
+		out[i].confidence *= decay;
+	}
+
+	if (params_.horizon_ms > 0.f) {
+		state.pending.push_back(prediction);
+	}
+}
+
+void JointPredictor::Score(UserState& state, uint64_t timestamp, const float* value, const float* present)
+{
+	while (!state.pending.empty() && (state.pending.front().target <= timestamp))
+	{
+		const Pending& pending(state.pending.front());
+
+		// Interpolate the real position at the target time from the frames either side of it.
+		// Predictions whose target fell before the previous frame, e.g. after a gap in tracking,
+		// cannot be scored.
+		if ((pending.target >= state.timestamp) && (timestamp > state.timestamp)) {
+			float f(static_cast<float>(pending.target - state.timestamp) /
+					static_cast<float>(timestamp - state.timestamp));
+			for (int j = 0; j < g_NumJointTypes; ++j)
+			{
+				int i(j * g_JointCoords);
+				if ((pending.valid[i] == 0.f) || (present[i] == 0.f) || (state.has_value[i] == 0.f)) {
+					continue;
+				}
+
+				double sq(0.);
+				for (int c = 0; c < 3; ++c)
+				{
+					float actual(state.value[i + c] + f * (value[i + c] - state.value[i + c]));
+					double d(pending.value[i + c] - actual);
+					sq += d * d;
+				}
+				double err(std::sqrt(sq));
+
+				JointError& stats(errors_[j]);
+				++stats.count;
+				stats.sum_mm += err;
+				stats.sum_sq_mm += sq;
+				if (err > stats.max_mm) {
+					stats.max_mm = err;
+				}
+			}
+		}
+
+		state.pending.pop_front();
+	}
+}
+
+void JointPredictor::Reset(uint16_t user)
+{
+	users_.erase(user);
+}
+
+void JointPredictor::ResetErrors()
+{
+	memset(errors_, 0, sizeof(errors_));
+}
+
+JointPredictor::JointError JointPredictor::TotalError() const
+{
+	JointError total;
+	memset(&total, 0, sizeof(total));
+	for (int j = 0; j < g_NumJointTypes; ++j)
+	{
+		total.count += errors_[j].count;
+		total.sum_mm += errors_[j].sum_mm;
+		total.sum_sq_mm += errors_[j].sum_sq_mm;
+		if (errors_[j].max_mm > total.max_mm) {
+			total.max_mm = errors_[j].max_mm;
+		}
+	}
+	return total;
+}
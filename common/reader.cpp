@@ -0,0 +1,304 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Random-access reading of logs written by DepthMapLogger
+//---------------------------------------------------------------------------
+#include <limits>
+#include <stdexcept>
+
+#include "reader.h"
+
+using namespace H5;
+
+namespace {
+
+// Read a whole dataset named name within group into out, resizing it to fit.
+template<typename T>
+void ReadDataSet(Group& group, const char* name, const PredType& type, std::vector<T>& out,
+		hsize_t* dims = NULL)
+{
+	DataSet ds(group.openDataSet(name));
+	DataSpace space(ds.getSpace());
+	out.resize(space.getSimpleExtentNpoints());
+	if (dims) {
+		space.getSimpleExtentDims(dims);
+	}
+	if (!out.empty()) {
+		ds.read(&out[0], type);
+	}
+}
+
+} // namespace
+
+FrameReader::FrameReader()
+	: p_file_(NULL), p_frames_group_(NULL)
+	, joint_dt_(MakeJointDataType())
+	, last_requested_(std::numeric_limits<size_t>::max())
+	, stopping_(false)
+{
+}
+
+FrameReader::~FrameReader()
+{
+	Close();
+}
+
+void FrameReader::Open(const char* filename, const Options& options)
+{
+	Close();
+
+	options_ = options;
+
+	// Size the raw data chunk cache. The slot count should be a prime around a hundred times
+	// the number of chunks which fit in the cache.
+	FileAccPropList access_props;
+	access_props.setCache(0, 12421, options_.chunk_cache_bytes, 0.75);
+
+	p_file_ = new H5File(filename, H5F_ACC_RDONLY, FileCreatPropList::DEFAULT, access_props);
+	p_frames_group_ = new Group(p_file_->openGroup(options_.frames_path));
+
+	hsize_t n_frames(p_frames_group_->getNumObjs());
+	frame_names_.resize(n_frames);
+	for (hsize_t i = 0; i < n_frames; ++i)
+	{
+		frame_names_[i] = p_frames_group_->getObjnameByIdx(i);
+	}
+
+	stopping_ = false;
+	if (options_.prefetch_frames > 0) {
+		prefetch_thread_ = std::thread(&FrameReader::Prefetch, this);
+	}
+}
+
+void FrameReader::Close()
+{
+	{
+		std::lock_guard<std::mutex> lock(cache_mutex_);
+		stopping_ = true;
+		prefetch_queue_.clear();
+	}
+	prefetch_wanted_.notify_all();
+	if (prefetch_thread_.joinable()) {
+		prefetch_thread_.join();
+	}
+
+	cache_.clear();
+	lru_.clear();
+	loading_.clear();
+	frame_names_.clear();
+	last_requested_ = std::numeric_limits<size_t>::max();
+
+	delete p_frames_group_;
+	delete p_file_;
+	p_frames_group_ = NULL;
+	p_file_ = NULL;
+}
+
+FrameReader::Range FrameReader::range(size_t begin, size_t end)
+{
+	if (end > size()) {
+		end = size();
+	}
+	if (begin > end) {
+		begin = end;
+	}
+	return Range(this, begin, end);
+}
+
+LogFramePtr FrameReader::frame(size_t i)
+{
+	if (i >= size()) {
+		throw std::out_of_range("frame index out of range");
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(cache_mutex_);
+
+		// Sequential access predicts what is wanted next. A seek elsewhere abandons any
+		// outstanding read-ahead.
+		if (options_.prefetch_frames > 0) {
+			if (i != last_requested_ + 1) {
+				prefetch_queue_.clear();
+			}
+			for (size_t j = i + 1; (j <= i + options_.prefetch_frames) && (j < size()); ++j)
+			{
+				if ((cache_.find(j) == cache_.end()) && (loading_.count(j) == 0) &&
+					((prefetch_queue_.empty()) || (j > prefetch_queue_.back())))
+				{
+					prefetch_queue_.push_back(j);
+				}
+			}
+			prefetch_wanted_.notify_one();
+		}
+		last_requested_ = i;
+
+		for (;;)
+		{
+			std::map<size_t, std::pair<LogFramePtr, std::list<size_t>::iterator> >::iterator
+				it(cache_.find(i));
+			if (it != cache_.end()) {
+				lru_.splice(lru_.begin(), lru_, it->second.second);
+				return it->second.first;
+			}
+
+			// Wait for another thread which is already reading this frame
+			if (loading_.count(i) == 0) {
+				break;
+			}
+			frame_loaded_.wait(lock);
+		}
+
+		loading_.insert(i);
+	}
+
+	LogFramePtr frame;
+	try
+	{
+		frame = Read(i);
+	}
+	catch (...)
+	{
+		std::lock_guard<std::mutex> lock(cache_mutex_);
+		loading_.erase(i);
+		frame_loaded_.notify_all();
+		throw;
+	}
+
+	std::lock_guard<std::mutex> lock(cache_mutex_);
+	Insert(i, frame);
+	return frame;
+}
+
+void FrameReader::Insert(size_t i, const LogFramePtr& frame)
+{
+	// Called with cache_mutex_ held
+	loading_.erase(i);
+	if (cache_.find(i) == cache_.end()) {
+		lru_.push_front(i);
+		cache_[i] = std::make_pair(frame, lru_.begin());
+	}
+
+	while ((cache_.size() > options_.cache_frames) && !lru_.empty())
+	{
+		cache_.erase(lru_.back());
+		lru_.pop_back();
+	}
+
+	frame_loaded_.notify_all();
+}
+
+void FrameReader::Prefetch()
+{
+	std::unique_lock<std::mutex> lock(cache_mutex_);
+	for (;;)
+	{
+		while (prefetch_queue_.empty() && !stopping_)
+		{
+			prefetch_wanted_.wait(lock);
+		}
+		if (stopping_) {
+			return;
+		}
+
+		size_t i(prefetch_queue_.front());
+		prefetch_queue_.pop_front();
+		if ((cache_.find(i) != cache_.end()) || (loading_.count(i) != 0)) {
+			continue;
+		}
+		loading_.insert(i);
+
+		lock.unlock();
+		LogFramePtr frame;
+		try
+		{
+			frame = Read(i);
+		}
+		catch (...)
+		{
+			// Leave the error to be reported if the frame is actually asked for
+		}
+		lock.lock();
+
+		if (frame) {
+			Insert(i, frame);
+		} else {
+			loading_.erase(i);
+			frame_loaded_.notify_all();
+		}
+	}
+}
+
+LogFramePtr FrameReader::Read(size_t i)
+{
+	std::lock_guard<std::mutex> lock(h5_mutex_);
+
+	std::shared_ptr<LogFrame> frame(new LogFrame);
+	frame->idx = i;
+	frame->frame_id = 0;
+	frame->timestamp = 0;
+	frame->x_to_z = 0.;
+	frame->y_to_z = 0.;
+
+	Group frame_group(p_frames_group_->openGroup(frame_names_[i]));
+	if (frame_group.attrExists("frame_id")) {
+		frame_group.openAttribute("frame_id").read(PredType::NATIVE_UINT32, &frame->frame_id);
+	}
+	if (frame_group.attrExists("timestamp")) {
+		frame_group.openAttribute("timestamp").read(PredType::NATIVE_UINT64, &frame->timestamp);
+	}
+	if (frame_group.attrExists("x_to_z") && frame_group.attrExists("y_to_z")) {
+		frame_group.openAttribute("x_to_z").read(PredType::NATIVE_DOUBLE, &frame->x_to_z);
+		frame_group.openAttribute("y_to_z").read(PredType::NATIVE_DOUBLE, &frame->y_to_z);
+	}
+
+	hsize_t dims[2] = { 0, 0 };
+	ReadDataSet(frame_group, "depth", PredType::NATIVE_UINT16, frame->depth, dims);
+	frame->rows = static_cast<int>(dims[0]);
+	frame->cols = static_cast<int>(dims[1]);
+	ReadDataSet(frame_group, "label", PredType::NATIVE_UINT16, frame->label);
+
+	if (frame_group.exists("points")) {
+		ReadDataSet(frame_group, "points", PredType::NATIVE_FLOAT, frame->points);
+		ReadDataSet(frame_group, "point_labels", PredType::NATIVE_UINT16, frame->point_labels);
+	}
+
+	if (frame_group.exists("users")) {
+		Group users_group(frame_group.openGroup("users"));
+		hsize_t n_users(users_group.getNumObjs());
+		frame->users.resize(n_users);
+		for (hsize_t u = 0; u < n_users; ++u)
+		{
+			LogFrame::User& user(frame->users[u]);
+			Group user_group(users_group.openGroup(users_group.getObjnameByIdx(u)));
+			user_group.openAttribute("idx").read(PredType::NATIVE_UINT16, &user.idx);
+
+			Attribute state_attr(user_group.openAttribute("state"));
+			state_attr.read(state_attr.getStrType(), user.state);
+
+			if (user_group.exists("joints")) {
+				DataSet joints_ds(user_group.openDataSet("joints"));
+				user.joints.resize(joints_ds.getSpace().getSimpleExtentNpoints());
+				if (!user.joints.empty()) {
+					joints_ds.read(&user.joints[0], joint_dt_);
+				}
+			}
+		}
+	}
+
+	return frame;
+}
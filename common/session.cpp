@@ -0,0 +1,446 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// An OpenNI context with its generators and tracking callbacks
+//---------------------------------------------------------------------------
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <thread>
+
+#include "session.h"
+
+Session::Session()
+	: log_next_(0), log_repeat_(true), log_real_time_(true), log_clock_started_(false)
+	, log_timestamp_start_(0), is_open_(false), eof_(false), deterministic_(false)
+{
+	ResetFrameSequence();
+	tracking_.pUserGenerator = &user_generator_;
+	tracking_.bNeedPose = FALSE;
+	tracking_.strPose[0] = '\0';
+	tracking_.pLostUserHandler = NULL;
+	tracking_.pLostUserCookie = NULL;
+	tracking_.pCalibrationCache = NULL;
+	tracking_.pEvents = &events_;
+	tracking_.timeToTracking.nCached = 0;
+	tracking_.timeToTracking.nCalibrated = 0;
+	tracking_.timeToTracking.fCachedSeconds = 0.0;
+	tracking_.timeToTracking.fCalibratedSeconds = 0.0;
+}
+
+Session::~Session()
+{
+	Close();
+}
+
+bool Session::OpenRecording(const char* recordingFilename, bool use_image)
+{
+	XnStatus nRetVal = XN_STATUS_OK;
+
+	Close();
+
+	nRetVal = context_.Init();
+	if (nRetVal != XN_STATUS_OK)
+	{
+		std::cerr << "Init failed: " << xnGetStatusString(nRetVal) << '\n';
+		return false;
+	}
+	is_open_ = true;
+
+	nRetVal = context_.OpenFileRecording(recordingFilename, player_);
+	if (nRetVal != XN_STATUS_OK)
+	{
+		std::cerr << "Can't open recording " << recordingFilename << ": "
+			<< xnGetStatusString(nRetVal) << '\n';
+		return false;
+	}
+
+	if (!Start(use_image))
+	{
+		std::cerr << "Error initialising generators for " << recordingFilename << ".\n";
+		return false;
+	}
+
+	return true;
+}
+
+bool Session::OpenXmlConfig(const char* xmlConfigFilename, bool use_image)
+{
+	XnStatus nRetVal = XN_STATUS_OK;
+	xn::EnumerationErrors errors;
+
+	Close();
+
+	nRetVal = context_.InitFromXmlFile(xmlConfigFilename, script_node_, &errors);
+	if (nRetVal == XN_STATUS_NO_NODE_PRESENT)
+	{
+		XnChar strError[1024];
+		errors.ToString(strError, 1024);
+		std::cerr << strError << '\n';
+		return false;
+	}
+	else if (nRetVal != XN_STATUS_OK)
+	{
+		std::cerr << "Open failed: " << xnGetStatusString(nRetVal) << '\n';
+		return false;
+	}
+	is_open_ = true;
+
+	if (!Start(use_image))
+	{
+		std::cerr << "Error initialising generators for " << xmlConfigFilename << ".\n";
+		return false;
+	}
+
+	return true;
+}
+
+bool Session::OpenLog(const char* logFilename, bool real_time)
+{
+	XnStatus nRetVal = XN_STATUS_OK;
+
+	Close();
+
+	// Only a few frames are needed at a time
+	FrameReader::Options options;
+	options.cache_frames = 16;
+	log_reader_.reset(new FrameReader);
+	try
+	{
+		log_reader_->Open(logFilename, options);
+		if (log_reader_->size() == 0) {
+			std::cerr << "Log " << logFilename << " has no frames.\n";
+			log_reader_.reset();
+			return false;
+		}
+		log_frame_ = log_reader_->frame(0);
+	}
+	catch (const H5::Exception& e)
+	{
+		std::cerr << "Can't read log " << logFilename << ": " << e.getDetailMsg() << '\n';
+		log_reader_.reset();
+		return false;
+	}
+
+	// The mock generator takes its resolution from the first frame and its frame rate from the
+	// first two. Logs which predate the field of view being recorded are assumed to be from a
+	// Kinect.
+	XnMapOutputMode mode;
+	mode.nXRes = static_cast<XnUInt32>(log_frame_->cols);
+	mode.nYRes = static_cast<XnUInt32>(log_frame_->rows);
+	mode.nFPS = 30;
+	if (log_reader_->size() > 1) {
+		LogFramePtr second(log_reader_->frame(1));
+		if (second->timestamp > log_frame_->timestamp) {
+			double fps(1e6 / static_cast<double>(second->timestamp - log_frame_->timestamp));
+			mode.nFPS = static_cast<XnUInt32>(std::max(1., std::min(120., floor(fps + 0.5))));
+		}
+	}
+	XnFieldOfView fov(g_DefaultFieldOfView);
+	if ((log_frame_->x_to_z > 0.) && (log_frame_->y_to_z > 0.)) {
+		fov.fHFOV = 2. * atan(log_frame_->x_to_z / 2.);
+		fov.fVFOV = 2. * atan(log_frame_->y_to_z / 2.);
+	}
+
+	nRetVal = context_.Init();
+	if (nRetVal != XN_STATUS_OK)
+	{
+		std::cerr << "Init failed: " << xnGetStatusString(nRetVal) << '\n';
+		return false;
+	}
+	is_open_ = true;
+
+	if (!CreateMockDepthGenerator(context_, mode, fov, log_depth_))
+	{
+		std::cerr << "Error creating depth generator for " << logFilename << ".\n";
+		return false;
+	}
+
+	if (!Start(false))
+	{
+		std::cerr << "Error initialising generators for " << logFilename << ".\n";
+		return false;
+	}
+
+	log_next_ = 0;
+	log_real_time_ = real_time;
+	log_clock_started_ = false;
+	return true;
+}
+
+bool Session::Start(bool use_image)
+{
+	if(!EnsureDepthGenerator(context_, depth_generator_)) {
+		std::cerr << "Error initialising depth generator.\n";
+		return false;
+	}
+
+	if(!EnsureUserGenerator(context_, user_generator_, tracking_)) {
+		std::cerr << "Error initialising user generator.\n";
+		return false;
+	}
+
+	if(use_image && !EnsureImageGenerator(context_, image_generator_, depth_generator_)) {
+		std::cerr << "Error initialising image generator.\n";
+		return false;
+	}
+
+	XnStatus nRetVal = context_.StartGeneratingAll();
+	if (nRetVal != XN_STATUS_OK)
+	{
+		std::cerr << "StartGenerating failed: " << xnGetStatusString(nRetVal) << '\n';
+		return false;
+	}
+
+	return true;
+}
+
+void Session::Close()
+{
+	if (!is_open_) {
+		return;
+	}
+
+	script_node_.Release();
+	depth_generator_.Release();
+	user_generator_.Release();
+	image_generator_.Release();
+	player_.Release();
+	log_depth_.Release();
+	context_.Release();
+	log_frame_.reset();
+	log_reader_.reset();
+	tracking_.detectionTimes.clear();
+	tracking_.startingTracking.clear();
+	is_open_ = false;
+	eof_ = false;
+	deterministic_ = false;
+	ResetFrameSequence();
+}
+
+void Session::SetRepeat(bool repeat)
+{
+	if (player_.IsValid()) {
+		player_.SetRepeat(repeat ? TRUE : FALSE);
+	}
+	log_repeat_ = repeat;
+}
+
+bool Session::SeekToFrame(XnUInt32 frameId)
+{
+	if (player_.IsValid()) {
+		XnStatus nRetVal = player_.SeekToFrame(depth_generator_.GetName(),
+				static_cast<XnInt32>(frameId), XN_PLAYER_SEEK_SET);
+		if (nRetVal != XN_STATUS_OK) {
+			std::cerr << "Seek failed: " << xnGetStatusString(nRetVal) << '\n';
+			return false;
+		}
+		sequence_.nLastFrameID = 0;
+		return true;
+	}
+
+	if (log_reader_) {
+		// Logged frames are in order of frame id
+		try
+		{
+			size_t begin(0), end(log_reader_->size());
+			while (begin < end)
+			{
+				size_t middle(begin + (end - begin) / 2);
+				if (log_reader_->frame(middle)->frame_id < frameId) {
+					begin = middle + 1;
+				} else {
+					end = middle;
+				}
+			}
+			log_next_ = begin;
+			log_clock_started_ = false;
+			sequence_.nLastFrameID = 0;
+			return true;
+		}
+		catch (const H5::Exception& e)
+		{
+			std::cerr << "Seek failed: " << e.getDetailMsg() << '\n';
+			return false;
+		}
+	}
+
+	std::cerr << "Seek failed: only recordings and logs can be seeked.\n";
+	return false;
+}
+
+void Session::SetDeterministic(bool deterministic)
+{
+	deterministic_ = deterministic;
+
+	// At the fastest speed the player never waits for a frame to be due, so each update reads
+	// exactly as far as the next depth frame
+	if (player_.IsValid()) {
+		XnStatus nRetVal = player_.SetPlaybackSpeed(deterministic ? XN_PLAYBACK_SPEED_FASTEST : 1.0);
+		if (nRetVal != XN_STATUS_OK) {
+			std::cerr << "Setting playback speed failed: " << xnGetStatusString(nRetVal) << '\n';
+		}
+	}
+	if (deterministic) {
+		log_real_time_ = false;
+	}
+}
+
+void Session::ResetFrameSequence()
+{
+	sequence_.nFrames = 0;
+	sequence_.nFirstFrameID = 0;
+	sequence_.nLastFrameID = 0;
+	sequence_.nSkipped = 0;
+	sequence_.nRepeated = 0;
+}
+
+void Session::CheckFrameSequence(XnUInt32 nFrameID)
+{
+	if (sequence_.nFrames == 0) {
+		sequence_.nFirstFrameID = nFrameID;
+	} else if (sequence_.nLastFrameID == 0 || nFrameID == sequence_.nFirstFrameID) {
+		// First frame after a seek or repeat
+	} else if (nFrameID <= sequence_.nLastFrameID) {
+		++sequence_.nRepeated;
+	} else {
+		sequence_.nSkipped += nFrameID - sequence_.nLastFrameID - 1;
+	}
+	++sequence_.nFrames;
+	sequence_.nLastFrameID = nFrameID;
+}
+
+void Session::SetLostUserHandler(UserEventHandler handler, void* pCookie)
+{
+	tracking_.pLostUserHandler = handler;
+	tracking_.pLostUserCookie = pCookie;
+}
+
+bool Session::EnableCalibrationCache(const std::string& directory, const CalibrationCacheParams& params)
+{
+	tracking_.pCalibrationCache = NULL;
+	tracking_.pEvents = &events_;
+	calibration_cache_.reset(new CalibrationCache(depth_generator_, user_generator_, params));
+	if (!calibration_cache_->Open(directory))
+	{
+		calibration_cache_.reset();
+		return false;
+	}
+
+	tracking_.pCalibrationCache = calibration_cache_.get();
+	return true;
+}
+
+void Session::TakeUserEvents(std::vector<UserEvent>& events)
+{
+	events_.Drain(events);
+}
+
+bool Session::Update()
+{
+	if (!is_open_ || eof_) {
+		return false;
+	}
+
+	if (log_reader_ && !PushLogFrame()) {
+		return false;
+	}
+
+	XnStatus nRetVal = context_.WaitOneUpdateAll(user_generator_);
+	if (nRetVal == XN_STATUS_EOF) {
+		eof_ = true;
+	}
+	if (nRetVal != XN_STATUS_OK) {
+		if (!eof_) {
+			std::cerr << "Update failed: " << xnGetStatusString(nRetVal) << '\n';
+		}
+		return false;
+	}
+
+	depth_generator_.GetMetaData(depth_md_);
+	user_generator_.GetUserPixels(0, scene_md_);
+	CheckFrameSequence(depth_md_.FrameID());
+	UpdateTimeToTracking(tracking_);
+
+	// The last frame of a recording which does not repeat is still returned
+	if (player_.IsValid() && player_.IsEOF()) {
+		eof_ = true;
+	}
+	if (log_reader_ && !log_repeat_ && (log_next_ >= log_reader_->size())) {
+		eof_ = true;
+	}
+
+	return true;
+}
+
+bool Session::PushLogFrame()
+{
+	if (log_next_ >= log_reader_->size()) {
+		if (!log_repeat_) {
+			eof_ = true;
+			return false;
+		}
+		log_next_ = 0;
+		log_clock_started_ = false;
+	}
+
+	size_t idx(log_next_++);
+	try
+	{
+		log_frame_ = log_reader_->frame(idx);
+	}
+	catch (const H5::Exception& e)
+	{
+		std::cerr << "Can't read frame " << idx << " of log: " << e.getDetailMsg() << '\n';
+		return false;
+	}
+
+	XnMapOutputMode mode;
+	log_depth_.GetMapOutputMode(mode);
+	if ((log_frame_->cols != static_cast<int>(mode.nXRes)) || (log_frame_->rows != static_cast<int>(mode.nYRes))) {
+		std::cerr << "Skipping frame " << log_frame_->idx << " of log: it is " << log_frame_->cols << "x"
+			<< log_frame_->rows << " rather than " << mode.nXRes << "x" << mode.nYRes << ".\n";
+		return false;
+	}
+
+	// Hold each frame back until the time it was captured, relative to the first frame replayed
+	if (log_real_time_) {
+		std::chrono::steady_clock::time_point now(std::chrono::steady_clock::now());
+		if (!log_clock_started_ || (log_frame_->timestamp < log_timestamp_start_)) {
+			log_clock_started_ = true;
+			log_clock_start_ = now;
+			log_timestamp_start_ = log_frame_->timestamp;
+		}
+		std::chrono::steady_clock::time_point due(log_clock_start_
+				+ std::chrono::microseconds(log_frame_->timestamp - log_timestamp_start_));
+		if (due > now) {
+			std::this_thread::sleep_for(due - now);
+		}
+	}
+
+	// Logs which predate frame ids are numbered from one
+	XnUInt32 nFrameID(log_frame_->frame_id ? log_frame_->frame_id : static_cast<XnUInt32>(log_frame_->idx + 1));
+	XnStatus nRetVal = log_depth_.SetData(nFrameID, log_frame_->timestamp,
+			static_cast<XnUInt32>(log_frame_->depth.size() * sizeof(XnDepthPixel)), &log_frame_->depth[0]);
+	if (nRetVal != XN_STATUS_OK) {
+		std::cerr << "Setting depth map failed: " << xnGetStatusString(nRetVal) << '\n';
+		return false;
+	}
+
+	return true;
+}
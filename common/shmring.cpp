@@ -0,0 +1,286 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+#include "shmring.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The sequence numbers are shared between processes so must not need a lock
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "64-bit atomics must be lock-free");
+
+// Slots start on cache line boundaries
+static const size_t g_SlotAlignment = 64;
+
+static size_t HeaderSize()
+{
+	return (sizeof(ShmRingHeader) + g_SlotAlignment - 1) / g_SlotAlignment * g_SlotAlignment;
+}
+
+static size_t SlotSize(int max_rows, int max_cols)
+{
+	size_t size(sizeof(ShmFrame) + 2 * sizeof(uint16_t) * max_rows * max_cols);
+	return (size + g_SlotAlignment - 1) / g_SlotAlignment * g_SlotAlignment;
+}
+
+static inline const uint16_t* DepthOf(const ShmFrame* p_frame)
+{
+	return reinterpret_cast<const uint16_t*>(p_frame + 1);
+}
+
+//---------------------------------------------------------------------------
+// ShmRingWriter
+//---------------------------------------------------------------------------
+
+ShmRingWriter::ShmRingWriter()
+	: p_header_(NULL), size_(0)
+{ }
+
+ShmRingWriter::~ShmRingWriter()
+{
+	Close();
+}
+
+bool ShmRingWriter::Open(const std::string& name, int n_slots, int max_rows, int max_cols)
+{
+	Close();
+
+	if ((n_slots < 2) || (max_rows < 1) || (max_cols < 1)) {
+		std::cerr << "Error: a shared memory ring needs at least two slots.\n";
+		return false;
+	}
+
+	// Replace any ring left behind by a writer which did not exit cleanly
+	shm_unlink(name.c_str());
+	int fd(shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644));
+	if (fd < 0) {
+		std::cerr << "Error: could not create shared memory " << name << ": " << strerror(errno) << '\n';
+		return false;
+	}
+
+	size_t slot_size(SlotSize(max_rows, max_cols));
+	size_ = HeaderSize() + n_slots * slot_size;
+	void* p_mem(MAP_FAILED);
+	if (ftruncate(fd, static_cast<off_t>(size_)) == 0) {
+		p_mem = mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (p_mem == MAP_FAILED) {
+		std::cerr << "Error: could not map shared memory " << name << ": " << strerror(errno) << '\n';
+		shm_unlink(name.c_str());
+		return false;
+	}
+	name_ = name;
+
+	// The object is zero-filled by ftruncate() so every slot starts with sequence number zero,
+	// which no frame has.
+	p_header_ = static_cast<ShmRingHeader*>(p_mem);
+	p_header_->n_slots = static_cast<uint32_t>(n_slots);
+	p_header_->max_rows = static_cast<uint32_t>(max_rows);
+	p_header_->max_cols = static_cast<uint32_t>(max_cols);
+	p_header_->slot_size = slot_size;
+	p_header_->published.store(0, std::memory_order_relaxed);
+	p_header_->version = g_ShmRingVersion;
+
+	// Readers check the magic number last
+	std::atomic_thread_fence(std::memory_order_release);
+	p_header_->magic = g_ShmRingMagic;
+
+	return true;
+}
+
+void ShmRingWriter::Close()
+{
+	if (!p_header_) { return; }
+
+	munmap(p_header_, size_);
+	shm_unlink(name_.c_str());
+	p_header_ = NULL;
+}
+
+void ShmRingWriter::Publish(uint32_t frame_id, uint64_t timestamp, int rows, int cols,
+		const uint16_t* depth, const uint16_t* label, const std::vector<TrackedUser>& users)
+{
+	if (!p_header_) { return; }
+
+	uint64_t n(p_header_->published.load(std::memory_order_relaxed));
+	ShmFrame* p_frame(reinterpret_cast<ShmFrame*>(
+		reinterpret_cast<uint8_t*>(p_header_) + HeaderSize() + (n % p_header_->n_slots) * p_header_->slot_size));
+
+	// Mark the slot as being written. The fence keeps the data writes below from being reordered
+	// before it.
+	p_frame->sequence.store(2 * n + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	// Larger frames lose their bottom rows and right-hand columns
+	const int stride(cols);
+	rows = std::min(rows, static_cast<int>(p_header_->max_rows));
+	cols = std::min(cols, static_cast<int>(p_header_->max_cols));
+	p_frame->number = n;
+	p_frame->frame_id = frame_id;
+	p_frame->timestamp = timestamp;
+	p_frame->rows = rows;
+	p_frame->cols = cols;
+	p_frame->n_users = static_cast<int32_t>(std::min(users.size(), static_cast<size_t>(g_ShmRingMaxUsers)));
+	std::copy(users.begin(), users.begin() + p_frame->n_users, p_frame->users);
+
+	// Images are stored with the row length of the frame, not of the largest possible frame
+	uint16_t* p_depth(reinterpret_cast<uint16_t*>(p_frame + 1));
+	uint16_t* p_label(p_depth + p_header_->max_rows * p_header_->max_cols);
+	for (int row = 0; row < rows; ++row)
+	{
+		memcpy(p_depth + row * cols, depth + row * stride, cols * sizeof(uint16_t));
+		memcpy(p_label + row * cols, label + row * stride, cols * sizeof(uint16_t));
+	}
+
+	p_frame->sequence.store(2 * (n + 1), std::memory_order_release);
+	p_header_->published.store(n + 1, std::memory_order_release);
+}
+
+//---------------------------------------------------------------------------
+// ShmRingReader
+//---------------------------------------------------------------------------
+
+ShmRingReader::ShmRingReader()
+	: p_header_(NULL), size_(0), started_(false), next_(0), n_overruns_(0)
+{ }
+
+ShmRingReader::~ShmRingReader()
+{
+	Close();
+}
+
+bool ShmRingReader::Open(const std::string& name)
+{
+	Close();
+
+	int fd(shm_open(name.c_str(), O_RDONLY, 0));
+	if (fd < 0) {
+		std::cerr << "Error: could not open shared memory " << name << ": " << strerror(errno) << '\n';
+		return false;
+	}
+
+	struct stat st;
+	void* p_mem(MAP_FAILED);
+	if ((fstat(fd, &st) == 0) && (static_cast<size_t>(st.st_size) >= HeaderSize())) {
+		size_ = static_cast<size_t>(st.st_size);
+		p_mem = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (p_mem == MAP_FAILED) {
+		std::cerr << "Error: could not map shared memory " << name << ".\n";
+		return false;
+	}
+
+	const ShmRingHeader* p_header(static_cast<const ShmRingHeader*>(p_mem));
+	bool valid(p_header->magic == g_ShmRingMagic);
+	std::atomic_thread_fence(std::memory_order_acquire);
+	valid = valid && (p_header->version == g_ShmRingVersion) &&
+		(HeaderSize() + p_header->n_slots * p_header->slot_size <= size_);
+	if (!valid) {
+		std::cerr << "Error: " << name << " is not a frame ring.\n";
+		munmap(p_mem, size_);
+		return false;
+	}
+
+	p_header_ = p_header;
+	started_ = false;
+	n_overruns_ = 0;
+	return true;
+}
+
+void ShmRingReader::Close()
+{
+	if (!p_header_) { return; }
+
+	munmap(const_cast<ShmRingHeader*>(p_header_), size_);
+	p_header_ = NULL;
+}
+
+uint64_t ShmRingReader::Published() const
+{
+	return p_header_ ? p_header_->published.load(std::memory_order_acquire) : 0;
+}
+
+const ShmFrame* ShmRingReader::Slot(uint64_t n) const
+{
+	return reinterpret_cast<const ShmFrame*>(
+		reinterpret_cast<const uint8_t*>(p_header_) + HeaderSize() + (n % p_header_->n_slots) * p_header_->slot_size);
+}
+
+bool ShmRingReader::Get(uint64_t n, ShmFrameView& view) const
+{
+	if (!p_header_) { return false; }
+
+	const ShmFrame* p_frame(Slot(n));
+	view.sequence = 2 * (n + 1);
+	if (p_frame->sequence.load(std::memory_order_acquire) != view.sequence) {
+		return false;
+	}
+
+	view.frame = p_frame;
+	view.depth = DepthOf(p_frame);
+	view.label = view.depth + p_header_->max_rows * p_header_->max_cols;
+	return true;
+}
+
+bool ShmRingReader::Latest(ShmFrameView& view) const
+{
+	uint64_t published(Published());
+	return (published > 0) && Get(published - 1, view);
+}
+
+bool ShmRingReader::Next(ShmFrameView& view)
+{
+	uint64_t published(Published());
+	if (!started_ && (published > 0)) {
+		next_ = (published > p_header_->n_slots) ? published - p_header_->n_slots : 0;
+		started_ = true;
+	}
+
+	while (next_ < published)
+	{
+		if (Get(next_, view)) {
+			++next_;
+			return true;
+		}
+
+		// The writer has lapped us. Skip to the oldest frame it cannot be writing over.
+		uint64_t oldest((published >= p_header_->n_slots) ? published - p_header_->n_slots + 1 : 0);
+		if (oldest <= next_) {
+			oldest = next_ + 1;
+		}
+		n_overruns_ += oldest - next_;
+		next_ = oldest;
+		published = Published();
+	}
+	return false;
+}
+
+bool ShmRingReader::IsValid(const ShmFrameView& view) const
+{
+	// Keep the reads of the frame data from being reordered after the check
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return view.frame->sequence.load(std::memory_order_relaxed) == view.sequence;
+}
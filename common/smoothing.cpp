@@ -0,0 +1,101 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+#include "smoothing.h"
+
+#include <cmath>
+#include <cstring>
+
+// Frame interval assumed if the timestamps do not give one
+static const float g_DefaultFrameInterval = 1.f / 30.f;
+
+// Smoothing factor of a first-order low-pass filter with the given cut-off in Hz
+static inline float Alpha(float dt, float cutoff)
+{
+	return 1.f / (1.f + 1.f / (2.f * static_cast<float>(M_PI) * cutoff * dt));
+}
+
+JointSmoother::JointSmoother(const OneEuroParams& params)
+	: params_(params)
+{ }
+
+void JointSmoother::Filter(uint16_t user, uint64_t timestamp, const Joint* joints, int n,
+		Joint* out, float* lag_ms)
+{
+	std::map<uint16_t, UserState>::iterator it(users_.find(user));
+	if (it == users_.end()) {
+		UserState fresh;
+		memset(&fresh, 0, sizeof(fresh));
+		fresh.timestamp = timestamp;
+		it = users_.insert(std::make_pair(user, fresh)).first;
+	}
+	UserState& state(it->second);
+
+	float dt(g_DefaultFrameInterval);
+	if (timestamp > state.timestamp) {
+		dt = 1e-6f * static_cast<float>(timestamp - state.timestamp);
+	}
+	state.timestamp = timestamp;
+
+	float raw[g_JointArraySize], present[g_JointArraySize];
+	ScatterJoints(joints, n, raw, present);
+
+	// Filter everything at once. Values without previous state pass straight through and absent
+	// joints lose their state.
+	const float alpha_d(Alpha(dt, params_.d_cutoff));
+	const float two_pi_dt(2.f * static_cast<float>(M_PI) * dt);
+	float filtered[g_JointArraySize], lag_s[g_JointArraySize];
+	for (int i = 0; i < g_JointArraySize; ++i)
+	{
+		float valid(state.valid[i]);
+		float speed((raw[i] - state.value[i]) / dt);
+		float smoothed_speed(alpha_d * speed + (1.f - alpha_d) * state.speed[i]);
+		float cutoff(params_.min_cutoff + params_.beta * std::fabs(smoothed_speed));
+		float alpha(1.f / (1.f + 1.f / (two_pi_dt * cutoff)));
+		float value(alpha * raw[i] + (1.f - alpha) * state.value[i]);
+
+		filtered[i] = valid * value + (1.f - valid) * raw[i];
+		lag_s[i] = valid / (2.f * static_cast<float>(M_PI) * cutoff);
+		state.value[i] = filtered[i];
+		state.speed[i] = valid * smoothed_speed;
+		state.valid[i] = present[i];
+	}
+
+	GatherJoints(joints, n, filtered, out);
+
+	// Report the lag of the real-world position
+	for (int i = 0; lag_ms && (i < n); ++i)
+	{
+		const Joint& joint(joints[i]);
+		lag_ms[i] = 0.f;
+		if ((joint.id < 1) || (joint.id > g_NumJointTypes)) {
+			continue;
+		}
+		const float* p_lag(lag_s + (joint.id - 1) * g_JointCoords);
+		lag_ms[i] = 1e3f * (p_lag[0] + p_lag[1] + p_lag[2]) / 3.f;
+	}
+}
+
+void JointSmoother::Reset(uint16_t user)
+{
+	users_.erase(user);
+}
+
+void JointSmoother::ResetAll()
+{
+	users_.clear();
+}
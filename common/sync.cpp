@@ -0,0 +1,216 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Logging of several simultaneous recordings to a single log
+//---------------------------------------------------------------------------
+#include <algorithm>
+#include <iostream>
+#include <stdio.h>
+
+#include "sync.h"
+
+using namespace H5;
+
+SynchronisedLogger::SynchronisedLogger()
+	: stop_(false), n_running_(0)
+	, p_h5_file_(NULL), tolerance_us_(0)
+{
+}
+
+SynchronisedLogger::~SynchronisedLogger()
+{
+	Stop();
+	for (size_t i = 0; i < streams_.size(); ++i)
+	{
+		delete streams_[i];
+	}
+}
+
+bool SynchronisedLogger::Open(const std::vector<std::string>& recordings)
+{
+	for (size_t i = 0; i < recordings.size(); ++i)
+	{
+		Stream* p_stream = new Stream;
+		streams_.push_back(p_stream);
+
+		p_stream->recording = recordings[i];
+		if (!p_stream->session.OpenRecording(recordings[i].c_str())) {
+			return false;
+		}
+		p_stream->session.SetRepeat(false);
+		p_stream->session.SetLostUserHandler(DepthMapLogger::LostUserHandler, &p_stream->logger);
+	}
+	return !streams_.empty();
+}
+
+bool SynchronisedLogger::Start(const char* h5_filename, double tolerance_ms)
+{
+	char name_str[20];
+
+	Stop();
+
+	p_h5_file_ = new H5File(h5_filename, H5F_ACC_TRUNC);
+	tolerance_us_ = static_cast<uint64_t>(1e3 * tolerance_ms);
+
+	Group sensors_group(p_h5_file_->createGroup("sensors"));
+	for (size_t i = 0; i < streams_.size(); ++i)
+	{
+		snprintf(name_str, 20, "sensor_%02zu", i);
+		Group sensor_group(sensors_group.createGroup(name_str));
+
+		const std::string& recording(streams_[i]->recording);
+		StrType str_type(PredType::C_S1, recording.size());
+		sensor_group.createAttribute("recording", str_type, DataSpace()).write(str_type, recording);
+
+		streams_[i]->logger.Open(sensor_group);
+		streams_[i]->timestamps.clear();
+	}
+
+	stop_ = false;
+	n_running_ = static_cast<int>(streams_.size());
+	for (size_t i = 0; i < streams_.size(); ++i)
+	{
+		threads_.push_back(std::thread(&SynchronisedLogger::Track, this, std::ref(*streams_[i])));
+	}
+
+	return true;
+}
+
+void SynchronisedLogger::Stop()
+{
+	stop_ = true;
+	for (size_t i = 0; i < threads_.size(); ++i)
+	{
+		threads_[i].join();
+	}
+	threads_.clear();
+
+	if (!p_h5_file_) {
+		return;
+	}
+
+	WriteSyncTable();
+
+	for (size_t i = 0; i < streams_.size(); ++i)
+	{
+		streams_[i]->logger.Close();
+	}
+	delete p_h5_file_;
+	p_h5_file_ = NULL;
+}
+
+void SynchronisedLogger::Track(Stream& stream)
+{
+	bool have_first(false);
+	uint64_t first_timestamp(0);
+	int n_update_failures(0);  // in a row
+
+	while (!stop_)
+	{
+		// A failed update may be a passing glitch; only the end of the recording or a run of
+		// failures ends the stream
+		if (!stream.session.Update()) {
+			if (stream.session.IsEOF()) {
+				break;
+			}
+			if (++n_update_failures >= g_MaxUpdateFailures) {
+				std::cerr << "Error: giving up on " << stream.recording << " after "
+					<< n_update_failures << " failed updates in a row.\n";
+				break;
+			}
+			continue;
+		}
+		n_update_failures = 0;
+
+		const xn::DepthMetaData& dmd(stream.session.GetDepthMetaData());
+		if (!have_first) {
+			first_timestamp = dmd.Timestamp();
+			have_first = true;
+		}
+
+		// Tracking and taking a copy of the frame run in parallel; only writing the log is
+		// serialised.
+		CaptureFrame(dmd, stream.session.GetSceneMetaData(), stream.session.GetDepthGenerator(),
+				stream.session.GetUserGenerator(), stream.frame);
+		stream.session.TakeUserEvents(stream.frame.user_events);
+		std::lock_guard<std::mutex> lock(write_mutex_);
+		stream.logger.DumpFrame(stream.frame);
+		stream.timestamps.push_back(dmd.Timestamp() - first_timestamp);
+	}
+
+	std::cout << "Finished logging " << stream.recording << " ("
+		<< stream.timestamps.size() << " frames)\n";
+	--n_running_;
+}
+
+void SynchronisedLogger::WriteSyncTable()
+{
+	if (streams_.empty()) {
+		return;
+	}
+
+	size_t n_sensors(streams_.size());
+	const std::vector<uint64_t>& reference(streams_[0]->timestamps);
+	std::vector<int64_t> frame_indices(reference.size() * n_sensors, -1);
+	std::vector<uint64_t> timestamps(reference.size() * n_sensors, 0);
+
+	for (size_t row = 0; row < reference.size(); ++row)
+	{
+		uint64_t t(reference[row]);
+		for (size_t s = 0; s < n_sensors; ++s)
+		{
+			// Timestamps are increasing so the closest frame is either side of the lower bound
+			const std::vector<uint64_t>& other(streams_[s]->timestamps);
+			std::vector<uint64_t>::const_iterator it(std::lower_bound(other.begin(), other.end(), t));
+			std::vector<uint64_t>::const_iterator best(other.end());
+			if (it != other.end()) {
+				best = it;
+			}
+			if ((it != other.begin()) &&
+				((best == other.end()) || (t - *(it - 1) < *best - t)))
+			{
+				best = it - 1;
+			}
+			if (best == other.end()) {
+				continue;
+			}
+
+			uint64_t delta((*best > t) ? (*best - t) : (t - *best));
+			if (delta <= tolerance_us_) {
+				frame_indices[row * n_sensors + s] = best - other.begin();
+				timestamps[row * n_sensors + s] = *best;
+			}
+		}
+	}
+
+	Group sync_group(p_h5_file_->createGroup("sync"));
+	Attribute tolerance_attr(sync_group.createAttribute(
+			"tolerance_us", PredType::NATIVE_UINT64, DataSpace()));
+	tolerance_attr.write(PredType::NATIVE_UINT64, &tolerance_us_);
+
+	if (reference.empty()) {
+		return;
+	}
+
+	hsize_t dims[2] = { reference.size(), n_sensors };
+	DataSpace space(2, dims);
+	DataSet idx_ds(sync_group.createDataSet("frame_idx", PredType::NATIVE_INT64, space));
+	idx_ds.write(&frame_indices[0], PredType::NATIVE_INT64);
+	DataSet ts_ds(sync_group.createDataSet("timestamp", PredType::NATIVE_UINT64, space));
+	ts_ds.write(&timestamps[0], PredType::NATIVE_UINT64);
+}
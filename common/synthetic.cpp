@@ -0,0 +1,388 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Synthetic scenes of walking figures for testing without a sensor
+//---------------------------------------------------------------------------
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <stdio.h>
+
+#include "synthetic.h"
+
+// Field of view of the mock depth generator in mainloop.cpp
+static const double g_HorizontalFov = 1.0225999419141749;
+static const double g_VerticalFov = 0.79661567681716894;
+
+// The sensor is this far above the floor and this far in front of the wall
+static const float g_SensorHeightMm = 1000.f;
+static const float g_WallDistanceMm = 8000.f;
+
+static const double g_Pi = 3.14159265358979323846;
+
+// Joints reported by NITE, in order of id. See XnSkeletonJoint.
+enum { HEAD = 1, NECK = 2, TORSO = 3, LEFT_SHOULDER = 6, LEFT_ELBOW = 7, LEFT_HAND = 9,
+	RIGHT_SHOULDER = 12, RIGHT_ELBOW = 13, RIGHT_HAND = 15, LEFT_HIP = 17, LEFT_KNEE = 18,
+	LEFT_FOOT = 20, RIGHT_HIP = 21, RIGHT_KNEE = 22, RIGHT_FOOT = 24 };
+
+// A small, fast generator whose output does not depend on the standard library
+static uint64_t SplitMix64(uint64_t& state)
+{
+	uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+// Uniform in [0, 1)
+static double Uniform(uint64_t& state)
+{
+	return (SplitMix64(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+bool ParseSyntheticParams(const std::string& spec, SyntheticParams& params)
+{
+	std::istringstream fields(spec);
+	std::string field;
+	while (std::getline(fields, field, ','))
+	{
+		size_t equals(field.find('='));
+		std::string key(field.substr(0, equals));
+		std::string value(equals == std::string::npos ? "" : field.substr(equals + 1));
+		const char* str(value.c_str());
+		char* end(NULL);
+		bool ok(!value.empty());
+
+		if (key == "users") {
+			long n(strtol(str, &end, 10));
+			ok = ok && (*end == '\0') && (n >= 1) && (n <= 15);
+			params.n_users = static_cast<int>(n);
+		} else if (key == "size") {
+			int cols(0), rows(0);
+			char tail;
+			ok = ok && (sscanf(str, "%dx%d%c", &cols, &rows, &tail) == 2) && (cols >= 16) && (rows >= 16);
+			params.cols = cols;
+			params.rows = rows;
+		} else if (key == "fps") {
+			params.fps = strtod(str, &end);
+			ok = ok && (*end == '\0') && (params.fps > 0.);
+		} else if (key == "noise") {
+			params.noise_mm = static_cast<float>(strtod(str, &end));
+			ok = ok && (*end == '\0') && (params.noise_mm >= 0.f);
+		} else if (key == "speed") {
+			params.speed = static_cast<float>(strtod(str, &end));
+			ok = ok && (*end == '\0') && (params.speed >= 0.f);
+		} else if (key == "seed") {
+			params.seed = static_cast<uint32_t>(strtoul(str, &end, 10));
+			ok = ok && (*end == '\0');
+		} else if (key == "frames") {
+			params.n_frames = strtoull(str, &end, 10);
+			ok = ok && (*end == '\0');
+		} else if (key == "enter") {
+			params.enter_frame = strtoull(str, &end, 10);
+			ok = ok && (*end == '\0');
+		} else {
+			std::cerr << "Error: unknown synthetic scene parameter \"" << key << "\". Use users, "
+				"size, fps, noise, speed, seed, frames or enter.\n";
+			return false;
+		}
+
+		if (!ok) {
+			std::cerr << "Error: invalid value for synthetic scene parameter " << key << ": \""
+				<< value << "\"\n";
+			return false;
+		}
+	}
+
+	return true;
+}
+
+SyntheticScene::SyntheticScene(const SyntheticParams& params)
+	: params_(params), started_(false), first_frame_(0)
+{
+	x_to_z_ = 2. * tan(g_HorizontalFov / 2.);
+	y_to_z_ = 2. * tan(g_VerticalFov / 2.);
+}
+
+void SyntheticScene::PoseFigure(int user, double t, TrackedUser& joints)
+{
+	// Per-figure constants drawn from the seed
+	uint64_t state(params_.seed * 0x100000001b3ULL + static_cast<uint64_t>(user));
+	double start_angle(2. * g_Pi * Uniform(state));
+	double scale(0.9 + 0.2 * Uniform(state));
+	double gait_offset(2. * g_Pi * Uniform(state));
+
+	// Each figure walks around its own circle, three abreast and further back in rows of three
+	const double radius(500.);
+	double centre_x(((user % 3) - 1) * 700.);
+	double centre_z(2900. + 1000. * (user / 3));
+	double walk_mm_per_s(1000. * params_.speed);
+	double angle(start_angle + t * walk_mm_per_s / radius);
+	double pos[3] = { centre_x + radius * cos(angle), -g_SensorHeightMm, centre_z + radius * sin(angle) };
+
+	// Body axes: forward along the circle, side pointing out of it, and up
+	double forward[3] = { -sin(angle), 0., cos(angle) };
+	double side[3] = { cos(angle), 0., sin(angle) };
+
+	// Swing of the limbs over the gait cycle
+	double amplitude(0.45 * std::min(1., static_cast<double>(params_.speed)));
+	double phase(2. * g_Pi * 0.9 * params_.speed * t + gait_offset);
+	double leg[2] = { amplitude * sin(phase), -amplitude * sin(phase) };
+	double knee[2] = { amplitude * std::max(0., cos(phase)), amplitude * std::max(0., -cos(phase)) };
+
+	// Joint positions in body co-ordinates: side, up from the floor and forward
+	double body[g_NumJointTypes + 1][3];
+	memset(body, 0, sizeof(body));
+	const double head[3] = { 0., 1650., 0. }, neck[3] = { 0., 1470., 0. }, torso[3] = { 0., 1200., 0. };
+	memcpy(body[HEAD], head, sizeof(head));
+	memcpy(body[NECK], neck, sizeof(neck));
+	memcpy(body[TORSO], torso, sizeof(torso));
+	for (int s = 0; s < 2; ++s)
+	{
+		double sign(s ? 1. : -1.);
+		int shoulder(s ? RIGHT_SHOULDER : LEFT_SHOULDER), elbow(s ? RIGHT_ELBOW : LEFT_ELBOW);
+		int hand(s ? RIGHT_HAND : LEFT_HAND), hip(s ? RIGHT_HIP : LEFT_HIP);
+		int knee_joint(s ? RIGHT_KNEE : LEFT_KNEE), foot(s ? RIGHT_FOOT : LEFT_FOOT);
+
+		// Arms swing against the legs on the same side
+		double arm(-0.8 * leg[s]);
+		body[shoulder][0] = sign * 190.; body[shoulder][1] = 1420.;
+		body[elbow][0] = sign * 200.;
+		body[elbow][1] = body[shoulder][1] - 290. * cos(arm);
+		body[elbow][2] = 290. * sin(arm);
+		body[hand][0] = sign * 200.;
+		body[hand][1] = body[elbow][1] - 270. * cos(arm + 0.3);
+		body[hand][2] = body[elbow][2] + 270. * sin(arm + 0.3);
+
+		body[hip][0] = sign * 100.; body[hip][1] = 950.;
+		body[knee_joint][0] = sign * 100.;
+		body[knee_joint][1] = body[hip][1] - 450. * cos(leg[s]);
+		body[knee_joint][2] = 450. * sin(leg[s]);
+		body[foot][0] = sign * 100.;
+		body[foot][1] = body[knee_joint][1] - 430. * cos(leg[s] - knee[s]);
+		body[foot][2] = body[knee_joint][2] + 430. * sin(leg[s] - knee[s]);
+	}
+
+	// Place the joints in the world
+	static const int ids[] = { HEAD, NECK, TORSO, LEFT_SHOULDER, LEFT_ELBOW, LEFT_HAND,
+		RIGHT_SHOULDER, RIGHT_ELBOW, RIGHT_HAND, LEFT_HIP, LEFT_KNEE, LEFT_FOOT,
+		RIGHT_HIP, RIGHT_KNEE, RIGHT_FOOT };
+	double world[g_NumJointTypes + 1][3];
+	joints.user = static_cast<uint16_t>(user + 1);
+	joints.n_joints = 0;
+	for (size_t i = 0; i < sizeof(ids) / sizeof(ids[0]); ++i)
+	{
+		int id(ids[i]);
+		for (int k = 0; k < 3; ++k)
+		{
+			world[id][k] = pos[k] + scale * (body[id][0] * side[k] + body[id][2] * forward[k]);
+		}
+		world[id][1] += scale * body[id][1];
+
+		Joint& joint(joints.joints[joints.n_joints++]);
+		joint.id = id;
+		joint.confidence = 1.f;
+		joint.x = static_cast<float>(world[id][0]);
+		joint.y = static_cast<float>(world[id][1]);
+		joint.z = static_cast<float>(world[id][2]);
+		joint.u = static_cast<float>(params_.cols * (0.5 + world[id][0] / (world[id][2] * x_to_z_)));
+		joint.v = static_cast<float>(params_.rows * (0.5 - world[id][1] / (world[id][2] * y_to_z_)));
+		joint.w = joint.z;
+	}
+
+	// Body segments, scaled with the figure
+	struct Segment { int a, b; float radius; };
+	static const Segment segments[] = {
+		{ HEAD, HEAD, 105.f }, { HEAD, NECK, 55.f }, { NECK, TORSO, 165.f }, { TORSO, TORSO, 160.f },
+		{ LEFT_SHOULDER, RIGHT_SHOULDER, 60.f }, { LEFT_HIP, RIGHT_HIP, 95.f },
+		{ LEFT_SHOULDER, LEFT_ELBOW, 50.f }, { LEFT_ELBOW, LEFT_HAND, 42.f },
+		{ RIGHT_SHOULDER, RIGHT_ELBOW, 50.f }, { RIGHT_ELBOW, RIGHT_HAND, 42.f },
+		{ LEFT_HIP, LEFT_KNEE, 75.f }, { LEFT_KNEE, LEFT_FOOT, 55.f },
+		{ RIGHT_HIP, RIGHT_KNEE, 75.f }, { RIGHT_KNEE, RIGHT_FOOT, 55.f },
+	};
+	for (size_t i = 0; i < sizeof(segments) / sizeof(segments[0]); ++i)
+	{
+		Capsule capsule;
+		for (int k = 0; k < 3; ++k)
+		{
+			capsule.a[k] = static_cast<float>(world[segments[i].a][k]);
+			capsule.b[k] = static_cast<float>(world[segments[i].b][k]);
+		}
+		capsule.radius = static_cast<float>(scale * segments[i].radius);
+		capsule.user = joints.user;
+		capsules_.push_back(capsule);
+	}
+
+	// The torso is a capsule from just below the neck to the hips
+	Capsule& trunk(capsules_[capsules_.size() - sizeof(segments) / sizeof(segments[0]) + 2]);
+	for (int k = 0; k < 3; ++k)
+	{
+		trunk.a[k] = static_cast<float>(0.7 * world[NECK][k] + 0.3 * world[TORSO][k]);
+		trunk.b[k] = static_cast<float>(0.5 * (world[LEFT_HIP][k] + world[RIGHT_HIP][k]));
+	}
+}
+
+void SyntheticScene::DrawCapsule(const Capsule& capsule, FrameSnapshot& frame) const
+{
+	const float* a(capsule.a);
+	const float* b(capsule.b);
+	float r(capsule.radius);
+
+	// Bounding box on screen, from the nearest depth the capsule reaches
+	float near_z(std::min(a[2], b[2]) - r);
+	if (near_z < 100.f) {
+		return; // behind or too close to the sensor
+	}
+	float min_u(1e9f), max_u(-1e9f), min_v(1e9f), max_v(-1e9f);
+	const float* ends[2] = { a, b };
+	for (int e = 0; e < 2; ++e)
+	{
+		float u(static_cast<float>(frame.cols * (0.5 + ends[e][0] / (ends[e][2] * x_to_z_))));
+		float v(static_cast<float>(frame.rows * (0.5 - ends[e][1] / (ends[e][2] * y_to_z_))));
+		min_u = std::min(min_u, u); max_u = std::max(max_u, u);
+		min_v = std::min(min_v, v); max_v = std::max(max_v, v);
+	}
+	float r_u(static_cast<float>(frame.cols * r / (near_z * x_to_z_)));
+	float r_v(static_cast<float>(frame.rows * r / (near_z * y_to_z_)));
+	int col0(std::max(0, static_cast<int>(floor(min_u - r_u))));
+	int col1(std::min(frame.cols - 1, static_cast<int>(ceil(max_u + r_u))));
+	int row0(std::max(0, static_cast<int>(floor(min_v - r_v))));
+	int row1(std::min(frame.rows - 1, static_cast<int>(ceil(max_v + r_v))));
+
+	// For each pixel find where its ray passes closest to the capsule's axis. If that is within
+	// the radius, the ray enters the capsule about sqrt(r^2 - d^2) before that point.
+	float axis[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+	float axis_sq(axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2]);
+	for (int row = row0; row <= row1; ++row)
+	{
+		float dy(static_cast<float>((0.5 - (row + 0.5) / frame.rows) * y_to_z_));
+		for (int col = col0; col <= col1; ++col)
+		{
+			// Ray direction with unit z, so the ray parameter is depth
+			float dx(static_cast<float>(((col + 0.5) / frame.cols - 0.5) * x_to_z_));
+			float ray_sq(dx*dx + dy*dy + 1.f);
+			float ray_axis(dx*axis[0] + dy*axis[1] + axis[2]);
+			float ray_a(dx*a[0] + dy*a[1] + a[2]);
+
+			// Closest point on the axis segment to the ray, then on the ray to that point
+			float t(0.f);
+			float denom(ray_sq * axis_sq - ray_axis * ray_axis);
+			if ((axis_sq > 0.f) && (denom > 1e-6f * ray_sq * axis_sq)) {
+				float axis_a(axis[0]*a[0] + axis[1]*a[1] + axis[2]*a[2]);
+				t = (ray_axis * ray_a - ray_sq * axis_a) / denom;
+				t = std::max(0.f, std::min(1.f, t));
+			}
+			float q[3] = { a[0] + t*axis[0], a[1] + t*axis[1], a[2] + t*axis[2] };
+			float z((dx*q[0] + dy*q[1] + q[2]) / ray_sq);
+			float p[3] = { dx*z - q[0], dy*z - q[1], z - q[2] };
+			float dist_sq(p[0]*p[0] + p[1]*p[1] + p[2]*p[2]);
+			if (dist_sq >= r*r) {
+				continue;
+			}
+
+			z -= sqrtf((r*r - dist_sq) / ray_sq);
+			int idx(row * frame.cols + col);
+			if ((z > 0.f) && (z < frame.depth[idx])) {
+				frame.depth[idx] = static_cast<uint16_t>(z);
+				frame.label[idx] = capsule.user;
+			}
+		}
+	}
+}
+
+void SyntheticScene::Render(uint64_t n, FrameSnapshot& frame)
+{
+	double t(n / params_.fps);
+
+	frame.frame_id = static_cast<uint32_t>(n + 1);
+	frame.timestamp = static_cast<uint64_t>(1e6 * t);
+	frame.rows = params_.rows;
+	frame.cols = params_.cols;
+	frame.x_to_z = x_to_z_;
+	frame.y_to_z = y_to_z_;
+	frame.depth.resize(frame.rows * frame.cols);
+	frame.label.assign(frame.rows * frame.cols, 0);
+
+	// Wall and floor
+	for (int row = 0; row < frame.rows; ++row)
+	{
+		double dy((0.5 - (row + 0.5) / frame.rows) * y_to_z_);
+		double floor_z((dy < 0.) ? -g_SensorHeightMm / dy : g_WallDistanceMm);
+		uint16_t z(static_cast<uint16_t>(std::min(static_cast<double>(g_WallDistanceMm), floor_z)));
+		std::fill(frame.depth.begin() + row * frame.cols, frame.depth.begin() + (row + 1) * frame.cols, z);
+	}
+
+	// Figures
+	int n_users((n >= params_.enter_frame) ? params_.n_users : 0);
+	capsules_.clear();
+	frame.users.resize(n_users);
+	frame.user_states.assign(n_users, USER_TRACKING);
+	for (int user = 0; user < n_users; ++user)
+	{
+		PoseFigure(user, t, frame.users[user]);
+	}
+	for (size_t i = 0; i < capsules_.size(); ++i)
+	{
+		DrawCapsule(capsules_[i], frame);
+	}
+
+	// Sensor noise
+	if (params_.noise_mm > 0.f)
+	{
+		uint64_t state(params_.seed ^ (n * 0xd1b54a32d192ed03ULL));
+		for (size_t i = 0; i + 1 < frame.depth.size(); i += 2)
+		{
+			// Box-Muller gives two normal deviates at a time
+			double u1(std::max(Uniform(state), 1e-12)), u2(Uniform(state));
+			double mag(params_.noise_mm * sqrt(-2. * log(u1)));
+			for (int k = 0; k < 2; ++k)
+			{
+				double z(frame.depth[i + k] + mag * (k ? sin(2. * g_Pi * u2) : cos(2. * g_Pi * u2)));
+				frame.depth[i + k] = static_cast<uint16_t>(std::max(1., std::min(65535., z)));
+			}
+		}
+	}
+
+	// Everyone appears, fully tracked, in the first frame with figures
+	frame.lost_users.clear();
+	frame.user_events.clear();
+	if ((n_users > 0) && (!started_ || (n == first_frame_)))
+	{
+		started_ = true;
+		first_frame_ = n;
+		for (int user = 0; user < n_users; ++user)
+		{
+			UserEvent event;
+			memset(&event, 0, sizeof(event));
+			event.timestamp = frame.timestamp;
+			event.frame_id = frame.frame_id;
+			event.user = static_cast<uint16_t>(user + 1);
+			event.type = USER_EVENT_NEW;
+			frame.user_events.push_back(event);
+			event.type = USER_EVENT_CALIBRATION_COMPLETE;
+			snprintf(event.detail, g_UserEventDetailLength, "synthetic");
+			frame.user_events.push_back(event);
+		}
+	}
+
+	frame.has_image = false;
+}
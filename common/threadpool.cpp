@@ -0,0 +1,103 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// A fixed-size pool of worker threads
+//---------------------------------------------------------------------------
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(size_t n_threads)
+	: n_active_(0), stopping_(false)
+{
+	if (n_threads == 0) {
+		n_threads = std::thread::hardware_concurrency();
+	}
+	if (n_threads == 0) {
+		n_threads = 1;
+	}
+
+	for (size_t i = 0; i < n_threads; ++i)
+	{
+		workers_.push_back(std::thread(&ThreadPool::Work, this));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	task_ready_.notify_all();
+
+	for (size_t i = 0; i < workers_.size(); ++i)
+	{
+		workers_[i].join();
+	}
+}
+
+void ThreadPool::Submit(const std::function<void()>& task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		tasks_.push_back(task);
+	}
+	task_ready_.notify_one();
+}
+
+void ThreadPool::Wait()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (!tasks_.empty() || (n_active_ > 0))
+	{
+		task_done_.wait(lock);
+	}
+}
+
+size_t ThreadPool::Pending() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return tasks_.size() + n_active_;
+}
+
+void ThreadPool::Work()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	for (;;)
+	{
+		while (tasks_.empty() && !stopping_)
+		{
+			task_ready_.wait(lock);
+		}
+
+		// Only exit once the queue has been drained
+		if (tasks_.empty()) {
+			return;
+		}
+
+		std::function<void()> task(tasks_.front());
+		tasks_.pop_front();
+		++n_active_;
+
+		lock.unlock();
+		task();
+		lock.lock();
+
+		--n_active_;
+		task_done_.notify_all();
+	}
+}
@@ -0,0 +1,192 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Passing frames on to a sink only while users are around
+//---------------------------------------------------------------------------
+#include <cmath>
+#include <iostream>
+
+#include "trigger.h"
+
+// Frame rate the ring is sized for. Faster sources keep less than pre_trigger_seconds.
+static const double g_TriggerMaxFps = 120.;
+
+// Make p_frame safe to overwrite, replacing it if the sink passed it on to still has it
+static void MakeWritable(std::shared_ptr<FrameSnapshot>& p_frame)
+{
+	if (p_frame.use_count() > 1) {
+		p_frame = std::make_shared<FrameSnapshot>();
+	}
+}
+
+// Insert lost_users and user_events before frame's own, then clear them
+static void InsertCarried(std::vector<uint16_t>& lost_users, std::vector<UserEvent>& user_events,
+		FrameSnapshot& frame)
+{
+	frame.lost_users.insert(frame.lost_users.begin(), lost_users.begin(), lost_users.end());
+	frame.user_events.insert(frame.user_events.begin(), user_events.begin(), user_events.end());
+	lost_users.clear();
+	user_events.clear();
+}
+
+bool ParseTriggerCondition(const std::string& name, TriggerCondition& condition)
+{
+	if (name == "user-present") {
+		condition = TRIGGER_USER_PRESENT;
+	} else if (name == "tracking") {
+		condition = TRIGGER_TRACKING;
+	} else {
+		std::cerr << "Error: unknown trigger " << name << ". Use user-present or tracking.\n";
+		return false;
+	}
+	return true;
+}
+
+TriggeredSink::TriggeredSink(FrameSink& sink, const TriggerParams& params)
+	: sink_(sink), params_(params)
+	, ring_(static_cast<size_t>(ceil(params.pre_trigger_seconds * g_TriggerMaxFps)))
+	, ring_start_(0), ring_count_(0), p_spare_(std::make_shared<FrameSnapshot>())
+	, triggered_(false), last_met_timestamp_(0)
+	, n_triggers_(0), n_passed_(0), n_discarded_(0)
+{
+	for (size_t i = 0; i < ring_.size(); ++i)
+	{
+		ring_[i] = std::make_shared<FrameSnapshot>();
+	}
+}
+
+bool TriggeredSink::ConditionMet(const FrameSnapshot& frame) const
+{
+	switch (params_.condition) {
+		case TRIGGER_USER_PRESENT:
+			if (!frame.users.empty()) {
+				return true;
+			}
+			for (size_t i = 0; i < frame.user_events.size(); ++i)
+			{
+				if (frame.user_events[i].type == USER_EVENT_NEW) {
+					return true;
+				}
+			}
+			return false;
+
+		case TRIGGER_TRACKING:
+			for (size_t i = 0; i < frame.user_states.size(); ++i)
+			{
+				if (frame.user_states[i] == USER_TRACKING) {
+					return true;
+				}
+			}
+			return false;
+	}
+	return false;
+}
+
+void TriggeredSink::Consume(const FrameRef& frame)
+{
+	if (ConditionMet(*frame)) {
+		if (!triggered_) {
+			triggered_ = true;
+			++n_triggers_;
+			PassOnHeld();
+		}
+		last_met_timestamp_ = frame->timestamp;
+	} else if (triggered_) {
+		// Timestamps go back when a recording loops
+		if ((frame->timestamp < last_met_timestamp_)
+				|| (frame->timestamp - last_met_timestamp_ > 1e6 * params_.hold_off_seconds)) {
+			triggered_ = false;
+		}
+	}
+
+	if (triggered_) {
+		PassOn(frame);
+	} else {
+		Hold(frame);
+	}
+}
+
+void TriggeredSink::Finish()
+{
+	n_discarded_ += ring_count_;
+	ring_start_ = ring_count_ = 0;
+	lost_users_.clear();
+	user_events_.clear();
+	sink_.Finish();
+}
+
+void TriggeredSink::Hold(const FrameRef& frame)
+{
+	if (ring_.empty()) {
+		Discard(*frame);
+		return;
+	}
+
+	// Drop frames which are too old or for which there is no room
+	while (ring_count_ > 0)
+	{
+		const FrameSnapshot& oldest(*ring_[ring_start_]);
+		bool too_old((frame->timestamp < oldest.timestamp)
+				|| (frame->timestamp - oldest.timestamp > 1e6 * params_.pre_trigger_seconds));
+		if (!too_old && (ring_count_ < ring_.size())) {
+			break;
+		}
+		Discard(oldest);
+		ring_start_ = (ring_start_ + 1) % ring_.size();
+		--ring_count_;
+	}
+
+	std::shared_ptr<FrameSnapshot>& p_slot(ring_[(ring_start_ + ring_count_) % ring_.size()]);
+	MakeWritable(p_slot);
+	*p_slot = *frame;
+	++ring_count_;
+
+	// What was discarded goes with the oldest frame still held
+	InsertCarried(lost_users_, user_events_, *ring_[ring_start_]);
+}
+
+void TriggeredSink::Discard(const FrameSnapshot& frame)
+{
+	lost_users_.insert(lost_users_.end(), frame.lost_users.begin(), frame.lost_users.end());
+	user_events_.insert(user_events_.end(), frame.user_events.begin(), frame.user_events.end());
+	++n_discarded_;
+}
+
+void TriggeredSink::PassOn(const FrameRef& frame)
+{
+	if (lost_users_.empty() && user_events_.empty()) {
+		sink_.Consume(frame);
+	} else {
+		MakeWritable(p_spare_);
+		*p_spare_ = *frame;
+		InsertCarried(lost_users_, user_events_, *p_spare_);
+		sink_.Consume(p_spare_);
+	}
+	++n_passed_;
+}
+
+void TriggeredSink::PassOnHeld()
+{
+	for (; ring_count_ > 0; --ring_count_)
+	{
+		sink_.Consume(ring_[ring_start_]);
+		++n_passed_;
+		ring_start_ = (ring_start_ + 1) % ring_.size();
+	}
+	ring_start_ = 0;
+}
@@ -0,0 +1,405 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+#include "udp.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+
+//---------------------------------------------------------------------------
+// Packet encoding
+//---------------------------------------------------------------------------
+
+static inline uint8_t* Put16(uint8_t* p, uint16_t v)
+{
+	p[0] = static_cast<uint8_t>(v >> 8);
+	p[1] = static_cast<uint8_t>(v);
+	return p + 2;
+}
+
+static inline uint8_t* Put32(uint8_t* p, uint32_t v)
+{
+	return Put16(Put16(p, static_cast<uint16_t>(v >> 16)), static_cast<uint16_t>(v));
+}
+
+static inline uint8_t* Put64(uint8_t* p, uint64_t v)
+{
+	return Put32(Put32(p, static_cast<uint32_t>(v >> 32)), static_cast<uint32_t>(v));
+}
+
+static inline uint16_t Get16(const uint8_t* p)
+{
+	return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t Get32(const uint8_t* p)
+{
+	return (static_cast<uint32_t>(Get16(p)) << 16) | Get16(p + 2);
+}
+
+static inline uint64_t Get64(const uint8_t* p)
+{
+	return (static_cast<uint64_t>(Get32(p)) << 32) | Get32(p + 4);
+}
+
+// Round a position in millimetres to the nearest representable int16
+static inline int16_t Quantise(float mm)
+{
+	if (!(mm > -32767.f)) { return -32767; } // also catches NaN
+	if (mm > 32767.f) { return 32767; }
+	return static_cast<int16_t>(lrintf(mm));
+}
+
+bool DecodeSkeletonPacket(const uint8_t* data, size_t size, SkeletonPacket& packet)
+{
+	if ((size < static_cast<size_t>(g_SkelPacketHeaderSize)) ||
+		(Get32(data) != g_SkelPacketMagic) || (data[4] != g_SkelPacketVersion))
+	{
+		return false;
+	}
+
+	packet.n_users = data[5];
+	if ((packet.n_users > g_SkelPacketMaxUsers) ||
+		(size != static_cast<size_t>(g_SkelPacketHeaderSize + packet.n_users * g_SkelPacketUserSize)))
+	{
+		return false;
+	}
+	packet.sequence = Get32(data + 8);
+	packet.frame_id = Get32(data + 12);
+	packet.timestamp = Get64(data + 16);
+	packet.send_time = Get64(data + 24);
+
+	const uint8_t* p(data + g_SkelPacketHeaderSize);
+	for (int u = 0; u < packet.n_users; ++u)
+	{
+		SkeletonPacket::User& user(packet.users[u]);
+		user.idx = Get16(p);
+		uint32_t mask(Get32(p + 2));
+		p += 6;
+
+		user.n_joints = 0;
+		for (int j = 0; j < g_NumJointTypes; ++j, p += 7)
+		{
+			if (!(mask & (1u << j))) {
+				continue;
+			}
+			Joint& joint(user.joints[user.n_joints++]);
+			joint.id = j + 1;
+			joint.x = static_cast<int16_t>(Get16(p));
+			joint.y = static_cast<int16_t>(Get16(p + 2));
+			joint.z = static_cast<int16_t>(Get16(p + 4));
+			joint.confidence = p[6] / 255.f;
+			joint.u = joint.v = joint.w = 0.f;
+		}
+	}
+
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// UdpSkeletonSender
+//---------------------------------------------------------------------------
+
+UdpSkeletonSender::UdpSkeletonSender()
+	: socket_(-1), size_(0), n_users_(0), sequence_(0), n_sent_(0), n_errors_(0)
+{
+	iov_.iov_base = NULL;
+	iov_.iov_len = 0;
+}
+
+UdpSkeletonSender::~UdpSkeletonSender()
+{
+	Close();
+}
+
+bool UdpSkeletonSender::Open(const std::vector<std::string>& destinations)
+{
+	Close();
+
+	for (size_t i = 0; i < destinations.size(); ++i)
+	{
+		const std::string& destination(destinations[i]);
+		size_t colon(destination.rfind(':'));
+		if ((colon == std::string::npos) || (colon == 0) || (colon + 1 == destination.size())) {
+			std::cerr << "Error: UDP destination " << destination << " is not of the form host:port.\n";
+			return false;
+		}
+		std::string host(destination.substr(0, colon)), port(destination.substr(colon + 1));
+
+		struct addrinfo hints, *p_result(NULL);
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_DGRAM;
+		int rv(getaddrinfo(host.c_str(), port.c_str(), &hints, &p_result));
+		if (rv != 0) {
+			std::cerr << "Error: could not resolve " << destination << ": " << gai_strerror(rv) << '\n';
+			return false;
+		}
+		addresses_.push_back(*reinterpret_cast<sockaddr_in*>(p_result->ai_addr));
+		freeaddrinfo(p_result);
+	}
+
+	socket_ = socket(AF_INET, SOCK_DGRAM, 0);
+	if (socket_ < 0) {
+		std::cerr << "Error: could not create UDP socket: " << strerror(errno) << '\n';
+		return false;
+	}
+	int enable(1);
+	setsockopt(socket_, SOL_SOCKET, SO_BROADCAST, &enable, sizeof(enable));
+
+	// Everything needed to send a packet is allocated once here. Each destination's message
+	// shares the one packet buffer.
+	buffer_.assign(g_SkelPacketMaxSize, 0);
+	iov_.iov_base = &buffer_[0];
+	messages_.resize(addresses_.size());
+	for (size_t i = 0; i < addresses_.size(); ++i)
+	{
+		memset(&messages_[i], 0, sizeof(messages_[i]));
+		messages_[i].msg_hdr.msg_name = &addresses_[i];
+		messages_[i].msg_hdr.msg_namelen = sizeof(addresses_[i]);
+		messages_[i].msg_hdr.msg_iov = &iov_;
+		messages_[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	return true;
+}
+
+void UdpSkeletonSender::Close()
+{
+	if (socket_ >= 0) {
+		close(socket_);
+	}
+	socket_ = -1;
+	addresses_.clear();
+	messages_.clear();
+}
+
+void UdpSkeletonSender::BeginFrame(uint32_t frame_id, uint64_t timestamp)
+{
+	if (buffer_.empty()) { return; }
+
+	uint8_t* p(&buffer_[0]);
+	p = Put32(p, g_SkelPacketMagic);
+	*p++ = g_SkelPacketVersion;
+	*p++ = 0; // n_users is filled in by AddUser()
+	p = Put16(p, 0);
+	p = Put32(p, sequence_);
+	p = Put32(p, frame_id);
+	p = Put64(p, timestamp);
+	size_ = g_SkelPacketHeaderSize;
+	n_users_ = 0;
+}
+
+void UdpSkeletonSender::AddUser(uint16_t user, const Joint* joints, int n)
+{
+	if (buffer_.empty() || (n_users_ >= g_SkelPacketMaxUsers)) { return; }
+
+	uint8_t* p_user(&buffer_[size_]);
+	memset(p_user, 0, g_SkelPacketUserSize);
+	Put16(p_user, user);
+
+	uint32_t mask(0);
+	for (int i = 0; i < n; ++i)
+	{
+		const Joint& joint(joints[i]);
+		if ((joint.id < 1) || (joint.id > g_NumJointTypes)) {
+			continue;
+		}
+		mask |= 1u << (joint.id - 1);
+
+		uint8_t* p(p_user + 6 + (joint.id - 1) * 7);
+		p = Put16(p, static_cast<uint16_t>(Quantise(joint.x)));
+		p = Put16(p, static_cast<uint16_t>(Quantise(joint.y)));
+		p = Put16(p, static_cast<uint16_t>(Quantise(joint.z)));
+		float confidence(joint.confidence < 0.f ? 0.f : (joint.confidence > 1.f ? 1.f : joint.confidence));
+		*p = static_cast<uint8_t>(lrintf(255.f * confidence));
+	}
+	Put32(p_user + 2, mask);
+
+	size_ += g_SkelPacketUserSize;
+	buffer_[5] = static_cast<uint8_t>(++n_users_);
+}
+
+bool UdpSkeletonSender::Send()
+{
+	if (socket_ < 0) { return false; }
+
+	// Stamp the packet as late as possible so that latency includes our own processing
+	Put64(&buffer_[24], WallClockMicroseconds());
+	iov_.iov_len = size_;
+	++sequence_;
+
+	// sendmmsg() may send fewer messages than asked if interrupted
+	size_t n_done(0);
+	while (n_done < messages_.size())
+	{
+		int rv(sendmmsg(socket_, &messages_[n_done], static_cast<unsigned int>(messages_.size() - n_done), 0));
+		if (rv < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			n_errors_ += messages_.size() - n_done;
+			return false;
+		}
+		n_done += rv;
+	}
+	n_sent_ += n_done;
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// UdpSkeletonReceiver
+//---------------------------------------------------------------------------
+
+UdpSkeletonReceiver::UdpSkeletonReceiver()
+	: socket_(-1), have_sequence_(false), next_sequence_(0)
+{
+	ResetStats();
+}
+
+UdpSkeletonReceiver::~UdpSkeletonReceiver()
+{
+	Close();
+}
+
+bool UdpSkeletonReceiver::Open(const std::string& bind_host, int port)
+{
+	Close();
+
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(static_cast<uint16_t>(port));
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (!bind_host.empty() && (inet_pton(AF_INET, bind_host.c_str(), &address.sin_addr) != 1)) {
+		std::cerr << "Error: " << bind_host << " is not an IPv4 address.\n";
+		return false;
+	}
+
+	socket_ = socket(AF_INET, SOCK_DGRAM, 0);
+	if (socket_ < 0) {
+		std::cerr << "Error: could not create UDP socket: " << strerror(errno) << '\n';
+		return false;
+	}
+	int enable(1);
+	setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+	// Allow a few frames to queue up if we are slow to read them
+	int buffer_size(64 * g_SkelPacketMaxSize);
+	setsockopt(socket_, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+
+	if (bind(socket_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+		std::cerr << "Error: could not listen on port " << port << ": " << strerror(errno) << '\n';
+		Close();
+		return false;
+	}
+
+	// One byte more than the largest packet so that oversized datagrams are noticed
+	buffer_.assign(g_SkelPacketMaxSize + 1, 0);
+	have_sequence_ = false;
+	return true;
+}
+
+void UdpSkeletonReceiver::Close()
+{
+	if (socket_ >= 0) {
+		close(socket_);
+	}
+	socket_ = -1;
+}
+
+int UdpSkeletonReceiver::Port() const
+{
+	sockaddr_in address;
+	socklen_t length(sizeof(address));
+	if ((socket_ < 0) || (getsockname(socket_, reinterpret_cast<sockaddr*>(&address), &length) < 0)) {
+		return 0;
+	}
+	return ntohs(address.sin_port);
+}
+
+void UdpSkeletonReceiver::ResetStats()
+{
+	memset(&stats_, 0, sizeof(stats_));
+}
+
+bool UdpSkeletonReceiver::Receive(SkeletonPacket& packet, int timeout_ms)
+{
+	if (socket_ < 0) { return false; }
+
+	while (true)
+	{
+		struct pollfd pfd;
+		pfd.fd = socket_;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		int rv(poll(&pfd, 1, timeout_ms));
+		if ((rv < 0) && (errno == EINTR)) {
+			continue;
+		}
+		if (rv <= 0) {
+			return false;
+		}
+
+		ssize_t size(recv(socket_, &buffer_[0], buffer_.size(), 0));
+		if (size < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		uint64_t now(WallClockMicroseconds());
+
+		if (!DecodeSkeletonPacket(&buffer_[0], static_cast<size_t>(size), packet)) {
+			++stats_.invalid;
+			continue;
+		}
+
+		// Sequence numbers are compared modulo 2^32 so that wrapping around is harmless
+		++stats_.received;
+		int32_t ahead(static_cast<int32_t>(packet.sequence - next_sequence_));
+		if (!have_sequence_ || (ahead >= 0)) {
+			if (have_sequence_) {
+				stats_.lost += static_cast<uint32_t>(ahead);
+			}
+			next_sequence_ = packet.sequence + 1;
+			have_sequence_ = true;
+		} else {
+			// A packet we had counted as lost turned up late
+			++stats_.out_of_order;
+			if (stats_.lost > 0) {
+				--stats_.lost;
+			}
+		}
+
+		double latency_ms((now > packet.send_time) ? 1e-3 * static_cast<double>(now - packet.send_time) : 0.);
+		stats_.latency_sum_ms += latency_ms;
+		if (latency_ms > stats_.latency_max_ms) {
+			stats_.latency_max_ms = latency_ms;
+		}
+
+		return true;
+	}
+}
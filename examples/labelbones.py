@@ -12,11 +12,13 @@ Options:
     -v, --verbose   Increase verbosity of output.
 """
 import logging
+import time
 import docopt
 import numpy as np
 import matplotlib.pyplot as plt
 from PIL import Image
-import tables
+
+import skelread
 
 LOG = logging.getLogger()
 
@@ -28,25 +30,22 @@ def main():
     )
 
     LOG.info('Opening log file {0}'.format(opts['<logfile>']))
-    log_root = tables.open_file(opts['<logfile>']).root
+    log = skelread.open(opts['<logfile>'])
 
-    for frame in log_root.frames:
-        frame_idx = frame._v_attrs.idx
+    start_time = time.time()
+    for frame in log:
+        frame_idx = frame.idx
         if frame_idx % 30 == 0:
             LOG.info('Processing frame {0}...'.format(frame_idx))
 
         user = None
         for tracked_user in frame.users:
-            try:
-                if tracked_user.joints.shape[0] > 0:
-                    user = tracked_user
-            except AttributeError:
-                # it's ok
-                pass
+            if tracked_user.joints.shape[0] > 0:
+                user = tracked_user
 
         # If we have a user, detect labels
         if user is None:
-            label_im = np.asanyarray(frame.label)
+            label_im = frame.label
         else:
             label_im = bone_labels(frame, user)
 
@@ -55,6 +54,9 @@ def main():
         Image.fromarray(label_color_im).save(
             '{0}-{1:05d}.png'.format(opts['<frame-prefix>'], frame_idx))
 
+    LOG.info('Processed {0} frames in {1:.1f}s'.format(
+        len(log), time.time() - start_time))
+
 def distances_to_line_segment(pts, line):
     """pts is a Nx3 array of 3d points.
     line = (p1, p2) where p1 and p2 are 3-vectors.
@@ -101,9 +103,9 @@ def distances_to_line_segment(pts, line):
 
 def bone_labels(frame, user):
     # Get points for this user
-    pts = frame.points[:]
-    pt_labels = frame.point_labels[:]
-    user_pts = pts[pt_labels == user._v_attrs.idx, :]
+    pts = frame.points
+    pt_labels = frame.point_labels
+    user_pts = pts[pt_labels == user.idx, :]
 
     joint_map = {}
     for joint in user.joints:
@@ -135,7 +137,7 @@ def bone_labels(frame, user):
 
     closest_bone_indices = np.argmin(bone_dists, axis=1)
     label_image = np.zeros_like(frame.depth)
-    label_image[frame.label == user._v_attrs.idx] = closest_bone_indices + 1
+    label_image[frame.label == user.idx] = closest_bone_indices + 1
 
     return label_image
 
@@ -12,12 +12,14 @@ Options:
     -v, --verbose   Increase verbosity of output.
 """
 import logging
+import time
 import docopt
 import numpy as np
 import matplotlib.pyplot as plt
 from PIL import Image
 import scipy.ndimage as ndi
-import tables
+
+import skelread
 
 LOG = logging.getLogger()
 
@@ -29,18 +31,16 @@ def main():
     )
 
     LOG.info('Opening log file {0}'.format(opts['<logfile>']))
-    log_root = tables.open_file(opts['<logfile>']).root
+    log = skelread.open(opts['<logfile>'])
 
-    for frame in log_root.frames:
-        frame_idx = frame._v_attrs.idx
+    start_time = time.time()
+    for frame in log:
+        frame_idx = frame.idx
         if frame_idx % 30 == 0:
             LOG.info('Processing frame {0}...'.format(frame_idx))
 
-        # Copy depth and label image to numpy array
-        depth, label = frame.depth[:], frame.label[:]
-
-        # Copy points to numpy array
-        points = frame.points[:]
+        # Depth, label and points are read-only views onto the log
+        depth, label, points = frame.depth, frame.label, frame.points
 
         # Create NxMx3 "point map"
         point_map = np.zeros(depth.shape + (3,))
@@ -51,7 +51,7 @@ def main():
 
         # Extract each user from the depth image
         for user in frame.users:
-            user_mask = label == user._v_attrs.idx
+            user_mask = label == user.idx
             user_points = np.where(np.dstack((user_mask,)*3), point_map, 0)
             user_normals = compute_normals(user_points, user_mask)
             normals = np.where(np.dstack((user_mask,) * 3), user_normals, normals)
@@ -61,6 +61,9 @@ def main():
         Image.fromarray(np.clip(255*light_im, 0, 255).astype(np.uint8)).save(
             '{0}-{1:05d}.png'.format(opts['<frame-prefix>'], frame_idx))
 
+    LOG.info('Processed {0} frames in {1:.1f}s'.format(
+        len(log), time.time() - start_time))
+
 def compute_normals(points, mask):
     """
     Given a NxMx3 array of points, compute a NxMx3 array of computed normals.
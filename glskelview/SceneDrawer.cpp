@@ -26,9 +26,6 @@
 
 #include <GL/glut.h>
 
-extern xn::UserGenerator g_UserGenerator;
-extern xn::DepthGenerator g_DepthGenerator;
-
 extern XnBool g_bDrawBackground;
 extern XnBool g_bDrawPixels;
 extern XnBool g_bDrawSkeleton;
@@ -120,23 +117,24 @@ void glPrintString(void *font, char *str)
 		glutBitmapCharacter(font,*str++);
 	}
 }
-bool DrawLimb(XnUserID player, XnSkeletonJoint eJoint1, XnSkeletonJoint eJoint2)
+bool DrawLimb(xn::UserGenerator& userGenerator, xn::DepthGenerator& depthGenerator,
+		XnUserID player, XnSkeletonJoint eJoint1, XnSkeletonJoint eJoint2)
 {
-	if (!g_UserGenerator.GetSkeletonCap().IsTracking(player))
+	if (!userGenerator.GetSkeletonCap().IsTracking(player))
 	{
 		printf("not tracked!\n");
 		return true;
 	}
 
-	if (!g_UserGenerator.GetSkeletonCap().IsJointActive(eJoint1) ||
-		!g_UserGenerator.GetSkeletonCap().IsJointActive(eJoint2))
+	if (!userGenerator.GetSkeletonCap().IsJointActive(eJoint1) ||
+		!userGenerator.GetSkeletonCap().IsJointActive(eJoint2))
 	{
 		return false;
 	}
 
 	XnSkeletonJointPosition joint1, joint2;
-	g_UserGenerator.GetSkeletonCap().GetSkeletonJointPosition(player, eJoint1, joint1);
-	g_UserGenerator.GetSkeletonCap().GetSkeletonJointPosition(player, eJoint2, joint2);
+	userGenerator.GetSkeletonCap().GetSkeletonJointPosition(player, eJoint1, joint1);
+	userGenerator.GetSkeletonCap().GetSkeletonJointPosition(player, eJoint2, joint2);
 
 	if (joint1.fConfidence < 0.5 || joint2.fConfidence < 0.5)
 	{
@@ -147,7 +145,7 @@ bool DrawLimb(XnUserID player, XnSkeletonJoint eJoint1, XnSkeletonJoint eJoint2)
 	pt[0] = joint1.position;
 	pt[1] = joint2.position;
 
-	g_DepthGenerator.ConvertRealWorldToProjective(2, pt, pt);
+	depthGenerator.ConvertRealWorldToProjective(2, pt, pt);
 	glVertex3i(pt[0].X, pt[0].Y, 0);
 	glVertex3i(pt[1].X, pt[1].Y, 0);
 
@@ -168,21 +166,22 @@ void drawCircle(float x, float y, float radius)
  
    glEnd();
 }
-void DrawJoint(XnUserID player, XnSkeletonJoint eJoint)
+void DrawJoint(xn::UserGenerator& userGenerator, xn::DepthGenerator& depthGenerator,
+		XnUserID player, XnSkeletonJoint eJoint)
 {
-	if (!g_UserGenerator.GetSkeletonCap().IsTracking(player))
+	if (!userGenerator.GetSkeletonCap().IsTracking(player))
 	{
 		printf("not tracked!\n");
 		return;
 	}
 
-	if (!g_UserGenerator.GetSkeletonCap().IsJointActive(eJoint))
+	if (!userGenerator.GetSkeletonCap().IsJointActive(eJoint))
 	{
 		return;
 	}
 
 	XnSkeletonJointPosition joint;
-	g_UserGenerator.GetSkeletonCap().GetSkeletonJointPosition(player, eJoint, joint);
+	userGenerator.GetSkeletonCap().GetSkeletonJointPosition(player, eJoint, joint);
 
 	if (joint.fConfidence < 0.5)
 	{
@@ -192,7 +191,7 @@ void DrawJoint(XnUserID player, XnSkeletonJoint eJoint)
 	XnPoint3D pt;
 	pt = joint.position;
 
-	g_DepthGenerator.ConvertRealWorldToProjective(1, &pt, &pt);
+	depthGenerator.ConvertRealWorldToProjective(1, &pt, &pt);
 
 	drawCircle(pt.X, pt.Y, 2);
 }
@@ -243,7 +242,8 @@ const XnChar* GetPoseErrorString(XnPoseDetectionStatus error)
 }
 
 
-void DrawDepthMap(const xn::DepthMetaData& dmd, const xn::SceneMetaData& smd)
+void DrawDepthMap(const xn::DepthMetaData& dmd, const xn::SceneMetaData& smd,
+		xn::DepthGenerator& depthGenerator, xn::UserGenerator& userGenerator)
 {
 	static bool bInitialized = false;	
 	static GLuint depthTexID;
@@ -385,14 +385,14 @@ void DrawDepthMap(const xn::DepthMetaData& dmd, const xn::SceneMetaData& smd)
 	char strLabel[50] = "";
 	XnUserID aUsers[15];
 	XnUInt16 nUsers = 15;
-	g_UserGenerator.GetUsers(aUsers, nUsers);
+	userGenerator.GetUsers(aUsers, nUsers);
 	for (int i = 0; i < nUsers; ++i)
 	{
 		if (g_bPrintID)
 		{
 			XnPoint3D com;
-			g_UserGenerator.GetCoM(aUsers[i], com);
-			g_DepthGenerator.ConvertRealWorldToProjective(1, &com, &com);
+			userGenerator.GetCoM(aUsers[i], com);
+			depthGenerator.ConvertRealWorldToProjective(1, &com, &com);
 
 			XnUInt32 nDummy = 0;
 
@@ -402,12 +402,12 @@ void DrawDepthMap(const xn::DepthMetaData& dmd, const xn::SceneMetaData& smd)
 				// Tracking
 				xnOSStrFormat(strLabel, sizeof(strLabel), &nDummy, "%d", aUsers[i]);
 			}
-			else if (g_UserGenerator.GetSkeletonCap().IsTracking(aUsers[i]))
+			else if (userGenerator.GetSkeletonCap().IsTracking(aUsers[i]))
 			{
 				// Tracking
 				xnOSStrFormat(strLabel, sizeof(strLabel), &nDummy, "%d - Tracking", aUsers[i]);
 			}
-			else if (g_UserGenerator.GetSkeletonCap().IsCalibrating(aUsers[i]))
+			else if (userGenerator.GetSkeletonCap().IsCalibrating(aUsers[i]))
 			{
 				// Calibrating
 				xnOSStrFormat(strLabel, sizeof(strLabel), &nDummy, "%d - Calibrating [%s]", aUsers[i], GetCalibrationErrorString(m_Errors[aUsers[i]].first));
@@ -424,7 +424,7 @@ void DrawDepthMap(const xn::DepthMetaData& dmd, const xn::SceneMetaData& smd)
 			glRasterPos2i(com.X, com.Y);
 			glPrintString(GLUT_BITMAP_HELVETICA_18, strLabel);
 		}
-		if (g_bDrawSkeleton && g_UserGenerator.GetSkeletonCap().IsTracking(aUsers[i]))
+		if (g_bDrawSkeleton && userGenerator.GetSkeletonCap().IsTracking(aUsers[i]))
 		{
 			glColor4f(1-Colors[aUsers[i]%nColors][0], 1-Colors[aUsers[i]%nColors][1], 1-Colors[aUsers[i]%nColors][2], 1);
 
@@ -432,78 +432,78 @@ void DrawDepthMap(const xn::DepthMetaData& dmd, const xn::SceneMetaData& smd)
 			if (g_bMarkJoints)
 			{
 				// Try to draw all joints
-				DrawJoint(aUsers[i], XN_SKEL_HEAD);
-				DrawJoint(aUsers[i], XN_SKEL_NECK);
-				DrawJoint(aUsers[i], XN_SKEL_TORSO);
-				DrawJoint(aUsers[i], XN_SKEL_WAIST);
-
-				DrawJoint(aUsers[i], XN_SKEL_LEFT_COLLAR);
-				DrawJoint(aUsers[i], XN_SKEL_LEFT_SHOULDER);
-				DrawJoint(aUsers[i], XN_SKEL_LEFT_ELBOW);
-				DrawJoint(aUsers[i], XN_SKEL_LEFT_WRIST);
-				DrawJoint(aUsers[i], XN_SKEL_LEFT_HAND);
-				DrawJoint(aUsers[i], XN_SKEL_LEFT_FINGERTIP);
-
-				DrawJoint(aUsers[i], XN_SKEL_RIGHT_COLLAR);
-				DrawJoint(aUsers[i], XN_SKEL_RIGHT_SHOULDER);
-				DrawJoint(aUsers[i], XN_SKEL_RIGHT_ELBOW);
-				DrawJoint(aUsers[i], XN_SKEL_RIGHT_WRIST);
-				DrawJoint(aUsers[i], XN_SKEL_RIGHT_HAND);
-				DrawJoint(aUsers[i], XN_SKEL_RIGHT_FINGERTIP);
-
-				DrawJoint(aUsers[i], XN_SKEL_LEFT_HIP);
-				DrawJoint(aUsers[i], XN_SKEL_LEFT_KNEE);
-				DrawJoint(aUsers[i], XN_SKEL_LEFT_ANKLE);
-				DrawJoint(aUsers[i], XN_SKEL_LEFT_FOOT);
-
-				DrawJoint(aUsers[i], XN_SKEL_RIGHT_HIP);
-				DrawJoint(aUsers[i], XN_SKEL_RIGHT_KNEE);
-				DrawJoint(aUsers[i], XN_SKEL_RIGHT_ANKLE);
-				DrawJoint(aUsers[i], XN_SKEL_RIGHT_FOOT);
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_HEAD);
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_NECK);
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_TORSO);
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_WAIST);
+
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_LEFT_COLLAR);
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_LEFT_SHOULDER);
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_LEFT_ELBOW);
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_LEFT_WRIST);
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_LEFT_HAND);
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_LEFT_FINGERTIP);
+
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_RIGHT_COLLAR);
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_RIGHT_SHOULDER);
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_RIGHT_ELBOW);
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_RIGHT_WRIST);
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_RIGHT_HAND);
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_RIGHT_FINGERTIP);
+
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_LEFT_HIP);
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_LEFT_KNEE);
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_LEFT_ANKLE);
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_LEFT_FOOT);
+
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_RIGHT_HIP);
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_RIGHT_KNEE);
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_RIGHT_ANKLE);
+				DrawJoint(userGenerator, depthGenerator, aUsers[i], XN_SKEL_RIGHT_FOOT);
 			}
 
 			glBegin(GL_LINES);
 
 			// Draw Limbs
-			DrawLimb(aUsers[i], XN_SKEL_HEAD, XN_SKEL_NECK);
+			DrawLimb(userGenerator, depthGenerator, aUsers[i], XN_SKEL_HEAD, XN_SKEL_NECK);
 
-			DrawLimb(aUsers[i], XN_SKEL_NECK, XN_SKEL_LEFT_SHOULDER);
-			DrawLimb(aUsers[i], XN_SKEL_LEFT_SHOULDER, XN_SKEL_LEFT_ELBOW);
-			if (!DrawLimb(aUsers[i], XN_SKEL_LEFT_ELBOW, XN_SKEL_LEFT_WRIST))
+			DrawLimb(userGenerator, depthGenerator, aUsers[i], XN_SKEL_NECK, XN_SKEL_LEFT_SHOULDER);
+			DrawLimb(userGenerator, depthGenerator, aUsers[i], XN_SKEL_LEFT_SHOULDER, XN_SKEL_LEFT_ELBOW);
+			if (!DrawLimb(userGenerator, depthGenerator, aUsers[i], XN_SKEL_LEFT_ELBOW, XN_SKEL_LEFT_WRIST))
 			{
-				DrawLimb(aUsers[i], XN_SKEL_LEFT_ELBOW, XN_SKEL_LEFT_HAND);
+				DrawLimb(userGenerator, depthGenerator, aUsers[i], XN_SKEL_LEFT_ELBOW, XN_SKEL_LEFT_HAND);
 			}
 			else
 			{
-				DrawLimb(aUsers[i], XN_SKEL_LEFT_WRIST, XN_SKEL_LEFT_HAND);
-				DrawLimb(aUsers[i], XN_SKEL_LEFT_HAND, XN_SKEL_LEFT_FINGERTIP);
+				DrawLimb(userGenerator, depthGenerator, aUsers[i], XN_SKEL_LEFT_WRIST, XN_SKEL_LEFT_HAND);
+				DrawLimb(userGenerator, depthGenerator, aUsers[i], XN_SKEL_LEFT_HAND, XN_SKEL_LEFT_FINGERTIP);
 			}
 
 
-			DrawLimb(aUsers[i], XN_SKEL_NECK, XN_SKEL_RIGHT_SHOULDER);
-			DrawLimb(aUsers[i], XN_SKEL_RIGHT_SHOULDER, XN_SKEL_RIGHT_ELBOW);
-			if (!DrawLimb(aUsers[i], XN_SKEL_RIGHT_ELBOW, XN_SKEL_RIGHT_WRIST))
+			DrawLimb(userGenerator, depthGenerator, aUsers[i], XN_SKEL_NECK, XN_SKEL_RIGHT_SHOULDER);
+			DrawLimb(userGenerator, depthGenerator, aUsers[i], XN_SKEL_RIGHT_SHOULDER, XN_SKEL_RIGHT_ELBOW);
+			if (!DrawLimb(userGenerator, depthGenerator, aUsers[i], XN_SKEL_RIGHT_ELBOW, XN_SKEL_RIGHT_WRIST))
 			{
-				DrawLimb(aUsers[i], XN_SKEL_RIGHT_ELBOW, XN_SKEL_RIGHT_HAND);
+				DrawLimb(userGenerator, depthGenerator, aUsers[i], XN_SKEL_RIGHT_ELBOW, XN_SKEL_RIGHT_HAND);
 			}
 			else
 			{
-				DrawLimb(aUsers[i], XN_SKEL_RIGHT_WRIST, XN_SKEL_RIGHT_HAND);
-				DrawLimb(aUsers[i], XN_SKEL_RIGHT_HAND, XN_SKEL_RIGHT_FINGERTIP);
+				DrawLimb(userGenerator, depthGenerator, aUsers[i], XN_SKEL_RIGHT_WRIST, XN_SKEL_RIGHT_HAND);
+				DrawLimb(userGenerator, depthGenerator, aUsers[i], XN_SKEL_RIGHT_HAND, XN_SKEL_RIGHT_FINGERTIP);
 			}
 
-			DrawLimb(aUsers[i], XN_SKEL_LEFT_SHOULDER, XN_SKEL_TORSO);
-			DrawLimb(aUsers[i], XN_SKEL_RIGHT_SHOULDER, XN_SKEL_TORSO);
+			DrawLimb(userGenerator, depthGenerator, aUsers[i], XN_SKEL_LEFT_SHOULDER, XN_SKEL_TORSO);
+			DrawLimb(userGenerator, depthGenerator, aUsers[i], XN_SKEL_RIGHT_SHOULDER, XN_SKEL_TORSO);
 
-			DrawLimb(aUsers[i], XN_SKEL_TORSO, XN_SKEL_LEFT_HIP);
-			DrawLimb(aUsers[i], XN_SKEL_LEFT_HIP, XN_SKEL_LEFT_KNEE);
-			DrawLimb(aUsers[i], XN_SKEL_LEFT_KNEE, XN_SKEL_LEFT_FOOT);
+			DrawLimb(userGenerator, depthGenerator, aUsers[i], XN_SKEL_TORSO, XN_SKEL_LEFT_HIP);
+			DrawLimb(userGenerator, depthGenerator, aUsers[i], XN_SKEL_LEFT_HIP, XN_SKEL_LEFT_KNEE);
+			DrawLimb(userGenerator, depthGenerator, aUsers[i], XN_SKEL_LEFT_KNEE, XN_SKEL_LEFT_FOOT);
 
-			DrawLimb(aUsers[i], XN_SKEL_TORSO, XN_SKEL_RIGHT_HIP);
-			DrawLimb(aUsers[i], XN_SKEL_RIGHT_HIP, XN_SKEL_RIGHT_KNEE);
-			DrawLimb(aUsers[i], XN_SKEL_RIGHT_KNEE, XN_SKEL_RIGHT_FOOT);
+			DrawLimb(userGenerator, depthGenerator, aUsers[i], XN_SKEL_TORSO, XN_SKEL_RIGHT_HIP);
+			DrawLimb(userGenerator, depthGenerator, aUsers[i], XN_SKEL_RIGHT_HIP, XN_SKEL_RIGHT_KNEE);
+			DrawLimb(userGenerator, depthGenerator, aUsers[i], XN_SKEL_RIGHT_KNEE, XN_SKEL_RIGHT_FOOT);
 
-			DrawLimb(aUsers[i], XN_SKEL_LEFT_HIP, XN_SKEL_RIGHT_HIP);
+			DrawLimb(userGenerator, depthGenerator, aUsers[i], XN_SKEL_LEFT_HIP, XN_SKEL_RIGHT_HIP);
 			glEnd();
 		}
 	}
@@ -23,7 +23,9 @@
 
 #include <XnCppWrapper.h>
 
-void DrawDepthMap(const xn::DepthMetaData& dmd, const xn::SceneMetaData& smd);
+// Draw the depth map and the users of the given generators
+void DrawDepthMap(const xn::DepthMetaData& dmd, const xn::SceneMetaData& smd,
+		xn::DepthGenerator& depthGenerator, xn::UserGenerator& userGenerator);
 
 void XN_CALLBACK_TYPE MyCalibrationInProgress(xn::SkeletonCapability& capability, XnUserID id, XnCalibrationStatus calibrationError, void* pCookie);
 void XN_CALLBACK_TYPE MyPoseInProgress(xn::PoseDetectionCapability& capability, const XnChar* strPose, XnUserID id, XnPoseDetectionStatus poseError, void* pCookie);
@@ -22,6 +22,7 @@
 // Includes
 //---------------------------------------------------------------------------
 #include <iostream>
+#include <vector>
 #include <XnOpenNI.h>
 #include <XnCodecIDs.h>
 #include <XnCppWrapper.h>
@@ -29,7 +30,7 @@
 #include <XnPropNames.h>
 #include <GL/glut.h>
 
-#include "mainloop.h"
+#include "session.h"
 
 //---------------------------------------------------------------------------
 // Globals
@@ -51,6 +52,9 @@ XnBool g_bRecord = false;
 
 XnBool g_bQuit = false;
 
+// GLUT callbacks have no user data so the viewer's one session is global
+Session g_Session;
+
 //---------------------------------------------------------------------------
 // Constants
 //---------------------------------------------------------------------------
@@ -78,18 +82,17 @@ int main(int argc, char **argv)
 {
 	if (argc > 1)
 	{
-		if(!InitialiseContextFromRecording(argv[1])) {
+		if(!g_Session.OpenRecording(argv[1])) {
 			return EXIT_FAILURE;
 		}
 	}
 	else
 	{
-		if(!InitialiseContextFromXmlConfig(SAMPLE_XML_PATH)) {
+		if(!g_Session.OpenXmlConfig(SAMPLE_XML_PATH)) {
 			return EXIT_FAILURE;
 		}
 	}
 
-	PreMainLoop();
 	glInit(&argc, argv);
 	glutMainLoop();
 
@@ -133,7 +136,7 @@ void glutDisplay()
 
 	xn::SceneMetaData sceneMD;
 	xn::DepthMetaData depthMD;
-	g_DepthGenerator.GetMetaData(depthMD);
+	g_Session.GetDepthGenerator().GetMetaData(depthMD);
 	glOrtho(0, depthMD.XRes(), depthMD.YRes(), 0, -1.0, 1.0);
 
 	glDisable(GL_TEXTURE_2D);
@@ -141,13 +144,22 @@ void glutDisplay()
 	if (!g_bPause)
 	{
 		// Read next available data
-		g_Context.WaitOneUpdateAll(g_UserGenerator);
+		g_Session.Update();
+
+		// Report what the tracker did during the update
+		static std::vector<UserEvent> events;
+		events.clear();
+		g_Session.TakeUserEvents(events);
+		for (size_t i = 0; i < events.size(); ++i)
+		{
+			PrintUserEvent(std::cout, events[i]);
+		}
 	}
 
 		// Process the data
-		g_DepthGenerator.GetMetaData(depthMD);
-		g_UserGenerator.GetUserPixels(0, sceneMD);
-		DrawDepthMap(depthMD, sceneMD);
+		g_Session.GetDepthGenerator().GetMetaData(depthMD);
+		g_Session.GetUserGenerator().GetUserPixels(0, sceneMD);
+		DrawDepthMap(depthMD, sceneMD, g_Session.GetDepthGenerator(), g_Session.GetUserGenerator());
 
 	glutSwapBuffers();
 }
@@ -155,7 +167,7 @@ void glutDisplay()
 void glutIdle (void)
 {
 	if (g_bQuit) {
-		PostMainLoop();
+		g_Session.Close();
 		exit(EXIT_SUCCESS);
 	}
 
@@ -169,7 +181,7 @@ void glutKeyboard (unsigned char key, int /*x*/, int /*y*/)
 	{
 	case 27:
 		g_bQuit = true;
-		PostMainLoop();
+		g_Session.Close();
 		break;
 	case 'b':
 		// Draw background?
@@ -214,16 +226,17 @@ void glutKeyboard (unsigned char key, int /*x*/, int /*y*/)
 // Save calibration to file
 void SaveCalibration()
 {
+	xn::UserGenerator& userGenerator(g_Session.GetUserGenerator());
 	XnUserID aUserIDs[20] = {0};
 	XnUInt16 nUsers = 20;
-	g_UserGenerator.GetUsers(aUserIDs, nUsers);
+	userGenerator.GetUsers(aUserIDs, nUsers);
 	for (int i = 0; i < nUsers; ++i)
 	{
 		// Find a user who is already calibrated
-		if (g_UserGenerator.GetSkeletonCap().IsCalibrated(aUserIDs[i]))
+		if (userGenerator.GetSkeletonCap().IsCalibrated(aUserIDs[i]))
 		{
 			// Save user's calibration to file
-			g_UserGenerator.GetSkeletonCap().SaveCalibrationDataToFile(aUserIDs[i], XN_CALIBRATION_FILE_NAME);
+			userGenerator.GetSkeletonCap().SaveCalibrationDataToFile(aUserIDs[i], XN_CALIBRATION_FILE_NAME);
 			break;
 		}
 	}
@@ -232,22 +245,23 @@ void SaveCalibration()
 // Load calibration from file
 void LoadCalibration()
 {
+	xn::UserGenerator& userGenerator(g_Session.GetUserGenerator());
 	XnUserID aUserIDs[20] = {0};
 	XnUInt16 nUsers = 20;
-	g_UserGenerator.GetUsers(aUserIDs, nUsers);
+	userGenerator.GetUsers(aUserIDs, nUsers);
 	for (int i = 0; i < nUsers; ++i)
 	{
 		// Find a user who isn't calibrated or currently in pose
-		if (g_UserGenerator.GetSkeletonCap().IsCalibrated(aUserIDs[i])) continue;
-		if (g_UserGenerator.GetSkeletonCap().IsCalibrating(aUserIDs[i])) continue;
+		if (userGenerator.GetSkeletonCap().IsCalibrated(aUserIDs[i])) continue;
+		if (userGenerator.GetSkeletonCap().IsCalibrating(aUserIDs[i])) continue;
 
 		// Load user's calibration from file
-		XnStatus rc = g_UserGenerator.GetSkeletonCap().LoadCalibrationDataFromFile(aUserIDs[i], XN_CALIBRATION_FILE_NAME);
+		XnStatus rc = userGenerator.GetSkeletonCap().LoadCalibrationDataFromFile(aUserIDs[i], XN_CALIBRATION_FILE_NAME);
 		if (rc == XN_STATUS_OK)
 		{
 			// Make sure state is coherent
-			g_UserGenerator.GetPoseDetectionCap().StopPoseDetection(aUserIDs[i]);
-			g_UserGenerator.GetSkeletonCap().StartTracking(aUserIDs[i]);
+			userGenerator.GetPoseDetectionCap().StopPoseDetection(aUserIDs[i]);
+			userGenerator.GetSkeletonCap().StartTracking(aUserIDs[i]);
 		}
 		break;
 	}
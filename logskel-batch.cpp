@@ -0,0 +1,385 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Run logskel over many recordings using a pool of worker processes.
+//
+// Each recording is converted by its own logskel process so that every job
+// gets a fresh OpenNI context and DepthMapLogger. Jobs are taken from a queue
+// as workers become free, have their output captured to a per-job log file and
+// are retried a configurable number of times if they fail.
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+// Includes
+//---------------------------------------------------------------------------
+#include <cstdlib> // for EXIT_SUCCESS
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "arghelpers.h"
+#include "optionparser.h"
+#include "wallclock.h"
+
+//---------------------------------------------------------------------------
+// Types
+//---------------------------------------------------------------------------
+
+// A single recording to be converted
+struct Job {
+	std::string recording;    // path to .oni input
+	std::string output;       // path to HDF5 output
+	std::string name;         // path of output without extension
+	std::string log;          // path to captured stdout/stderr of the current attempt
+	int         attempts;     // number of times this job has been started
+	double      start_time;   // MonotonicSeconds() when the current attempt started
+};
+
+//---------------------------------------------------------------------------
+// Code
+//---------------------------------------------------------------------------
+
+// Command-line option description
+enum optionIndex { UNKNOWN, HELP, JOBS, OUTPUT_DIR, LIST, RETRIES, LOGSKEL, DURATION, };
+const option::Descriptor g_Usage[] =
+{
+	{ UNKNOWN,    0, "",   "",            option::Arg::None, "Usage:\n"
+								"  logskel-batch [options] --output-dir DIR [RECORDING|GLOB]...\n\n"
+								"Options:" },
+	{ HELP,       0, "h?", "help",        option::Arg::None, "  --help, -h, -?  \tPrint a brief usage summary." },
+	{ JOBS,       0, "j",  "jobs",        Arg::Numeric,      "  --jobs, -j N  \tRun N logskel processes at once. "
+								"(Default: number of online CPUs.)" },
+	{ OUTPUT_DIR, 0, "o",  "output-dir",  Arg::NonEmpty,     "  --output-dir, -o DIR  \tWrite logs and per-job output to DIR." },
+	{ LIST,       0, "l",  "list",        Arg::NonEmpty,     "  --list, -l FILE  \tRead recording paths or globs, one per line, from FILE." },
+	{ RETRIES,    0, "r",  "retries",     Arg::Numeric,      "  --retries, -r N  \tRetry a failing job up to N times. (Default: 1.)" },
+	{ LOGSKEL,    0, "",   "logskel",     Arg::NonEmpty,     "  --logskel PATH  \tPath to the logskel executable. "
+								"(Default: alongside this program.)" },
+	{ DURATION,   0, "d",  "duration",    Arg::Numeric,      "  --duration, -d SECONDS  \tLimit each job to the specified duration." },
+
+	{ 0,0,0,0,0,0 } // Zero record marking end of array.
+};
+
+// Expand pattern as a glob, appending matches to recordings. Patterns which match nothing are
+// added verbatim so that a missing file is reported as a failed job rather than silently dropped.
+void ExpandRecordings(const std::string& pattern, std::vector<std::string>& recordings)
+{
+	glob_t matches;
+	if (glob(pattern.c_str(), 0, NULL, &matches) != 0)
+	{
+		recordings.push_back(pattern);
+	}
+	else
+	{
+		for (size_t i = 0; i < matches.gl_pathc; ++i)
+		{
+			recordings.push_back(matches.gl_pathv[i]);
+		}
+	}
+
+	// glob() may have allocated even if it failed
+	globfree(&matches);
+}
+
+// Return the final path component of path with any extension removed
+std::string StemName(const std::string& path)
+{
+	std::string::size_type slash = path.find_last_of('/');
+	std::string name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+	std::string::size_type dot = name.find_last_of('.');
+	return (dot == std::string::npos || dot == 0) ? name : name.substr(0, dot);
+}
+
+// Return the size of the file at path or zero if it does not exist
+off_t FileSize(const std::string& path)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0) {
+		return 0;
+	}
+	return st.st_size;
+}
+
+// Start a logskel process for job. Returns the child's pid or -1 on failure.
+pid_t StartJob(const std::string& logskel, const Job& job, const char* duration)
+{
+	pid_t pid = fork();
+	if (pid != 0) {
+		return pid;
+	}
+
+	// In the child. Send stdout and stderr to the job's log and detach stdin from any terminal so
+	// that logskel does not wait for a key press.
+	int log_fd = open(job.log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	int null_fd = open("/dev/null", O_RDONLY);
+	if ((log_fd < 0) || (null_fd < 0)) {
+		_exit(127);
+	}
+	dup2(null_fd, STDIN_FILENO);
+	dup2(log_fd, STDOUT_FILENO);
+	dup2(log_fd, STDERR_FILENO);
+	close(null_fd);
+	close(log_fd);
+
+	std::vector<const char*> args;
+	args.push_back(logskel.c_str());
+	args.push_back("--single-pass");
+	args.push_back("--playback");
+	args.push_back(job.recording.c_str());
+	args.push_back("--log");
+	args.push_back(job.output.c_str());
+	if (duration) {
+		args.push_back("--duration");
+		args.push_back(duration);
+	}
+	args.push_back(NULL);
+
+	execv(logskel.c_str(), const_cast<char* const*>(&args[0]));
+
+	// Only reached if exec failed
+	fprintf(stderr, "Could not execute %s: %s\n", logskel.c_str(), strerror(errno));
+	_exit(127);
+}
+
+int main(int argc, char **argv)
+{
+	// Default to the logskel living next to this program
+	std::string logskel("logskel");
+	if (argc > 0) {
+		std::string self(argv[0]);
+		std::string::size_type slash = self.find_last_of('/');
+		if (slash != std::string::npos) {
+			logskel = self.substr(0, slash + 1) + logskel;
+		}
+	}
+
+	// Parse command-line options
+	argc-=(argc>0); argv+=(argc>0); // skip program name argv[0] if present
+	option::Stats  stats(g_Usage, argc, argv);
+	option::Option options[stats.options_max], buffer[stats.buffer_max];
+	option::Parser parse(g_Usage, argc, argv, options, buffer);
+
+	if (parse.error()) {
+		return EXIT_FAILURE;
+	}
+
+	if (options[HELP]) {
+		option::printUsage(std::cout, g_Usage);
+		return EXIT_SUCCESS;
+	}
+
+	if (!options[OUTPUT_DIR]) {
+		std::cerr << "Error: --output-dir must be specified.\n";
+		option::printUsage(std::cerr, g_Usage);
+		return EXIT_FAILURE;
+	}
+	std::string output_dir(options[OUTPUT_DIR].arg);
+
+	if (options[LOGSKEL]) {
+		logskel = options[LOGSKEL].arg;
+	}
+	if (access(logskel.c_str(), X_OK) != 0) {
+		std::cerr << "Error: " << logskel << " does not exist or is not executable.\n";
+		return EXIT_FAILURE;
+	}
+
+	long n_workers(sysconf(_SC_NPROCESSORS_ONLN));
+	if (options[JOBS]) {
+		n_workers = strtol(options[JOBS].arg, NULL, 10);
+	}
+	if (n_workers < 1) {
+		std::cerr << "Number of jobs must be positive.\n";
+		return EXIT_FAILURE;
+	}
+
+	int max_retries(1);
+	if (options[RETRIES]) {
+		max_retries = static_cast<int>(strtol(options[RETRIES].arg, NULL, 10));
+		if (max_retries < 0) {
+			std::cerr << "Number of retries must not be negative.\n";
+			return EXIT_FAILURE;
+		}
+	}
+
+	const char* duration = options[DURATION] ? options[DURATION].arg : NULL;
+
+	// Gather recordings from the command line and any list files. Globs are expanded here as well
+	// as by the shell so that very large sets may be passed quoted without hitting ARG_MAX.
+	std::vector<std::string> recordings;
+	for (int i = 0; i < parse.nonOptionsCount(); ++i)
+	{
+		ExpandRecordings(parse.nonOption(i), recordings);
+	}
+	for (option::Option* opt = options[LIST]; opt; opt = opt->next())
+	{
+		std::ifstream list_file(opt->arg);
+		if (!list_file) {
+			std::cerr << "Error: could not open list file " << opt->arg << ".\n";
+			return EXIT_FAILURE;
+		}
+		std::string line;
+		while (std::getline(list_file, line))
+		{
+			if (line.empty() || line[0] == '#') {
+				continue;
+			}
+			ExpandRecordings(line, recordings);
+		}
+	}
+
+	if (recordings.empty()) {
+		std::cerr << "Error: no recordings specified.\n";
+		return EXIT_FAILURE;
+	}
+
+	if ((mkdir(output_dir.c_str(), 0755) != 0) && (errno != EEXIST)) {
+		std::cerr << "Error: could not create " << output_dir << ": " << strerror(errno) << '\n';
+		return EXIT_FAILURE;
+	}
+
+	// Build the job queue. Recordings which share a name get the lowest numeric suffix which
+	// makes their outputs unique, taking into account recordings whose names already end in one.
+	std::deque<Job> queue;
+	std::set<std::string> names;
+	for (size_t i = 0; i < recordings.size(); ++i)
+	{
+		std::string stem(StemName(recordings[i])), name(stem);
+		for (int count = 1; !names.insert(name).second; ++count)
+		{
+			char suffix[16];
+			snprintf(suffix, 16, "-%d", count);
+			name = stem + suffix;
+		}
+
+		Job job;
+		job.recording = recordings[i];
+		job.name = output_dir + "/" + name;
+		job.output = job.name + ".h5";
+		job.log = job.name + ".log";
+		job.attempts = 0;
+		job.start_time = 0.;
+		queue.push_back(job);
+	}
+
+	size_t n_jobs(queue.size()), n_finished(0), n_succeeded(0), n_retried(0);
+	std::vector<Job> failed;
+	std::map<pid_t, Job> running;
+	double batch_start(MonotonicSeconds());
+	off_t total_bytes(0);
+
+	std::cout << "Converting " << n_jobs << " recording(s) with " << n_workers
+		<< " worker(s) using " << logskel << '\n';
+
+	while (!queue.empty() || !running.empty())
+	{
+		// Keep every worker busy
+		while (!queue.empty() && (static_cast<long>(running.size()) < n_workers))
+		{
+			Job job(queue.front());
+			queue.pop_front();
+
+			// Each retry gets its own log so that the output of the failed attempt is kept
+			++job.attempts;
+			if (job.attempts > 1) {
+				char suffix[32];
+				snprintf(suffix, 32, ".attempt%d.log", job.attempts);
+				job.log = job.name + suffix;
+			}
+			job.start_time = MonotonicSeconds();
+			pid_t pid = StartJob(logskel, job, duration);
+			if (pid < 0) {
+				std::cerr << "Error: could not fork: " << strerror(errno) << '\n';
+				queue.push_front(job);
+				break;
+			}
+			running[pid] = job;
+		}
+
+		// Wait for any worker to finish
+		int status(0);
+		pid_t pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			std::cerr << "Error: waitpid failed: " << strerror(errno) << '\n';
+			return EXIT_FAILURE;
+		}
+
+		std::map<pid_t, Job>::iterator it = running.find(pid);
+		if (it == running.end()) {
+			continue;
+		}
+		Job job(it->second);
+		running.erase(it);
+
+		double elapsed(MonotonicSeconds() - job.start_time);
+		bool ok(WIFEXITED(status) && (WEXITSTATUS(status) == EXIT_SUCCESS));
+
+		if (ok) {
+			++n_finished;
+			++n_succeeded;
+			off_t size(FileSize(job.output));
+			total_bytes += size;
+			printf("[%zu/%zu] ok     %s (%.1fs, %.1f MiB)\n", n_finished, n_jobs,
+				job.recording.c_str(), elapsed, size / (1024. * 1024.));
+		} else if (job.attempts <= max_retries) {
+			++n_retried;
+			printf("[%zu/%zu] retry  %s (attempt %d failed, see %s)\n", n_finished, n_jobs,
+				job.recording.c_str(), job.attempts, job.log.c_str());
+			queue.push_back(job);
+		} else {
+			++n_finished;
+			failed.push_back(job);
+			printf("[%zu/%zu] FAILED %s (see %s)\n", n_finished, n_jobs,
+				job.recording.c_str(), job.log.c_str());
+		}
+		fflush(stdout);
+	}
+
+	// Throughput summary
+	double batch_elapsed(MonotonicSeconds() - batch_start);
+	std::cout << "---------------------------------------------------------------------------\n";
+	printf("Jobs:       %zu succeeded, %zu failed, %zu retried\n",
+		n_succeeded, failed.size(), n_retried);
+	printf("Wall time:  %.1fs\n", batch_elapsed);
+	if (batch_elapsed > 0.) {
+		printf("Throughput: %.2f recordings/min, %.1f MiB/s written\n",
+			60. * n_succeeded / batch_elapsed, total_bytes / (1024. * 1024. * batch_elapsed));
+	}
+	for (size_t i = 0; i < failed.size(); ++i)
+	{
+		printf("Failed:     %s\n", failed[i].recording.c_str());
+	}
+	std::cout << "---------------------------------------------------------------------------\n";
+
+	return failed.empty() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
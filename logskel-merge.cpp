@@ -0,0 +1,423 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Concatenate logs of consecutive frame ranges into a single log.
+//
+// Each input log is expected to have been written by logskel with
+// --start-frame/--end-frame. Frames are copied in order of their source
+// frame_id and renumbered so that the output has continuous frame indices.
+// Frames which appear in more than one input are only copied once. Frames
+// whose pixels were shared with an earlier frame by --skip-unchanged share
+// them with that frame's copy, and their pixels_from_idx is renumbered.
+//
+// The user events of the copied frames are gathered into a single "events"
+// table. Tracking metrics and prediction statistics describe a whole input and
+// cannot be combined, so each input's are copied to "shards/shard_NN".
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+// Includes
+//---------------------------------------------------------------------------
+#include <algorithm>
+#include <cstdlib> // for EXIT_SUCCESS
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <hdf5.h>
+#include <H5Cpp.h>
+
+#include "arghelpers.h"
+#include "optionparser.h"
+
+using namespace H5;
+
+//---------------------------------------------------------------------------
+// Types
+//---------------------------------------------------------------------------
+
+// A frame within one of the input logs
+struct SourceFrame {
+	size_t      input;      // index into list of inputs
+	std::string name;       // name of frame group within /frames
+	hsize_t     idx;        // index of the frame within its input
+	uint32_t    frame_id;   // depth frame id in the original recording
+
+	bool operator < (const SourceFrame& other) const {
+		return frame_id < other.frame_id;
+	}
+};
+
+// The native type of an input's events table, closed when it goes out of scope
+class EventType
+{
+public:
+	EventType() : id_(-1) { }
+	~EventType() { if (id_ >= 0) { H5Tclose(id_); } }
+
+	hid_t Id() const { return id_; }
+	void Reset(hid_t id) { if (id_ >= 0) { H5Tclose(id_); } id_ = id; }
+
+private:
+	hid_t id_;
+
+	EventType(const EventType&);
+	EventType& operator = (const EventType&);
+};
+
+//---------------------------------------------------------------------------
+// Code
+//---------------------------------------------------------------------------
+
+// Command-line option description
+enum optionIndex { UNKNOWN, HELP, OUTPUT, };
+const option::Descriptor g_Usage[] =
+{
+	{ UNKNOWN,  0, "",   "",       option::Arg::None, "Usage:\n"
+							"  logskel-merge [options] --output FILE SHARD...\n\n"
+							"Options:" },
+	{ HELP,     0, "h?", "help",   option::Arg::None, "  --help, -h, -?  \tPrint a brief usage summary." },
+	{ OUTPUT,   0, "o",  "output", Arg::NonEmpty,     "  --output, -o FILE  \tWrite merged log to FILE." },
+
+	{ 0,0,0,0,0,0 } // Zero record marking end of array.
+};
+
+// Datasets of a frame which --skip-unchanged may share with an earlier frame
+static const char* const g_PixelDatasets[] = { "depth", "label", "points", "point_labels", "normals" };
+
+bool IsPixelDataset(const std::string& name)
+{
+	for (size_t i = 0; i < sizeof(g_PixelDatasets) / sizeof(g_PixelDatasets[0]); ++i)
+	{
+		if (name == g_PixelDatasets[i]) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Copy the frame group called name in input_frames to out_name in output_frames as H5Ocopy would,
+// except that its pixel datasets become hard links to those of the frame ref_name, which has
+// already been copied. H5Ocopy would store a copy of the pixels for every frame.
+void CopyLinkedFrame(Group& input_frames, const std::string& name, Group& output_frames,
+		const char* out_name, const std::string& ref_name)
+{
+	Group in_group(input_frames.openGroup(name));
+	Group out_group(output_frames.createGroup(out_name));
+
+	for (int i = 0; i < in_group.getNumAttrs(); ++i)
+	{
+		Attribute attr(in_group.openAttribute(static_cast<unsigned>(i)));
+		DataType type(attr.getDataType());
+		DataSpace space(attr.getSpace());
+		std::vector<char> value(type.getSize() * static_cast<size_t>(space.getSimpleExtentNpoints()));
+		attr.read(type, &value[0]);
+		out_group.createAttribute(attr.getName(), type, space).write(type, &value[0]);
+	}
+
+	for (hsize_t i = 0; i < in_group.getNumObjs(); ++i)
+	{
+		std::string child(in_group.getObjnameByIdx(i));
+		std::string source(ref_name + "/" + child);
+		herr_t err;
+		if (IsPixelDataset(child) && (H5Lexists(output_frames.getId(), source.c_str(), H5P_DEFAULT) > 0)) {
+			err = H5Lcreate_hard(output_frames.getId(), source.c_str(), out_group.getId(), child.c_str(),
+					H5P_DEFAULT, H5P_DEFAULT);
+		} else {
+			err = H5Ocopy(in_group.getId(), child.c_str(), out_group.getId(), child.c_str(),
+					H5P_DEFAULT, H5P_DEFAULT);
+		}
+		if (err < 0) {
+			throw GroupIException("CopyLinkedFrame", "could not copy " + name + "/" + child);
+		}
+	}
+}
+
+// Gather the events of the copied frames from every input into an "events" table in output and
+// renumber their frames. out_indices gives the output index of each copied frame by input and
+// index within it. The events of frames which were not copied, because an earlier input also had
+// them, are dropped. Returns false if the inputs' event tables cannot be combined.
+bool MergeEvents(const std::vector<std::unique_ptr<H5File> >& inputs,
+		const std::map<std::pair<size_t, hsize_t>, hsize_t>& out_indices, H5File& output)
+{
+	EventType type;
+	size_t row_size(0), frame_idx_offset(0);
+	std::vector<char> rows;
+	std::vector<std::pair<hsize_t, size_t> > order;   // output frame index and row of each event
+
+	for (size_t i = 0; i < inputs.size(); ++i)
+	{
+		if (H5Lexists(inputs[i]->getId(), "events", H5P_DEFAULT) <= 0) {
+			continue;
+		}
+		DataSet ds(inputs[i]->openDataSet("events"));
+		EventType input_type;
+		input_type.Reset(H5Tget_native_type(ds.getDataType().getId(), H5T_DIR_ASCEND));
+
+		if (type.Id() < 0) {
+			int member(H5Tget_member_index(input_type.Id(), "frame_idx"));
+			if ((member < 0) || (H5Tget_member_class(input_type.Id(), member) != H5T_INTEGER)) {
+				std::cerr << "Error: the events table of input " << i + 1 << " has no frame indices.\n";
+				return false;
+			}
+			type.Reset(H5Tcopy(input_type.Id()));
+			row_size = H5Tget_size(type.Id());
+			frame_idx_offset = H5Tget_member_offset(type.Id(), static_cast<unsigned>(member));
+		} else if (H5Tequal(type.Id(), input_type.Id()) <= 0) {
+			std::cerr << "Error: the events table of input " << i + 1 << " differs from earlier inputs.\n";
+			return false;
+		}
+
+		size_t n_rows(static_cast<size_t>(ds.getSpace().getSimpleExtentNpoints()));
+		if (n_rows == 0) {
+			continue;
+		}
+		std::vector<char> input_rows(n_rows * row_size);
+		if (H5Dread(ds.getId(), type.Id(), H5S_ALL, H5S_ALL, H5P_DEFAULT, &input_rows[0]) < 0) {
+			std::cerr << "Error: could not read the events table of input " << i + 1 << ".\n";
+			return false;
+		}
+
+		for (size_t row = 0; row < n_rows; ++row)
+		{
+			char *p_row(&input_rows[row * row_size]);
+			uint64_t frame_idx(0);
+			memcpy(&frame_idx, p_row + frame_idx_offset, sizeof(frame_idx));
+
+			std::map<std::pair<size_t, hsize_t>, hsize_t>::const_iterator it(
+					out_indices.find(std::make_pair(i, static_cast<hsize_t>(frame_idx))));
+			if (it == out_indices.end()) {
+				continue;
+			}
+			frame_idx = it->second;
+			memcpy(p_row + frame_idx_offset, &frame_idx, sizeof(frame_idx));
+			order.push_back(std::make_pair(it->second, order.size()));
+			rows.insert(rows.end(), p_row, p_row + row_size);
+		}
+	}
+
+	if (type.Id() < 0) {
+		return true;
+	}
+
+	// Put the events in frame order, keeping the order of events within a frame
+	std::sort(order.begin(), order.end());
+	std::vector<char> sorted(rows.size());
+	for (size_t k = 0; k < order.size(); ++k)
+	{
+		memcpy(&sorted[k * row_size], &rows[order[k].second * row_size], row_size);
+	}
+
+	// Lay the table out as logskel does so that it may be extended in the same way
+	hsize_t dims[1] = { order.size() }, max_dims[1] = { H5S_UNLIMITED }, chunk_dims[1] = { 256 };
+	DSetCreatPropList props;
+	props.setChunk(1, chunk_dims);
+	DataSpace space(1, dims, max_dims);
+	hid_t ds(H5Dcreate2(output.getId(), "events", type.Id(), space.getId(), H5P_DEFAULT,
+				props.getId(), H5P_DEFAULT));
+	if (ds < 0) {
+		std::cerr << "Error: could not create the events table.\n";
+		return false;
+	}
+	herr_t err(sorted.empty() ? 0 : H5Dwrite(ds, type.Id(), H5S_ALL, H5S_ALL, H5P_DEFAULT, &sorted[0]));
+	H5Dclose(ds);
+	if (err < 0) {
+		std::cerr << "Error: could not write the events table.\n";
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	// Parse command-line options
+	argc-=(argc>0); argv+=(argc>0); // skip program name argv[0] if present
+	option::Stats  stats(g_Usage, argc, argv);
+	option::Option options[stats.options_max], buffer[stats.buffer_max];
+	option::Parser parse(g_Usage, argc, argv, options, buffer);
+
+	if (parse.error()) {
+		return EXIT_FAILURE;
+	}
+
+	if (options[HELP]) {
+		option::printUsage(std::cout, g_Usage);
+		return EXIT_SUCCESS;
+	}
+
+	if (!options[OUTPUT] || (parse.nonOptionsCount() == 0)) {
+		std::cerr << "Error: an output and at least one input must be specified.\n";
+		option::printUsage(std::cerr, g_Usage);
+		return EXIT_FAILURE;
+	}
+
+	try
+	{
+		// Open every input and gather its frames
+		std::vector<std::unique_ptr<H5File> > inputs;
+		std::vector<Group> input_frames;
+		std::vector<SourceFrame> frames;
+		for (int i = 0; i < parse.nonOptionsCount(); ++i)
+		{
+			inputs.push_back(std::unique_ptr<H5File>(new H5File(parse.nonOption(i), H5F_ACC_RDONLY)));
+			hid_t root(inputs.back()->getId());
+			if ((H5Lexists(root, "sync", H5P_DEFAULT) > 0) || (H5Lexists(root, "sensors", H5P_DEFAULT) > 0)) {
+				std::cerr << "Error: " << parse.nonOption(i) << " holds several synchronised "
+					<< "recordings, which cannot be merged.\n";
+				return EXIT_FAILURE;
+			}
+			input_frames.push_back(inputs.back()->openGroup("frames"));
+
+			Group& group(input_frames.back());
+			for (hsize_t obj_idx = 0; obj_idx < group.getNumObjs(); ++obj_idx)
+			{
+				SourceFrame frame;
+				frame.input = inputs.size() - 1;
+				frame.name = group.getObjnameByIdx(obj_idx);
+				frame.idx = obj_idx;
+
+				Group frame_group(group.openGroup(frame.name));
+				if (!frame_group.attrExists("frame_id")) {
+					std::cerr << "Error: " << parse.nonOption(i) << " has no frame ids. "
+						<< "Was it written by an older logskel?\n";
+					return EXIT_FAILURE;
+				}
+				frame_group.openAttribute("frame_id").read(PredType::NATIVE_UINT32, &frame.frame_id);
+				frames.push_back(frame);
+			}
+		}
+
+		// Put frames in recording order. The sort is stable so that, where shards overlap, the
+		// frame from the earlier input on the command line wins.
+		std::stable_sort(frames.begin(), frames.end());
+
+		H5File output(options[OUTPUT].arg, H5F_ACC_TRUNC);
+		Group output_frames(output.createGroup("frames"));
+
+		// Output index of each copied frame, by input and index within it
+		std::map<std::pair<size_t, hsize_t>, hsize_t> out_indices;
+
+		// Output index of the frame holding the pixels of each input frame which others share
+		std::map<std::pair<size_t, hsize_t>, hsize_t> pixel_indices;
+
+		char name_str[20], comment_str[255];
+		hsize_t out_idx(0);
+		for (size_t i = 0; i < frames.size(); ++i)
+		{
+			const SourceFrame& frame(frames[i]);
+
+			if ((i > 0) && (frames[i-1].frame_id == frame.frame_id)) {
+				continue;
+			}
+			if ((i > 0) && (frames[i-1].frame_id + 1 != frame.frame_id)) {
+				std::cerr << "Warning: frames " << frames[i-1].frame_id << " to "
+					<< frame.frame_id << " are not contiguous.\n";
+			}
+
+			snprintf(name_str, 20, "frame_%06lld", out_idx);
+			snprintf(comment_str, 255, "Data for frame %lld", out_idx);
+
+			// Find the output frame holding the pixels this one shares, if any. There is none yet
+			// if another input's frame was copied in place of the one they came from.
+			Group& input_group(input_frames[frame.input]);
+			Group in_group(input_group.openGroup(frame.name));
+			bool shares_pixels(in_group.attrExists("pixels_from_idx"));
+			std::pair<size_t, hsize_t> pixels_key(frame.input, frame.idx);
+			std::map<std::pair<size_t, hsize_t>, hsize_t>::const_iterator ref(pixel_indices.end());
+			if (shares_pixels) {
+				in_group.openAttribute("pixels_from_idx").read(PredType::NATIVE_HSIZE, &pixels_key.second);
+				ref = pixel_indices.find(pixels_key);
+			}
+
+			if (ref != pixel_indices.end()) {
+				char ref_name[20];
+				snprintf(ref_name, 20, "frame_%06lld", ref->second);
+				CopyLinkedFrame(input_group, frame.name, output_frames, name_str, ref_name);
+			} else {
+				herr_t err = H5Ocopy(input_group.getId(), frame.name.c_str(),
+						output_frames.getId(), name_str, H5P_DEFAULT, H5P_DEFAULT);
+				if (err < 0) {
+					std::cerr << "Error: could not copy " << frame.name << " from "
+						<< parse.nonOption(static_cast<int>(frame.input)) << ".\n";
+					return EXIT_FAILURE;
+				}
+			}
+
+			// Renumber the copied frame. The first to share pixels with a frame which was not copied
+			// holds them in its place.
+			Group out_group(output_frames.openGroup(name_str));
+			out_group.setComment(".", comment_str);
+			out_group.openAttribute("idx").write(PredType::NATIVE_HSIZE, &out_idx);
+			if (ref != pixel_indices.end()) {
+				out_group.openAttribute("pixels_from_idx").write(PredType::NATIVE_HSIZE, &ref->second);
+			} else {
+				if (shares_pixels) {
+					out_group.removeAttr("pixels_from_idx");
+				}
+				pixel_indices[pixels_key] = out_idx;
+			}
+			out_indices[std::make_pair(frame.input, frame.idx)] = out_idx;
+			++out_idx;
+		}
+
+		if (!MergeEvents(inputs, out_indices, output)) {
+			return EXIT_FAILURE;
+		}
+
+		// Keep each input's statistics under its own shard group
+		Group shards(output.createGroup("shards"));
+		for (size_t i = 0; i < inputs.size(); ++i)
+		{
+			static const char* const names[] = { "metrics", "prediction" };
+			std::string input(parse.nonOption(static_cast<int>(i)));
+
+			snprintf(name_str, 20, "shard_%02d", static_cast<int>(i));
+			Group shard(shards.createGroup(name_str));
+			StrType str_type(PredType::C_S1, input.size());
+			shard.createAttribute("input", str_type, DataSpace()).write(str_type, input);
+
+			hid_t root(inputs[i]->getId());
+			for (size_t j = 0; j < sizeof(names) / sizeof(names[0]); ++j)
+			{
+				if (H5Lexists(root, names[j], H5P_DEFAULT) <= 0) {
+					continue;
+				}
+				if (H5Ocopy(root, names[j], shard.getId(), names[j], H5P_DEFAULT, H5P_DEFAULT) < 0) {
+					std::cerr << "Error: could not copy " << names[j] << " from " << input << ".\n";
+					return EXIT_FAILURE;
+				}
+			}
+		}
+
+		std::cout << "Merged " << out_idx << " frames from " << inputs.size()
+			<< " log(s) into " << options[OUTPUT].arg << '\n';
+	}
+	catch (const Exception& e)
+	{
+		std::cerr << "HDF5 error: " << e.getDetailMsg() << '\n';
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -21,17 +21,37 @@
 //---------------------------------------------------------------------------
 // Includes
 //---------------------------------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <cstdlib> // for EXIT_SUCCESS
+#include <cstring>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
 #include <time.h>
+#include <unistd.h> // for isatty, usleep
+#include <string>
+#include <vector>
 
 #include <XnOpenNI.h>
 #include <XnCppWrapper.h>
 
 #include "arghelpers.h"
+#include "framesink.h"
 #include "io.h"
-#include "mainloop.h"
+#ifdef HAVE_ARROW
+#include "jointstream.h"
+#endif
 #include "optionparser.h"
+#include "session.h"
+#include "shmring.h"
+#include "sync.h"
+#include "synthetic.h"
+#include "trigger.h"
+#include "udp.h"
 
 //---------------------------------------------------------------------------
 // Globals
@@ -44,7 +64,7 @@ DepthMapLogger g_Log;
 //---------------------------------------------------------------------------
 
 // Command-line option description
-enum optionIndex { UNKNOWN, HELP, CAPTURE, PLAYBACK, LOG, DURATION, };
+enum optionIndex { UNKNOWN, HELP, CAPTURE, PLAYBACK, LOG, DURATION, SINGLE_PASS, START_FRAME, END_FRAME, WARMUP, SYNC_TOLERANCE, IMAGE, JPEG_QUALITY, NORMALS, SKIP_UNCHANGED, ARROW, SMOOTH, SMOOTH_CUTOFF, SMOOTH_BETA, PREDICT, PREDICT_ACCELERATION, UDP, SHM, SHM_SLOTS, SINK, CALIBRATION_CACHE, QUIET_EVENTS, SYNTHETIC, REPLAY, MAX_SPEED, DETERMINISTIC, TRIGGER, PRE_TRIGGER, HOLD_OFF, SELF_TEST, };
 const option::Descriptor g_Usage[] =
 {
 	{ UNKNOWN,  0, "",   "",         option::Arg::None,	"Usage:\n"
@@ -52,13 +72,418 @@ const option::Descriptor g_Usage[] =
 							  	"Options:" },
 	{ HELP,     0, "h?", "help",     option::Arg::None, 	"  --help, -h, -?  \tPrint a brief usage summary." },
 	{ CAPTURE,  0, "c",  "capture",  Arg::Required,		"  --capture, -c CONFIG  \tCapture from sensor using specified XML config." },
-	{ PLAYBACK, 0, "p",  "playback", Arg::Required,		"  --playback, -p RECORDING  \tPlayback a .oni recording." },
+	{ PLAYBACK, 0, "p",  "playback", Arg::Required,		"  --playback, -p RECORDING  \tPlayback a .oni recording. "
+								"Repeat to log several recordings of one scene in sync." },
+	{ REPLAY,   0, "",   "replay",   Arg::NonEmpty,		"  --replay LOG  \tTrack users again in the depth maps of a log written by --log." },
+	{ MAX_SPEED, 0, "",  "max-speed", option::Arg::None,	"  --max-speed  \tReplay a log as fast as frames can be tracked rather "
+								"than in real time." },
+	{ DETERMINISTIC, 0, "", "deterministic", option::Arg::None, "  --deterministic  \tTrack every frame of a recording or log "
+								"exactly once, as fast as possible, and print a hash of the output. Runs over the same "
+								"input then give the same hash. Implies --single-pass. A --synthetic scene needs frames=N or "
+								"--end-frame." },
+	{ SYNTHETIC, 0, "",  "synthetic", Arg::NonEmpty,	"  --synthetic SPEC  \tLog a synthetic scene of figures walking in circles, "
+								"tracked from the first frame. SPEC is a comma separated list of users=N, size=COLSxROWS, "
+								"fps=FPS, noise=MM, speed=SPEED, seed=SEED, frames=N and enter=N, the frame in which the "
+								"figures appear. (Default: "
+								"users=1,size=320x240,fps=30,noise=0,speed=1,seed=1.)" },
 	{ LOG,      0, "l",  "log",      Arg::Required,		"  --log, -l FILE  \tLog results to FILE in HDF5 format." },
 	{ DURATION, 0, "d",  "duration", Arg::Numeric,		"  --duration, -d SECONDS  \tRun main loop for the specified duration." },
+	{ SINGLE_PASS, 0, "s", "single-pass", option::Arg::None,	"  --single-pass, -s  \tStop at the end of a recording rather than looping." },
+	{ START_FRAME, 0, "", "start-frame", Arg::Numeric,	"  --start-frame FRAME  \tStart logging a recording at depth frame FRAME." },
+	{ END_FRAME, 0, "",  "end-frame", Arg::Numeric,		"  --end-frame FRAME  \tStop logging a recording before depth frame FRAME." },
+	{ WARMUP,   0, "",   "warmup",   Arg::Numeric,		"  --warmup FRAMES  \tTrack, but do not log, FRAMES frames before the start frame. "
+								"(Default: 150.)" },
+	{ IMAGE,    0, "i",  "image",    option::Arg::None,	"  --image, -i  \tAlso log the colour stream as JPEG images." },
+	{ JPEG_QUALITY, 0, "", "jpeg-quality", Arg::Numeric,	"  --jpeg-quality QUALITY  \tJPEG quality from 1 to 100 for --image. "
+								"(Default: 90.)" },
+	{ NORMALS,  0, "n",  "normals",  option::Arg::None,	"  --normals, -n  \tAlso log surface normals of user pixels." },
+	{ SKIP_UNCHANGED, 0, "", "skip-unchanged", Arg::Real,	"  --skip-unchanged MM  \tDo not store the depth map of a frame again unless a "
+								"16x16 tile of it has moved by more than MM millimetres on average or "
+								"its labels have changed. Such frames link to the last depth map stored." },
+	{ ARROW,    0, "",   "arrow",    Arg::NonEmpty,		"  --arrow FILE  \tAlso write joints to FILE as an Apache Arrow IPC file." },
+	{ SMOOTH,   0, "",   "smooth",   option::Arg::None,	"  --smooth  \tAlso log joints smoothed by a One Euro filter." },
+	{ SMOOTH_CUTOFF, 0, "", "smooth-cutoff", Arg::Real,	"  --smooth-cutoff HZ  \tMinimum cut-off frequency for --smooth. "
+								"(Default: 1.)" },
+	{ SMOOTH_BETA, 0, "", "smooth-beta", Arg::Real,		"  --smooth-beta BETA  \tIncrease in cut-off frequency per mm/s of joint speed "
+								"for --smooth. (Default: 0.01.)" },
+	{ PREDICT,  0, "",   "predict",  Arg::Numeric,		"  --predict MS  \tAlso log joints predicted MS milliseconds ahead. "
+								"The --arrow output then carries predicted joints." },
+	{ PREDICT_ACCELERATION, 0, "", "predict-acceleration", option::Arg::None,
+								"  --predict-acceleration  \tPredict assuming constant acceleration "
+								"rather than constant velocity." },
+	{ UDP,      0, "u",  "udp",      Arg::NonEmpty,		"  --udp, -u HOST:PORT  \tAlso send joints to HOST:PORT as UDP packets. "
+								"May be repeated." },
+	{ SHM,      0, "",   "shm",      Arg::NonEmpty,		"  --shm NAME  \tAlso publish depth, labels and joints to the POSIX shared "
+								"memory object NAME, e.g. /logskel." },
+	{ SHM_SLOTS, 0, "",  "shm-slots", Arg::Numeric,		"  --shm-slots N  \tNumber of frames kept in the --shm ring. (Default: 8.)" },
+	{ SINK,     0, "",   "sink",     Arg::NonEmpty,		"  --sink OUTPUT:POLICY[:LENGTH]  \tQueue up to LENGTH frames for OUTPUT, one of "
+								"log, arrow, udp, shm or events. When the queue is full POLICY is block, drop-oldest "
+								"or drop-newest. (Default: log:block:32, arrow:block:64, udp:drop-oldest:2, "
+								"shm:drop-oldest:2, events:block:64. LENGTH defaults to the output's.) May be repeated." },
+	{ TRIGGER,  0, "",   "trigger",  Arg::NonEmpty,		"  --trigger CONDITION  \tOnly log frames around those meeting CONDITION, "
+								"user-present or tracking." },
+	{ PRE_TRIGGER, 0, "", "pre-trigger", Arg::Real,		"  --pre-trigger SECONDS  \tWith --trigger, also log up to SECONDS of frames "
+								"from before the condition was met. (Default: 5.)" },
+	{ HOLD_OFF, 0, "",   "hold-off", Arg::Real,		"  --hold-off SECONDS  \tWith --trigger, keep logging for SECONDS after the "
+								"condition was last met. (Default: 5.)" },
+	{ QUIET_EVENTS, 0, "q", "quiet-events", option::Arg::None, "  --quiet-events, -q  \tDo not print user events, such as "
+								"users being detected, calibrated or lost, to stderr." },
+	{ CALIBRATION_CACHE, 0, "", "calibration-cache", Arg::NonEmpty, "  --calibration-cache DIR  \tSave calibrations in DIR and "
+								"reuse them for users of a similar build rather than calibrating again." },
+	{ SYNC_TOLERANCE, 0, "", "sync-tolerance", Arg::Real, "  --sync-tolerance MS  \tMaximum timestamp difference between "
+								"synchronised frames. (Default: 20.)" },
+	{ SELF_TEST, 0, "",  "self-test", option::Arg::None,	"  --self-test  \tCheck that frames are queued and dropped for each "
+								"output as its policy says, then exit." },
 
 	{ 0,0,0,0,0,0 } // Zero record marking end of array.
 };
 
+// Set predicted to users with their joints replaced by the positions predictor expects them to
+// have after its horizon.
+void PredictJoints(JointPredictor& predictor, uint64_t timestamp,
+		const std::vector<TrackedUser>& users, std::vector<TrackedUser>& predicted)
+{
+	predicted.resize(users.size());
+	for (size_t i = 0; i < users.size(); ++i)
+	{
+		predicted[i].user = users[i].user;
+		predicted[i].n_joints = users[i].n_joints;
+		if (users[i].n_joints > 0) {
+			predictor.Predict(users[i].user, timestamp, users[i].joints, users[i].n_joints,
+					predicted[i].joints);
+		} else {
+			predictor.Reset(users[i].user);
+		}
+	}
+}
+
+// Writes frames to the HDF5 log
+class LogSink : public FrameSink
+{
+	DepthMapLogger& log_;
+public:
+	explicit LogSink(DepthMapLogger& log) : log_(log) { }
+	const char* Name() const { return "log"; }
+	void Consume(const FrameRef& frame) { log_.DumpFrame(*frame); }
+};
+
+// Base for sinks which stream joints. If prediction is enabled, each sink predicts joints ahead
+// on its own thread and stamps them with the time they were predicted for.
+class JointSink : public FrameSink
+{
+	JointPredictor*          p_predictor_;
+	uint64_t                 horizon_us_;
+	std::vector<TrackedUser> predicted_;
+protected:
+	// Get the users to stream for frame and their timestamp
+	const std::vector<TrackedUser>& Users(const FrameSnapshot& frame, uint64_t& timestamp)
+	{
+		timestamp = frame.timestamp;
+		if (!p_predictor_) {
+			return frame.users;
+		}
+
+		for (size_t i = 0; i < frame.lost_users.size(); ++i)
+		{
+			p_predictor_->Reset(frame.lost_users[i]);
+		}
+		PredictJoints(*p_predictor_, frame.timestamp, frame.users, predicted_);
+		timestamp += horizon_us_;
+		return predicted_;
+	}
+public:
+	// Pass NULL to stream joints as tracked
+	explicit JointSink(const PredictionParams* p_prediction)
+		: p_predictor_(p_prediction ? new JointPredictor(*p_prediction) : NULL)
+		, horizon_us_(p_prediction ? static_cast<uint64_t>(1e3f * p_prediction->horizon_ms) : 0)
+	{ }
+	~JointSink() { delete p_predictor_; }
+};
+
+// Sends joints as UDP packets
+class UdpSink : public JointSink
+{
+	UdpSkeletonSender& sender_;
+public:
+	UdpSink(UdpSkeletonSender& sender, const PredictionParams* p_prediction)
+		: JointSink(p_prediction), sender_(sender)
+	{ }
+	const char* Name() const { return "udp"; }
+
+	void Consume(const FrameRef& frame)
+	{
+		uint64_t timestamp;
+		const std::vector<TrackedUser>& users(Users(*frame, timestamp));
+		sender_.BeginFrame(frame->frame_id, timestamp);
+		for (size_t i = 0; i < users.size(); ++i)
+		{
+			if (users[i].n_joints > 0) {
+				sender_.AddUser(users[i].user, users[i].joints, users[i].n_joints);
+			}
+		}
+		sender_.Send();
+	}
+};
+
+#ifdef HAVE_ARROW
+// Appends joints to an Arrow IPC file
+class ArrowSink : public JointSink
+{
+	JointStreamWriter& stream_;
+public:
+	ArrowSink(JointStreamWriter& stream, const PredictionParams* p_prediction)
+		: JointSink(p_prediction), stream_(stream)
+	{ }
+	const char* Name() const { return "arrow"; }
+
+	void Consume(const FrameRef& frame)
+	{
+		uint64_t timestamp;
+		const std::vector<TrackedUser>& users(Users(*frame, timestamp));
+		for (size_t i = 0; i < users.size(); ++i)
+		{
+			stream_.Append(frame->number, timestamp, users[i].user, users[i].joints, users[i].n_joints);
+		}
+	}
+};
+#endif
+
+// Publishes frames to shared memory. Joints are published as tracked.
+class ShmSink : public FrameSink
+{
+	ShmRingWriter& ring_;
+public:
+	explicit ShmSink(ShmRingWriter& ring) : ring_(ring) { }
+	const char* Name() const { return "shm"; }
+
+	void Consume(const FrameRef& frame)
+	{
+		ring_.Publish(frame->frame_id, frame->timestamp, frame->rows, frame->cols,
+				&frame->depth[0], &frame->label[0], frame->users);
+	}
+};
+
+// Prints user events to stderr so that the tracking callbacks need not
+class EventSink : public FrameSink
+{
+public:
+	const char* Name() const { return "events"; }
+
+	void Consume(const FrameRef& frame)
+	{
+		for (size_t i = 0; i < frame->user_events.size(); ++i)
+		{
+			PrintUserEvent(std::cerr, frame->user_events[i]);
+		}
+	}
+};
+
+// For --self-test: records the frames it is given. While closed, it holds on to the frame it has
+// been given until opened.
+class GatedSink : public FrameSink
+{
+	const char*             name_;
+	std::mutex              mutex_;
+	std::condition_variable changed_;
+	bool                    open_, holding_;
+public:
+	std::vector<uint64_t>   numbers;     // of the frames consumed
+	std::vector<uint16_t>   lost_users;  // in the frames consumed
+	std::vector<uint16_t>   event_users; // users of the events in the frames consumed
+
+	explicit GatedSink(const char* name) : name_(name), open_(true), holding_(false) { }
+	const char* Name() const { return name_; }
+
+	void Close() { std::lock_guard<std::mutex> lock(mutex_); open_ = false; }
+	void Open()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			open_ = true;
+		}
+		changed_.notify_all();
+	}
+
+	// Wait until the sink is holding on to a frame
+	void WaitUntilHolding()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (!holding_) { changed_.wait(lock); }
+	}
+
+	void Consume(const FrameRef& frame)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		numbers.push_back(frame->number);
+		lost_users.insert(lost_users.end(), frame->lost_users.begin(), frame->lost_users.end());
+		for (size_t i = 0; i < frame->user_events.size(); ++i)
+		{
+			event_users.push_back(frame->user_events[i].user);
+		}
+
+		holding_ = !open_;
+		changed_.notify_all();
+		while (!open_) { changed_.wait(lock); }
+		holding_ = false;
+	}
+};
+
+// Check the frame dispatcher. Frame n loses user n and has an event for them. Sinks which drop
+// frames are held in the first frame while the rest queue up, released and given one more frame.
+// Every sink must still see each user lost and each event, in order.
+int SelfTest()
+{
+	bool ok(true);
+
+	std::string name;
+	SinkOptions seeded(DROP_OLDEST, 2);
+	if (!ParseSinkOptions("udp:drop-newest", name, seeded) || (name != "udp")
+			|| (seeded.policy != DROP_NEWEST) || (seeded.queue_length != 2)) {
+		std::cerr << "Self test failed: a sink specification without a length changed the length.\n";
+		ok = false;
+	}
+
+	const uint16_t n_held(10);
+	GatedSink oldest("drop-oldest"), newest("drop-newest"), blocking("block");
+	FrameDispatcher dispatcher;
+	dispatcher.AddSink(&oldest, SinkOptions(DROP_OLDEST, 2));
+	dispatcher.AddSink(&newest, SinkOptions(DROP_NEWEST, 2));
+	dispatcher.AddSink(&blocking, SinkOptions(DROP_NONE, n_held));
+	oldest.Close();
+	newest.Close();
+	dispatcher.Start();
+
+	std::vector<uint16_t> all_users;
+	for (uint16_t n = 1; n <= n_held + 1; ++n)
+	{
+		if (n == n_held + 1) {
+			oldest.Open();
+			newest.Open();
+			for (size_t i = 0; i < 2; ++i)
+			{
+				FrameDispatcher::SinkStats stats(dispatcher.Stats(i));
+				while (stats.consumed + stats.dropped < n_held) {
+					usleep(1000);
+					stats = dispatcher.Stats(i);
+				}
+			}
+		}
+
+		std::shared_ptr<FrameSnapshot> p_frame(dispatcher.NewFrame());
+		*p_frame = FrameSnapshot();
+		p_frame->number = n;
+		p_frame->lost_users.push_back(n);
+		UserEvent event;
+		memset(&event, 0, sizeof(event));
+		event.user = n;
+		event.type = USER_EVENT_LOST;
+		p_frame->user_events.push_back(event);
+		dispatcher.Dispatch(p_frame);
+		all_users.push_back(n);
+
+		if (n == 1) {
+			oldest.WaitUntilHolding();
+			newest.WaitUntilHolding();
+		}
+	}
+	dispatcher.Stop();
+
+	const uint64_t oldest_numbers[] = { 1, n_held - 1, n_held, n_held + 1 };
+	const uint64_t newest_numbers[] = { 1, 2, 3, n_held + 1 };
+	std::vector<uint64_t> all_numbers(all_users.begin(), all_users.end());
+	GatedSink* sinks[] = { &oldest, &newest, &blocking };
+	std::vector<uint64_t> expected[] = {
+		std::vector<uint64_t>(oldest_numbers, oldest_numbers + 4),
+		std::vector<uint64_t>(newest_numbers, newest_numbers + 4),
+		all_numbers,
+	};
+	for (size_t i = 0; i < 3; ++i)
+	{
+		GatedSink& sink(*sinks[i]);
+		if (sink.numbers != expected[i]) {
+			std::cerr << "Self test failed: sink " << sink.Name() << " consumed the wrong frames.\n";
+			ok = false;
+		}
+		if ((sink.lost_users != all_users) || (sink.event_users != all_users)) {
+			std::cerr << "Self test failed: sink " << sink.Name()
+				<< " missed users lost or events of frames it dropped.\n";
+			ok = false;
+		}
+	}
+	dispatcher.PrintStats(std::cout);
+
+	if (!ok) {
+		return EXIT_FAILURE;
+	}
+	std::cout << "Self test passed.\n";
+	return EXIT_SUCCESS;
+}
+
+// Log several recordings at once, each on its own thread, into a single log with a sync table.
+int RunSynchronised(option::Option* options, double duration)
+{
+	if (!options[LOG]) {
+		std::cerr << "Error: --log must be specified when playing back more than one recording.\n";
+		return EXIT_FAILURE;
+	}
+	if (options[START_FRAME] || options[END_FRAME]) {
+		std::cerr << "Error: frame ranges are not supported with more than one recording.\n";
+		return EXIT_FAILURE;
+	}
+	if (options[ARROW] || options[UDP] || options[SHM] || options[SINK] || options[CALIBRATION_CACHE]) {
+		std::cerr << "Error: --arrow, --udp, --shm, --sink and --calibration-cache are not supported with "
+			"more than one recording.\n";
+		return EXIT_FAILURE;
+	}
+	if (options[TRIGGER] || options[PRE_TRIGGER] || options[HOLD_OFF] || options[SKIP_UNCHANGED]
+			|| options[SMOOTH] || options[SMOOTH_CUTOFF] || options[SMOOTH_BETA] || options[PREDICT]
+			|| options[PREDICT_ACCELERATION] || options[NORMALS] || options[IMAGE] || options[JPEG_QUALITY]
+			|| options[DETERMINISTIC]) {
+		std::cerr << "Error: --trigger, --skip-unchanged, --smooth, --predict, --normals, --image, "
+			"--deterministic and their settings are not supported with more than one recording.\n";
+		return EXIT_FAILURE;
+	}
+
+	double tolerance_ms(20.);
+	if (options[SYNC_TOLERANCE]) {
+		tolerance_ms = strtod(options[SYNC_TOLERANCE].arg, NULL);
+		if (tolerance_ms < 0.) {
+			std::cerr << "Synchronisation tolerance must not be negative.\n";
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::vector<std::string> recordings;
+	for (option::Option* opt = options[PLAYBACK]; opt; opt = opt->next())
+	{
+		recordings.push_back(opt->arg);
+	}
+
+	SynchronisedLogger sync_log;
+	if (!sync_log.Open(recordings)) {
+		return EXIT_FAILURE;
+	}
+
+	std::cout << "Logging " << recordings.size() << " recordings to " << options[LOG].arg << '\n';
+	if (!sync_log.Start(options[LOG].arg, tolerance_ms)) {
+		return EXIT_FAILURE;
+	}
+
+	time_t loop_start(time(NULL));
+	bool watch_keyboard(isatty(STDIN_FILENO));
+	while (sync_log.IsRunning() && (!watch_keyboard || !xnOSWasKeyboardHit()))
+	{
+		if ((duration > 0.) && (difftime(time(NULL), loop_start) >= duration)) {
+			std::cout << "Logging has run for " << duration << " seconds.\n";
+			break;
+		}
+		usleep(100000);
+	}
+	sync_log.Stop();
+
+	return EXIT_SUCCESS;
+}
+
 int main(int argc, char **argv)
 {
 	// Parse command-line options
@@ -76,9 +501,13 @@ int main(int argc, char **argv)
 		return EXIT_SUCCESS;
 	}
 
+	if (options[SELF_TEST]) {
+		return SelfTest();
+	}
+
 	// Check command-line options for validity.
-	if (options[CAPTURE] && options[PLAYBACK]) {
-		std::cerr << "Error: only one of --playback and --capture may be specified.\n";
+	if ((!!options[CAPTURE] + !!options[PLAYBACK] + !!options[REPLAY] + !!options[SYNTHETIC]) > 1) {
+		std::cerr << "Error: only one of --playback, --capture, --replay and --synthetic may be specified.\n";
 		option::printUsage(std::cerr, g_Usage);
 		return EXIT_FAILURE;
 	}
@@ -93,44 +522,340 @@ int main(int argc, char **argv)
 		}
 	}
 
+	// A deterministic run covers its input exactly once, however long that takes
+	bool deterministic(options[DETERMINISTIC]);
+	if (deterministic && !options[PLAYBACK] && !options[REPLAY] && !options[SYNTHETIC]) {
+		std::cerr << "Error: --deterministic requires --playback, --replay or --synthetic.\n";
+		return EXIT_FAILURE;
+	}
+	if (deterministic && options[DURATION]) {
+		std::cerr << "Error: --duration cannot be used with --deterministic.\n";
+		return EXIT_FAILURE;
+	}
+
+	// Stopping at the end of the input only makes sense for recordings
+	bool single_pass((options[SINGLE_PASS] || deterministic) && (options[PLAYBACK] || options[REPLAY]));
+
+	// Frame range to log. Frames before start_frame are still fed to the tracker so that users
+	// have been acquired by the time logging starts. An end_frame of zero means "no limit".
+	long start_frame(0), end_frame(0), warmup_frames(150);
+	if (options[START_FRAME] || options[END_FRAME]) {
+		if (!options[PLAYBACK] && !options[REPLAY] && !options[SYNTHETIC]) {
+			std::cerr << "Error: --start-frame and --end-frame require --playback, --replay or --synthetic.\n";
+			return EXIT_FAILURE;
+		}
+
+		// A frame range never wraps around the end of the recording
+		single_pass = true;
+	}
+	if (options[START_FRAME]) {
+		start_frame = strtol(options[START_FRAME].arg, NULL, 10);
+	}
+	if (options[END_FRAME]) {
+		end_frame = strtol(options[END_FRAME].arg, NULL, 10);
+	}
+	if (options[WARMUP]) {
+		warmup_frames = strtol(options[WARMUP].arg, NULL, 10);
+	}
+	if ((start_frame < 0) || (end_frame < 0) || (warmup_frames < 0)) {
+		std::cerr << "Frame numbers must be positive.\n";
+		return EXIT_FAILURE;
+	}
+	if ((end_frame > 0) && (end_frame <= start_frame)) {
+		std::cerr << "End frame must be after start frame.\n";
+		return EXIT_FAILURE;
+	}
+
+	// Several recordings are handled separately
+	if (options[PLAYBACK].count() > 1) {
+		return RunSynchronised(options, duration);
+	}
+
+	// A synthetic scene replaces the sensor and tracker altogether
+	std::unique_ptr<SyntheticScene> scene;
+	if (options[SYNTHETIC]) {
+		SyntheticParams params;
+		if (!ParseSyntheticParams(options[SYNTHETIC].arg, params)) {
+			return EXIT_FAILURE;
+		}
+		if (options[IMAGE] || options[CALIBRATION_CACHE]) {
+			std::cerr << "Error: --image and --calibration-cache are not supported with --synthetic.\n";
+			return EXIT_FAILURE;
+		}
+		if (deterministic && (params.n_frames == 0) && (end_frame == 0)) {
+			std::cerr << "Error: --deterministic needs frames=N in --synthetic, or --end-frame, to end.\n";
+			return EXIT_FAILURE;
+		}
+		scene.reset(new SyntheticScene(params));
+	}
+
+	if (options[REPLAY] && options[IMAGE]) {
+		std::cerr << "Error: --image is not supported with --replay. Logs are replayed without colour.\n";
+		return EXIT_FAILURE;
+	}
+
+	bool log_images(options[IMAGE]);
+	if (log_images) {
+		long jpeg_quality(90);
+		if (options[JPEG_QUALITY]) {
+			jpeg_quality = strtol(options[JPEG_QUALITY].arg, NULL, 10);
+		}
+		if ((jpeg_quality < 1) || (jpeg_quality > 100)) {
+			std::cerr << "JPEG quality must be between 1 and 100.\n";
+			return EXIT_FAILURE;
+		}
+		g_Log.EnableImages(static_cast<int>(jpeg_quality));
+	}
+
+	g_Log.EnableNormals(options[NORMALS]);
+
+	if (options[SKIP_UNCHANGED]) {
+		ChangeParams params;
+		params.threshold_mm = static_cast<float>(strtod(options[SKIP_UNCHANGED].arg, NULL));
+		if (params.threshold_mm < 0.f) {
+			std::cerr << "Change threshold must not be negative.\n";
+			return EXIT_FAILURE;
+		}
+		g_Log.EnableChangeDetection(true, params);
+	}
+
+	if (options[SMOOTH]) {
+		OneEuroParams params;
+		if (options[SMOOTH_CUTOFF]) {
+			params.min_cutoff = static_cast<float>(strtod(options[SMOOTH_CUTOFF].arg, NULL));
+		}
+		if (options[SMOOTH_BETA]) {
+			params.beta = static_cast<float>(strtod(options[SMOOTH_BETA].arg, NULL));
+		}
+		if ((params.min_cutoff <= 0.f) || (params.beta < 0.f)) {
+			std::cerr << "Smoothing cut-off must be positive and beta must not be negative.\n";
+			return EXIT_FAILURE;
+		}
+		g_Log.EnableSmoothing(true, params);
+	}
+
+	PredictionParams prediction;
+	if (options[PREDICT]) {
+		prediction.horizon_ms = static_cast<float>(strtol(options[PREDICT].arg, NULL, 10));
+		prediction.use_acceleration = options[PREDICT_ACCELERATION];
+		if (prediction.horizon_ms <= 0.f) {
+			std::cerr << "Prediction horizon must be positive.\n";
+			return EXIT_FAILURE;
+		}
+		g_Log.EnablePrediction(true, prediction);
+	}
+
+	// Logging only around users turning up
+	TriggerParams trigger;
+	if (options[TRIGGER] || options[PRE_TRIGGER] || options[HOLD_OFF]) {
+		if (!options[TRIGGER] || !options[LOG]) {
+			std::cerr << "Error: --pre-trigger and --hold-off require --trigger, which requires --log.\n";
+			return EXIT_FAILURE;
+		}
+		if (!ParseTriggerCondition(options[TRIGGER].arg, trigger.condition)) {
+			return EXIT_FAILURE;
+		}
+		if (options[PRE_TRIGGER]) {
+			trigger.pre_trigger_seconds = strtod(options[PRE_TRIGGER].arg, NULL);
+		}
+		if (options[HOLD_OFF]) {
+			trigger.hold_off_seconds = strtod(options[HOLD_OFF].arg, NULL);
+		}
+		if ((trigger.pre_trigger_seconds < 0.) || (trigger.hold_off_seconds < 0.)) {
+			std::cerr << "Pre-trigger and hold-off times must not be negative.\n";
+			return EXIT_FAILURE;
+		}
+	}
+
 	if (options[LOG]) {
 		std::string h5_logfile(options[LOG].arg);
 		std::cout << "Logging to " << h5_logfile << '\n';
 		g_Log.Open(h5_logfile.c_str());
 	}
 
+	// Queue lengths and drop policies of the outputs. By default files are written losslessly,
+	// holding up tracking if need be, while live outputs only ever send the latest frames.
+	std::map<std::string, SinkOptions> sink_options;
+	sink_options["log"] = SinkOptions(DROP_NONE, 32);
+	sink_options["arrow"] = SinkOptions(DROP_NONE, 64);
+	sink_options["udp"] = SinkOptions(DROP_OLDEST, 2);
+	sink_options["shm"] = SinkOptions(DROP_OLDEST, 2);
+	sink_options["events"] = SinkOptions(DROP_NONE, 64);
+	for (option::Option* opt = options[SINK]; opt; opt = opt->next())
+	{
+		// Fields not given keep the sink's defaults
+		std::string spec(opt->arg), name(spec.substr(0, spec.find(':')));
+		SinkOptions sink(sink_options.count(name) ? sink_options[name] : SinkOptions());
+		if (!ParseSinkOptions(spec, name, sink)) {
+			return EXIT_FAILURE;
+		}
+		if (sink_options.find(name) == sink_options.end()) {
+			std::cerr << "Error: unknown sink " << name << ". Use log, arrow, udp, shm or events.\n";
+			return EXIT_FAILURE;
+		}
+		sink_options[name] = sink;
+	}
+
+	UdpSkeletonSender udp_sender;
+	if (options[UDP]) {
+		std::vector<std::string> destinations;
+		for (option::Option* opt = options[UDP]; opt; opt = opt->next())
+		{
+			std::cout << "Sending joints to " << opt->arg << '\n';
+			destinations.push_back(opt->arg);
+		}
+		if (!udp_sender.Open(destinations)) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	ShmRingWriter shm_ring;
+	int shm_slots(8);
+	if (options[SHM_SLOTS]) {
+		shm_slots = static_cast<int>(strtol(options[SHM_SLOTS].arg, NULL, 10));
+	}
+	if (options[SHM]) {
+		std::cout << "Publishing frames to shared memory " << options[SHM].arg << '\n';
+		if (!shm_ring.Open(options[SHM].arg, shm_slots, g_ShmRingMaxRows, g_ShmRingMaxCols)) {
+			return EXIT_FAILURE;
+		}
+	}
+
+#ifdef HAVE_ARROW
+	JointStreamWriter joint_stream;
+	if (options[ARROW]) {
+		std::cout << "Writing joints to " << options[ARROW].arg << '\n';
+		if (!joint_stream.Open(options[ARROW].arg)) {
+			return EXIT_FAILURE;
+		}
+	}
+#else
+	if (options[ARROW]) {
+		std::cerr << "Error: logskel was built without Apache Arrow support.\n";
+		return EXIT_FAILURE;
+	}
+#endif
+
+	// Each output consumes frames on its own thread. Streaming outputs have their own predictor
+	// so that they work without --log.
+	const PredictionParams* p_prediction(options[PREDICT] ? &prediction : NULL);
+	LogSink log_sink(g_Log);
+	TriggeredSink triggered_log_sink(log_sink, trigger);
+	UdpSink udp_sink(udp_sender, p_prediction);
+	ShmSink shm_sink(shm_ring);
+	FrameDispatcher dispatcher;
+	if (options[LOG] && options[TRIGGER]) {
+		dispatcher.AddSink(&triggered_log_sink, sink_options["log"]);
+	} else if (options[LOG]) {
+		dispatcher.AddSink(&log_sink, sink_options["log"]);
+	}
+#ifdef HAVE_ARROW
+	ArrowSink arrow_sink(joint_stream, p_prediction);
+	if (options[ARROW]) {
+		dispatcher.AddSink(&arrow_sink, sink_options["arrow"]);
+	}
+#endif
+	if (options[UDP]) {
+		dispatcher.AddSink(&udp_sink, sink_options["udp"]);
+	}
+	if (options[SHM]) {
+		dispatcher.AddSink(&shm_sink, sink_options["shm"]);
+	}
+	EventSink event_sink;
+	if (!options[QUIET_EVENTS]) {
+		dispatcher.AddSink(&event_sink, sink_options["events"]);
+	}
+	dispatcher.Start();
+
 	// Set up capture device
+	Session session;
+	if (options[CALIBRATION_CACHE])
+	{
+		if (!session.EnableCalibrationCache(options[CALIBRATION_CACHE].arg))
+		{
+			return EXIT_FAILURE;
+		}
+		std::cout << "Using calibration cache " << options[CALIBRATION_CACHE].arg << " with "
+			<< session.GetCalibrationCache()->Slots().size() << " calibration(s)\n";
+	}
 	if (options[PLAYBACK])
 	{
-		if(!InitialiseContextFromRecording(options[PLAYBACK].arg))
+		if(!session.OpenRecording(options[PLAYBACK].arg, log_images))
 		{
 			return EXIT_FAILURE;
 		}
+		session.SetRepeat(!single_pass);
 	}
 	else if(options[CAPTURE])
 	{
-		if(!InitialiseContextFromXmlConfig(options[CAPTURE].arg))
+		if(!session.OpenXmlConfig(options[CAPTURE].arg, log_images))
+		{
+			return EXIT_FAILURE;
+		}
+	}
+	else if(options[REPLAY])
+	{
+		if(!session.OpenLog(options[REPLAY].arg, !options[MAX_SPEED]))
 		{
 			return EXIT_FAILURE;
 		}
+		session.SetRepeat(!single_pass);
+	}
+	else if(scene)
+	{
+		const SyntheticParams& params(scene->Params());
+		std::cout << "Rendering a synthetic scene of " << params.n_users << " user(s) at "
+			<< params.cols << "x" << params.rows << '\n';
 	} else {
-		std::cerr << "Error: exactly one of --playback and --capture must be specified.\n";
+		std::cerr << "Error: exactly one of --playback, --capture, --replay and --synthetic must be specified.\n";
 		option::printUsage(std::cerr, g_Usage);
 		return EXIT_FAILURE;
 	}
 
-	if(!PreMainLoop()) {
-		return EXIT_FAILURE;
+	if (deterministic && session.IsOpen()) {
+		session.SetDeterministic(true);
+	}
+
+	std::vector<uint16_t> lost_users;
+	session.SetLostUserHandler(QueueLostUser, &lost_users);
+	std::vector<UserEvent> user_events;  // since the last frame handed to the outputs
+
+	// Synthetic frames are rendered in any order, so there is no need to warm up. Frame n has id n + 1.
+	uint64_t synthetic_n((start_frame > 0) ? static_cast<uint64_t>(start_frame - 1) : 0);
+
+	// Seek to the start of the warm-up period for this range of frames
+	if ((start_frame > 0) && !scene) {
+		long seek_frame(start_frame - warmup_frames);
+		if (seek_frame < 1) {
+			seek_frame = 1;
+		}
+		std::cout << "Seeking to frame " << seek_frame << " (logging starts at frame "
+			<< start_frame << ")\n";
+		if (!session.SeekToFrame(static_cast<XnUInt32>(seek_frame))) {
+			return EXIT_FAILURE;
+		}
 	}
 
 	// Main event loop
-	xn::SceneMetaData sceneMD;
-	xn::DepthMetaData depthMD;
+	xn::ImageMetaData imageMD;
 	std::cout << "---------------------------------------------------------------------------\n";
 	std::cout << "Starting tracker. Press any key to exit.\n";
 	std::cout << "---------------------------------------------------------------------------\n";
 	time_t loop_start(time(NULL));
-	while (!xnOSWasKeyboardHit())
+	uint64_t n_logged_frames(0);
+	uint64_t output_hash(g_FrameHashSeed);
+	int n_update_failures(0);  // in a row
+	bool update_failed(false);
+
+	// Time spent on each stage of the logged frames
+	typedef std::chrono::steady_clock Clock;
+	std::chrono::duration<double> track_time(0.), capture_time(0.), dispatch_time(0.);
+	Clock::time_point loop_clock_start(Clock::now());
+
+	// Only watch for a key press if there is someone at a terminal to press one. When run from a
+	// script or batch driver stdin may be /dev/null which would otherwise end the loop at once.
+	bool watch_keyboard(isatty(STDIN_FILENO));
+	while (!watch_keyboard || !xnOSWasKeyboardHit())
 	{
 		// Was a particular duration requested?
 		if ((duration > 0.) && (difftime(time(NULL), loop_start) >= duration)) {
@@ -139,22 +864,159 @@ int main(int argc, char **argv)
 		}
 
 		// Wait for an update
-		g_Context.WaitOneUpdateAll(g_UserGenerator);
+		Clock::time_point track_start(Clock::now());
+		long frame_id;
+		if (scene) {
+			uint64_t n_frames(scene->Params().n_frames);
+			if ((n_frames > 0) && (synthetic_n >= n_frames)) {
+				std::cout << "End of synthetic scene reached.\n";
+				break;
+			}
+			frame_id = static_cast<long>(synthetic_n + 1);
+		} else {
+			if (!session.Update()) {
+				if (session.IsEOF()) {
+					std::cout << "End of recording reached.\n";
+					break;
+				}
+				if (++n_update_failures >= g_MaxUpdateFailures) {
+					std::cerr << "Error: giving up after " << n_update_failures << " failed updates in a row.\n";
+					update_failed = true;
+					break;
+				}
+				continue;
+			}
+			n_update_failures = 0;
+			frame_id = static_cast<long>(session.GetDepthMetaData().FrameID());
+			session.TakeUserEvents(user_events);
+		}
+
+		// Respect any requested frame range
+		if ((end_frame > 0) && (frame_id >= end_frame)) {
+			std::cout << "Reached end frame " << end_frame << ".\n";
+			break;
+		}
+		if (frame_id < start_frame) {
+			continue;
+		}
 
-		// Process the data
-		g_DepthGenerator.GetMetaData(depthMD);
-		g_UserGenerator.GetUserPixels(0, sceneMD);
+		// Hand a snapshot of the frame to the outputs
+		Clock::time_point capture_start(Clock::now());
+		track_time += capture_start - track_start;
+		if ((dispatcher.SinkCount() > 0) || deterministic) {
+			std::shared_ptr<FrameSnapshot> frame(dispatcher.NewFrame());
+			if (scene) {
+				scene->Render(synthetic_n, *frame);
+			} else {
+				CaptureFrame(session.GetDepthMetaData(), session.GetSceneMetaData(),
+						session.GetDepthGenerator(), session.GetUserGenerator(), *frame);
+				frame->lost_users.swap(lost_users);
+				frame->user_events.swap(user_events);
+			}
+			frame->number = n_logged_frames;
+			if (log_images) {
+				session.GetImageGenerator().GetMetaData(imageMD);
+				CaptureImage(imageMD, *frame);
+			}
+			if (deterministic) {
+				output_hash = HashFrame(*frame, output_hash);
+			}
+			Clock::time_point dispatch_start(Clock::now());
+			capture_time += dispatch_start - capture_start;
+			dispatcher.Dispatch(frame);
+			dispatch_time += Clock::now() - dispatch_start;
+		} else {
+			lost_users.clear();
+			user_events.clear();
+		}
+		++n_logged_frames;
+		++synthetic_n;
 
-		// Log the data
-		g_Log.DumpDepthMap(depthMD, sceneMD);
+		// Stop once the final frame of a recording has been logged
+		if (!scene && session.IsEOF()) {
+			std::cout << "End of recording reached.\n";
+			break;
+		}
 	}
 	std::cout << '\n';
 	std::cout << "---------------------------------------------------------------------------\n";
 	std::cout << "Exiting tracker.\n";
 	std::cout << "---------------------------------------------------------------------------\n";
 
+	// Let the outputs finish with any frames still queued
+	dispatcher.Stop();
+	std::chrono::duration<double> loop_time(Clock::now() - loop_clock_start);
+	dispatcher.PrintStats(std::cout);
+	if (options[TRIGGER]) {
+		std::cout << "Trigger met " << triggered_log_sink.Triggers() << " time(s): logged "
+			<< triggered_log_sink.FramesPassed() << " frame(s) and discarded "
+			<< triggered_log_sink.FramesDiscarded() << ".\n";
+	}
+	if (options[LOG] && g_Log.Predictor()) {
+		JointPredictor::JointError total(g_Log.Predictor()->TotalError());
+		std::cout << "Prediction error at " << prediction.horizon_ms << " ms: mean " << total.Mean()
+			<< " mm, RMS " << total.Rms() << " mm, max " << total.max_mm << " mm over "
+			<< total.count << " joint(s).\n";
+	}
+	if (options[SKIP_UNCHANGED]) {
+		std::cout << "Unchanged depth maps: " << g_Log.UnchangedFrameCount() << " of "
+			<< g_Log.FrameCount() << " frame(s) logged.\n";
+	}
+	std::cout << "Processed " << n_logged_frames << " frame(s) in " << loop_time.count() << " s: "
+		<< n_logged_frames / std::max(loop_time.count(), 1e-9) << " frame(s) per second\n";
+	if (n_logged_frames > 0) {
+		std::cout << "Time per frame: track " << 1e3 * track_time.count() / n_logged_frames
+			<< " ms, capture " << 1e3 * capture_time.count() / n_logged_frames
+			<< " ms, dispatch " << 1e3 * dispatch_time.count() / n_logged_frames << " ms\n";
+	}
+
+	const TimeToTracking& time_to_tracking(session.GetTimeToTracking());
+	if (time_to_tracking.nCalibrated > 0) {
+		std::cout << "Calibrated " << time_to_tracking.nCalibrated << " user(s), mean time to tracking "
+			<< time_to_tracking.fCalibratedSeconds / time_to_tracking.nCalibrated << " s\n";
+	}
+	if (time_to_tracking.nCached > 0) {
+		std::cout << "Reused calibration for " << time_to_tracking.nCached << " user(s), mean time to tracking "
+			<< time_to_tracking.fCachedSeconds / time_to_tracking.nCached << " s\n";
+	}
+	if (session.GetCalibrationCache()) {
+		std::cout << "Calibration cache: " << session.GetCalibrationCache()->Hits() << " hit(s), "
+			<< session.GetCalibrationCache()->Misses() << " miss(es)\n";
+	}
+
+	if (session.DroppedUserEvents() > 0) {
+		std::cerr << "Warning: " << session.DroppedUserEvents() << " user event(s) were dropped.\n";
+	}
+
+	// Check that every frame was tracked exactly once
+	bool frames_in_sequence(true);
+	if (deterministic) {
+		if (session.IsOpen()) {
+			const FrameSequence& sequence(session.GetFrameSequence());
+			std::cout << "Tracked " << sequence.nFrames << " frame(s) from id " << sequence.nFirstFrameID
+				<< " to " << sequence.nLastFrameID << ": " << sequence.nSkipped << " skipped, "
+				<< sequence.nRepeated << " out of order.\n";
+			if ((sequence.nSkipped > 0) || (sequence.nRepeated > 0)) {
+				std::cerr << "Error: frames were skipped or repeated, so the output is not reproducible.\n";
+				frames_in_sequence = false;
+			}
+		}
+		char hash_str[17];
+		snprintf(hash_str, sizeof(hash_str), "%016llx", static_cast<unsigned long long>(output_hash));
+		std::cout << "Output hash of " << n_logged_frames << " frame(s): " << hash_str << '\n';
+	}
+
 	// Clean up all resources
-	PostMainLoop();
+	session.Close();
+	if (udp_sender.IsOpen()) {
+		std::cout << "Sent " << udp_sender.PacketsSent() << " UDP packet(s) with "
+			<< udp_sender.SendErrors() << " error(s).\n";
+	}
+#ifdef HAVE_ARROW
+	if (!joint_stream.Close()) {
+		return EXIT_FAILURE;
+	}
+#endif
 
-	return EXIT_SUCCESS;
+	return (frames_in_sequence && !update_failed) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -0,0 +1,548 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Keep tracking between logging sessions.
+//
+// logskeld opens the sensor once and tracks users continuously. Logs are
+// started, stopped and rotated by commands sent to a Unix domain socket, so
+// that a new log begins with the tracker already running and users already
+// calibrated.
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+// Includes
+//---------------------------------------------------------------------------
+#include <atomic>
+#include <cstdlib> // for EXIT_SUCCESS
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <signal.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <XnOpenNI.h>
+#include <XnCppWrapper.h>
+
+#include "arghelpers.h"
+#include "control.h"
+#include "framesink.h"
+#include "io.h"
+#include "optionparser.h"
+#include "session.h"
+
+//---------------------------------------------------------------------------
+// Types
+//---------------------------------------------------------------------------
+
+// Options which may be changed between logs with "set"
+struct LogSettings {
+	int   jpeg_quality;
+	bool  normals;
+	bool  smooth;
+	float predict_ms;  // zero for no prediction
+
+	LogSettings() : jpeg_quality(90), normals(false), smooth(false), predict_ms(0.f) { }
+};
+
+// Writes frames to a log which may be switched to a new file between frames without stopping.
+// Only the sink's thread touches the log once the dispatcher has started.
+class RotatingLogSink : public FrameSink
+{
+	DepthMapLogger        log_;
+	bool                  log_images_;
+	std::mutex            mutex_;
+	std::string           filename_;       // log being written
+	std::string           next_filename_;  // log to switch to at the next frame, if any
+	LogSettings           next_settings_;
+	std::string           error_;          // why the last log could not be opened, if it could not
+	std::string           rotate_reply_;   // to the last Rotate(), once the log has been switched
+	std::atomic<uint64_t> n_frames_;       // written to filename_
+
+	bool OpenLog(const std::string& filename, const LogSettings& settings)
+	{
+		log_.Close();
+		if (log_images_) {
+			log_.EnableImages(settings.jpeg_quality);
+		}
+		log_.EnableNormals(settings.normals);
+		log_.EnableSmoothing(settings.smooth);
+		PredictionParams prediction;
+		prediction.horizon_ms = settings.predict_ms;
+		log_.EnablePrediction(settings.predict_ms > 0.f, prediction);
+
+		n_frames_ = 0;
+		try
+		{
+			log_.Open(filename.c_str());
+		}
+		catch (const H5::Exception& e)
+		{
+			std::cerr << "Error: could not open " << filename << ": " << e.getDetailMsg() << '\n';
+			std::lock_guard<std::mutex> lock(mutex_);
+			filename_.clear();
+			error_ = "could not open " + filename;
+			return false;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		filename_ = filename;
+		error_.clear();
+		return true;
+	}
+
+	// Switch to filename, keeping the current log if filename cannot be created. Returns the reply
+	// to the rotate command.
+	std::string SwitchLog(const std::string& filename, const LogSettings& settings)
+	{
+		try
+		{
+			H5::H5File probe(filename.c_str(), H5F_ACC_TRUNC);
+		}
+		catch (const H5::Exception& e)
+		{
+			std::cerr << "Error: could not create " << filename << ": " << e.getDetailMsg()
+				<< ". Still logging to " << Filename() << ".\n";
+			std::lock_guard<std::mutex> lock(mutex_);
+			error_ = "could not create " + filename;
+			return "ERROR could not create " + filename + "; still logging to " + filename_;
+		}
+
+		std::cout << "Logged " << n_frames_ << " frames to " << Filename() << '\n';
+		if (!OpenLog(filename, settings)) {
+			return "ERROR could not open " + filename + "; logging stopped";
+		}
+		return "OK rotated to " + filename;
+	}
+public:
+	explicit RotatingLogSink(bool log_images) : log_images_(log_images), n_frames_(0) { }
+	const char* Name() const { return "log"; }
+
+	// Start writing to filename. Only call this while the dispatcher is stopped.
+	bool Open(const std::string& filename, const LogSettings& settings)
+	{
+		return OpenLog(filename, settings);
+	}
+
+	// Close the current log and start filename before the next frame is written. The outcome is
+	// got from TakeRotateReply().
+	void Rotate(const std::string& filename, const LogSettings& settings)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		next_filename_ = filename;
+		next_settings_ = settings;
+		rotate_reply_.clear();
+	}
+
+	// Get the reply to the last Rotate() once the log has been switched, or it has failed. Returns
+	// false if there is no reply yet.
+	bool TakeRotateReply(std::string& reply)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (rotate_reply_.empty()) {
+			return false;
+		}
+		reply.swap(rotate_reply_);
+		rotate_reply_.clear();
+		return true;
+	}
+
+	// Log being written, empty if none
+	std::string Filename()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return filename_;
+	}
+
+	// Why the last log could not be opened, empty if it was
+	std::string Error()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return error_;
+	}
+
+	uint64_t Frames() const { return n_frames_; }
+
+	void Consume(const FrameRef& frame)
+	{
+		std::string next_filename;
+		LogSettings next_settings;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			next_filename.swap(next_filename_);
+			next_settings = next_settings_;
+		}
+		if (!next_filename.empty()) {
+			std::string reply(SwitchLog(next_filename, next_settings));
+			std::lock_guard<std::mutex> lock(mutex_);
+			rotate_reply_ = reply;
+		}
+
+		if (!Filename().empty()) {
+			log_.DumpFrame(*frame);
+			++n_frames_;
+		}
+	}
+
+	void Finish()
+	{
+		log_.Close();
+		std::lock_guard<std::mutex> lock(mutex_);
+		filename_.clear();
+		if (!next_filename_.empty()) {
+			rotate_reply_ = "ERROR stopped before rotating to " + next_filename_;
+			next_filename_.clear();
+		}
+	}
+};
+
+//---------------------------------------------------------------------------
+// Globals
+//---------------------------------------------------------------------------
+
+// Set by SIGINT and SIGTERM
+volatile sig_atomic_t g_Quit = 0;
+
+//---------------------------------------------------------------------------
+// Code
+//---------------------------------------------------------------------------
+
+void HandleQuitSignal(int /*signal*/)
+{
+	g_Quit = 1;
+}
+
+// Command-line option description
+enum optionIndex { UNKNOWN, HELP, CAPTURE, PLAYBACK, SOCKET, SEND, LOG, IMAGE, JPEG_QUALITY, CALIBRATION_CACHE, };
+const option::Descriptor g_Usage[] =
+{
+	{ UNKNOWN,  0, "",   "",         option::Arg::None,	"Usage:\n"
+								"  logskeld [options] (--capture FILE | --playback FILE)\n"
+								"  logskeld [--socket PATH] --send COMMAND\n\n"
+								"Options:" },
+	{ HELP,     0, "h?", "help",     option::Arg::None,	"  --help, -h, -?  \tPrint a brief usage summary." },
+	{ CAPTURE,  0, "c",  "capture",  Arg::NonEmpty,		"  --capture, -c FILE  \tTrack from the sensors described by the OpenNI XML config FILE." },
+	{ PLAYBACK, 0, "p",  "playback", Arg::NonEmpty,		"  --playback, -p FILE  \tTrack a recording, looping over it." },
+	{ SOCKET,   0, "s",  "socket",   Arg::NonEmpty,		"  --socket, -s PATH  \tListen for commands on the Unix domain socket PATH. "
+								"(Default: /tmp/logskeld.sock.)" },
+	{ SEND,     0, "",   "send",     Arg::NonEmpty,		"  --send COMMAND  \tSend COMMAND to a running logskeld, print its reply and exit." },
+	{ LOG,      0, "l",  "log",      Arg::NonEmpty,		"  --log, -l FILE  \tStart logging to FILE straight away." },
+	{ IMAGE,    0, "",   "image",    option::Arg::None,	"  --image  \tAlso log JPEG compressed colour images." },
+	{ JPEG_QUALITY, 0, "", "jpeg-quality", Arg::Numeric,	"  --jpeg-quality N  \tQuality of logged colour images from 1 to 100. (Default: 90.)" },
+	{ CALIBRATION_CACHE, 0, "", "calibration-cache", Arg::NonEmpty, "  --calibration-cache DIR  \tSave calibrations in DIR and "
+								"reuse them for users of a similar build rather than calibrating again." },
+	{ UNKNOWN,  0, "",   "",         option::Arg::None,	"\nCommands:\n"
+								"  start FILE  \tStart logging to FILE.\n"
+								"  stop  \tFinish the current log.\n"
+								"  rotate FILE  \tFinish the current log and continue in FILE from the next frame.\n"
+								"  set OPTION VALUE  \tChange an option for logs started from now on. OPTION is "
+								"normals (on or off), smooth (on or off), predict (milliseconds or off) or "
+								"jpeg-quality (1 to 100).\n"
+								"  status  \tReport what is being logged and how many users are tracked.\n"
+								"  quit  \tFinish any log and exit." },
+
+	{ 0,0,0,0,0,0 } // Zero record marking end of array.
+};
+
+// Apply "set name value" to settings. Returns an empty string on success or an error message.
+std::string SetOption(const std::string& name, const std::string& value, LogSettings& settings)
+{
+	if ((name == "normals") || (name == "smooth"))
+	{
+		if ((value != "on") && (value != "off")) {
+			return name + " must be on or off";
+		}
+		(name == "normals" ? settings.normals : settings.smooth) = (value == "on");
+	}
+	else if (name == "predict")
+	{
+		if (value == "off") {
+			settings.predict_ms = 0.f;
+		} else {
+			char* end(NULL);
+			long ms(strtol(value.c_str(), &end, 10));
+			if ((end == value.c_str()) || (*end != '\0') || (ms <= 0)) {
+				return "predict must be a positive number of milliseconds or off";
+			}
+			settings.predict_ms = static_cast<float>(ms);
+		}
+	}
+	else if (name == "jpeg-quality")
+	{
+		char* end(NULL);
+		long quality(strtol(value.c_str(), &end, 10));
+		if ((end == value.c_str()) || (*end != '\0') || (quality < 1) || (quality > 100)) {
+			return "jpeg-quality must be between 1 and 100";
+		}
+		settings.jpeg_quality = static_cast<int>(quality);
+	}
+	else
+	{
+		return "unknown option " + name;
+	}
+
+	return std::string();
+}
+
+int main(int argc, char **argv)
+{
+	// Parse command-line options
+	argc-=(argc>0); argv+=(argc>0); // skip program name argv[0] if present
+	option::Stats  stats(g_Usage, argc, argv);
+	option::Option options[stats.options_max], buffer[stats.buffer_max];
+	option::Parser parse(g_Usage, argc, argv, options, buffer);
+
+	if (parse.error()) {
+		return EXIT_FAILURE;
+	}
+
+	if (options[HELP]) {
+		option::printUsage(std::cout, g_Usage);
+		return EXIT_SUCCESS;
+	}
+
+	std::string socket_path(options[SOCKET] ? options[SOCKET].arg : "/tmp/logskeld.sock");
+
+	// Act as a client of a running daemon
+	if (options[SEND]) {
+		return SendControlCommand(socket_path, options[SEND].arg) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (!options[CAPTURE] == !options[PLAYBACK]) {
+		std::cerr << "Error: exactly one of --playback and --capture must be specified.\n";
+		option::printUsage(std::cerr, g_Usage);
+		return EXIT_FAILURE;
+	}
+
+	LogSettings settings;
+	if (options[JPEG_QUALITY]) {
+		std::string error(SetOption("jpeg-quality", options[JPEG_QUALITY].arg, settings));
+		if (!error.empty()) {
+			std::cerr << "Error: " << error << ".\n";
+			return EXIT_FAILURE;
+		}
+	}
+	bool log_images(options[IMAGE]);
+
+	// Set up capture device. This is the slow part which the daemon only does once.
+	Session session;
+	if (options[CALIBRATION_CACHE] && !session.EnableCalibrationCache(options[CALIBRATION_CACHE].arg)) {
+		return EXIT_FAILURE;
+	}
+	if (options[PLAYBACK])
+	{
+		if (!session.OpenRecording(options[PLAYBACK].arg, log_images)) {
+			return EXIT_FAILURE;
+		}
+		session.SetRepeat(true);
+	}
+	else if (!session.OpenXmlConfig(options[CAPTURE].arg, log_images))
+	{
+		return EXIT_FAILURE;
+	}
+
+	std::vector<uint16_t> lost_users;
+	session.SetLostUserHandler(QueueLostUser, &lost_users);
+
+	ControlServer control;
+	if (!control.Open(socket_path)) {
+		return EXIT_FAILURE;
+	}
+	std::cout << "Listening for commands on " << socket_path << '\n';
+
+	signal(SIGINT, HandleQuitSignal);
+	signal(SIGTERM, HandleQuitSignal);
+
+	// The log is written on its own thread. The dispatcher only runs while logging.
+	RotatingLogSink log_sink(log_images);
+	FrameDispatcher dispatcher;
+	dispatcher.AddSink(&log_sink, SinkOptions(DROP_NONE, 32));
+	bool logging(false);
+
+	if (options[LOG])
+	{
+		if (!log_sink.Open(options[LOG].arg, settings)) {
+			return EXIT_FAILURE;
+		}
+		std::cout << "Logging to " << options[LOG].arg << '\n';
+		dispatcher.Start();
+		logging = true;
+	}
+
+	xn::ImageMetaData imageMD;
+	std::vector<UserEvent> discarded_events;  // while not logging
+	uint64_t n_captured(0);
+	int rotate_client(-1);  // waiting for the log to be rotated
+	int n_update_failures(0);  // in a row
+	bool update_failed(false);
+	bool quit(false);
+	while (!quit && !g_Quit)
+	{
+		// Handle every command waiting
+		int client;
+		std::string line;
+		while (!quit && control.Poll(client, line))
+		{
+			std::istringstream command_stream(line);
+			std::string command, argument, value;
+			command_stream >> command >> argument >> value;
+			std::ostringstream reply;
+
+			if ((command == "start") && !argument.empty())
+			{
+				if (logging) {
+					reply << "ERROR already logging to " << log_sink.Filename();
+				} else if (!log_sink.Open(argument, settings)) {
+					reply << "ERROR could not open " << argument;
+				} else {
+					dispatcher.Start();
+					logging = true;
+					reply << "OK logging to " << argument;
+				}
+			}
+			else if (command == "stop")
+			{
+				if (!logging) {
+					reply << "ERROR not logging";
+				} else {
+					std::string filename(log_sink.Filename());
+					dispatcher.Stop();
+					logging = false;
+					reply << "OK logged " << log_sink.Frames() << " frames to " << filename;
+				}
+			}
+			else if ((command == "rotate") && !argument.empty())
+			{
+				if (!logging) {
+					reply << "ERROR not logging";
+				} else if (rotate_client >= 0) {
+					reply << "ERROR already rotating";
+				} else {
+					// Replied to once the log has been switched, before the next frame
+					log_sink.Rotate(argument, settings);
+					rotate_client = client;
+					continue;
+				}
+			}
+			else if ((command == "set") && !value.empty())
+			{
+				std::string error(SetOption(argument, value, settings));
+				if (error.empty()) {
+					reply << "OK " << argument << ' ' << value;
+				} else {
+					reply << "ERROR " << error;
+				}
+			}
+			else if (command == "status")
+			{
+				XnUserID aUsers[15];
+				XnUInt16 nUsers = 15;
+				session.GetUserGenerator().GetUsers(aUsers, nUsers);
+				int n_tracked(0);
+				for (int i = 0; i < nUsers; ++i)
+				{
+					if (session.GetUserGenerator().GetSkeletonCap().IsTracking(aUsers[i])) {
+						++n_tracked;
+					}
+				}
+
+				reply << "OK ";
+				if (logging) {
+					reply << "logging " << log_sink.Filename() << " frames " << log_sink.Frames();
+				} else {
+					reply << "idle";
+				}
+				reply << " users " << nUsers << " tracked " << n_tracked;
+				std::string error(log_sink.Error());
+				if (!error.empty()) {
+					reply << " error " << error;
+				}
+			}
+			else if (command == "quit")
+			{
+				reply << "OK quitting";
+				quit = true;
+			}
+			else
+			{
+				reply << "ERROR unknown command: " << line;
+			}
+
+			control.Reply(client, reply.str());
+		}
+
+		// A log which could not be opened on rotation stops logging
+		std::string rotate_reply;
+		if ((rotate_client >= 0) && log_sink.TakeRotateReply(rotate_reply)) {
+			control.Reply(rotate_client, rotate_reply);
+			rotate_client = -1;
+			if (logging && log_sink.Filename().empty()) {
+				dispatcher.Stop();
+				logging = false;
+			}
+		}
+
+		if (!session.Update()) {
+			if (session.IsEOF()) {
+				break;
+			}
+			if (++n_update_failures >= g_MaxUpdateFailures) {
+				std::cerr << "Error: giving up after " << n_update_failures << " failed updates in a row.\n";
+				update_failed = true;
+				break;
+			}
+			continue;
+		}
+		n_update_failures = 0;
+
+		if (!logging) {
+			lost_users.clear();
+			discarded_events.clear();
+			session.TakeUserEvents(discarded_events);
+			continue;
+		}
+
+		std::shared_ptr<FrameSnapshot> frame(dispatcher.NewFrame());
+		CaptureFrame(session.GetDepthMetaData(), session.GetSceneMetaData(), session.GetDepthGenerator(),
+				session.GetUserGenerator(), *frame);
+		frame->number = n_captured++;
+		frame->lost_users.swap(lost_users);
+		session.TakeUserEvents(frame->user_events);
+		if (log_images) {
+			session.GetImageGenerator().GetMetaData(imageMD);
+			CaptureImage(imageMD, *frame);
+		}
+		dispatcher.Dispatch(frame);
+	}
+
+	std::cout << "Exiting.\n";
+	if (logging) {
+		std::string filename(log_sink.Filename());
+		dispatcher.Stop();
+		std::cout << "Logged " << log_sink.Frames() << " frames to " << filename << '\n';
+	}
+	std::string rotate_reply;
+	if ((rotate_client >= 0) && log_sink.TakeRotateReply(rotate_reply)) {
+		control.Reply(rotate_client, rotate_reply);
+	}
+	control.Close();
+	session.Close();
+
+	return update_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
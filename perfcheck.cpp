@@ -0,0 +1,648 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Check logskel's output and performance against golden runs.
+//
+// Each case in a case file is an input for logskel: a recording, log or
+// synthetic scene. Cases are run one at a time with --deterministic so that
+// every run tracks the same frames. A case passes if its depth and labels are
+// identical to its golden run, its joints are within a tolerance of the golden
+// joints, and its throughput and peak memory use are within budget of the
+// golden run's. Per-stage timings reported by logskel are passed on to a JSON
+// report for trending. --update records the golden runs.
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+// Includes
+//---------------------------------------------------------------------------
+#include <algorithm>
+#include <cmath>
+#include <cstdlib> // for EXIT_SUCCESS
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arghelpers.h"
+#include "hash.h"
+#include "optionparser.h"
+#include "reader.h"
+#include "wallclock.h"
+
+//---------------------------------------------------------------------------
+// Types
+//---------------------------------------------------------------------------
+
+// A joint of a user in a frame, identified by frame index, user and joint id
+struct JointKey {
+	size_t   frame_idx;
+	uint16_t user;
+	int      id;
+
+	bool operator < (const JointKey& other) const {
+		if (frame_idx != other.frame_idx) { return frame_idx < other.frame_idx; }
+		if (user != other.user) { return user < other.user; }
+		return id < other.id;
+	}
+};
+
+struct JointPosition {
+	float x, y, z;
+};
+
+typedef std::map<JointKey, JointPosition> JointMap;
+
+// What one run of a case produced. Golden runs are stored the same way.
+struct RunResult {
+	uint64_t    frames;
+	uint64_t    depth_label_hash;  // of the depth and labels of every frame in the log
+	double      frames_per_second;
+	long        peak_rss_kb;
+	JointMap    joints;
+
+	// Milliseconds per frame spent in each of logskel's stages and sinks, in the order reported
+	std::vector<std::pair<std::string, double> > stages_ms;
+
+	RunResult() : frames(0), depth_label_hash(0), frames_per_second(0.), peak_rss_kb(0) { }
+};
+
+// A case from the case file and how it fared
+struct Case {
+	std::string              name;
+	std::vector<std::string> args;      // logskel's input options
+	int                      exit_status;
+	RunResult                result;
+	bool                     has_golden;
+	RunResult                golden;
+	size_t                   joint_mismatches;
+	double                   max_joint_error_mm;
+	std::vector<std::string> failures;
+};
+
+//---------------------------------------------------------------------------
+// Code
+//---------------------------------------------------------------------------
+
+// Command-line option description
+enum optionIndex { UNKNOWN, HELP, GOLDEN_DIR, OUTPUT_DIR, REPORT, UPDATE, LOGSKEL, JOINT_TOLERANCE,
+	THROUGHPUT_BUDGET, RSS_BUDGET, };
+const option::Descriptor g_Usage[] =
+{
+	{ UNKNOWN,    0, "",   "",            option::Arg::None, "Usage:\n"
+								"  perfcheck [options] --golden-dir DIR --output-dir DIR CASEFILE\n\n"
+								"Each line of CASEFILE is a case name followed by logskel's input options, e.g.\n"
+								"  walk --playback recordings/walk.oni --end-frame 300\n\n"
+								"Options:" },
+	{ HELP,       0, "h?", "help",        option::Arg::None, "  --help, -h, -?  \tPrint a brief usage summary." },
+	{ GOLDEN_DIR, 0, "g",  "golden-dir",  Arg::NonEmpty,     "  --golden-dir, -g DIR  \tRead golden runs from DIR." },
+	{ OUTPUT_DIR, 0, "o",  "output-dir",  Arg::NonEmpty,     "  --output-dir, -o DIR  \tWrite logs and logskel output to DIR." },
+	{ REPORT,     0, "r",  "report",      Arg::NonEmpty,     "  --report, -r FILE  \tWrite results as JSON to FILE." },
+	{ UPDATE,     0, "u",  "update",      option::Arg::None, "  --update, -u  \tRecord this run as the golden run of every case "
+								"rather than checking it." },
+	{ LOGSKEL,    0, "",   "logskel",     Arg::NonEmpty,     "  --logskel PATH  \tPath to the logskel executable. "
+								"(Default: alongside this program.)" },
+	{ JOINT_TOLERANCE, 0, "", "joint-tolerance", Arg::Real, "  --joint-tolerance MM  \tLargest distance a joint may be from its "
+								"golden position. (Default: 10.)" },
+	{ THROUGHPUT_BUDGET, 0, "", "throughput-budget", Arg::Real, "  --throughput-budget PERCENT  \tLargest drop in frames per "
+								"second from the golden run. (Default: 10.)" },
+	{ RSS_BUDGET, 0, "",   "rss-budget",  Arg::Real,         "  --rss-budget PERCENT  \tLargest rise in peak resident memory "
+								"from the golden run. (Default: 10.)" },
+
+	{ 0,0,0,0,0,0 } // Zero record marking end of array.
+};
+
+// Read the case file. Returns false and prints an error if it cannot be read.
+bool ReadCases(const char* filename, std::vector<Case>& cases)
+{
+	std::ifstream case_file(filename);
+	if (!case_file) {
+		std::cerr << "Error: could not open case file " << filename << ".\n";
+		return false;
+	}
+
+	std::string line;
+	while (std::getline(case_file, line))
+	{
+		std::istringstream fields(line);
+		Case c;
+		if (!(fields >> c.name) || (c.name[0] == '#')) {
+			continue;
+		}
+		std::string arg;
+		while (fields >> arg)
+		{
+			c.args.push_back(arg);
+		}
+		if (c.args.empty()) {
+			std::cerr << "Error: case " << c.name << " has no input options.\n";
+			return false;
+		}
+		c.exit_status = -1;
+		c.has_golden = false;
+		c.joint_mismatches = 0;
+		c.max_joint_error_mm = 0.;
+		cases.push_back(c);
+	}
+
+	if (cases.empty()) {
+		std::cerr << "Error: no cases in " << filename << ".\n";
+		return false;
+	}
+	return true;
+}
+
+// Run logskel for c, writing its log to output and its stdout and stderr to log. Returns the
+// exit status, or -1 if logskel could not be run, and sets peak_rss_kb.
+int RunLogskel(const std::string& logskel, const Case& c, const std::string& output,
+		const std::string& log, long& peak_rss_kb)
+{
+	pid_t pid = fork();
+	if (pid < 0) {
+		std::cerr << "Error: could not fork: " << strerror(errno) << '\n';
+		return -1;
+	}
+	if (pid == 0) {
+		// In the child. Send stdout and stderr to the log and detach stdin from any terminal so
+		// that logskel does not wait for a key press.
+		int log_fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		int null_fd = open("/dev/null", O_RDONLY);
+		if ((log_fd < 0) || (null_fd < 0)) {
+			_exit(127);
+		}
+		dup2(null_fd, STDIN_FILENO);
+		dup2(log_fd, STDOUT_FILENO);
+		dup2(log_fd, STDERR_FILENO);
+		close(null_fd);
+		close(log_fd);
+
+		std::vector<const char*> args;
+		args.push_back(logskel.c_str());
+		for (size_t i = 0; i < c.args.size(); ++i)
+		{
+			args.push_back(c.args[i].c_str());
+		}
+		args.push_back("--deterministic");
+		args.push_back("--quiet-events");
+		args.push_back("--log");
+		args.push_back(output.c_str());
+		args.push_back(NULL);
+
+		execv(logskel.c_str(), const_cast<char* const*>(&args[0]));
+
+		// Only reached if exec failed
+		fprintf(stderr, "Could not execute %s: %s\n", logskel.c_str(), strerror(errno));
+		_exit(127);
+	}
+
+	// Each case runs alone, so the child's resource usage is its own
+	int status(0);
+	struct rusage usage;
+	while (wait4(pid, &status, 0, &usage) < 0)
+	{
+		if (errno != EINTR) {
+			std::cerr << "Error: wait4 failed: " << strerror(errno) << '\n';
+			return -1;
+		}
+	}
+	peak_rss_kb = usage.ru_maxrss;
+
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Pick out the frame count, throughput and stage timings from logskel's output. The output hash is
+// not kept: it covers joints exactly, which are compared within a tolerance instead.
+void ParseLogskelOutput(const std::string& log, RunResult& result)
+{
+	std::ifstream log_file(log.c_str());
+	std::string line;
+	while (std::getline(log_file, line))
+	{
+		unsigned long long frames(0);
+		double seconds(0.), fps(0.), track(0.), capture(0.), dispatch(0.);
+		char hash[32], sink[64];
+		size_t ms_pos;
+
+		if (sscanf(line.c_str(), "Output hash of %llu frame(s): %31s", &frames, hash) == 2) {
+			result.frames = frames;
+		} else if (sscanf(line.c_str(), "Processed %llu frame(s) in %lf s: %lf", &frames, &seconds, &fps) == 3) {
+			result.frames_per_second = fps;
+		} else if (sscanf(line.c_str(), "Time per frame: track %lf ms, capture %lf ms, dispatch %lf ms",
+					&track, &capture, &dispatch) == 3) {
+			result.stages_ms.push_back(std::make_pair(std::string("track"), track));
+			result.stages_ms.push_back(std::make_pair(std::string("capture"), capture));
+			result.stages_ms.push_back(std::make_pair(std::string("dispatch"), dispatch));
+		} else if ((sscanf(line.c_str(), "Sink %63[^:]:", sink) == 1)
+				&& ((ms_pos = line.rfind(", ")) != std::string::npos)
+				&& (sscanf(line.c_str() + ms_pos, ", %lf ms per frame", &seconds) == 1)) {
+			result.stages_ms.push_back(std::make_pair(std::string("sink_") + sink, seconds));
+		}
+	}
+}
+
+// Hash the depth and labels of every frame of the log at path and gather its joints
+void ReadLog(const std::string& path, RunResult& result)
+{
+	FrameReader reader;
+	reader.Open(path.c_str());
+
+	uint64_t hash(g_HashSeed);
+	for (LogFramePtr frame : reader.all())
+	{
+		hash = HashBytes(&frame->frame_id, sizeof(frame->frame_id), hash);
+		if (!frame->depth.empty()) {
+			hash = HashBytes(&frame->depth[0], frame->depth.size() * sizeof(uint16_t), hash);
+		}
+		if (!frame->label.empty()) {
+			hash = HashBytes(&frame->label[0], frame->label.size() * sizeof(uint16_t), hash);
+		}
+
+		for (size_t u = 0; u < frame->users.size(); ++u)
+		{
+			const LogFrame::User& user(frame->users[u]);
+			for (size_t j = 0; j < user.joints.size(); ++j)
+			{
+				JointKey key = { frame->idx, user.idx, user.joints[j].id };
+				JointPosition position = { user.joints[j].x, user.joints[j].y, user.joints[j].z };
+				result.joints[key] = position;
+			}
+		}
+	}
+	result.depth_label_hash = hash;
+}
+
+// Golden runs are text files of "key value" lines followed by one line per joint
+bool WriteGolden(const std::string& path, const Case& c)
+{
+	std::ofstream golden(path.c_str());
+	if (!golden) {
+		std::cerr << "Error: could not write " << path << ".\n";
+		return false;
+	}
+
+	char hash_str[17];
+	snprintf(hash_str, sizeof(hash_str), "%016llx", static_cast<unsigned long long>(c.result.depth_label_hash));
+	golden << "# perfcheck golden run of " << c.name << '\n';
+	golden << "frames " << c.result.frames << '\n';
+	golden << "depth_label_hash " << hash_str << '\n';
+	golden << "frames_per_second " << c.result.frames_per_second << '\n';
+	golden << "peak_rss_kb " << c.result.peak_rss_kb << '\n';
+	golden << "joints " << c.result.joints.size() << '\n' << std::setprecision(9);
+	for (JointMap::const_iterator it = c.result.joints.begin(); it != c.result.joints.end(); ++it)
+	{
+		golden << it->first.frame_idx << ' ' << it->first.user << ' ' << it->first.id << ' '
+			<< it->second.x << ' ' << it->second.y << ' ' << it->second.z << '\n';
+	}
+
+	return golden.good();
+}
+
+bool ReadGolden(const std::string& path, RunResult& golden)
+{
+	std::ifstream golden_file(path.c_str());
+	if (!golden_file) {
+		return false;
+	}
+
+	std::string key;
+	while (golden_file >> key)
+	{
+		if (key[0] == '#') {
+			std::getline(golden_file, key);
+		} else if (key == "frames") {
+			golden_file >> golden.frames;
+		} else if (key == "depth_label_hash") {
+			std::string hash;
+			golden_file >> hash;
+			golden.depth_label_hash = strtoull(hash.c_str(), NULL, 16);
+		} else if (key == "frames_per_second") {
+			golden_file >> golden.frames_per_second;
+		} else if (key == "peak_rss_kb") {
+			golden_file >> golden.peak_rss_kb;
+		} else if (key == "joints") {
+			size_t n_joints(0);
+			golden_file >> n_joints;
+			for (size_t i = 0; (i < n_joints) && golden_file; ++i)
+			{
+				JointKey joint;
+				JointPosition position;
+				golden_file >> joint.frame_idx >> joint.user >> joint.id >> position.x >> position.y >> position.z;
+				golden.joints[joint] = position;
+			}
+		} else {
+			std::cerr << "Warning: unknown key " << key << " in " << path << ".\n";
+			std::getline(golden_file, key);
+		}
+	}
+
+	return !golden_file.bad();
+}
+
+// Compare a run of c with its golden run, adding any failures to c
+void CheckCase(Case& c, double joint_tolerance_mm, double throughput_budget, double rss_budget)
+{
+	const RunResult& result(c.result);
+	const RunResult& golden(c.golden);
+	std::ostringstream failure;
+
+	if (result.frames != golden.frames) {
+		failure << "tracked " << result.frames << " frame(s) rather than " << golden.frames;
+		c.failures.push_back(failure.str());
+		return;
+	}
+	if (result.depth_label_hash != golden.depth_label_hash) {
+		c.failures.push_back("depth or labels differ from the golden run");
+	}
+
+	// Every joint must be present in both runs and close to its golden position
+	for (JointMap::const_iterator it = golden.joints.begin(); it != golden.joints.end(); ++it)
+	{
+		JointMap::const_iterator found(result.joints.find(it->first));
+		if (found == result.joints.end()) {
+			++c.joint_mismatches;
+			continue;
+		}
+		float dx(found->second.x - it->second.x), dy(found->second.y - it->second.y), dz(found->second.z - it->second.z);
+		double error(sqrt(dx*dx + dy*dy + dz*dz));
+		c.max_joint_error_mm = std::max(c.max_joint_error_mm, error);
+		if (error > joint_tolerance_mm) {
+			++c.joint_mismatches;
+		}
+	}
+	for (JointMap::const_iterator it = result.joints.begin(); it != result.joints.end(); ++it)
+	{
+		if (golden.joints.find(it->first) == golden.joints.end()) {
+			++c.joint_mismatches;
+		}
+	}
+	if (c.joint_mismatches > 0) {
+		failure.str("");
+		failure << c.joint_mismatches << " joint(s) missing, extra or more than " << joint_tolerance_mm
+			<< " mm from the golden run";
+		c.failures.push_back(failure.str());
+	}
+
+	if (result.frames_per_second < golden.frames_per_second * (1. - throughput_budget / 100.)) {
+		failure.str("");
+		failure << "throughput fell from " << golden.frames_per_second << " to " << result.frames_per_second
+			<< " frame(s) per second";
+		c.failures.push_back(failure.str());
+	}
+	if (result.peak_rss_kb > golden.peak_rss_kb * (1. + rss_budget / 100.)) {
+		failure.str("");
+		failure << "peak RSS rose from " << golden.peak_rss_kb << " to " << result.peak_rss_kb << " kB";
+		c.failures.push_back(failure.str());
+	}
+}
+
+// Quote s as a JSON string
+std::string JsonString(const std::string& s)
+{
+	std::string quoted("\"");
+	for (size_t i = 0; i < s.size(); ++i)
+	{
+		char ch(s[i]);
+		if ((ch == '"') || (ch == '\\')) {
+			quoted += '\\';
+			quoted += ch;
+		} else if (static_cast<unsigned char>(ch) < 0x20) {
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", ch);
+			quoted += escaped;
+		} else {
+			quoted += ch;
+		}
+	}
+	return quoted + '"';
+}
+
+bool WriteReport(const char* filename, const std::vector<Case>& cases, bool update, double joint_tolerance_mm,
+		double throughput_budget, double rss_budget)
+{
+	std::ofstream report(filename);
+	if (!report) {
+		std::cerr << "Error: could not write report " << filename << ".\n";
+		return false;
+	}
+
+	bool passed(true);
+	for (size_t i = 0; i < cases.size(); ++i)
+	{
+		passed = passed && cases[i].failures.empty();
+	}
+
+	report << "{\n";
+	report << "  \"time\": " << static_cast<long long>(time(NULL)) << ",\n";
+	report << "  \"update\": " << (update ? "true" : "false") << ",\n";
+	report << "  \"passed\": " << (passed ? "true" : "false") << ",\n";
+	report << "  \"budgets\": { \"joint_tolerance_mm\": " << joint_tolerance_mm << ", \"throughput_percent\": "
+		<< throughput_budget << ", \"rss_percent\": " << rss_budget << " },\n";
+	report << "  \"cases\": [\n";
+	for (size_t i = 0; i < cases.size(); ++i)
+	{
+		const Case& c(cases[i]);
+		char hash_str[17];
+		snprintf(hash_str, sizeof(hash_str), "%016llx", static_cast<unsigned long long>(c.result.depth_label_hash));
+
+		report << "    {\n";
+		report << "      \"name\": " << JsonString(c.name) << ",\n";
+		report << "      \"passed\": " << (c.failures.empty() ? "true" : "false") << ",\n";
+		report << "      \"exit_status\": " << c.exit_status << ",\n";
+		report << "      \"frames\": " << c.result.frames << ",\n";
+		report << "      \"frames_per_second\": " << c.result.frames_per_second << ",\n";
+		report << "      \"peak_rss_kb\": " << c.result.peak_rss_kb << ",\n";
+		report << "      \"depth_label_hash\": " << JsonString(hash_str) << ",\n";
+		report << "      \"max_joint_error_mm\": " << c.max_joint_error_mm << ",\n";
+		report << "      \"joint_mismatches\": " << c.joint_mismatches << ",\n";
+		report << "      \"stages_ms\": {";
+		for (size_t s = 0; s < c.result.stages_ms.size(); ++s)
+		{
+			report << (s ? ", " : " ") << JsonString(c.result.stages_ms[s].first) << ": " << c.result.stages_ms[s].second;
+		}
+		report << " },\n";
+		if (c.has_golden) {
+			report << "      \"golden\": { \"frames_per_second\": " << c.golden.frames_per_second
+				<< ", \"peak_rss_kb\": " << c.golden.peak_rss_kb << " },\n";
+		} else {
+			report << "      \"golden\": null,\n";
+		}
+		report << "      \"failures\": [";
+		for (size_t f = 0; f < c.failures.size(); ++f)
+		{
+			report << (f ? ", " : "") << JsonString(c.failures[f]);
+		}
+		report << "]\n";
+		report << "    }" << ((i + 1 < cases.size()) ? "," : "") << '\n';
+	}
+	report << "  ]\n";
+	report << "}\n";
+
+	return report.good();
+}
+
+int main(int argc, char **argv)
+{
+	// Default to the logskel living next to this program
+	std::string logskel("logskel");
+	if (argc > 0) {
+		std::string self(argv[0]);
+		std::string::size_type slash = self.find_last_of('/');
+		if (slash != std::string::npos) {
+			logskel = self.substr(0, slash + 1) + logskel;
+		}
+	}
+
+	// Parse command-line options
+	argc-=(argc>0); argv+=(argc>0); // skip program name argv[0] if present
+	option::Stats  stats(g_Usage, argc, argv);
+	option::Option options[stats.options_max], buffer[stats.buffer_max];
+	option::Parser parse(g_Usage, argc, argv, options, buffer);
+
+	if (parse.error()) {
+		return EXIT_FAILURE;
+	}
+
+	if (options[HELP]) {
+		option::printUsage(std::cout, g_Usage);
+		return EXIT_SUCCESS;
+	}
+
+	if (!options[GOLDEN_DIR] || !options[OUTPUT_DIR] || (parse.nonOptionsCount() != 1)) {
+		std::cerr << "Error: --golden-dir, --output-dir and a case file must be specified.\n";
+		option::printUsage(std::cerr, g_Usage);
+		return EXIT_FAILURE;
+	}
+	std::string golden_dir(options[GOLDEN_DIR].arg);
+	std::string output_dir(options[OUTPUT_DIR].arg);
+	bool update(options[UPDATE]);
+
+	if (options[LOGSKEL]) {
+		logskel = options[LOGSKEL].arg;
+	}
+	if (access(logskel.c_str(), X_OK) != 0) {
+		std::cerr << "Error: " << logskel << " does not exist or is not executable.\n";
+		return EXIT_FAILURE;
+	}
+
+	double joint_tolerance_mm(10.), throughput_budget(10.), rss_budget(10.);
+	if (options[JOINT_TOLERANCE]) {
+		joint_tolerance_mm = strtod(options[JOINT_TOLERANCE].arg, NULL);
+	}
+	if (options[THROUGHPUT_BUDGET]) {
+		throughput_budget = strtod(options[THROUGHPUT_BUDGET].arg, NULL);
+	}
+	if (options[RSS_BUDGET]) {
+		rss_budget = strtod(options[RSS_BUDGET].arg, NULL);
+	}
+	if ((joint_tolerance_mm < 0.) || (throughput_budget < 0.) || (rss_budget < 0.)) {
+		std::cerr << "Tolerances and budgets must not be negative.\n";
+		return EXIT_FAILURE;
+	}
+
+	std::vector<Case> cases;
+	if (!ReadCases(parse.nonOption(0), cases)) {
+		return EXIT_FAILURE;
+	}
+
+	const std::string dirs[2] = { output_dir, golden_dir };
+	for (int i = 0; i < (update ? 2 : 1); ++i)
+	{
+		if ((mkdir(dirs[i].c_str(), 0755) != 0) && (errno != EEXIST)) {
+			std::cerr << "Error: could not create " << dirs[i] << ": " << strerror(errno) << '\n';
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Cases run one after another so that they do not compete for the CPU
+	size_t n_failed(0);
+	for (size_t i = 0; i < cases.size(); ++i)
+	{
+		Case& c(cases[i]);
+		std::string output(output_dir + "/" + c.name + ".h5");
+		std::string log(output_dir + "/" + c.name + ".log");
+		std::string golden_path(golden_dir + "/" + c.name + ".golden");
+
+		std::cout << "Running " << c.name << "... " << std::flush;
+		double start(MonotonicSeconds());
+		c.exit_status = RunLogskel(logskel, c, output, log, c.result.peak_rss_kb);
+		double elapsed(MonotonicSeconds() - start);
+
+		if (c.exit_status != 0) {
+			std::ostringstream failure;
+			failure << "logskel exited with status " << c.exit_status << "; see " << log;
+			c.failures.push_back(failure.str());
+		} else {
+			ParseLogskelOutput(log, c.result);
+			try
+			{
+				ReadLog(output, c.result);
+			}
+			catch (const H5::Exception& e)
+			{
+				c.failures.push_back("could not read log: " + e.getDetailMsg());
+			}
+		}
+
+		if (c.failures.empty()) {
+			if (update) {
+				if (!WriteGolden(golden_path, c)) {
+					c.failures.push_back("could not write golden run " + golden_path);
+				}
+			} else if ((c.has_golden = ReadGolden(golden_path, c.golden))) {
+				CheckCase(c, joint_tolerance_mm, throughput_budget, rss_budget);
+			} else {
+				c.failures.push_back("no golden run at " + golden_path + "; record one with --update");
+			}
+		}
+
+		if (c.failures.empty()) {
+			std::cout << (update ? "recorded" : "passed");
+		} else {
+			std::cout << "FAILED";
+			++n_failed;
+		}
+		std::cout << " (" << c.result.frames << " frame(s) in " << elapsed << " s, "
+			<< c.result.frames_per_second << " frame(s) per second, peak RSS " << c.result.peak_rss_kb << " kB)\n";
+		for (size_t f = 0; f < c.failures.size(); ++f)
+		{
+			std::cout << "    " << c.failures[f] << '\n';
+		}
+	}
+
+	if (options[REPORT] && !WriteReport(options[REPORT].arg, cases, update, joint_tolerance_mm,
+				throughput_budget, rss_budget)) {
+		return EXIT_FAILURE;
+	}
+
+	std::cout << (cases.size() - n_failed) << " of " << cases.size() << " case(s) "
+		<< (update ? "recorded" : "passed") << ".\n";
+	return (n_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
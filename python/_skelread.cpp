@@ -0,0 +1,526 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Python bindings for FrameReader
+//
+// Arrays are returned as read-only objects supporting the buffer protocol
+// which point directly into the reader's decoded frames. Each holds a
+// reference to the frame it came from so numpy.asarray() can wrap them
+// without copying. See skelread/__init__.py for the public interface.
+//---------------------------------------------------------------------------
+#include <Python.h>
+
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#include "reader.h"
+
+//---------------------------------------------------------------------------
+// Buffer: a read-only strided array owned by a shared_ptr
+//---------------------------------------------------------------------------
+
+const int g_MaxDims = 3;
+
+// PEP 3118 format describing struct Joint
+const char g_JointFormat[] = "T{i:id:f:confidence:f:x:f:y:f:z:f:u:f:v:f:w:}";
+
+struct BufferObject {
+	PyObject_HEAD
+	std::shared_ptr<const void> owner;
+	const void*                 data;
+	const char*                 format;
+	Py_ssize_t                  itemsize;
+	int                         ndim;
+	Py_ssize_t                  shape[g_MaxDims];
+	Py_ssize_t                  strides[g_MaxDims];
+};
+
+// Created by PyInit__skelread()
+static PyTypeObject* g_pBufferType = NULL;
+
+static void Buffer_dealloc(BufferObject* self)
+{
+	// Instances of heap types hold a reference to their type
+	PyTypeObject* type(Py_TYPE(self));
+	self->owner.~shared_ptr<const void>();
+	type->tp_free(reinterpret_cast<PyObject*>(self));
+	Py_DECREF(type);
+}
+
+static int Buffer_getbuffer(BufferObject* self, Py_buffer* view, int flags)
+{
+	if (flags & PyBUF_WRITABLE) {
+		PyErr_SetString(PyExc_BufferError, "log arrays are read-only");
+		view->obj = NULL;
+		return -1;
+	}
+
+	Py_ssize_t len(self->itemsize);
+	for (int i = 0; i < self->ndim; ++i)
+	{
+		len *= self->shape[i];
+	}
+
+	view->buf = const_cast<void*>(self->data);
+	view->obj = reinterpret_cast<PyObject*>(self);
+	Py_INCREF(self);
+	view->len = len;
+	view->readonly = 1;
+	view->itemsize = self->itemsize;
+	view->format = (flags & PyBUF_FORMAT) ? const_cast<char*>(self->format) : NULL;
+	view->ndim = self->ndim;
+	view->shape = self->shape;
+	view->strides = self->strides;
+	view->suboffsets = NULL;
+	view->internal = NULL;
+	return 0;
+}
+
+static PyType_Slot g_BufferSlots[] = {
+	{ Py_tp_dealloc, reinterpret_cast<void*>(Buffer_dealloc) },
+	{ Py_bf_getbuffer, reinterpret_cast<void*>(Buffer_getbuffer) },
+	{ Py_tp_doc, const_cast<char*>("Read-only array exposed via the buffer protocol.") },
+	{ 0, NULL }
+};
+
+static PyType_Spec g_BufferSpec = {
+	"skelread._skelread.Buffer",  // name
+	sizeof(BufferObject),         // basicsize
+	0,                            // itemsize
+	Py_TPFLAGS_DEFAULT,           // flags
+	g_BufferSlots,                // slots
+};
+
+// Wrap ndim dimensional C-contiguous data kept alive by owner. A zero-sized array gets a valid
+// pointer so that consumers never see NULL.
+template<typename T>
+static PyObject* MakeBuffer(const std::shared_ptr<const void>& owner, const T* data,
+		const char* format, int ndim, const Py_ssize_t* shape)
+{
+	static const T empty = T();
+
+	BufferObject* self(PyObject_New(BufferObject, g_pBufferType));
+	if (!self) {
+		return NULL;
+	}
+	new (&self->owner) std::shared_ptr<const void>(owner);
+	self->data = data ? data : &empty;
+	self->format = format;
+	self->itemsize = sizeof(T);
+	self->ndim = ndim;
+
+	Py_ssize_t stride(sizeof(T));
+	for (int i = ndim - 1; i >= 0; --i)
+	{
+		self->shape[i] = shape[i];
+		self->strides[i] = stride;
+		stride *= shape[i];
+	}
+	return reinterpret_cast<PyObject*>(self);
+}
+
+template<typename T>
+static const T* DataOrNull(const std::vector<T>& v)
+{
+	return v.empty() ? NULL : &v[0];
+}
+
+//---------------------------------------------------------------------------
+// Reader: wraps FrameReader
+//---------------------------------------------------------------------------
+
+struct ReaderObject {
+	PyObject_HEAD
+	FrameReader* p_reader;
+};
+
+// Translate the current C++ exception into a Python one. Must be called from a catch block.
+static PyObject* SetErrorFromException()
+{
+	try
+	{
+		throw;
+	}
+	catch (const std::out_of_range& e)
+	{
+		PyErr_SetString(PyExc_IndexError, e.what());
+	}
+	catch (const H5::Exception& e)
+	{
+		PyErr_SetString(PyExc_IOError, e.getDetailMsg().c_str());
+	}
+	catch (const std::exception& e)
+	{
+		PyErr_SetString(PyExc_RuntimeError, e.what());
+	}
+	return NULL;
+}
+
+static PyObject* Reader_new(PyTypeObject* type, PyObject* /*args*/, PyObject* /*kwds*/)
+{
+	ReaderObject* self(reinterpret_cast<ReaderObject*>(type->tp_alloc(type, 0)));
+	if (self) {
+		self->p_reader = new FrameReader;
+	}
+	return reinterpret_cast<PyObject*>(self);
+}
+
+static int Reader_init(ReaderObject* self, PyObject* args, PyObject* kwds)
+{
+	static const char* kwlist[] = {
+		"filename", "frames_path", "cache_frames", "prefetch_frames", "chunk_cache_bytes", NULL
+	};
+
+	FrameReader::Options options;
+	const char* filename(NULL);
+	const char* frames_path(options.frames_path.c_str());
+	Py_ssize_t cache_frames(options.cache_frames), prefetch_frames(options.prefetch_frames);
+	Py_ssize_t chunk_cache_bytes(options.chunk_cache_bytes);
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|snnn", const_cast<char**>(kwlist),
+			&filename, &frames_path, &cache_frames, &prefetch_frames, &chunk_cache_bytes))
+	{
+		return -1;
+	}
+	if ((cache_frames < 1) || (prefetch_frames < 0) || (chunk_cache_bytes < 0)) {
+		PyErr_SetString(PyExc_ValueError, "cache sizes must be positive");
+		return -1;
+	}
+
+	options.frames_path = frames_path;
+	options.cache_frames = cache_frames;
+	options.prefetch_frames = prefetch_frames;
+	options.chunk_cache_bytes = chunk_cache_bytes;
+
+	try
+	{
+		self->p_reader->Open(filename, options);
+	}
+	catch (...)
+	{
+		SetErrorFromException();
+		return -1;
+	}
+	return 0;
+}
+
+static void Reader_dealloc(ReaderObject* self)
+{
+	PyTypeObject* type(Py_TYPE(self));
+	delete self->p_reader;
+	type->tp_free(reinterpret_cast<PyObject*>(self));
+	Py_DECREF(type);
+}
+
+static Py_ssize_t Reader_len(ReaderObject* self)
+{
+	return static_cast<Py_ssize_t>(self->p_reader->size());
+}
+
+// Fetch frame i with the GIL released so that other Python threads can run during I/O.
+static LogFramePtr FetchFrame(FrameReader* p_reader, size_t i)
+{
+	LogFramePtr frame;
+	Py_BEGIN_ALLOW_THREADS
+	try
+	{
+		frame = p_reader->frame(i);
+	}
+	catch (...)
+	{
+		// Rethrown below once we hold the GIL again
+		Py_BLOCK_THREADS
+		throw;
+	}
+	Py_END_ALLOW_THREADS
+	return frame;
+}
+
+// Parse optional (start, stop) arguments into a range clamped to the reader's size.
+static bool ParseRange(ReaderObject* self, Py_ssize_t start, Py_ssize_t stop, size_t& begin, size_t& end)
+{
+	Py_ssize_t n(static_cast<Py_ssize_t>(self->p_reader->size()));
+	if (stop < 0 || stop > n) {
+		stop = n;
+	}
+	if (start < 0 || start > stop) {
+		PyErr_SetString(PyExc_IndexError, "invalid frame range");
+		return false;
+	}
+	begin = start;
+	end = stop;
+	return true;
+}
+
+// frame(i) -> dict of frame data
+static PyObject* Reader_frame(ReaderObject* self, PyObject* args)
+{
+	Py_ssize_t i;
+	if (!PyArg_ParseTuple(args, "n", &i)) {
+		return NULL;
+	}
+	if (i < 0) {
+		i += static_cast<Py_ssize_t>(self->p_reader->size());
+	}
+	if (i < 0) {
+		PyErr_SetString(PyExc_IndexError, "frame index out of range");
+		return NULL;
+	}
+
+	LogFramePtr frame;
+	try
+	{
+		frame = FetchFrame(self->p_reader, static_cast<size_t>(i));
+	}
+	catch (...)
+	{
+		return SetErrorFromException();
+	}
+
+	Py_ssize_t image_shape[2] = { frame->rows, frame->cols };
+	Py_ssize_t points_shape[2] = { static_cast<Py_ssize_t>(frame->point_labels.size()), 3 };
+
+	PyObject* users(PyList_New(static_cast<Py_ssize_t>(frame->users.size())));
+	if (!users) {
+		return NULL;
+	}
+	for (size_t u = 0; u < frame->users.size(); ++u)
+	{
+		const LogFrame::User& user(frame->users[u]);
+		Py_ssize_t joints_shape[1] = { static_cast<Py_ssize_t>(user.joints.size()) };
+		PyObject* user_dict(Py_BuildValue("{s:H,s:s,s:N}",
+			"idx", user.idx, "state", user.state.c_str(),
+			"joints", MakeBuffer(frame, DataOrNull(user.joints), g_JointFormat, 1, joints_shape)));
+		if (!user_dict) {
+			Py_DECREF(users);
+			return NULL;
+		}
+		PyList_SET_ITEM(users, u, user_dict);
+	}
+
+	return Py_BuildValue("{s:n,s:k,s:K,s:N,s:N,s:N,s:N,s:N}",
+		"idx", static_cast<Py_ssize_t>(frame->idx),
+		"frame_id", static_cast<unsigned long>(frame->frame_id),
+		"timestamp", static_cast<unsigned long long>(frame->timestamp),
+		"depth", MakeBuffer(frame, DataOrNull(frame->depth), "H", 2, image_shape),
+		"label", MakeBuffer(frame, DataOrNull(frame->label), "H", 2, image_shape),
+		"points", MakeBuffer(frame, DataOrNull(frame->points), "f", 2, points_shape),
+		"point_labels", MakeBuffer(frame, DataOrNull(frame->point_labels), "H", 1, points_shape),
+		"users", users);
+}
+
+// Copy depth or label images of frames [start, stop) into one N x rows x cols array.
+static PyObject* ReadImages(ReaderObject* self, PyObject* args, bool depth)
+{
+	Py_ssize_t start(0), stop(-1);
+	size_t begin, end;
+	if (!PyArg_ParseTuple(args, "|nn", &start, &stop) || !ParseRange(self, start, stop, begin, end)) {
+		return NULL;
+	}
+
+	std::shared_ptr<std::vector<uint16_t> > out(new std::vector<uint16_t>);
+	Py_ssize_t shape[3] = { static_cast<Py_ssize_t>(end - begin), 0, 0 };
+	try
+	{
+		Py_BEGIN_ALLOW_THREADS
+		try
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				LogFramePtr frame(self->p_reader->frame(i));
+				const std::vector<uint16_t>& image(depth ? frame->depth : frame->label);
+				if (i == begin) {
+					shape[1] = frame->rows;
+					shape[2] = frame->cols;
+					out->resize((end - begin) * image.size());
+				}
+				if (image.size() != static_cast<size_t>(shape[1] * shape[2])) {
+					throw std::runtime_error("frames differ in size");
+				}
+				std::memcpy(&(*out)[(i - begin) * image.size()], DataOrNull(image),
+						image.size() * sizeof(uint16_t));
+			}
+		}
+		catch (...)
+		{
+			Py_BLOCK_THREADS
+			throw;
+		}
+		Py_END_ALLOW_THREADS
+	}
+	catch (...)
+	{
+		return SetErrorFromException();
+	}
+
+	return MakeBuffer(std::shared_ptr<const void>(out), DataOrNull(*out), "H", 3, shape);
+}
+
+static PyObject* Reader_read_depth(ReaderObject* self, PyObject* args)
+{
+	return ReadImages(self, args, true);
+}
+
+static PyObject* Reader_read_label(ReaderObject* self, PyObject* args)
+{
+	return ReadImages(self, args, false);
+}
+
+// read_track(user, start, stop) -> (frame indices, N x 24 x 7 joint array)
+//
+// Each row of the joint array holds confidence, x, y, z, u, v, w for joint id (column + 1). Rows
+// are only present for frames where the user has joints; missing joints are NaN.
+static PyObject* Reader_read_track(ReaderObject* self, PyObject* args)
+{
+	const size_t n_fields(7);
+	unsigned short user_idx;
+	Py_ssize_t start(0), stop(-1);
+	size_t begin, end;
+	if (!PyArg_ParseTuple(args, "H|nn", &user_idx, &start, &stop) ||
+		!ParseRange(self, start, stop, begin, end))
+	{
+		return NULL;
+	}
+
+	std::shared_ptr<std::vector<int64_t> > indices(new std::vector<int64_t>);
+	std::shared_ptr<std::vector<float> > joints(new std::vector<float>);
+	try
+	{
+		Py_BEGIN_ALLOW_THREADS
+		try
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				LogFramePtr frame(self->p_reader->frame(i));
+				for (size_t u = 0; u < frame->users.size(); ++u)
+				{
+					const LogFrame::User& user(frame->users[u]);
+					if ((user.idx != user_idx) || user.joints.empty()) {
+						continue;
+					}
+
+					indices->push_back(static_cast<int64_t>(i));
+					size_t row(joints->size());
+					joints->resize(row + g_NumJointTypes * n_fields, Py_NAN);
+					for (size_t j = 0; j < user.joints.size(); ++j)
+					{
+						const Joint& joint(user.joints[j]);
+						if ((joint.id < 1) || (joint.id > g_NumJointTypes)) {
+							continue;
+						}
+						float* out(&(*joints)[row + (joint.id - 1) * n_fields]);
+						out[0] = joint.confidence;
+						out[1] = joint.x; out[2] = joint.y; out[3] = joint.z;
+						out[4] = joint.u; out[5] = joint.v; out[6] = joint.w;
+					}
+				}
+			}
+		}
+		catch (...)
+		{
+			Py_BLOCK_THREADS
+			throw;
+		}
+		Py_END_ALLOW_THREADS
+	}
+	catch (...)
+	{
+		return SetErrorFromException();
+	}
+
+	Py_ssize_t indices_shape[1] = { static_cast<Py_ssize_t>(indices->size()) };
+	Py_ssize_t joints_shape[3] = { indices_shape[0], g_NumJointTypes, static_cast<Py_ssize_t>(n_fields) };
+	return Py_BuildValue("(NN)",
+		MakeBuffer(std::shared_ptr<const void>(indices), DataOrNull(*indices), "q", 1, indices_shape),
+		MakeBuffer(std::shared_ptr<const void>(joints), DataOrNull(*joints), "f", 3, joints_shape));
+}
+
+static PyMethodDef g_ReaderMethods[] = {
+	{ "frame", reinterpret_cast<PyCFunction>(Reader_frame), METH_VARARGS,
+		"frame(i) -> dict of arrays for frame i" },
+	{ "read_depth", reinterpret_cast<PyCFunction>(Reader_read_depth), METH_VARARGS,
+		"read_depth(start=0, stop=-1) -> N x rows x cols depth array" },
+	{ "read_label", reinterpret_cast<PyCFunction>(Reader_read_label), METH_VARARGS,
+		"read_label(start=0, stop=-1) -> N x rows x cols label array" },
+	{ "read_track", reinterpret_cast<PyCFunction>(Reader_read_track), METH_VARARGS,
+		"read_track(user, start=0, stop=-1) -> (frame indices, N x 24 x 7 joints)" },
+	{ NULL, NULL, 0, NULL }
+};
+
+static PyType_Slot g_ReaderSlots[] = {
+	{ Py_tp_new, reinterpret_cast<void*>(Reader_new) },
+	{ Py_tp_init, reinterpret_cast<void*>(Reader_init) },
+	{ Py_tp_dealloc, reinterpret_cast<void*>(Reader_dealloc) },
+	{ Py_sq_length, reinterpret_cast<void*>(Reader_len) },
+	{ Py_tp_methods, g_ReaderMethods },
+	{ Py_tp_doc, const_cast<char*>("Reader(filename, frames_path='/frames', cache_frames=64, "
+		"prefetch_frames=8, chunk_cache_bytes=16MiB)") },
+	{ 0, NULL }
+};
+
+static PyType_Spec g_ReaderSpec = {
+	"skelread._skelread.Reader",  // name
+	sizeof(ReaderObject),         // basicsize
+	0,                            // itemsize
+	Py_TPFLAGS_DEFAULT,           // flags
+	g_ReaderSlots,                // slots
+};
+
+//---------------------------------------------------------------------------
+// Module
+//---------------------------------------------------------------------------
+
+static struct PyModuleDef g_Module = {
+	PyModuleDef_HEAD_INIT,
+	"_skelread",
+	"Native reader for logskel logs.",
+	-1,    // m_size
+	NULL,  // m_methods
+	NULL,  // m_slots
+	NULL,  // m_traverse
+	NULL,  // m_clear
+	NULL,  // m_free
+};
+
+PyMODINIT_FUNC PyInit__skelread()
+{
+	g_pBufferType = reinterpret_cast<PyTypeObject*>(PyType_FromSpec(&g_BufferSpec));
+	if (!g_pBufferType) {
+		return NULL;
+	}
+	// Buffers are only made by MakeBuffer(). Heap types would otherwise inherit object's tp_new.
+	g_pBufferType->tp_new = NULL;
+
+	PyObject* reader_type(PyType_FromSpec(&g_ReaderSpec));
+	if (!reader_type) {
+		return NULL;
+	}
+
+	PyObject* module(PyModule_Create(&g_Module));
+	if (!module) {
+		Py_DECREF(reader_type);
+		return NULL;
+	}
+	// PyModule_AddObject() steals a reference, so keep one of our own for MakeBuffer()
+	Py_INCREF(g_pBufferType);
+	PyModule_AddObject(module, "Buffer", reinterpret_cast<PyObject*>(g_pBufferType));
+	PyModule_AddObject(module, "Reader", reader_type);
+	return module;
+}
@@ -0,0 +1,103 @@
+"""
+Fast, zero-copy access to logs written by logskel.
+
+Frames are decoded by the native FrameReader which caches recently used frames
+and prefetches ahead of sequential access. The arrays returned by this module
+are read-only numpy views directly onto the decoded frames; no data is copied
+into Python.
+
+    >>> import skelread
+    >>> log = skelread.open('log.h5')
+    >>> for frame in log:
+    ...     user_pixels = frame.label == frame.users[0].idx
+
+Batch accessors return a single array for a range of frames:
+
+    >>> depth = log.read_depth(0, 100)           # 100 x rows x cols
+    >>> frame_idxs, joints = log.read_track(1)   # N x 24 x 7
+
+"""
+import numpy as np
+
+from ._skelread import Reader as _Reader
+
+__all__ = ['open', 'Log', 'Frame', 'User', 'TRACK_FIELDS']
+
+#: Names of the columns in the last axis of the joints array from
+#: :py:meth:`Log.read_track`.
+TRACK_FIELDS = ('confidence', 'x', 'y', 'z', 'u', 'v', 'w')
+
+class User(object):
+    """A user present in a frame. joints is a structured array with fields id,
+    confidence, x, y, z, u, v and w.
+
+    """
+    __slots__ = ('idx', 'state', 'joints')
+
+    def __init__(self, idx, state, joints):
+        self.idx, self.state, self.joints = idx, state, joints
+
+class Frame(object):
+    """A single logged frame. All arrays are read-only."""
+    __slots__ = ('idx', 'frame_id', 'timestamp', 'depth', 'label', 'points',
+                 'point_labels', 'users')
+
+    def __init__(self, d):
+        self.idx = d['idx']
+        self.frame_id = d['frame_id']
+        self.timestamp = d['timestamp']
+        self.depth = np.asarray(d['depth'])
+        self.label = np.asarray(d['label'])
+        self.points = np.asarray(d['points'])
+        self.point_labels = np.asarray(d['point_labels'])
+        self.users = [
+            User(u['idx'], u['state'], np.asarray(u['joints']))
+            for u in d['users']
+        ]
+
+class Log(object):
+    """A log opened for reading. Supports len(), indexing and iteration over
+    :py:class:`Frame` objects. Keyword arguments are passed to the native
+    reader and control its cache: frames_path, cache_frames, prefetch_frames
+    and chunk_cache_bytes.
+
+    """
+    def __init__(self, filename, **kwargs):
+        self._reader = _Reader(filename, **kwargs)
+
+    def __len__(self):
+        return len(self._reader)
+
+    def __getitem__(self, idx):
+        if isinstance(idx, slice):
+            return [self[i] for i in range(*idx.indices(len(self)))]
+        return Frame(self._reader.frame(idx))
+
+    def __iter__(self):
+        for i in range(len(self)):
+            yield self[i]
+
+    def read_depth(self, start=0, stop=-1):
+        """Return depth images for frames [start, stop) as a single array."""
+        return np.asarray(self._reader.read_depth(start, stop))
+
+    def read_label(self, start=0, stop=-1):
+        """Return label images for frames [start, stop) as a single array."""
+        return np.asarray(self._reader.read_label(start, stop))
+
+    def read_track(self, user, start=0, stop=-1):
+        """Return the skeleton of user over frames [start, stop).
+
+        Returns a pair (frame_idxs, joints). frame_idxs is a length N array of
+        the frames in which the user had a skeleton. joints is a N x 24 x 7
+        array where joints[i, j-1, :] holds the fields named by TRACK_FIELDS
+        for joint id j in frame frame_idxs[i]. Joints which were not logged
+        are NaN.
+
+        """
+        frame_idxs, joints = self._reader.read_track(user, start, stop)
+        return np.asarray(frame_idxs), np.asarray(joints)
+
+def open(filename, **kwargs):
+    """Open a log for reading. See :py:class:`Log`."""
+    return Log(filename, **kwargs)
@@ -0,0 +1,298 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Label each user pixel of a log with its nearest bone.
+//
+// A native replacement for examples/labelbones.py. Every frame with a tracked
+// user gains a "bone_label" dataset: an image the same size as "label" where
+// user pixels hold one more than the index of their nearest bone in g_Bones
+// and all other pixels are zero. Frames are labelled in parallel; reading and
+// writing the log happens on the main thread.
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+// Includes
+//---------------------------------------------------------------------------
+#include <cstdlib> // for EXIT_SUCCESS
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <hdf5.h>
+#include <H5Cpp.h>
+
+#include "arghelpers.h"
+#include "bonelabel.h"
+#include "joint.h"
+#include "optionparser.h"
+#include "threadpool.h"
+#include "wallclock.h"
+
+using namespace H5;
+
+//---------------------------------------------------------------------------
+// Types
+//---------------------------------------------------------------------------
+
+// A tracked user within a frame
+struct UserJoints {
+	uint16_t           idx;
+	std::vector<Joint> joints;
+};
+
+// Everything needed to label one frame, and the result
+struct FrameJob {
+	std::string             name;
+	hsize_t                 rows, cols;
+	std::vector<uint16_t>   depth;
+	std::vector<float>      points;        // n x 3
+	std::vector<uint16_t>   point_labels;  // n
+	std::vector<UserJoints> users;
+	std::vector<uint16_t>   bone_label;    // rows x cols
+};
+
+//---------------------------------------------------------------------------
+// Code
+//---------------------------------------------------------------------------
+
+// Command-line option description
+enum optionIndex { UNKNOWN, HELP, JOBS, };
+const option::Descriptor g_Usage[] =
+{
+	{ UNKNOWN,  0, "",   "",     option::Arg::None, "Usage:\n"
+						"  skel-bonelabel [options] LOG...\n\n"
+						"Options:" },
+	{ HELP,     0, "h?", "help", option::Arg::None, "  --help, -h, -?  \tPrint a brief usage summary." },
+	{ JOBS,     0, "j",  "jobs", Arg::Numeric,      "  --jobs, -j N  \tLabel N frames at once. "
+						"(Default: number of hardware threads.)" },
+
+	{ 0,0,0,0,0,0 } // Zero record marking end of array.
+};
+
+// Read the data for frame_group into job. Returns false if there is nothing to label.
+bool ReadFrame(Group& frame_group, const CompType& joint_dt, FrameJob& job)
+{
+	if (!frame_group.exists("points") || !frame_group.exists("users")) {
+		return false;
+	}
+
+	// Find users with joints
+	job.users.clear();
+	Group users_group(frame_group.openGroup("users"));
+	for (hsize_t i = 0; i < users_group.getNumObjs(); ++i)
+	{
+		Group user_group(users_group.openGroup(users_group.getObjnameByIdx(i)));
+		if (!user_group.exists("joints")) {
+			continue;
+		}
+
+		UserJoints user;
+		user_group.openAttribute("idx").read(PredType::NATIVE_UINT16, &user.idx);
+		DataSet joints_ds(user_group.openDataSet("joints"));
+		hsize_t n_joints;
+		joints_ds.getSpace().getSimpleExtentDims(&n_joints);
+		user.joints.resize(n_joints);
+		joints_ds.read(&user.joints[0], joint_dt);
+		job.users.push_back(user);
+	}
+	if (job.users.empty()) {
+		return false;
+	}
+
+	DataSet depth_ds(frame_group.openDataSet("depth"));
+	hsize_t dims[2];
+	depth_ds.getSpace().getSimpleExtentDims(dims);
+	job.rows = dims[0];
+	job.cols = dims[1];
+	job.depth.resize(job.rows * job.cols);
+	depth_ds.read(&job.depth[0], PredType::NATIVE_UINT16);
+
+	DataSet points_ds(frame_group.openDataSet("points"));
+	points_ds.getSpace().getSimpleExtentDims(dims);
+	job.points.resize(dims[0] * 3);
+	points_ds.read(&job.points[0], PredType::NATIVE_FLOAT);
+	job.point_labels.resize(dims[0]);
+	frame_group.openDataSet("point_labels").read(&job.point_labels[0], PredType::NATIVE_UINT16);
+
+	return true;
+}
+
+// Compute job.bone_label. Safe to run on any thread.
+void LabelFrame(FrameJob& job)
+{
+	job.bone_label.assign(job.rows * job.cols, 0);
+
+	// Points were logged for non-zero depth pixels in raster order
+	std::vector<size_t> pixel_of_point;
+	pixel_of_point.reserve(job.point_labels.size());
+	for (size_t pixel = 0; pixel < job.depth.size(); ++pixel)
+	{
+		if (job.depth[pixel] != 0) {
+			pixel_of_point.push_back(pixel);
+		}
+	}
+	if (pixel_of_point.size() != job.point_labels.size()) {
+		std::cerr << "Warning: points in " << job.name << " do not match depth map.\n";
+		return;
+	}
+
+	std::vector<float> xs, ys, zs;
+	std::vector<size_t> user_pixels;
+	std::vector<uint16_t> labels;
+	for (size_t u = 0; u < job.users.size(); ++u)
+	{
+		const UserJoints& user(job.users[u]);
+
+		xs.clear(); ys.clear(); zs.clear(); user_pixels.clear();
+		for (size_t i = 0; i < job.point_labels.size(); ++i)
+		{
+			if (job.point_labels[i] != user.idx) {
+				continue;
+			}
+			xs.push_back(job.points[i * 3]);
+			ys.push_back(job.points[i * 3 + 1]);
+			zs.push_back(job.points[i * 3 + 2]);
+			user_pixels.push_back(pixel_of_point[i]);
+		}
+		if (xs.empty()) {
+			continue;
+		}
+
+		LabelBones(&xs[0], &ys[0], &zs[0], xs.size(), &user.joints[0], user.joints.size(), labels);
+		for (size_t i = 0; i < labels.size(); ++i)
+		{
+			job.bone_label[user_pixels[i]] = labels[i];
+		}
+	}
+}
+
+// Write job.bone_label to frame_group, replacing any existing labelling.
+void WriteFrame(Group& frame_group, const FrameJob& job)
+{
+	if (frame_group.exists("bone_label")) {
+		frame_group.unlink("bone_label");
+	}
+
+	hsize_t dims[2] = { job.rows, job.cols };
+	DataSpace space(2, dims);
+	DataSet ds(frame_group.createDataSet("bone_label", PredType::NATIVE_UINT16, space));
+	ds.write(&job.bone_label[0], PredType::NATIVE_UINT16);
+
+	std::string bone_names;
+	for (int i = 0; i < g_NumBones; ++i)
+	{
+		if (i > 0) {
+			bone_names += ",";
+		}
+		bone_names += g_Bones[i].name;
+	}
+	StrType str_type(PredType::C_S1, bone_names.size());
+	ds.createAttribute("bones", str_type, DataSpace()).write(str_type, bone_names);
+}
+
+int main(int argc, char **argv)
+{
+	// Parse command-line options
+	argc-=(argc>0); argv+=(argc>0); // skip program name argv[0] if present
+	option::Stats  stats(g_Usage, argc, argv);
+	option::Option options[stats.options_max], buffer[stats.buffer_max];
+	option::Parser parse(g_Usage, argc, argv, options, buffer);
+
+	if (parse.error()) {
+		return EXIT_FAILURE;
+	}
+
+	if (options[HELP] || (parse.nonOptionsCount() == 0)) {
+		option::printUsage(std::cout, g_Usage);
+		return options[HELP] ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	long n_threads(0);
+	if (options[JOBS]) {
+		n_threads = strtol(options[JOBS].arg, NULL, 10);
+		if (n_threads < 1) {
+			std::cerr << "Number of jobs must be positive.\n";
+			return EXIT_FAILURE;
+		}
+	}
+
+	ThreadPool pool(static_cast<size_t>(n_threads));
+	CompType joint_dt(MakeJointDataType());
+
+	// Frames are read, labelled and written in batches. Keep a couple of frames per worker in
+	// flight so that no worker is idle while the main thread does I/O.
+	const size_t batch_size(2 * pool.Size());
+	std::vector<FrameJob> jobs(batch_size);
+
+	for (int log_idx = 0; log_idx < parse.nonOptionsCount(); ++log_idx)
+	{
+		const char* log_path(parse.nonOption(log_idx));
+		double start(MonotonicSeconds());
+		size_t n_frames(0), n_labelled(0);
+
+		try
+		{
+			H5File file(log_path, H5F_ACC_RDWR);
+			Group frames_group(file.openGroup("frames"));
+			hsize_t n_objs(frames_group.getNumObjs());
+
+			for (hsize_t batch_start = 0; batch_start < n_objs; batch_start += batch_size)
+			{
+				std::vector<FrameJob*> batch;
+				for (hsize_t i = batch_start; (i < n_objs) && (i < batch_start + batch_size); ++i)
+				{
+					FrameJob& job(jobs[i - batch_start]);
+					job.name = frames_group.getObjnameByIdx(i);
+					Group frame_group(frames_group.openGroup(job.name));
+					++n_frames;
+					if (ReadFrame(frame_group, joint_dt, job)) {
+						batch.push_back(&job);
+					}
+				}
+
+				for (size_t i = 0; i < batch.size(); ++i)
+				{
+					FrameJob* p_job(batch[i]);
+					pool.Submit([p_job]() { LabelFrame(*p_job); });
+				}
+				pool.Wait();
+
+				for (size_t i = 0; i < batch.size(); ++i)
+				{
+					Group frame_group(frames_group.openGroup(batch[i]->name));
+					WriteFrame(frame_group, *batch[i]);
+					++n_labelled;
+				}
+			}
+		}
+		catch (const Exception& e)
+		{
+			std::cerr << "HDF5 error processing " << log_path << ": " << e.getDetailMsg() << '\n';
+			return EXIT_FAILURE;
+		}
+
+		double elapsed(MonotonicSeconds() - start);
+		printf("%s: labelled %zu of %zu frames in %.1fs (%.1f frames/s)\n", log_path,
+			n_labelled, n_frames, elapsed, elapsed > 0. ? n_frames / elapsed : 0.);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,301 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Attach to frames published by logskel --shm and report their rate, users
+// and any frames lost because we fell behind.
+//
+// With --self-test, frames are published and read back within this process
+// to check the ring without a sensor.
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+// Includes
+//---------------------------------------------------------------------------
+#include <atomic>
+#include <cstdlib> // for EXIT_SUCCESS
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <unistd.h> // for getpid, usleep
+
+#include "monitor.h"
+#include "shmring.h"
+
+//---------------------------------------------------------------------------
+// Code
+//---------------------------------------------------------------------------
+
+// We have no options beyond those common to every monitor
+const option::Descriptor g_Options[] =
+{
+	{ 0,0,0,0,0,0 } // Zero record marking end of array.
+};
+
+// Small frames for the self test. Every pixel of frame f holds f + pixel index so that a frame
+// torn by the writer is easy to spot.
+const int g_TestRows = 48, g_TestCols = 64;
+
+void MakeTestFrame(uint32_t f, std::vector<uint16_t>& depth, std::vector<uint16_t>& label,
+		std::vector<TrackedUser>& users)
+{
+	for (size_t i = 0; i < depth.size(); ++i)
+	{
+		depth[i] = static_cast<uint16_t>(f + i);
+		label[i] = static_cast<uint16_t>(f);
+	}
+
+	users.resize(1 + f % 3);
+	for (size_t u = 0; u < users.size(); ++u)
+	{
+		users[u].user = static_cast<uint16_t>(u + 1);
+		users[u].n_joints = static_cast<int>(f % (g_NumJointTypes + 1));
+		for (int j = 0; j < users[u].n_joints; ++j)
+		{
+			Joint& joint(users[u].joints[j]);
+			joint.id = j + 1;
+			joint.confidence = 1.f;
+			joint.x = static_cast<float>(f);
+			joint.y = static_cast<float>(u);
+			joint.z = static_cast<float>(j);
+			joint.u = joint.v = joint.w = 0.f;
+		}
+	}
+}
+
+// True if view holds an intact copy of the frame made by MakeTestFrame
+bool CheckTestFrame(const ShmFrameView& view)
+{
+	const ShmFrame& frame(*view.frame);
+	uint32_t f(frame.frame_id);
+	bool ok((frame.number == f) && (frame.timestamp == 1000ull * f) &&
+		(frame.rows == g_TestRows) && (frame.cols == g_TestCols) &&
+		(frame.n_users == static_cast<int32_t>(1 + f % 3)));
+	for (int i = 0; ok && (i < g_TestRows * g_TestCols); ++i)
+	{
+		ok = (view.depth[i] == static_cast<uint16_t>(f + i)) && (view.label[i] == static_cast<uint16_t>(f));
+	}
+	for (int u = 0; ok && (u < frame.n_users); ++u)
+	{
+		const TrackedUser& user(frame.users[u]);
+		ok = (user.user == u + 1) && (user.n_joints == static_cast<int>(f % (g_NumJointTypes + 1)));
+		for (int j = 0; ok && (j < user.n_joints); ++j)
+		{
+			ok = (user.joints[j].id == j + 1) && (user.joints[j].x == static_cast<float>(f));
+		}
+	}
+	return ok;
+}
+
+// Publish a frame larger than the ring and check that it is cropped rather than garbled. Returns
+// false on failure.
+bool TestLargeFrame(const std::string& name)
+{
+	ShmRingWriter writer;
+	if (!writer.Open(name, 2, g_TestRows, g_TestCols)) {
+		return false;
+	}
+	ShmRingReader reader;
+	if (!reader.Open(name)) {
+		return false;
+	}
+
+	const int rows(g_TestRows + 8), cols(g_TestCols + 16);
+	std::vector<uint16_t> depth(rows * cols), label(depth.size());
+	for (size_t i = 0; i < depth.size(); ++i)
+	{
+		depth[i] = static_cast<uint16_t>(i);
+		label[i] = static_cast<uint16_t>(i / cols);
+	}
+	writer.Publish(0, 0, rows, cols, &depth[0], &label[0], std::vector<TrackedUser>());
+
+	ShmFrameView view;
+	bool ok(reader.Next(view) && (view.frame->rows == g_TestRows) && (view.frame->cols == g_TestCols));
+	for (int row = 0; ok && (row < g_TestRows); ++row)
+	{
+		for (int col = 0; ok && (col < g_TestCols); ++col)
+		{
+			ok = (view.depth[row * g_TestCols + col] == static_cast<uint16_t>(row * cols + col)) &&
+				(view.label[row * g_TestCols + col] == static_cast<uint16_t>(row));
+		}
+	}
+	return ok && reader.IsValid(view);
+}
+
+int SelfTest(int n_frames)
+{
+	std::ostringstream name;
+	name << "/skel-shmstat-" << getpid();
+
+	if (!TestLargeFrame(name.str() + "-large")) {
+		std::cerr << "Self test failed: a frame larger than the ring was not cropped correctly.\n";
+		return EXIT_FAILURE;
+	}
+
+	// A short ring so that the reader is overtaken now and then
+	ShmRingWriter writer;
+	if (!writer.Open(name.str(), 4, g_TestRows, g_TestCols)) {
+		return EXIT_FAILURE;
+	}
+	ShmRingReader reader;
+	if (!reader.Open(name.str())) {
+		return EXIT_FAILURE;
+	}
+
+	std::vector<uint16_t> depth(g_TestRows * g_TestCols), label(depth.size());
+	std::vector<TrackedUser> users;
+	auto publish = [&](uint32_t f) {
+		MakeTestFrame(f, depth, label, users);
+		writer.Publish(f, 1000ull * f, g_TestRows, g_TestCols, &depth[0], &label[0], users);
+	};
+
+	// Publish the first frame before starting the writer thread so that the reader starts
+	// from the beginning and every later frame is accounted for.
+	publish(0);
+	ShmFrameView view;
+	if (!reader.Next(view) || !CheckTestFrame(view) || !reader.IsValid(view)) {
+		std::cerr << "Self test failed: could not read the first frame.\n";
+		return EXIT_FAILURE;
+	}
+
+	std::atomic<bool> done(false);
+	std::thread write_thread([&publish, &done, n_frames]() {
+		for (int f = 1; f < n_frames; ++f)
+		{
+			publish(static_cast<uint32_t>(f));
+			if (f % 16 == 0) {
+				usleep(100);
+			}
+		}
+		done = true;
+	});
+
+	// Only frames which are still valid after being checked count. A frame which fails the
+	// check but is still valid is an error in the ring.
+	uint64_t n_read(1), n_torn(0), n_bad(0);
+	while (true)
+	{
+		bool finished(done);
+		while (reader.Next(view))
+		{
+			bool ok(CheckTestFrame(view));
+			if (!reader.IsValid(view)) {
+				++n_torn;
+			} else if (!ok) {
+				++n_bad;
+			} else {
+				++n_read;
+			}
+		}
+		if (finished) {
+			break;
+		}
+	}
+	write_thread.join();
+
+	printf("published %llu, read %llu, overwritten while reading %llu, overruns %llu, bad %llu\n",
+		static_cast<unsigned long long>(reader.Published()), static_cast<unsigned long long>(n_read),
+		static_cast<unsigned long long>(n_torn), static_cast<unsigned long long>(reader.Overruns()),
+		static_cast<unsigned long long>(n_bad));
+
+	// Every frame is either read, lost while reading or counted as an overrun
+	bool ok((n_bad == 0) && (reader.Published() == static_cast<uint64_t>(n_frames)) &&
+		(n_read + n_torn + reader.Overruns() == static_cast<uint64_t>(n_frames)) &&
+		reader.Latest(view) && (view.frame->frame_id + 1 == static_cast<uint32_t>(n_frames)));
+	if (!ok) {
+		std::cerr << "Self test failed.\n";
+		return EXIT_FAILURE;
+	}
+	std::cout << "Self test passed.\n";
+	return EXIT_SUCCESS;
+}
+
+// Reports on frames published to a shared memory ring
+class ShmMonitor : public Monitor
+{
+public:
+	ShmMonitor()
+		: n_frames_(0), n_torn_(0), last_overruns_(0), n_users_(0)
+	{ }
+
+	bool Open(const char* name, const option::Option*)
+	{
+		if (!reader_.Open(name)) {
+			return false;
+		}
+		std::cout << "Reading frames from " << name << '\n';
+		return true;
+	}
+
+	void Poll(bool verbose)
+	{
+		bool got_frame(false);
+		ShmFrameView view;
+		while (reader_.Next(view))
+		{
+			// Copy what we need before checking that the writer has not overtaken us
+			uint32_t frame_id(view.frame->frame_id);
+			uint64_t timestamp(view.frame->timestamp);
+			int frame_users(view.frame->n_users);
+			if (!reader_.IsValid(view)) {
+				++n_torn_;
+				continue;
+			}
+			got_frame = true;
+			++n_frames_;
+			n_users_ = frame_users;
+			if (verbose) {
+				printf("frame %u, timestamp %llu, %d user(s)\n", frame_id,
+					static_cast<unsigned long long>(timestamp), frame_users);
+			}
+		}
+		if (!got_frame) {
+			usleep(1000);
+		}
+	}
+
+	void Report(double seconds)
+	{
+		printf("%.1f fps, %d user(s), overruns %llu, overwritten while reading %llu\n",
+			(seconds > 0.) ? n_frames_ / seconds : 0., n_users_,
+			static_cast<unsigned long long>(reader_.Overruns() - last_overruns_),
+			static_cast<unsigned long long>(n_torn_));
+		fflush(stdout);
+		n_frames_ = n_torn_ = 0;
+		last_overruns_ = reader_.Overruns();
+	}
+
+	int SelfTest(int n_frames)
+	{
+		return ::SelfTest(n_frames);
+	}
+
+private:
+	ShmRingReader reader_;
+	uint64_t      n_frames_, n_torn_, last_overruns_;
+	int           n_users_;
+};
+
+int main(int argc, char **argv)
+{
+	ShmMonitor monitor;
+	return RunMonitor(argc, argv, monitor, "skel-shmstat [options] NAME", "a shared memory name", g_Options);
+}
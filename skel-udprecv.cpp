@@ -0,0 +1,219 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Receive skeletons sent by logskel --udp and report loss and latency.
+//
+// With --self-test, skeletons are sent to ourselves over loopback and checked
+// after decoding. This exercises the packet format and socket code without a
+// sensor.
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+// Includes
+//---------------------------------------------------------------------------
+#include <cmath>
+#include <cstdlib> // for EXIT_SUCCESS
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <unistd.h> // for usleep
+
+#include "arghelpers.h"
+#include "monitor.h"
+#include "udp.h"
+
+//---------------------------------------------------------------------------
+// Code
+//---------------------------------------------------------------------------
+
+// Options of our own, after those common to every monitor
+enum optionIndex { BIND = MONITOR_OPTIONS_END, };
+const option::Descriptor g_Options[] =
+{
+	{ BIND,      0, "b",  "bind",      Arg::NonEmpty,     "  --bind, -b ADDRESS  \tListen only on ADDRESS." },
+
+	{ 0,0,0,0,0,0 } // Zero record marking end of array.
+};
+
+void PrintStats(const UdpSkeletonReceiver::Stats& stats)
+{
+	printf("received %llu, lost %llu, out of order %llu, invalid %llu, "
+		"latency mean %.3f ms, max %.3f ms\n",
+		static_cast<unsigned long long>(stats.received), static_cast<unsigned long long>(stats.lost),
+		static_cast<unsigned long long>(stats.out_of_order), static_cast<unsigned long long>(stats.invalid),
+		stats.MeanLatencyMs(), stats.latency_max_ms);
+	fflush(stdout);
+}
+
+// Synthetic joints for frame f of the self test
+void MakeTestJoints(int f, Joint* joints, int& n)
+{
+	n = 0;
+	for (int id = 1; id <= g_NumJointTypes; ++id)
+	{
+		// Leave out a different joint each frame to exercise the joint mask
+		if ((id - 1) == (f % g_NumJointTypes)) {
+			continue;
+		}
+		Joint& joint(joints[n++]);
+		joint.id = id;
+		joint.confidence = ((f + id) % 3) * 0.5f;
+		joint.x = 100.f * id - 1200.f + 0.25f * f;
+		joint.y = -37.5f * id;
+		joint.z = 2000.f + 10.f * f;
+		joint.u = joint.v = joint.w = 0.f;
+	}
+}
+
+int SelfTest(int n_frames)
+{
+	UdpSkeletonReceiver receiver;
+	if (!receiver.Open("127.0.0.1", 0)) {
+		return EXIT_FAILURE;
+	}
+	std::ostringstream destination;
+	destination << "127.0.0.1:" << receiver.Port();
+
+	UdpSkeletonSender sender;
+	if (!sender.Open(std::vector<std::string>(1, destination.str()))) {
+		return EXIT_FAILURE;
+	}
+
+	// Send from another thread at a little over 1000 frames per second
+	std::thread send_thread([&sender, n_frames]() {
+		Joint joints[g_NumJointTypes];
+		int n;
+		for (int f = 0; f < n_frames; ++f)
+		{
+			MakeTestJoints(f, joints, n);
+			sender.BeginFrame(static_cast<uint32_t>(f), 1000ull * f);
+			sender.AddUser(1, joints, n);
+			sender.AddUser(2, joints, n / 2);
+			sender.Send();
+			usleep(900);
+		}
+	});
+
+	// Check every user of every packet which arrives. The final frame may be lost, so also stop if
+	// nothing arrives for a second.
+	int n_bad(0);
+	SkeletonPacket packet;
+	Joint expected[g_NumJointTypes];
+	int n_expected;
+	while (receiver.Receive(packet, 1000))
+	{
+		MakeTestJoints(static_cast<int>(packet.frame_id), expected, n_expected);
+		const int n_user_joints[2] = { n_expected, n_expected / 2 };
+		bool ok((packet.timestamp == 1000ull * packet.frame_id) && (packet.n_users == 2));
+		for (int u = 0; ok && (u < packet.n_users); ++u)
+		{
+			const SkeletonPacket::User& user(packet.users[u]);
+			ok = (user.idx == u + 1) && (user.n_joints == n_user_joints[u]);
+			for (int i = 0; ok && (i < user.n_joints); ++i)
+			{
+				const Joint& a(user.joints[i]);
+				const Joint& b(expected[i]);
+				ok = (a.id == b.id) && (std::fabs(a.x - b.x) <= 0.5f) && (std::fabs(a.y - b.y) <= 0.5f) &&
+					(std::fabs(a.z - b.z) <= 0.5f) &&
+					(std::fabs(a.confidence - b.confidence) <= 1.f / 255.f);
+			}
+		}
+		if (!ok) {
+			++n_bad;
+		}
+		if (packet.frame_id + 1 == static_cast<uint32_t>(n_frames)) {
+			break;
+		}
+	}
+	send_thread.join();
+
+	// UDP may drop datagrams even over loopback, for instance on a loaded machine, so only fail if
+	// most are lost. Every one which arrives must decode correctly.
+	const UdpSkeletonReceiver::Stats& stats(receiver.GetStats());
+	PrintStats(stats);
+	if ((n_bad > 0) || (2 * stats.received < static_cast<uint64_t>(n_frames))) {
+		std::cerr << "Self test failed: " << n_bad << " packet(s) decoded incorrectly, "
+			<< stats.received << " of " << n_frames << " received.\n";
+		return EXIT_FAILURE;
+	}
+	std::cout << "Self test passed.\n";
+	return EXIT_SUCCESS;
+}
+
+// Reports on skeletons arriving on a UDP port
+class UdpMonitor : public Monitor
+{
+public:
+	bool Open(const char* name, const option::Option* options)
+	{
+		long port(strtol(name, NULL, 10));
+		if ((port < 1) || (port > 65535)) {
+			std::cerr << "Port must be between 1 and 65535.\n";
+			return false;
+		}
+		if (!receiver_.Open(options[BIND] ? options[BIND].arg : "", static_cast<int>(port))) {
+			return false;
+		}
+		std::cout << "Listening on port " << port << '\n';
+		return true;
+	}
+
+	void Poll(bool verbose)
+	{
+		if (!receiver_.Receive(packet_, 100) || !verbose) {
+			return;
+		}
+		printf("frame %u, timestamp %llu, %d user(s)\n", packet_.frame_id,
+			static_cast<unsigned long long>(packet_.timestamp), packet_.n_users);
+		for (int u = 0; u < packet_.n_users; ++u)
+		{
+			const SkeletonPacket::User& user(packet_.users[u]);
+			for (int j = 0; j < user.n_joints; ++j)
+			{
+				const Joint& joint(user.joints[j]);
+				printf("  user %u joint %2d: %6.0f %6.0f %6.0f (%.2f)\n", user.idx, joint.id,
+					joint.x, joint.y, joint.z, joint.confidence);
+			}
+		}
+	}
+
+	void Report(double)
+	{
+		PrintStats(receiver_.GetStats());
+		receiver_.ResetStats();
+	}
+
+	int SelfTest(int n_frames)
+	{
+		return ::SelfTest(n_frames);
+	}
+
+private:
+	UdpSkeletonReceiver receiver_;
+	SkeletonPacket      packet_;
+};
+
+int main(int argc, char **argv)
+{
+	UdpMonitor monitor;
+	return RunMonitor(argc, argv, monitor, "skel-udprecv [options] PORT", "a port", g_Options);
+}
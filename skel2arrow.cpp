@@ -0,0 +1,142 @@
+/*****************************************************************************
+*                                                                            *
+*  Copyright (C) 2014 Rich Wareham <rich.openni@richwareham.com>             *
+*                                                                            *
+*  Licensed under the Apache License, Version 2.0 (the "License");           *
+*  you may not use this file except in compliance with the License.          *
+*  You may obtain a copy of the License at                                   *
+*                                                                            *
+*      http://www.apache.org/licenses/LICENSE-2.0                            *
+*                                                                            *
+*  Unless required by applicable law or agreed to in writing, software       *
+*  distributed under the License is distributed on an "AS IS" BASIS,         *
+*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  *
+*  See the License for the specific language governing permissions and       *
+*  limitations under the License.                                            *
+*                                                                            *
+*****************************************************************************/
+//---------------------------------------------------------------------------
+// Export the joints of a log as an Apache Arrow IPC file.
+//
+// The per-user compound "joints" datasets are flattened into a single table
+// with one row per joint. See JointStreamWriter in jointstream.h for the
+// columns. The output can be memory-mapped by any Arrow implementation.
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+// Includes
+//---------------------------------------------------------------------------
+#include <cstdlib> // for EXIT_SUCCESS
+#include <iostream>
+#include <stdexcept>
+
+#include "arghelpers.h"
+#include "jointstream.h"
+#include "optionparser.h"
+#include "reader.h"
+#include "wallclock.h"
+
+//---------------------------------------------------------------------------
+// Code
+//---------------------------------------------------------------------------
+
+// Command-line option description
+enum optionIndex { UNKNOWN, HELP, OUTPUT, BATCH_ROWS, };
+const option::Descriptor g_Usage[] =
+{
+	{ UNKNOWN,    0, "",   "",           option::Arg::None, "Usage:\n"
+							"  skel2arrow [options] --output FILE LOG\n\n"
+							"Options:" },
+	{ HELP,       0, "h?", "help",       option::Arg::None, "  --help, -h, -?  \tPrint a brief usage summary." },
+	{ OUTPUT,     0, "o",  "output",     Arg::NonEmpty,     "  --output, -o FILE  \tWrite Arrow IPC file to FILE." },
+	{ BATCH_ROWS, 0, "b",  "batch-rows", Arg::Numeric,      "  --batch-rows, -b ROWS  \tWrite record batches of ROWS joints. "
+							"(Default: 16384.)" },
+
+	{ 0,0,0,0,0,0 } // Zero record marking end of array.
+};
+
+int main(int argc, char **argv)
+{
+	// Parse command-line options
+	argc-=(argc>0); argv+=(argc>0); // skip program name argv[0] if present
+	option::Stats  stats(g_Usage, argc, argv);
+	option::Option options[stats.options_max], buffer[stats.buffer_max];
+	option::Parser parse(g_Usage, argc, argv, options, buffer);
+
+	if (parse.error()) {
+		return EXIT_FAILURE;
+	}
+
+	if (options[HELP]) {
+		option::printUsage(std::cout, g_Usage);
+		return EXIT_SUCCESS;
+	}
+
+	if (!options[OUTPUT] || (parse.nonOptionsCount() != 1)) {
+		std::cerr << "Error: an output and exactly one input must be specified.\n";
+		option::printUsage(std::cerr, g_Usage);
+		return EXIT_FAILURE;
+	}
+
+	long batch_rows(16384);
+	if (options[BATCH_ROWS]) {
+		batch_rows = strtol(options[BATCH_ROWS].arg, NULL, 10);
+		if (batch_rows < 1) {
+			std::cerr << "Batch size must be positive.\n";
+			return EXIT_FAILURE;
+		}
+	}
+
+	double start_time(MonotonicSeconds());
+
+	FrameReader reader;
+	try
+	{
+		reader.Open(parse.nonOption(0));
+	}
+	catch (const H5::Exception& e)
+	{
+		std::cerr << "HDF5 error: " << e.getDetailMsg() << '\n';
+		return EXIT_FAILURE;
+	}
+
+	JointStreamWriter writer;
+	if (!writer.Open(options[OUTPUT].arg, static_cast<size_t>(batch_rows))) {
+		return EXIT_FAILURE;
+	}
+
+	try
+	{
+		for (LogFramePtr frame : reader.all())
+		{
+			for (size_t u = 0; u < frame->users.size(); ++u)
+			{
+				const LogFrame::User& user(frame->users[u]);
+				if (user.joints.empty()) {
+					continue;
+				}
+				writer.Append(frame->idx, frame->timestamp, user.idx, &user.joints[0], user.joints.size());
+			}
+		}
+	}
+	catch (const H5::Exception& e)
+	{
+		std::cerr << "HDF5 error: " << e.getDetailMsg() << '\n';
+		return EXIT_FAILURE;
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "Error: " << e.what() << '\n';
+		return EXIT_FAILURE;
+	}
+
+	uint64_t n_rows(writer.RowCount());
+	if (!writer.Close()) {
+		return EXIT_FAILURE;
+	}
+
+	std::cout << "Exported " << n_rows << " joints from " << reader.size() << " frames to "
+		<< options[OUTPUT].arg << " in " << MonotonicSeconds() - start_time << "s\n";
+
+	return EXIT_SUCCESS;
+}
@@ -54,3 +54,163 @@ if ! echo "${_h5ls_out}" | grep -q 'frame_000050/label'; then
 	echo "label not present in h5ls output"
 	exit 1
 fi
+
+# Try logging a recording in two frame ranges and merging the results
+LOGSKEL_MERGE="${BUILD_DIR}/logskel-merge"
+SHARD_PREFIX="/tmp/logskel-shard"
+"${LOGSKEL}" --playback "${RECORDINGS_DIR}/Captured-2014-10-31.oni" --end-frame 40 --log ${SHARD_PREFIX}-1 && \
+	"${LOGSKEL}" --playback "${RECORDINGS_DIR}/Captured-2014-10-31.oni" --start-frame 40 --end-frame 80 --log ${SHARD_PREFIX}-2
+if [ $? -ne 0 ]; then
+	echo "Frame range logging command failed."
+	exit 1
+fi
+MERGED_FILE="/tmp/logskel-merged"
+"${LOGSKEL_MERGE}" --output ${MERGED_FILE} ${SHARD_PREFIX}-1 ${SHARD_PREFIX}-2
+if [ $? -ne 0 ]; then
+	echo "Merge command failed."
+	exit 1
+fi
+echo "Checking depth in ${MERGED_FILE}"
+if ! ${H5LS} -r "${MERGED_FILE}" | grep -q 'frame_000050/depth'; then
+	echo "depth not present in merged h5ls output"
+	exit 1
+fi
+if ! ${H5LS} "${MERGED_FILE}" | grep -q '^events'; then
+	echo "events not present in merged h5ls output"
+	exit 1
+fi
+
+# Check that merging keeps the pixels shared by unchanged frames shared
+echo "Checking unchanged frames stay linked when merged..."
+"${LOGSKEL}" --synthetic users=2,speed=0,noise=2 --end-frame 30 --skip-unchanged 10 --quiet-events \
+	--log ${SHARD_PREFIX}-1 > /dev/null && \
+	"${LOGSKEL}" --synthetic users=2,speed=0,noise=2 --start-frame 25 --end-frame 60 --skip-unchanged 10 \
+	--quiet-events --log ${SHARD_PREFIX}-2 > /dev/null && \
+	"${LOGSKEL_MERGE}" --output ${MERGED_FILE} ${SHARD_PREFIX}-1 ${SHARD_PREFIX}-2 > /dev/null
+if [ $? -ne 0 ]; then
+	echo "Merging unchanged frames failed."
+	exit 1
+fi
+if ! ${H5LS} -r "${MERGED_FILE}" | grep -q 'frame_000050/depth.*same as'; then
+	echo "depth of unchanged frames not linked in merged h5ls output"
+	exit 1
+fi
+
+# Try starting, rotating and stopping logs in a running daemon
+LOGSKELD="${BUILD_DIR}/logskeld"
+DAEMON_SOCKET="/tmp/logskeld-test.sock"
+DAEMON_PREFIX="/tmp/logskeld"
+"${LOGSKELD}" --playback "${RECORDINGS_DIR}/Captured-2014-10-31.oni" --socket ${DAEMON_SOCKET} &
+DAEMON_PID=$!
+for _ in $(seq 50); do
+	[ -S ${DAEMON_SOCKET} ] && break
+	sleep 0.1
+done
+# Wait until the daemon's current log has at least $1 frames
+wait_for_daemon_frames() {
+	for _ in $(seq 300); do
+		_frames=$("${LOGSKELD}" --socket ${DAEMON_SOCKET} --send status | sed -n 's/.* frames \([0-9]*\) .*/\1/p')
+		[ -n "${_frames}" ] && [ "${_frames}" -ge "$1" ] && return 0
+		sleep 0.1
+	done
+	echo "Daemon did not log $1 frames."
+	return 1
+}
+"${LOGSKELD}" --socket ${DAEMON_SOCKET} --send "start ${DAEMON_PREFIX}-1" && wait_for_daemon_frames 11 && \
+	"${LOGSKELD}" --socket ${DAEMON_SOCKET} --send "rotate ${DAEMON_PREFIX}-2" && wait_for_daemon_frames 11 && \
+	"${LOGSKELD}" --socket ${DAEMON_SOCKET} --send "stop" && \
+	"${LOGSKELD}" --socket ${DAEMON_SOCKET} --send "quit"
+_send_status=$?
+wait ${DAEMON_PID}
+_daemon_status=$?
+if [ ${_send_status} -ne 0 ] || [ ${_daemon_status} -ne 0 ]; then
+	echo "Daemon logging failed."
+	exit 1
+fi
+for _log in ${DAEMON_PREFIX}-1 ${DAEMON_PREFIX}-2; do
+	echo "Checking frames in ${_log}"
+	if ! ${H5LS} -r "${_log}" | grep -q 'frame_000010/depth'; then
+		echo "depth not present in ${_log}"
+		exit 1
+	fi
+done
+
+# Try logging a synthetic scene of several users
+SYNTHETIC_FILE="/tmp/logskel-synthetic"
+"${LOGSKEL}" --synthetic users=4,noise=5 --end-frame 100 --quiet-events --log ${SYNTHETIC_FILE}
+if [ $? -ne 0 ]; then
+	echo "Synthetic logging command failed."
+	exit 1
+fi
+echo "Checking depth in ${SYNTHETIC_FILE}"
+if ! ${H5LS} -r "${SYNTHETIC_FILE}" | grep -q 'frame_000050/depth'; then
+	echo "depth not present in synthetic h5ls output"
+	exit 1
+fi
+
+# Check that a scene which does not move is stored only once
+echo "Checking unchanged frames are skipped..."
+_unchanged=$("${LOGSKEL}" --synthetic users=2,speed=0,noise=2,frames=30 --skip-unchanged 10 --quiet-events \
+	--log ${SYNTHETIC_FILE} | grep '^Unchanged depth maps')
+if [ "${_unchanged}" != "Unchanged depth maps: 29 of 30 frame(s) logged." ]; then
+	echo "Unexpected unchanged frame count: '${_unchanged}'"
+	exit 1
+fi
+
+# Check that only the lead-up to users appearing and the frames after it are logged. At 30 fps,
+# 0.51 seconds of pre-trigger holds the 16 frames before the figures enter.
+echo "Checking triggered logging..."
+_triggered=$("${LOGSKEL}" --synthetic users=2,frames=90,enter=60 --trigger user-present --pre-trigger 0.51 \
+	--quiet-events --log ${SYNTHETIC_FILE} | grep '^Trigger met')
+if [ "${_triggered}" != "Trigger met 1 time(s): logged 46 frame(s) and discarded 44." ]; then
+	echo "Unexpected triggered frame counts: '${_triggered}'"
+	exit 1
+fi
+
+# Check that deterministic runs over the same input give the same output
+echo "Checking deterministic runs are reproducible..."
+_hash_1=$("${LOGSKEL}" --synthetic users=2,noise=5,frames=60 --deterministic --quiet-events | grep '^Output hash')
+_hash_2=$("${LOGSKEL}" --synthetic users=2,noise=5,frames=60 --deterministic --quiet-events | grep '^Output hash')
+if [ -z "${_hash_1}" ] || [ "${_hash_1}" != "${_hash_2}" ]; then
+	echo "Deterministic runs differ: '${_hash_1}' and '${_hash_2}'"
+	exit 1
+fi
+"${LOGSKEL}" --playback "${RECORDINGS_DIR}/Captured-2014-10-31.oni" --end-frame 60 --deterministic --quiet-events
+if [ $? -ne 0 ]; then
+	echo "Deterministic playback skipped or repeated frames."
+	exit 1
+fi
+
+# Check that the performance harness passes against golden runs it has just recorded. Only the
+# depth, labels and joints are checked: the budgets are wide open as timings depend on other load.
+echo "Checking perfcheck..."
+PERFCHECK_DIR="/tmp/perfcheck"
+(cd "${DIR}" && \
+	"${BUILD_DIR}/perfcheck" --update --golden-dir ${PERFCHECK_DIR}/golden --output-dir ${PERFCHECK_DIR}/output Data/perfcheck.cases && \
+	"${BUILD_DIR}/perfcheck" --golden-dir ${PERFCHECK_DIR}/golden --output-dir ${PERFCHECK_DIR}/output \
+		--throughput-budget 100 --rss-budget 1000 --report ${PERFCHECK_DIR}/report.json Data/perfcheck.cases)
+if [ $? -ne 0 ]; then
+	echo "perfcheck failed."
+	exit 1
+fi
+
+# Check skeletons survive a round trip through the UDP packet format
+echo "Checking UDP skeleton packets over loopback..."
+if ! "${BUILD_DIR}/skel-udprecv" --self-test 1000; then
+	echo "UDP self test failed."
+	exit 1
+fi
+
+# Check frames survive a trip through the shared memory ring
+echo "Checking shared memory frame ring..."
+if ! "${BUILD_DIR}/skel-shmstat" --self-test 10000; then
+	echo "Shared memory self test failed."
+	exit 1
+fi
+
+# Check outputs which fall behind drop frames as their policies say without losing events
+echo "Checking frame dispatcher drop policies..."
+if ! "${LOGSKEL}" --self-test; then
+	echo "Frame dispatcher self test failed."
+	exit 1
+fi